@@ -3,6 +3,22 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtx/dual_quaternion.hpp>
+#include <glm/gtx/intersect.hpp>
+
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+
 #include <iostream>
 #include <fstream>
 #include <stdexcept>
@@ -12,10 +28,168 @@
 #include <cstdlib>
 #include <optional>
 #include <set>
+#include <limits>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <type_traits>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <memory>
+#include <map>
+#include <iterator>
+#include <cstdio>
+#include <cstddef>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#define ASSET_IO_URING 1
+#endif
+#endif
 
 const int WIDTH = 800;
 const int HEIGHT = 600; 
 const int MAX_FRAMES_IN_FLIGHT = 2;
+const size_t FRAME_ARENA_SIZE = 1 << 20;
+
+enum class ParticleBackend {
+    None,
+    Cpu,
+    Gpu
+};
+
+// Gpu steps the particles in particle.comp; Cpu runs the SSE reference and
+// uploads the result every frame.
+const ParticleBackend PARTICLE_BACKEND = ParticleBackend::Gpu;
+const uint32_t PARTICLE_COUNT = 1 << 16;
+
+enum class SkinningPath {
+    None,
+    VertexShader,
+    Cpu
+};
+
+enum class SkinningMethod {
+    Linear,
+    DualQuaternion
+};
+
+// VertexShader skins in skinned.vert from the palette; Cpu pre-skins the
+// vertices and draws them with skinned_static.vert.
+const SkinningPath SKINNING_PATH = SkinningPath::VertexShader;
+const SkinningMethod SKINNING_METHOD = SkinningMethod::DualQuaternion;
+const uint32_t SKINNED_CHARACTER_COUNT = 16;
+
+// Materials shade with the specialized variants of material.frag.
+const bool MATERIALS_ENABLED = true;
+
+// Clustered lights are binned and uploaded every frame, and light a ground
+// plane drawn with clustered.vert and clustered.frag.
+const bool LIGHTING_ENABLED = true;
+const uint32_t LIGHT_COUNT = 4096;
+// index list capacity; clusters past it lose their overflowing lights
+const uint32_t MAX_LIGHT_INDICES = LIGHT_COUNT * 32;
+
+// A grid of sphere props on the ground plane, each drawn at the LOD that
+// LodSelector picks for it and cross-faded with lod.vert and lod.frag.
+const bool PROPS_ENABLED = true;
+const uint32_t PROP_GRID = 12;
+const uint32_t PROP_COUNT = PROP_GRID * PROP_GRID;
+const float PROP_SPACING = 10.0f;
+const float PROP_RADIUS = 1.5f;
+// icosphere refinements; the chain has one more level than this
+const uint32_t PROP_SUBDIVISIONS = 3;
+
+// Blocks standing between the props and drawn like them. They are also the
+// occluders that the software culler rasterizes, so props hidden behind
+// them are never recorded.
+const uint32_t BLOCK_GRID = 3;
+const uint32_t BLOCK_COUNT = BLOCK_GRID * BLOCK_GRID;
+const glm::vec3 BLOCK_EXTENT(6.0f, 10.0f, 6.0f);
+
+// The orbiting world camera that the lights, ground and props are seen from.
+const float CAMERA_FOV = 60.0f;
+const float CAMERA_Z_NEAR = 0.1f;
+const float CAMERA_Z_FAR = 150.0f;
+
+// Readback buffers in flight for frame capture; when all are busy a capture
+// is dropped instead of stalling the frame.
+const int READBACK_RING_SIZE = 3;
+// golden-image runs capture this frame (at a fixed time step) and exit
+const uint64_t GOLDEN_CAPTURE_FRAME = 30;
+
+// Initial size of the shared static geometry buffers; they grow by
+// compacting into larger ones when a mesh doesn't fit.
+const uint32_t GEOMETRY_ARENA_VERTICES = 1 << 16;
+const uint32_t GEOMETRY_ARENA_INDICES = 1 << 18;
+
+enum class BlockFormat {
+    BC1,
+    BC3,
+    BC7
+};
+
+enum class BlockQuality {
+    Fast,
+    Normal,
+    High
+};
+
+// Textures are block compressed on load when the device can sample the
+// format, and uploaded as RGBA8 otherwise. No shader samples them yet.
+const bool TEXTURES_ENABLED = false;
+const BlockFormat TEXTURE_FORMAT = BlockFormat::BC7;
+const BlockQuality TEXTURE_QUALITY = BlockQuality::Normal;
+
+// Asset I/O: reader threads keep up to ASSET_READ_QUEUE_DEPTH chunk reads in
+// flight per file; the render thread takes at most ASSET_DELIVERIES_PER_FRAME
+// finished assets each frame so uploads never pile into a single frame.
+const unsigned ASSET_READER_THREADS = 2;
+const unsigned ASSET_DECODER_THREADS = 2;
+const size_t ASSET_READ_CHUNK = 1 << 20;
+const unsigned ASSET_READ_QUEUE_DEPTH = 8;
+const size_t ASSET_DELIVERIES_PER_FRAME = 4;
+
+enum class TelemetryCounter {
+    FrameTime,
+    FenceWait,
+    Acquire,
+    Draws,
+    Triangles,
+    Binds,
+    DescriptorAllocations,
+    UploadBytes,
+    PipelineCompiles,
+    OccludedDraws,
+    Count
+};
+
+// Telemetry exports every TELEMETRY_EXPORT_SECONDS, covering a rolling window
+// of the last TELEMETRY_WINDOW_SLOTS exports' worth of frames.
+const double TELEMETRY_EXPORT_SECONDS = 10.0;
+const size_t TELEMETRY_WINDOW_SLOTS = 6;
+
+// simulation steps per second when it runs on its own thread
+const double SIMULATION_RATE = 120.0;
+
+// idle mode redraws static content at least this often (clocks, live data)
+const double IDLE_REDRAW_SECONDS = 1.0;
 
 const std::vector<const char*> validationLayers = {
     "VK_LAYER_LUNARG_standard_validation"
@@ -31,6 +205,28 @@ const bool enableValidationLayers = false;
 const bool enableValidationLayers = true;
 #endif
 
+#ifndef NDEBUG
+// Counts operator new calls on the current thread, so debug builds can check
+// that a steady-state frame does not touch the heap.
+thread_local size_t heapAllocationCount = 0;
+
+void* operator new(size_t size) {
+    heapAllocationCount++;
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+#endif
+
 VkResult CreateDebugUtilsMessengerEXT(VkInstance instance, const VkDebugUtilsMessengerCreateInfoEXT* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkDebugUtilsMessengerEXT* pCallback) {
     auto func = (PFN_vkCreateDebugUtilsMessengerEXT)vkGetInstanceProcAddr(instance, "vkCreateDebugUtilsMessengerEXT");
     if (func != nullptr) {
@@ -48,9 +244,50 @@ void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT
     }
 }
 
+// Every device-level entry point main.cpp calls. Calling through pointers
+// from vkGetDeviceProcAddr goes straight to the driver (or the first layer)
+// instead of through the loader's trampoline, which has to look the
+// dispatch table up from the handle on every call.
+#define DEVICE_FUNCTIONS(X) \
+    X(vkAcquireNextImageKHR) X(vkAllocateCommandBuffers) X(vkAllocateDescriptorSets) X(vkAllocateMemory) \
+    X(vkBeginCommandBuffer) X(vkBindBufferMemory) X(vkBindImageMemory) X(vkCmdBeginRenderPass) X(vkCmdBindDescriptorSets) \
+    X(vkCmdBindIndexBuffer) X(vkCmdBindPipeline) X(vkCmdBindVertexBuffers) X(vkCmdCopyBuffer) X(vkCmdCopyBufferToImage) X(vkCmdCopyImageToBuffer) \
+    X(vkCmdDispatch) X(vkCmdDraw) X(vkCmdDrawIndexed) X(vkCmdEndRenderPass) X(vkCmdExecuteCommands) \
+    X(vkCmdPipelineBarrier) X(vkCmdPushConstants) X(vkCmdResetQueryPool) X(vkCmdWriteTimestamp) X(vkCreateBuffer) \
+    X(vkCreateCommandPool) X(vkCreateComputePipelines) X(vkCreateDescriptorPool) X(vkCreateDescriptorSetLayout) \
+    X(vkCreateFence) X(vkCreateFramebuffer) X(vkCreateGraphicsPipelines) X(vkCreateImage) X(vkCreateImageView) X(vkCreatePipelineLayout) \
+    X(vkCreateQueryPool) X(vkCreateRenderPass) X(vkCreateSemaphore) X(vkCreateShaderModule) X(vkCreateSwapchainKHR) \
+    X(vkDestroyBuffer) X(vkDestroyCommandPool) X(vkDestroyDescriptorPool) X(vkDestroyDescriptorSetLayout) \
+    X(vkDestroyDevice) X(vkDestroyFence) X(vkDestroyFramebuffer) X(vkDestroyImage) X(vkDestroyImageView) X(vkDestroyPipeline) \
+    X(vkDestroyPipelineLayout) X(vkDestroyQueryPool) X(vkDestroyRenderPass) X(vkDestroySemaphore) \
+    X(vkDestroyShaderModule) X(vkDestroySwapchainKHR) X(vkDeviceWaitIdle) X(vkEndCommandBuffer) X(vkFreeCommandBuffers) \
+    X(vkFreeMemory) X(vkGetBufferMemoryRequirements) X(vkGetDeviceQueue) X(vkGetImageMemoryRequirements) X(vkGetQueryPoolResults) \
+    X(vkGetSwapchainImagesKHR) X(vkMapMemory) X(vkQueuePresentKHR) X(vkQueueSubmit) X(vkQueueWaitIdle) X(vkResetFences) \
+    X(vkUnmapMemory) X(vkUpdateDescriptorSets) X(vkWaitForFences)
+
+struct DeviceDispatch {
+#define DECLARE_DEVICE_FUNCTION(name) PFN_##name name = nullptr;
+    DEVICE_FUNCTIONS(DECLARE_DEVICE_FUNCTION)
+#undef DECLARE_DEVICE_FUNCTION
+
+    void load(VkDevice device) {
+#define LOAD_DEVICE_FUNCTION(name) \
+        name = (PFN_##name)vkGetDeviceProcAddr(device, #name); \
+        if (name == nullptr) throw std::runtime_error("failed to load " #name "!");
+        DEVICE_FUNCTIONS(LOAD_DEVICE_FUNCTION)
+#undef LOAD_DEVICE_FUNCTION
+    }
+};
+
+// The renderer drives a single VkDevice; its table is loaded right after
+// vkCreateDevice in createLogicalDevice.
+DeviceDispatch vkd;
+
 struct QueueFamilyIndices {
     std::optional<uint32_t> graphicsFamily;
     std::optional<uint32_t> presentFamily;
+    // a compute family without graphics, for async compute; optional
+    std::optional<uint32_t> computeFamily;
 
     bool isComplete() {
         return graphicsFamily.has_value() && presentFamily.has_value();
@@ -63,275 +300,7392 @@ struct SwapChainSupportDetails {
     std::vector<VkPresentModeKHR> presentModes;
 };
 
-class HelloTriangleApplication {
-public:
-    void run() {
-        initWindow();
-        initVulkan();
-        mainLoop();
-        cleanup();
-    }
+// Non-indexed unless indexCount is set, in which case the mesh's index
+// buffer is bound and vkCmdDrawIndexed is used.
+struct DrawCommand {
+    uint32_t vertexCount;
+    uint32_t instanceCount;
+    uint32_t firstVertex;
+    uint32_t firstInstance;
+    uint32_t indexCount;
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+};
 
-private:
-    GLFWwindow * window;
+// One timestamped zone boundary. End events set the top bit of the
+// timestamp; name points at a string literal (or __func__).
+struct ProfileEvent {
+    uint64_t timestamp;
+    const char* name;
+};
 
-    VkInstance instance;
-    VkDebugUtilsMessengerEXT callback;
-    VkSurfaceKHR surface;
+const uint64_t PROFILE_END_BIT = 1ull << 63;
+
+// Single-producer, single-consumer event ring owned by one thread. The
+// owning thread writes events and publishes them by advancing head; the
+// collector copies them out and advances tail. A zone only begins when
+// there is room for its end and for the ends of every zone still open, so
+// drops never leave an end without its begin.
+struct ProfileRing {
+    static const size_t CAPACITY = 1 << 16;
+
+    ProfileEvent events[CAPACITY];
+    alignas(64) std::atomic<uint64_t> head{ 0 };
+    alignas(64) std::atomic<uint64_t> tail{ 0 };
+
+    // owning thread only
+    uint64_t cachedTail = 0;
+    uint64_t open = 0;
+    std::atomic<uint64_t> dropped{ 0 };
+
+    uint32_t threadId = 0;
+    std::atomic<const char*> threadName{ nullptr };
+    std::atomic<bool> retired{ false };
+
+    bool begin(const char* name, uint64_t timestamp) {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        if (h - cachedTail + open + 2 > CAPACITY) {
+            cachedTail = tail.load(std::memory_order_acquire);
+            if (h - cachedTail + open + 2 > CAPACITY) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        events[h & (CAPACITY - 1)] = { timestamp, name };
+        head.store(h + 1, std::memory_order_release);
+        open++;
+        return true;
+    }
 
-    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
-    VkDevice device;
+    void end(const char* name, uint64_t timestamp) {
+        uint64_t h = head.load(std::memory_order_relaxed);
+        events[h & (CAPACITY - 1)] = { timestamp | PROFILE_END_BIT, name };
+        head.store(h + 1, std::memory_order_release);
+        open--;
+    }
+};
 
-    VkQueue graphicsQueue;
-    VkQueue presentQueue;
+inline uint64_t profileTimestamp() {
+    return __rdtsc();
+}
 
-    VkSwapchainKHR swapChain;
-    std::vector<VkImage> swapChainImages;
-    VkFormat swapChainImageFormat;
-    VkExtent2D swapChainExtent;
-    std::vector<VkImageView> swapChainImageViews;
-    std::vector<VkFramebuffer> swapChainFramebuffers;
+// Collects profiling zones from every thread into a Chrome trace-event JSON
+// file (chrome://tracing, Perfetto). Zones cost a relaxed load when no
+// capture is running and a timestamp plus a ring write when one is; the
+// collector thread drains the rings every PROFILE_DRAIN_MILLISECONDS and
+// does all formatting and I/O. One capture per run: start() once, stop()
+// at exit.
+class Profiler {
+public:
+    static const int PROFILE_DRAIN_MILLISECONDS = 5;
 
-    VkRenderPass renderPass;
-    VkPipelineLayout pipelineLayout;
-    VkPipeline graphicsPipeline;
+    ~Profiler() {
+        stop();
+    }
 
-    VkCommandPool commandPool;
-    std::vector<VkCommandBuffer> commandBuffers;
+    bool active() const {
+        return capturing.load(std::memory_order_relaxed);
+    }
 
-    std::vector<VkSemaphore> imageAvailableSemaphores;
-    std::vector<VkSemaphore> renderFinishedSemaphores;
-    std::vector<VkFence> inFlightFences;
-    size_t currentFrame  = 0;
+    void start(const std::string& path) {
+        file.open(path);
+        if (!file.is_open()) {
+            throw std::runtime_error("failed to open " + path + "!");
+        }
 
-    void initWindow() {
-        glfwInit();
+        // ticks to microseconds, against the steady clock
+        auto clockStart = std::chrono::steady_clock::now();
+        uint64_t ticksStart = profileTimestamp();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        double microseconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - clockStart).count();
+        microsecondsPerTick = microseconds / double(profileTimestamp() - ticksStart);
+        baseTicks = profileTimestamp();
+
+        file << "[";
+        running = true;
+        collector = std::thread([this]() { collectLoop(); });
+        capturing = true;
+    }
 
-        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-        glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+    // Zones still open keep their begin without an end; trace viewers close
+    // them at the end of the capture.
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(collectorMutex);
+            if (!running) return;
+            running = false;
+            capturing = false;
+        }
+        wake.notify_one();
+        collector.join();
+        drain();
+        file << "\n]\n";
+        file.close();
+    }
 
-        window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
+    // The calling thread's ring, registered on its first zone.
+    ProfileRing* threadRing() {
+        // a plain pointer skips the init check a thread_local with a destructor needs
+        thread_local ProfileRing* cached = nullptr;
+        if (cached) return cached;
+
+        ThreadRegistration& registration = threadRegistration();
+        if (!registration.ring) {
+            std::unique_ptr<ProfileRing> ring(new ProfileRing());
+            ring->threadName = registration.name;
+            registration.ring = ring.get();
+            std::lock_guard<std::mutex> lock(ringsMutex);
+            ring->threadId = nextThreadId++;
+            rings.push_back(std::move(ring));
+        }
+        cached = registration.ring;
+        return cached;
     }
 
-    void initVulkan() {
-        createInstance();
-        setupDebugCallback();
-        createSurface();
-        pickPhysicalDevice();
-        createLogicalDevice();
-        createSwapChain();
-        createImageViews();
-        createRenderPass();
-        createGraphicsPipeline();
-        createFramebuffers();
-        createCommandPool();
-        createCommandBuffers();
-        createSyncObjects();
+    // Doesn't register the thread; threads that never profile cost nothing.
+    void nameThread(const char* name) {
+        ThreadRegistration& registration = threadRegistration();
+        registration.name = name;
+        if (registration.ring) registration.ring->threadName = name;
     }
 
-    void mainLoop() {
-        while (!glfwWindowShouldClose(window)) {
-            glfwPollEvents();
-            drawFrame();
+    uint64_t droppedEvents() {
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        uint64_t total = dropped;
+        for (const auto& ring : rings) {
+            total += ring->dropped;
         }
-        vkDeviceWaitIdle(device);
+        return total;
     }
 
-    void cleanup() {
+private:
+    // marks the thread's ring retired on thread exit; the collector frees it
+    // once drained
+    struct ThreadRegistration {
+        ProfileRing* ring = nullptr;
+        const char* name = nullptr;
+        ~ThreadRegistration() {
+            if (ring) ring->retired = true;
+        }
+    };
 
-        cleanupSwapChain();
+    static ThreadRegistration& threadRegistration() {
+        thread_local ThreadRegistration registration;
+        return registration;
+    }
 
-        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-            vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
-            vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
-            vkDestroyFence(device, inFlightFences[i], nullptr);
+    std::atomic<bool> capturing{ false };
+    double microsecondsPerTick = 0.0;
+    uint64_t baseTicks = 0;
+
+    std::mutex ringsMutex;
+    std::vector<std::unique_ptr<ProfileRing>> rings;
+    uint32_t nextThreadId = 1;
+    // collector thread only, past the first drain
+    std::vector<uint32_t> namedThreads;
+
+    std::thread collector;
+    std::mutex collectorMutex;
+    std::condition_variable wake;
+    bool running = false;
+    std::ofstream file;
+    bool firstEvent = true;
+    std::atomic<uint64_t> dropped{ 0 };
+
+    void collectLoop() {
+        std::unique_lock<std::mutex> lock(collectorMutex);
+        while (running) {
+            wake.wait_for(lock, std::chrono::milliseconds(PROFILE_DRAIN_MILLISECONDS));
+            lock.unlock();
+            drain();
+            lock.lock();
         }
+    }
 
-        vkDestroyCommandPool(device, commandPool, nullptr);
+    void separator() {
+        file << (firstEvent ? "\n" : ",\n");
+        firstEvent = false;
+    }
 
-        vkDestroyDevice(device, nullptr);
+    void drain() {
+        std::lock_guard<std::mutex> lock(ringsMutex);
+        for (size_t r = 0; r < rings.size();) {
+            ProfileRing& ring = *rings[r];
+            // read before draining: a ring retired now has published everything
+            bool retired = ring.retired;
+
+            const char* threadName = ring.threadName;
+            if (threadName && std::find(namedThreads.begin(), namedThreads.end(), ring.threadId) == namedThreads.end()) {
+                separator();
+                file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << ring.threadId << ",\"args\":{\"name\":\"" << threadName << "\"}}";
+                namedThreads.push_back(ring.threadId);
+            }
 
-        if (enableValidationLayers) {
-            DestroyDebugReportCallbackEXT(instance, callback, nullptr);
-        }
+            // snprintf keeps up with producers far better than stream formatting
+            uint64_t t = ring.tail.load(std::memory_order_relaxed);
+            uint64_t h = ring.head.load(std::memory_order_acquire);
+            char line[256];
+            for (; t != h; t++) {
+                const ProfileEvent& event = ring.events[t & (ProfileRing::CAPACITY - 1)];
+                uint64_t ticks = event.timestamp & ~PROFILE_END_BIT;
+                double microseconds = ticks >= baseTicks ? (ticks - baseTicks) * microsecondsPerTick : 0.0;
+                int length = snprintf(line, sizeof(line), "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}",
+                    firstEvent ? "\n" : ",\n", event.name, event.timestamp & PROFILE_END_BIT ? 'E' : 'B', microseconds, ring.threadId);
+                file.write(line, std::min<int>(length, sizeof(line) - 1));
+                firstEvent = false;
+            }
+            ring.tail.store(h, std::memory_order_release);
 
-        vkDestroySurfaceKHR(instance, surface, nullptr);
-        vkDestroyInstance(instance, nullptr);
+            if (retired) {
+                dropped += ring.dropped;
+                rings.erase(rings.begin() + r);
+            }
+            else {
+                r++;
+            }
+        }
+        file.flush();
+    }
+};
 
-        glfwDestroyWindow(window);
+Profiler& profiler() {
+    static Profiler instance;
+    return instance;
+}
 
-        glfwTerminate();
+// Begins a zone in the constructor and ends it in the destructor, when a
+// capture was running at the start.
+class ProfileZone {
+public:
+    explicit ProfileZone(const char* name) {
+        if (!profiler().active()) return;
+        ring = profiler().threadRing();
+        if (ring->begin(name, profileTimestamp())) {
+            this->name = name;
+        }
     }
 
-    void recreateSwapChain()
-    {
-        vkDeviceWaitIdle(device);
-
-        createSwapChain();
-        createImageViews();
-        createRenderPass();
-        createGraphicsPipeline();
-        createFramebuffers();
-        createCommandBuffers();
+    ~ProfileZone() {
+        if (name) ring->end(name, profileTimestamp());
     }
 
-    void cleanupSwapChain()
-    {
-        for (size_t i = 0; i < swapChainFramebuffers.size(); i++) {
-            vkDestroyFramebuffer(device, swapChainFramebuffers[i], nullptr);
-        }
+    ProfileZone(const ProfileZone&) = delete;
+    ProfileZone& operator=(const ProfileZone&) = delete;
 
-        vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
+private:
+    ProfileRing* ring = nullptr;
+    const char* name = nullptr;
+};
 
-        vkDestroyPipeline(device, graphicsPipeline, nullptr);
-        vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-        vkDestroyRenderPass(device, renderPass, nullptr);
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#ifndef DISABLE_PROFILING
+// name must outlive the capture: a string literal or __func__
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_FUNCTION() PROFILE_ZONE(__func__)
+#define PROFILE_THREAD(name) profiler().nameThread(name)
+#else
+#define PROFILE_ZONE(name)
+#define PROFILE_FUNCTION()
+#define PROFILE_THREAD(name)
+#endif
 
-        for (size_t i = 0; i < swapChainImageViews.size(); i++) {
-            vkDestroyImageView(device, swapChainImageViews[i], nullptr);
+// Fixed set of worker threads for data-parallel loops. run() hands out task
+// indices through an atomic counter and works on them itself too; it does not
+// allocate, so it can be used from inside a frame. There is one job at a
+// time: concurrent callers (the simulation and render threads) queue on a
+// caller mutex, and a task must not call run() itself or it deadlocks.
+class WorkerPool {
+public:
+    explicit WorkerPool(unsigned threadCount) {
+        for (unsigned i = 0; i < threadCount; i++) {
+            threads.emplace_back([this] { workerLoop(); });
         }
-
-        vkDestroySwapchainKHR(device, swapChain, nullptr);
     }
-    
 
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
 
-    void drawFrame()
-    {
-        vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
-        vkResetFences(device, 1, &inFlightFences[currentFrame]);
+    size_t size() const {
+        return threads.size() + 1;
+    }
 
-        uint32_t imageIndex; 
-        vkAcquireNextImageKHR(device, swapChain, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+    template<typename F>
+    void run(size_t taskCount, F&& fn) {
+        if (threads.empty() || taskCount <= 1) {
+            for (size_t i = 0; i < taskCount; i++) {
+                fn(i);
+            }
+            return;
+        }
 
-        VkSubmitInfo submitInfo = {};
-        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        Job current;
+        current.context = &fn;
+        current.invoke = [](void* c, size_t i) { (*static_cast<std::remove_reference_t<F>*>(c))(i); };
+        current.count = taskCount;
+
+        // one job at a time: a second caller would reset next and remaining
+        // while the first one is still working through its indices
+        std::lock_guard<std::mutex> caller(callerMutex);
+
+        // a worker that woke late for the previous job may still be inside
+        // work(); resetting next under it would hand it this job's indices
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return active == 0; });
+        job = current;
+        next = 0;
+        remaining = taskCount;
+        generation++;
+        lock.unlock();
+        wake.notify_all();
+
+        work(current);
+
+        lock.lock();
+        done.wait(lock, [this] { return remaining == 0 && active == 0; });
+    }
 
-        VkSemaphore waitSemaphores[] = { imageAvailableSemaphores[currentFrame] };
-        VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-        submitInfo.waitSemaphoreCount = 1;
-        submitInfo.pWaitSemaphores = waitSemaphores;
-        submitInfo.pWaitDstStageMask = waitStages;
+private:
+    std::vector<std::thread> threads;
+    std::mutex callerMutex;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    bool stopping = false;
+    uint64_t generation = 0;
+    size_t active = 0;
+
+    struct Job {
+        void* context = nullptr;
+        void (*invoke)(void*, size_t) = nullptr;
+        size_t count = 0;
+    };
+
+    // Guarded by mutex; workers copy it together with the generation.
+    Job job;
+    std::atomic<size_t> next{ 0 };
+    std::atomic<size_t> remaining{ 0 };
+
+    void work(const Job& current) {
+        size_t i;
+        while ((i = next.fetch_add(1)) < current.count) {
+            current.invoke(current.context, i);
+            if (--remaining == 0) {
+                std::lock_guard<std::mutex> lock(mutex);
+                done.notify_all();
+            }
+        }
+    }
 
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
+    void workerLoop() {
+        PROFILE_THREAD("worker");
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            wake.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            Job current = job;
+            active++;
+            lock.unlock();
 
-        VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[currentFrame] };
-        submitInfo.signalSemaphoreCount = 1;
-        submitInfo.pSignalSemaphores = signalSemaphores;
+            {
+                PROFILE_ZONE("worker tasks");
+                work(current);
+            }
 
-        if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS)
-        {
-            throw std::runtime_error("failed to submit draw command buffer!");
+            lock.lock();
+            active--;
+            done.notify_all();
         }
+    }
+};
 
-        VkPresentInfoKHR presentInfo = {};
-        presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-        presentInfo.waitSemaphoreCount = 1;
-        presentInfo.pWaitSemaphores = signalSemaphores;
+WorkerPool& workerPool() {
+    static WorkerPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+}
 
-        VkSwapchainKHR swapChains[] = { swapChain };
-        presentInfo.swapchainCount = 1;
-        presentInfo.pSwapchains = swapChains;
-        presentInfo.pImageIndices = &imageIndex;
+struct AABB {
+    glm::vec3 min;
+    glm::vec3 max;
+};
 
-        presentInfo.pResults = nullptr;
+// Low resolution software depth buffer filled from a few large occluders.
+// Rows are split into bands that workers rasterize independently with SSE,
+// four pixels at a time; bounding boxes are then tested against it so hidden
+// draws never get recorded.
+class OcclusionCuller {
+public:
+    static const int WIDTH = 320;
+    static const int HEIGHT = 192;
+    static const int BAND_HEIGHT = 16;
 
-        vkQueuePresentKHR(presentQueue, &presentInfo);
-       // vkQueueWaitIdle(presentQueue);
+    OcclusionCuller() : depth(WIDTH * HEIGHT + 4, FLT_MAX) {}
 
-        currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+    void setViewProjection(const glm::mat4& matrix) {
+        viewProjection = matrix;
+    }
 
+    void clearOccluders() {
+        triangles.clear();
     }
 
-    void createSyncObjects()
-    {
-        imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-        renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-        inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+    bool empty() const {
+        return triangles.empty();
+    }
 
-        VkSemaphoreCreateInfo semaphoreInfo = {};
-        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    void addOccluder(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices, const glm::mat4& model) {
+        glm::mat4 mvp = viewProjection * model;
 
-        VkFenceCreateInfo fenceInfo = {};
-        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-        fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+        clip.resize(positions.size());
+        for (size_t i = 0; i < positions.size(); i++) {
+            clip[i] = mvp * glm::vec4(positions[i], 1.0f);
+        }
 
-        for(int i=0;i<MAX_FRAMES_IN_FLIGHT; i++)
-        {
-            if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &imageAvailableSemaphores[i]) != VK_SUCCESS ||
-                vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS ||
-                vkCreateFence(device, &fenceInfo, nullptr, &inFlightFences[i]) != VK_SUCCESS
-                )
-            {
-                throw std::runtime_error("failed to create synchronization objects for a frame!");
+        for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+            const glm::vec4* v[3] = { &clip[indices[i]], &clip[indices[i + 1]], &clip[indices[i + 2]] };
+
+            // no clipping: triangles crossing the near plane just don't occlude
+            if (v[0]->w <= NEAR_W || v[1]->w <= NEAR_W || v[2]->w <= NEAR_W) {
+                continue;
+            }
+
+            ScreenTriangle tri;
+            for (int k = 0; k < 3; k++) {
+                tri.x[k] = (v[k]->x / v[k]->w * 0.5f + 0.5f) * WIDTH;
+                tri.y[k] = (v[k]->y / v[k]->w * 0.5f + 0.5f) * HEIGHT;
+                tri.z[k] = v[k]->z / v[k]->w;
+            }
+
+            // occluders are double sided, so normalize the winding
+            float area = (tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0]) - (tri.y[1] - tri.y[0]) * (tri.x[2] - tri.x[0]);
+            if (std::abs(area) < 1e-6f) {
+                continue;
+            }
+            if (area < 0.0f) {
+                std::swap(tri.x[1], tri.x[2]);
+                std::swap(tri.y[1], tri.y[2]);
+                std::swap(tri.z[1], tri.z[2]);
             }
+            triangles.push_back(tri);
         }
     }
 
-    void createCommandPool()
-    {
-        QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
-        
-        VkCommandPoolCreateInfo poolInfo = {};
-        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-        poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
-        poolInfo.flags = 0;
+    void rasterize() {
+        std::fill(depth.begin(), depth.end(), FLT_MAX);
 
-        if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
-        {
-            throw std::runtime_error("failed to craeate command pool!");
-        }
+        workerPool().run(HEIGHT / BAND_HEIGHT, [this](size_t band) {
+            int row = static_cast<int>(band) * BAND_HEIGHT;
+            rasterizeRows(row, row + BAND_HEIGHT);
+        });
     }
 
-    void createCommandBuffers()
-    {
-        commandBuffers.resize(swapChainFramebuffers.size());
-        VkCommandBufferAllocateInfo allocInfo = {};
-        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        allocInfo.commandPool = commandPool;
-        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        allocInfo.commandBufferCount = (uint32_t)commandBuffers.size();
-        if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) != VK_SUCCESS)
-        {
-            throw std::runtime_error("failed to allocate command buffers!");
+    // Conservative: anything that crosses the near plane, leaves the screen
+    // or has a single pixel closer than the occluders counts as visible.
+    bool isVisible(const AABB& box) const {
+        float minX = FLT_MAX, minY = FLT_MAX, minZ = FLT_MAX;
+        float maxX = -FLT_MAX, maxY = -FLT_MAX;
+
+        for (int corner = 0; corner < 8; corner++) {
+            glm::vec3 p((corner & 1) ? box.max.x : box.min.x, (corner & 2) ? box.max.y : box.min.y, (corner & 4) ? box.max.z : box.min.z);
+            glm::vec4 c = viewProjection * glm::vec4(p, 1.0f);
+            if (c.w <= NEAR_W) {
+                return true;
+            }
+            float x = (c.x / c.w * 0.5f + 0.5f) * WIDTH;
+            float y = (c.y / c.w * 0.5f + 0.5f) * HEIGHT;
+            minX = std::min(minX, x); maxX = std::max(maxX, x);
+            minY = std::min(minY, y); maxY = std::max(maxY, y);
+            minZ = std::min(minZ, c.z / c.w);
         }
 
-        for (size_t i = 0; i < commandBuffers.size(); i++)
-        {
-            VkCommandBufferBeginInfo beginInfo = {};
-            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
-            beginInfo.pInheritanceInfo = nullptr;
+        if (minX < 0.0f || minY < 0.0f || maxX >= WIDTH || maxY >= HEIGHT) {
+            return true;
+        }
 
-            if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) != VK_SUCCESS)
-            {
-                throw std::runtime_error("failed to record command buffer!");
+        int x0 = static_cast<int>(minX), x1 = static_cast<int>(maxX);
+        int y0 = static_cast<int>(minY), y1 = static_cast<int>(maxY);
+        const __m128 z = _mm_set1_ps(minZ);
+        const __m128 laneOffsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+
+        for (int y = y0; y <= y1; y++) {
+            const float* row = &depth[y * WIDTH];
+            for (int x = x0; x <= x1; x += 4) {
+                __m128 inRange = _mm_cmple_ps(_mm_add_ps(_mm_set1_ps(static_cast<float>(x)), laneOffsets), _mm_set1_ps(static_cast<float>(x1)));
+                __m128 closer = _mm_cmplt_ps(z, _mm_loadu_ps(row + x));
+                if (_mm_movemask_ps(_mm_and_ps(inRange, closer)) != 0) {
+                    return true;
+                }
             }
+        }
+        return false;
+    }
 
-            VkRenderPassBeginInfo renderPassInfo = {};
-            renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-            renderPassInfo.renderPass = renderPass;
-            renderPassInfo.framebuffer = swapChainFramebuffers[i];
-            renderPassInfo.renderArea.offset = { 0,0 };
-            renderPassInfo.renderArea.extent = swapChainExtent;
+private:
+    struct ScreenTriangle {
+        float x[3];
+        float y[3];
+        float z[3];
+    };
+
+    static constexpr float NEAR_W = 1e-4f;
+
+    glm::mat4 viewProjection = glm::mat4(1.0f);
+    std::vector<ScreenTriangle> triangles;
+    std::vector<float> depth;
+    // addOccluder scratch, kept so per-frame occluders don't reallocate
+    std::vector<glm::vec4> clip;
+
+    void rasterizeRows(int rowBegin, int rowEnd) {
+        for (const auto& tri : triangles) {
+            int x0 = std::max(0, static_cast<int>(std::min({ tri.x[0], tri.x[1], tri.x[2] })));
+            int x1 = std::min(WIDTH - 1, static_cast<int>(std::max({ tri.x[0], tri.x[1], tri.x[2] })));
+            int y0 = std::max(rowBegin, static_cast<int>(std::min({ tri.y[0], tri.y[1], tri.y[2] })));
+            int y1 = std::min(rowEnd - 1, static_cast<int>(std::max({ tri.y[0], tri.y[1], tri.y[2] })));
+            if (x0 > x1 || y0 > y1) {
+                continue;
+            }
+            x0 &= ~3;
+
+            // edge k is opposite vertex k: E = A*x + B*y + C, inside when all >= 0
+            float a[3], b[3], c[3];
+            for (int k = 0; k < 3; k++) {
+                int i = (k + 1) % 3, j = (k + 2) % 3;
+                a[k] = tri.y[i] - tri.y[j];
+                b[k] = tri.x[j] - tri.x[i];
+                c[k] = -(a[k] * tri.x[i] + b[k] * tri.y[i]);
+            }
+            float area = c[0] + c[1] + c[2];
+            float za = (a[0] * tri.z[0] + a[1] * tri.z[1] + a[2] * tri.z[2]) / area;
+            float zb = (b[0] * tri.z[0] + b[1] * tri.z[1] + b[2] * tri.z[2]) / area;
+            float zc = (c[0] * tri.z[0] + c[1] * tri.z[1] + c[2] * tri.z[2]) / area;
+
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 px0 = _mm_add_ps(_mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f), _mm_set1_ps(x0 + 0.5f));
+
+            for (int y = y0; y <= y1; y++) {
+                const __m128 py = _mm_set1_ps(y + 0.5f);
+                __m128 px = px0;
+                float* row = &depth[y * WIDTH];
+
+                for (int x = x0; x <= x1; x += 4) {
+                    __m128 e0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[0]), px), _mm_mul_ps(_mm_set1_ps(b[0]), py)), _mm_set1_ps(c[0]));
+                    __m128 e1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[1]), px), _mm_mul_ps(_mm_set1_ps(b[1]), py)), _mm_set1_ps(c[1]));
+                    __m128 e2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[2]), px), _mm_mul_ps(_mm_set1_ps(b[2]), py)), _mm_set1_ps(c[2]));
+                    __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+
+                    if (_mm_movemask_ps(inside) != 0) {
+                        __m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(za), px), _mm_mul_ps(_mm_set1_ps(zb), py)), _mm_set1_ps(zc));
+                        __m128 current = _mm_loadu_ps(row + x);
+                        __m128 nearest = _mm_min_ps(current, z);
+                        _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, current)));
+                    }
+                    px = _mm_add_ps(px, _mm_set1_ps(4.0f));
+                }
+            }
+        }
+    }
+};
 
-            VkClearValue clearColor = { 0.0f, 0.0f, 0.0f, 1.0f };
-            renderPassInfo.clearValueCount = 1;
-            renderPassInfo.pClearValues = &clearColor;
-            
-            vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+const uint16_t NO_DESCRIPTOR_SET = 0xFFFF;
+const uint16_t NO_MESH = 0xFFFF;
 
-            vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+// Key layout, most significant first: pipeline (12 bits), descriptor set (16),
+// mesh (16), depth (20). Sorting by it groups draws by bind cost and then
+// front to back.
+uint64_t makeSortKey(uint16_t pipeline, uint16_t descriptorSet, uint16_t mesh, float depth) {
+    float clamped = std::min(std::max(depth, 0.0f), 1.0f);
+    uint64_t depthBits = static_cast<uint64_t>(clamped * 0xFFFFF);
+    return (uint64_t(pipeline & 0xFFF) << 52) | (uint64_t(descriptorSet) << 36) | (uint64_t(mesh) << 20) | depthBits;
+}
 
-            vkCmdDraw(commandBuffers[i], 3, 1, 0, 0);
-            vkCmdEndRenderPass(commandBuffers[i]);
-            if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS)
-            {
-                throw std::runtime_error("failed to record command buffer!");
-            }
-        }
+struct DrawPacket {
+    uint64_t sortKey;
+    uint16_t pipeline;
+    uint16_t descriptorSet;
+    uint16_t mesh;
+    DrawCommand draw;
+    bool hasBounds;
+    bool visible;
+    AABB bounds;
+};
 
+struct DrawStats {
+    uint32_t draws = 0;
+    uint64_t triangles = 0;
+    uint32_t pipelineBinds = 0;
+    uint32_t descriptorSetBinds = 0;
+    uint32_t vertexBufferBinds = 0;
+    uint32_t bindsAvoided = 0;
+    uint32_t occluded = 0;
+
+    uint32_t binds() const {
+        return pipelineBinds + descriptorSetBinds + vertexBufferBinds;
+    }
+
+    DrawStats& operator+=(const DrawStats& other) {
+        draws += other.draws;
+        triangles += other.triangles;
+        pipelineBinds += other.pipelineBinds;
+        descriptorSetBinds += other.descriptorSetBinds;
+        vertexBufferBinds += other.vertexBufferBinds;
+        bindsAvoided += other.bindsAvoided;
+        occluded += other.occluded;
+        return *this;
+    }
+};
+
+// Stable LSD radix sort of 64-bit keys, 8 bits per pass. Passes where every
+// key has the same digit are skipped, and lists above the threshold build
+// histograms and scatter in parallel chunks. The temp vectors are scratch
+// space owned by the caller so repeated sorts don't reallocate.
+void radixSortKeys(std::vector<uint64_t>& keys, std::vector<uint32_t>& order, std::vector<uint64_t>& tempKeys, std::vector<uint32_t>& tempOrder) {
+    const size_t PARALLEL_THRESHOLD = 1 << 16;
+    const size_t MAX_CHUNKS = 8;
+    const size_t count = keys.size();
+
+    size_t chunkCount = 1;
+    if (count >= PARALLEL_THRESHOLD) {
+        chunkCount = std::min(workerPool().size(), MAX_CHUNKS);
+    }
+    const size_t chunk = (count + chunkCount - 1) / chunkCount;
+
+    tempKeys.resize(count);
+    tempOrder.resize(count);
+    size_t histograms[MAX_CHUNKS * 256];
+
+    for (int shift = 0; shift < 64; shift += 8) {
+        std::fill(histograms, histograms + chunkCount * 256, 0);
+
+        workerPool().run(chunkCount, [&](size_t t) {
+            size_t* histogram = &histograms[t * 256];
+            for (size_t i = t * chunk; i < std::min(count, (t + 1) * chunk); i++) {
+                histogram[(keys[i] >> shift) & 0xFF]++;
+            }
+        });
+
+        // skip the pass if every key falls into one digit
+        bool trivial = false;
+        for (size_t digit = 0; digit < 256; digit++) {
+            size_t total = 0;
+            for (size_t t = 0; t < chunkCount; t++) {
+                total += histograms[t * 256 + digit];
+            }
+            if (total == count) {
+                trivial = true;
+                break;
+            }
+            if (total != 0) {
+                break;
+            }
+        }
+        if (trivial) {
+            continue;
+        }
+
+        // exclusive prefix sum ordered by digit, then by chunk, keeps the sort stable
+        size_t offset = 0;
+        for (size_t digit = 0; digit < 256; digit++) {
+            for (size_t t = 0; t < chunkCount; t++) {
+                size_t n = histograms[t * 256 + digit];
+                histograms[t * 256 + digit] = offset;
+                offset += n;
+            }
+        }
+
+        workerPool().run(chunkCount, [&](size_t t) {
+            size_t* offsets = &histograms[t * 256];
+            for (size_t i = t * chunk; i < std::min(count, (t + 1) * chunk); i++) {
+                size_t dst = offsets[(keys[i] >> shift) & 0xFF]++;
+                tempKeys[dst] = keys[i];
+                tempOrder[dst] = order[i];
+            }
+        });
+
+        keys.swap(tempKeys);
+        order.swap(tempOrder);
+    }
+}
+
+class DrawList {
+public:
+    void clear() {
+        packets.clear();
+    }
+
+    void add(uint16_t pipeline, uint16_t descriptorSet, uint16_t mesh, float depth, const DrawCommand& draw, const AABB* bounds = nullptr) {
+        DrawPacket packet = {};
+        packet.sortKey = makeSortKey(pipeline, descriptorSet, mesh, depth);
+        packet.pipeline = pipeline;
+        packet.descriptorSet = descriptorSet;
+        packet.mesh = mesh;
+        packet.draw = draw;
+        packet.hasBounds = bounds != nullptr;
+        packet.visible = true;
+        if (bounds) {
+            packet.bounds = *bounds;
+        }
+        packets.push_back(packet);
+        sorted = false;
+    }
+
+    // Returns true when any packet changed visibility, i.e. the list has to
+    // be recorded again.
+    bool updateVisibility(const OcclusionCuller& culler) {
+        bool changed = false;
+        for (auto& packet : packets) {
+            bool visible = !packet.hasBounds || culler.isVisible(packet.bounds);
+            changed |= visible != packet.visible;
+            packet.visible = visible;
+        }
+        return changed;
+    }
+
+    size_t size() const {
+        return packets.size();
+    }
+
+    void sort() {
+        if (sorted) return;
+
+        keys.resize(packets.size());
+        order.resize(packets.size());
+        for (size_t i = 0; i < packets.size(); i++) {
+            keys[i] = packets[i].sortKey;
+            order[i] = static_cast<uint32_t>(i);
+        }
+
+        radixSortKeys(keys, order, tempKeys, tempOrder);
+
+        sortedPackets.resize(packets.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            sortedPackets[i] = packets[order[i]];
+        }
+        packets.swap(sortedPackets);
+        sorted = true;
+    }
+
+    // Emits the sorted packets, skipping binds of state that is already bound.
+    // The tables map packet ids to handles (and pipeline ids to topologies,
+    // for the triangle count); indexBuffers may be null.
+    void record(VkCommandBuffer commandBuffer, const VkPipelineLayout* layouts, const VkPipeline* pipelines, const VkPrimitiveTopology* topologies,
+        const VkDescriptorSet* descriptorSets, const VkBuffer* vertexBuffers, const VkBuffer* indexBuffers, DrawStats& stats) {
+        sort();
+
+        uint32_t boundPipeline = ~0u;
+        uint32_t boundDescriptorSet = ~0u;
+        uint32_t boundMesh = ~0u;
+
+        for (const auto& packet : packets) {
+            if (!packet.visible) {
+                stats.occluded++;
+                continue;
+            }
+
+            if (packet.pipeline != boundPipeline) {
+                vkd.vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelines[packet.pipeline]);
+                boundPipeline = packet.pipeline;
+                // a new pipeline may use an incompatible layout, so set bindings are lost
+                boundDescriptorSet = ~0u;
+                stats.pipelineBinds++;
+            }
+            else {
+                stats.bindsAvoided++;
+            }
+
+            if (packet.descriptorSet != NO_DESCRIPTOR_SET) {
+                if (packet.descriptorSet != boundDescriptorSet) {
+                    vkd.vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layouts[packet.pipeline], 0, 1, &descriptorSets[packet.descriptorSet], 0, nullptr);
+                    boundDescriptorSet = packet.descriptorSet;
+                    stats.descriptorSetBinds++;
+                }
+                else {
+                    stats.bindsAvoided++;
+                }
+            }
+
+            if (packet.mesh != NO_MESH) {
+                if (packet.mesh != boundMesh) {
+                    VkDeviceSize offset = 0;
+                    vkd.vkCmdBindVertexBuffers(commandBuffer, 0, 1, &vertexBuffers[packet.mesh], &offset);
+                    if (indexBuffers && indexBuffers[packet.mesh] != VK_NULL_HANDLE) {
+                        vkd.vkCmdBindIndexBuffer(commandBuffer, indexBuffers[packet.mesh], 0, VK_INDEX_TYPE_UINT32);
+                    }
+                    boundMesh = packet.mesh;
+                    stats.vertexBufferBinds++;
+                }
+                else {
+                    stats.bindsAvoided++;
+                }
+            }
+
+            if (packet.draw.indexCount > 0) {
+                vkd.vkCmdDrawIndexed(commandBuffer, packet.draw.indexCount, packet.draw.instanceCount, packet.draw.firstIndex, packet.draw.vertexOffset, packet.draw.firstInstance);
+            }
+            else {
+                vkd.vkCmdDraw(commandBuffer, packet.draw.vertexCount, packet.draw.instanceCount, packet.draw.firstVertex, packet.draw.firstInstance);
+            }
+            stats.draws++;
+            uint32_t vertices = packet.draw.indexCount > 0 ? packet.draw.indexCount : packet.draw.vertexCount;
+            if (topologies[packet.pipeline] == VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST) {
+                stats.triangles += uint64_t(vertices / 3) * packet.draw.instanceCount;
+            }
+        }
+    }
+
+private:
+    std::vector<DrawPacket> packets;
+    bool sorted = true;
+
+    // sort scratch, kept between sorts to avoid reallocating
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> order;
+    std::vector<uint64_t> tempKeys;
+    std::vector<uint32_t> tempOrder;
+    std::vector<DrawPacket> sortedPackets;
+};
+
+// First-fit allocator over [0, capacity) with coalescing free blocks. It
+// only hands out offsets; the caller remembers sizes.
+class RangeAllocator {
+public:
+    static const uint32_t INVALID = 0xFFFFFFFF;
+
+    explicit RangeAllocator(uint32_t capacity = 0) {
+        reset(capacity);
+    }
+
+    void reset(uint32_t capacity) {
+        total = capacity;
+        used = 0;
+        freeBlocks.clear();
+        if (capacity > 0) {
+            freeBlocks[0] = capacity;
+        }
+    }
+
+    uint32_t allocate(uint32_t size) {
+        if (size == 0) return 0;
+        for (auto it = freeBlocks.begin(); it != freeBlocks.end(); ++it) {
+            if (it->second < size) continue;
+            uint32_t offset = it->first;
+            uint32_t remaining = it->second - size;
+            freeBlocks.erase(it);
+            if (remaining > 0) {
+                freeBlocks[offset + size] = remaining;
+            }
+            used += size;
+            return offset;
+        }
+        return INVALID;
+    }
+
+    void free(uint32_t offset, uint32_t size) {
+        if (size == 0) return;
+        used -= size;
+        auto next = freeBlocks.lower_bound(offset);
+        if (next != freeBlocks.end() && offset + size == next->first) {
+            size += next->second;
+            next = freeBlocks.erase(next);
+        }
+        if (next != freeBlocks.begin()) {
+            auto previous = std::prev(next);
+            if (previous->first + previous->second == offset) {
+                previous->second += size;
+                return;
+            }
+        }
+        freeBlocks[offset] = size;
+    }
+
+    uint32_t capacity() const {
+        return total;
+    }
+
+    uint32_t allocated() const {
+        return used;
+    }
+
+    uint32_t largestFreeBlock() const {
+        uint32_t largest = 0;
+        for (const auto& block : freeBlocks) {
+            largest = std::max(largest, block.second);
+        }
+        return largest;
+    }
+
+private:
+    std::map<uint32_t, uint32_t> freeBlocks; // offset -> size
+    uint32_t total = 0;
+    uint32_t used = 0;
+};
+
+// Where a mesh lives in the shared buffers: draw it with
+// vkCmdDrawIndexed(indexCount, ..., firstIndex, firstVertex) and mesh-local indices.
+struct MeshRange {
+    uint32_t firstVertex;
+    uint32_t vertexCount;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+};
+
+// Bookkeeping for one large vertex buffer (of a single vertex format) and
+// one large index buffer shared by many meshes, so they can all be drawn
+// after a single bind. Meshes are referred to by stable handles; compact()
+// packs the live ranges to the front of new buffers and returns the copies
+// that move the data there.
+class GeometryArena {
+public:
+    static const uint32_t INVALID = 0xFFFFFFFF;
+
+    GeometryArena(uint32_t vertexStride, uint32_t vertexCapacity, uint32_t indexCapacity)
+        : stride(vertexStride), vertices(vertexCapacity), indices(indexCapacity) {}
+
+    // INVALID when either buffer lacks a large enough free range.
+    uint32_t add(uint32_t vertexCount, uint32_t indexCount) {
+        uint32_t firstVertex = vertices.allocate(vertexCount);
+        if (firstVertex == RangeAllocator::INVALID) return INVALID;
+        uint32_t firstIndex = indices.allocate(indexCount);
+        if (firstIndex == RangeAllocator::INVALID) {
+            vertices.free(firstVertex, vertexCount);
+            return INVALID;
+        }
+
+        uint32_t handle;
+        if (!freeHandles.empty()) {
+            handle = freeHandles.back();
+            freeHandles.pop_back();
+        }
+        else {
+            handle = static_cast<uint32_t>(meshes.size());
+            meshes.push_back({});
+            live.push_back(false);
+        }
+        meshes[handle] = { firstVertex, vertexCount, firstIndex, indexCount };
+        live[handle] = true;
+        return handle;
+    }
+
+    void remove(uint32_t handle) {
+        const MeshRange& range = meshes[handle];
+        vertices.free(range.firstVertex, range.vertexCount);
+        indices.free(range.firstIndex, range.indexCount);
+        live[handle] = false;
+        freeHandles.push_back(handle);
+    }
+
+    const MeshRange& mesh(uint32_t handle) const {
+        return meshes[handle];
+    }
+
+    // Copies are in bytes, for vkCmdCopyBuffer from the old buffers into new
+    // ones of the given capacities, which must hold everything still live.
+    void compact(uint32_t vertexCapacity, uint32_t indexCapacity, std::vector<VkBufferCopy>& vertexCopies, std::vector<VkBufferCopy>& indexCopies) {
+        if (vertexCapacity < vertices.allocated() || indexCapacity < indices.allocated()) {
+            throw std::runtime_error("geometry arena compacted below its contents!");
+        }
+
+        vertexCopies.clear();
+        indexCopies.clear();
+        vertices.reset(vertexCapacity);
+        indices.reset(indexCapacity);
+        for (uint32_t handle = 0; handle < meshes.size(); handle++) {
+            if (!live[handle]) continue;
+            MeshRange& range = meshes[handle];
+            uint32_t firstVertex = vertices.allocate(range.vertexCount);
+            uint32_t firstIndex = indices.allocate(range.indexCount);
+            if (range.vertexCount > 0) {
+                vertexCopies.push_back({ VkDeviceSize(range.firstVertex) * stride, VkDeviceSize(firstVertex) * stride, VkDeviceSize(range.vertexCount) * stride });
+            }
+            if (range.indexCount > 0) {
+                indexCopies.push_back({ VkDeviceSize(range.firstIndex) * sizeof(uint32_t), VkDeviceSize(firstIndex) * sizeof(uint32_t), VkDeviceSize(range.indexCount) * sizeof(uint32_t) });
+            }
+            range.firstVertex = firstVertex;
+            range.firstIndex = firstIndex;
+        }
+    }
+
+    uint32_t vertexStride() const {
+        return stride;
+    }
+
+    const RangeAllocator& vertexRanges() const {
+        return vertices;
+    }
+
+    const RangeAllocator& indexRanges() const {
+        return indices;
+    }
+
+    // 0 when all free space is one block, approaching 1 as it splinters
+    float fragmentation() const {
+        auto of = [](const RangeAllocator& ranges) {
+            uint32_t free = ranges.capacity() - ranges.allocated();
+            return free == 0 ? 0.0f : 1.0f - float(ranges.largestFreeBlock()) / free;
+        };
+        return std::max(of(vertices), of(indices));
+    }
+
+private:
+    uint32_t stride;
+    RangeAllocator vertices;
+    RangeAllocator indices;
+    std::vector<MeshRange> meshes;
+    std::vector<bool> live;
+    std::vector<uint32_t> freeHandles;
+};
+
+struct LodLevel {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float geometricError;
+};
+
+// Levels are ordered finest first; firstIndex is relative to the mesh and
+// geometricError is the world space deviation from the full mesh.
+struct LodChain {
+    std::vector<LodLevel> levels;
+};
+
+struct LodInstance {
+    glm::vec3 center;
+    float radius;
+    uint32_t chain;
+    uint32_t level;
+    uint32_t previousLevel;
+    float fade;
+};
+
+// Picks a level per instance from its projected screen space error. Distances
+// are computed four instances at a time with SSE; switching to a coarser level
+// needs the error to drop below the threshold by the hysteresis margin, and a
+// change cross-fades from the previous level over fadeTime seconds.
+class LodSelector {
+public:
+    float pixelThreshold = 1.0f;
+    float hysteresis = 0.25f;
+    float fadeTime = 0.25f;
+
+    void setCamera(const glm::mat4& view, const glm::mat4& projection, float viewportHeight) {
+        cameraPosition = glm::vec3(glm::inverse(view)[3]);
+        // pixels covered by one world unit at distance one
+        projectionScale = projection[1][1] * 0.5f * viewportHeight;
+    }
+
+    void select(std::vector<LodInstance>& instances, const std::vector<LodChain>& chains, float deltaTime) {
+        pixelsPerUnit.resize((instances.size() + 3) & ~size_t(3));
+
+        const __m128 camX = _mm_set1_ps(cameraPosition.x);
+        const __m128 camY = _mm_set1_ps(cameraPosition.y);
+        const __m128 camZ = _mm_set1_ps(cameraPosition.z);
+        const __m128 scale = _mm_set1_ps(projectionScale);
+        const __m128 minDistance = _mm_set1_ps(1e-3f);
+
+        for (size_t i = 0; i < instances.size(); i += 4) {
+            float x[4] = {}, y[4] = {}, z[4] = {}, r[4] = {};
+            for (size_t k = 0; k < 4 && i + k < instances.size(); k++) {
+                x[k] = instances[i + k].center.x;
+                y[k] = instances[i + k].center.y;
+                z[k] = instances[i + k].center.z;
+                r[k] = instances[i + k].radius;
+            }
+            __m128 dx = _mm_sub_ps(_mm_loadu_ps(x), camX);
+            __m128 dy = _mm_sub_ps(_mm_loadu_ps(y), camY);
+            __m128 dz = _mm_sub_ps(_mm_loadu_ps(z), camZ);
+            __m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+            // measure from the closest point of the bounding sphere
+            distance = _mm_max_ps(_mm_sub_ps(distance, _mm_loadu_ps(r)), minDistance);
+            _mm_storeu_ps(&pixelsPerUnit[i], _mm_div_ps(scale, distance));
+        }
+
+        const float coarsenThreshold = pixelThreshold * (1.0f - hysteresis);
+
+        for (size_t i = 0; i < instances.size(); i++) {
+            LodInstance& instance = instances[i];
+            const auto& levels = chains[instance.chain].levels;
+
+            uint32_t refine = 0;
+            uint32_t coarsen = 0;
+            for (uint32_t level = 0; level < levels.size(); level++) {
+                float error = levels[level].geometricError * pixelsPerUnit[i];
+                if (error <= pixelThreshold) refine = level;
+                if (error <= coarsenThreshold) coarsen = level;
+            }
+
+            uint32_t target = instance.level;
+            if (refine < instance.level) {
+                target = refine;
+            }
+            else if (coarsen > instance.level) {
+                target = coarsen;
+            }
+
+            if (target != instance.level) {
+                instance.previousLevel = instance.level;
+                instance.level = target;
+                instance.fade = 0.0f;
+            }
+            else if (instance.previousLevel != instance.level) {
+                instance.fade = std::min(1.0f, instance.fade + deltaTime / fadeTime);
+                if (instance.fade >= 1.0f) {
+                    instance.previousLevel = instance.level;
+                }
+            }
+        }
+    }
+
+private:
+    glm::vec3 cameraPosition = glm::vec3(0.0f);
+    float projectionScale = 1.0f;
+    std::vector<float> pixelsPerUnit;
+};
+
+// Adds the draw for the instance's current level, plus the outgoing level
+// while a cross-fade is in progress. base carries the mesh's first index,
+// vertex offset and the instance to draw; the outgoing level is drawn as
+// instance firstInstance + fadingInstanceOffset so the shaders can tell the
+// two apart. Both draws get the bounds for occlusion culling.
+void addLodDraws(DrawList& list, const LodInstance& instance, const LodChain& chain, uint16_t pipeline, uint16_t descriptorSet, uint16_t mesh, float depth,
+    const DrawCommand& base, uint32_t fadingInstanceOffset, const AABB* bounds = nullptr) {
+    DrawCommand draw = base;
+
+    const LodLevel& level = chain.levels[instance.level];
+    draw.firstIndex = base.firstIndex + level.firstIndex;
+    draw.indexCount = level.indexCount;
+    list.add(pipeline, descriptorSet, mesh, depth, draw, bounds);
+
+    if (instance.previousLevel != instance.level) {
+        const LodLevel& previous = chain.levels[instance.previousLevel];
+        draw.firstIndex = base.firstIndex + previous.firstIndex;
+        draw.indexCount = previous.indexCount;
+        draw.firstInstance = base.firstInstance + fadingInstanceOffset;
+        list.add(pipeline, descriptorSet, mesh, depth, draw, bounds);
+    }
+}
+
+// Unit icosphere refined by midpoint subdivision, as a LOD chain scaled for
+// the given radius. Refining keeps the earlier vertices, so every level
+// shares one vertex array and has its own index range. Faces wind
+// counter-clockwise seen from outside.
+void buildIcosphereChain(uint32_t subdivisions, float radius, std::vector<glm::vec3>& positions, std::vector<uint32_t>& indices, LodChain& chain) {
+    const float t = (1.0f + std::sqrt(5.0f)) * 0.5f;
+    positions = {
+        { -1, t, 0 }, { 1, t, 0 }, { -1, -t, 0 }, { 1, -t, 0 },
+        { 0, -1, t }, { 0, 1, t }, { 0, -1, -t }, { 0, 1, -t },
+        { t, 0, -1 }, { t, 0, 1 }, { -t, 0, -1 }, { -t, 0, 1 },
+    };
+    for (auto& position : positions) {
+        position = glm::normalize(position);
+    }
+
+    std::vector<std::vector<uint32_t>> levels(1);
+    levels[0] = {
+        0, 11, 5, 0, 5, 1, 0, 1, 7, 0, 7, 10, 0, 10, 11,
+        1, 5, 9, 5, 11, 4, 11, 10, 2, 10, 7, 6, 7, 1, 8,
+        3, 9, 4, 3, 4, 2, 3, 2, 6, 3, 6, 8, 3, 8, 9,
+        4, 9, 5, 2, 4, 11, 6, 2, 10, 8, 6, 7, 9, 8, 1,
+    };
+
+    std::map<uint64_t, uint32_t> midpoints;
+    auto midpoint = [&](uint32_t a, uint32_t b) {
+        uint64_t key = (uint64_t(std::min(a, b)) << 32) | std::max(a, b);
+        auto found = midpoints.find(key);
+        if (found != midpoints.end()) return found->second;
+        uint32_t index = static_cast<uint32_t>(positions.size());
+        positions.push_back(glm::normalize(positions[a] + positions[b]));
+        midpoints.emplace(key, index);
+        return index;
+    };
+
+    for (uint32_t level = 1; level <= subdivisions; level++) {
+        const std::vector<uint32_t>& coarse = levels.back();
+        std::vector<uint32_t> fine;
+        fine.reserve(coarse.size() * 4);
+        for (size_t i = 0; i < coarse.size(); i += 3) {
+            uint32_t a = coarse[i], b = coarse[i + 1], c = coarse[i + 2];
+            uint32_t ab = midpoint(a, b), bc = midpoint(b, c), ca = midpoint(c, a);
+            fine.insert(fine.end(), { a, ab, ca, b, bc, ab, c, ca, bc, ab, bc, ca });
+        }
+        levels.push_back(std::move(fine));
+    }
+
+    indices.clear();
+    chain.levels.clear();
+    for (size_t level = levels.size(); level-- > 0;) {
+        // the flat faces sag furthest from the sphere at their closest point to the center
+        float closest = 1.0f;
+        const std::vector<uint32_t>& faces = levels[level];
+        for (size_t i = 0; i < faces.size(); i += 3) {
+            const glm::vec3& a = positions[faces[i]];
+            glm::vec3 normal = glm::normalize(glm::cross(positions[faces[i + 1]] - a, positions[faces[i + 2]] - a));
+            closest = std::min(closest, std::abs(glm::dot(normal, a)));
+        }
+        chain.levels.push_back({ static_cast<uint32_t>(indices.size()), static_cast<uint32_t>(faces.size()), (1.0f - closest) * radius });
+        indices.insert(indices.end(), faces.begin(), faces.end());
+    }
+}
+
+// Box around the origin with a flat normal per face, wound counter-clockwise
+// seen from outside.
+void buildBox(const glm::vec3& halfExtents, std::vector<glm::vec3>& positions, std::vector<glm::vec3>& normals, std::vector<uint32_t>& indices) {
+    positions.clear();
+    normals.clear();
+    indices.clear();
+    for (int axis = 0; axis < 3; axis++) {
+        for (float sign : { -1.0f, 1.0f }) {
+            // u x v points along the normal, so the corners below run counter-clockwise around it
+            glm::vec3 normal(0.0f), u(0.0f), v(0.0f);
+            normal[axis] = sign;
+            u[(axis + 1) % 3] = sign;
+            v[(axis + 2) % 3] = 1.0f;
+
+            uint32_t first = static_cast<uint32_t>(positions.size());
+            const float corners[4][2] = { { -1.0f, -1.0f }, { 1.0f, -1.0f }, { 1.0f, 1.0f }, { -1.0f, 1.0f } };
+            for (const auto& corner : corners) {
+                positions.push_back((normal + u * corner[0] + v * corner[1]) * halfExtents);
+                normals.push_back(normal);
+            }
+            indices.insert(indices.end(), { first, first + 1, first + 2, first, first + 2, first + 3 });
+        }
+    }
+}
+
+// Bump allocator for data that only lives until the frame's fence signals.
+// Memory is reserved up front and handed out linearly; reset() releases
+// everything at once.
+class FrameArena {
+public:
+    explicit FrameArena(size_t capacity) : memory(capacity) {}
+
+    void* allocate(size_t size, size_t alignment) {
+        size_t offset = (used + alignment - 1) & ~(alignment - 1);
+        if (offset + size > memory.size()) {
+            throw std::runtime_error("frame arena exhausted!");
+        }
+        used = offset + size;
+        peak = std::max(peak, used);
+        return memory.data() + offset;
+    }
+
+    void reset() {
+        used = 0;
+    }
+
+    size_t bytesUsed() const {
+        return used;
+    }
+
+    size_t peakBytes() const {
+        return peak;
+    }
+
+private:
+    std::vector<uint8_t> memory;
+    size_t used = 0;
+    size_t peak = 0;
+};
+
+template<typename T>
+struct ArenaAllocator {
+    using value_type = T;
+
+    FrameArena* arena;
+
+    ArenaAllocator(FrameArena& arena) : arena(&arena) {}
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T*, size_t) {}
+};
+
+template<typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+    return a.arena == b.arena;
+}
+
+template<typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+    return a.arena != b.arena;
+}
+
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+struct SubmitStats {
+    uint32_t submits = 0;
+    uint32_t batches = 0;
+    uint32_t commandBuffers = 0;
+    double submitMilliseconds = 0.0;
+};
+
+// Collects command buffers with their semaphore waits and signals from every
+// producer in a frame and submits each queue's share with as few
+// vkQueueSubmit calls as the dependencies allow. Consecutive work on one
+// queue shares a VkSubmitInfo unless it waits or the previous work signals;
+// a queue is flushed early only when another queue waits on a semaphore it
+// has yet to signal.
+class SubmitBatcher {
+public:
+    void add(VkQueue queue, uint32_t commandBufferCount, const VkCommandBuffer* commandBuffers,
+        uint32_t waitCount, const VkSemaphore* waits, const VkPipelineStageFlags* waitStages,
+        uint32_t signalCount, const VkSemaphore* signals) {
+        for (uint32_t i = 0; i < waitCount; i++) {
+            flushSignaler(queue, waits[i]);
+        }
+
+        bool merge = !batches.empty() && !batches.back().submitted && batches.back().queue == queue &&
+            batches.back().signalCount == 0 && waitCount == 0;
+
+        if (!merge) {
+            Batch batch = {};
+            batch.queue = queue;
+            batch.firstWait = static_cast<uint32_t>(waitSemaphores.size());
+            batch.firstCommandBuffer = static_cast<uint32_t>(this->commandBuffers.size());
+            batch.firstSignal = static_cast<uint32_t>(signalSemaphores.size());
+            batches.push_back(batch);
+        }
+
+        Batch& batch = batches.back();
+        waitSemaphores.insert(waitSemaphores.end(), waits, waits + waitCount);
+        this->waitStages.insert(this->waitStages.end(), waitStages, waitStages + waitCount);
+        this->commandBuffers.insert(this->commandBuffers.end(), commandBuffers, commandBuffers + commandBufferCount);
+        signalSemaphores.insert(signalSemaphores.end(), signals, signals + signalCount);
+        batch.waitCount += waitCount;
+        batch.commandBufferCount += commandBufferCount;
+        batch.signalCount += signalCount;
+    }
+
+    // Submits everything still pending; fence is attached to fenceQueue's last submit.
+    void flush(VkQueue fenceQueue, VkFence fence) {
+        PROFILE_ZONE("SubmitBatcher::flush");
+        bool fenced = false;
+        for (size_t i = 0; i < batches.size(); i++) {
+            if (!batches[i].submitted) {
+                VkQueue queue = batches[i].queue;
+                fenced |= queue == fenceQueue;
+                submitQueue(queue, queue == fenceQueue ? fence : VK_NULL_HANDLE);
+            }
+        }
+
+        // the fence queue's work may have gone out early; fence it on its own
+        if (!fenced && fence != VK_NULL_HANDLE) {
+            submitQueue(fenceQueue, fence);
+        }
+
+        frameStats = pendingStats;
+        pendingStats = SubmitStats();
+        batches.clear();
+        waitSemaphores.clear();
+        waitStages.clear();
+        commandBuffers.clear();
+        signalSemaphores.clear();
+    }
+
+    const SubmitStats& stats() const {
+        return frameStats;
+    }
+
+private:
+    struct Batch {
+        VkQueue queue;
+        uint32_t firstWait, waitCount;
+        uint32_t firstCommandBuffer, commandBufferCount;
+        uint32_t firstSignal, signalCount;
+        bool submitted;
+    };
+
+    std::vector<Batch> batches;
+    std::vector<VkSemaphore> waitSemaphores;
+    std::vector<VkPipelineStageFlags> waitStages;
+    std::vector<VkCommandBuffer> commandBuffers;
+    std::vector<VkSemaphore> signalSemaphores;
+    std::vector<VkSubmitInfo> submitInfos;
+
+    SubmitStats pendingStats;
+    SubmitStats frameStats;
+
+    // binary semaphores must be signaled by an earlier submit than their wait
+    void flushSignaler(VkQueue waitingQueue, VkSemaphore semaphore) {
+        for (const auto& batch : batches) {
+            if (batch.submitted || batch.queue == waitingQueue) continue;
+            for (uint32_t i = 0; i < batch.signalCount; i++) {
+                if (signalSemaphores[batch.firstSignal + i] == semaphore) {
+                    submitQueue(batch.queue, VK_NULL_HANDLE);
+                    return;
+                }
+            }
+        }
+    }
+
+    void submitQueue(VkQueue queue, VkFence fence) {
+        submitInfos.clear();
+        for (auto& batch : batches) {
+            if (batch.submitted || batch.queue != queue) continue;
+
+            VkSubmitInfo submitInfo = {};
+            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            submitInfo.waitSemaphoreCount = batch.waitCount;
+            submitInfo.pWaitSemaphores = waitSemaphores.data() + batch.firstWait;
+            submitInfo.pWaitDstStageMask = waitStages.data() + batch.firstWait;
+            submitInfo.commandBufferCount = batch.commandBufferCount;
+            submitInfo.pCommandBuffers = commandBuffers.data() + batch.firstCommandBuffer;
+            submitInfo.signalSemaphoreCount = batch.signalCount;
+            submitInfo.pSignalSemaphores = signalSemaphores.data() + batch.firstSignal;
+            submitInfos.push_back(submitInfo);
+
+            batch.submitted = true;
+            pendingStats.batches++;
+            pendingStats.commandBuffers += batch.commandBufferCount;
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        VkResult result = vkd.vkQueueSubmit(queue, static_cast<uint32_t>(submitInfos.size()), submitInfos.data(), fence);
+        auto end = std::chrono::high_resolution_clock::now();
+
+        pendingStats.submits++;
+        pendingStats.submitMilliseconds += std::chrono::duration<double, std::milli>(end - start).count();
+
+        if (result != VK_SUCCESS) {
+            throw std::runtime_error("failed to submit draw command buffer!");
+        }
+    }
+};
+
+// Accumulates how long the graphics and async compute queues were busy at
+// the same time, from GPU timestamp intervals. Each queue's intervals are
+// read back whenever its frame slot comes round again, so they arrive out of
+// order; a new interval is intersected with the other queue's recent ones,
+// which counts every overlapping pair exactly once, when its later half
+// arrives.
+class QueueOverlap {
+public:
+    enum Queue { Graphics, Compute };
+
+    void add(Queue queue, uint64_t begin, uint64_t end) {
+        const History& other = history[queue == Graphics ? Compute : Graphics];
+        for (uint32_t i = 0; i < other.count; i++) {
+            uint64_t overlapBegin = std::max(begin, other.begin[i]);
+            uint64_t overlapEnd = std::min(end, other.end[i]);
+            if (overlapEnd > overlapBegin) {
+                overlapTicks += overlapEnd - overlapBegin;
+            }
+        }
+        busyTicks[queue] += end - begin;
+
+        History& own = history[queue];
+        own.begin[own.next] = begin;
+        own.end[own.next] = end;
+        own.next = (own.next + 1) % HISTORY;
+        own.count = std::min(own.count + 1, HISTORY);
+    }
+
+    uint64_t busy(Queue queue) const {
+        return busyTicks[queue];
+    }
+
+    uint64_t overlap() const {
+        return overlapTicks;
+    }
+
+    // the history stays, so pairs straddling a report still count
+    void resetTotals() {
+        busyTicks[Graphics] = busyTicks[Compute] = 0;
+        overlapTicks = 0;
+    }
+
+private:
+    static constexpr uint32_t HISTORY = 8;
+
+    struct History {
+        uint64_t begin[HISTORY];
+        uint64_t end[HISTORY];
+        uint32_t next = 0;
+        uint32_t count = 0;
+    };
+
+    History history[2];
+    uint64_t busyTicks[2] = {};
+    uint64_t overlapTicks = 0;
+};
+
+const int MAX_PARTICLE_COLLIDERS = 2;
+
+// Matches the Particle struct in particle.comp and the particle vertex input.
+struct ParticleVertex {
+    glm::vec4 position;
+    glm::vec4 velocity;
+};
+
+// Unused colliders are set up so they can never be hit: planes with a zero
+// normal and positive offset, spheres with zero radius.
+struct ParticleSettings {
+    glm::vec3 emitterPosition = glm::vec3(0.0f, 0.3f, 0.5f);
+    float emitSpeed = 1.0f;
+    glm::vec3 gravity = glm::vec3(0.0f, 1.0f, 0.0f);
+    float lifetime = 3.0f;
+    float restitution = 0.5f;
+    glm::vec4 planes[MAX_PARTICLE_COLLIDERS] = { glm::vec4(0.0f, -1.0f, 0.0f, 0.8f), glm::vec4(0.0f, 0.0f, 0.0f, 1.0f) };
+    glm::vec4 spheres[MAX_PARTICLE_COLLIDERS] = { glm::vec4(0.0f, 0.6f, 0.5f, 0.15f), glm::vec4(0.0f) };
+};
+
+// Layout of the particle.comp push constant block.
+struct ParticlePushConstants {
+    glm::vec4 emitter;
+    glm::vec4 gravity;
+    glm::vec4 params;
+    glm::uvec4 counts;
+    glm::vec4 planes[MAX_PARTICLE_COLLIDERS];
+    glm::vec4 spheres[MAX_PARTICLE_COLLIDERS];
+};
+
+// Same hash as particle.comp, so both backends respawn identically.
+uint32_t particleHash(uint32_t x) {
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return x;
+}
+
+float particleRandom(uint32_t index, uint32_t seed, uint32_t channel) {
+    return float(particleHash(index * 0x9e3779b9u ^ particleHash(seed * 4u + channel)) >> 8) * (1.0f / 16777216.0f);
+}
+
+// Multi-threaded SoA particle simulation; mirrors particle.comp step for step
+// and serves as its validation reference.
+class CpuParticleSystem {
+public:
+    static const size_t CHUNK_SIZE = 4096;
+
+    void init(uint32_t particleCount, const ParticleSettings& settings) {
+        count = particleCount;
+        // padded to a multiple of four so the SSE loop needs no tail
+        size_t padded = (count + 3) & ~size_t(3);
+        for (auto* array : { &px, &py, &pz, &vx, &vy, &vz, &life }) {
+            array->assign(padded, 0.0f);
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            respawn(i, 0, settings);
+            life[i] = settings.lifetime * particleRandom(i, 0, 3);
+        }
+    }
+
+    uint32_t size() const {
+        return count;
+    }
+
+    void update(float dt, uint32_t seed, const ParticleSettings& settings) {
+        size_t chunks = (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        workerPool().run(chunks, [&](size_t chunk) {
+            size_t begin = chunk * CHUNK_SIZE;
+            size_t end = std::min<size_t>(count, begin + CHUNK_SIZE);
+            updateRange(begin, end, dt, seed, settings);
+        });
+    }
+
+    // Writes the particles into vertex layout; with sortBackToFront they are
+    // ordered by decreasing distance from the viewer.
+    void writeVertices(ParticleVertex* out, bool sortBackToFront, const glm::vec3& viewer) {
+        if (sortBackToFront) {
+            keys.resize(count);
+            order.resize(count);
+            for (uint32_t i = 0; i < count; i++) {
+                float dx = px[i] - viewer.x, dy = py[i] - viewer.y, dz = pz[i] - viewer.z;
+                float dist2 = dx * dx + dy * dy + dz * dz;
+                uint32_t bits;
+                std::memcpy(&bits, &dist2, sizeof(bits));
+                // positive floats order like their bits; invert for far to near
+                keys[i] = ~bits;
+                order[i] = i;
+            }
+            radixSortKeys(keys, order, tempKeys, tempOrder);
+        }
+
+        size_t chunks = (count + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        workerPool().run(chunks, [&](size_t chunk) {
+            size_t begin = chunk * CHUNK_SIZE;
+            size_t end = std::min<size_t>(count, begin + CHUNK_SIZE);
+            for (size_t i = begin; i < end; i++) {
+                uint32_t src = sortBackToFront ? order[i] : static_cast<uint32_t>(i);
+                out[i].position = glm::vec4(px[src], py[src], pz[src], life[src]);
+                out[i].velocity = glm::vec4(vx[src], vy[src], vz[src], 0.0f);
+            }
+        });
+    }
+
+    glm::vec4 position(uint32_t i) const {
+        return glm::vec4(px[i], py[i], pz[i], life[i]);
+    }
+
+private:
+    uint32_t count = 0;
+    std::vector<float> px, py, pz, vx, vy, vz, life;
+
+    std::vector<uint64_t> keys, tempKeys;
+    std::vector<uint32_t> order, tempOrder;
+
+    void respawn(uint32_t i, uint32_t seed, const ParticleSettings& settings) {
+        px[i] = settings.emitterPosition.x;
+        py[i] = settings.emitterPosition.y;
+        pz[i] = settings.emitterPosition.z;
+        vx[i] = (particleRandom(i, seed, 0) - 0.5f) * settings.emitSpeed;
+        vy[i] = (-0.5f - 0.5f * particleRandom(i, seed, 1)) * settings.emitSpeed;
+        vz[i] = (particleRandom(i, seed, 2) - 0.5f) * settings.emitSpeed;
+    }
+
+    // v -= (1 + e) * min(dot(v, n), 0) * n for the lanes in mask
+    static void reflect(__m128 mask, __m128 nx, __m128 ny, __m128 nz, __m128& x, __m128& y, __m128& z, __m128 bounce) {
+        __m128 vn = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, nx), _mm_mul_ps(y, ny)), _mm_mul_ps(z, nz));
+        __m128 scale = _mm_and_ps(_mm_and_ps(mask, _mm_cmplt_ps(vn, _mm_setzero_ps())), _mm_mul_ps(bounce, vn));
+        x = _mm_sub_ps(x, _mm_mul_ps(scale, nx));
+        y = _mm_sub_ps(y, _mm_mul_ps(scale, ny));
+        z = _mm_sub_ps(z, _mm_mul_ps(scale, nz));
+    }
+
+    static __m128 select(__m128 mask, __m128 a, __m128 b) {
+        return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    }
+
+    void updateRange(size_t begin, size_t end, float dt, uint32_t seed, const ParticleSettings& settings) {
+        const __m128 t = _mm_set1_ps(dt);
+        const __m128 gx = _mm_set1_ps(settings.gravity.x * dt);
+        const __m128 gy = _mm_set1_ps(settings.gravity.y * dt);
+        const __m128 gz = _mm_set1_ps(settings.gravity.z * dt);
+        const __m128 bounce = _mm_set1_ps(1.0f + settings.restitution);
+        const __m128 zero = _mm_setzero_ps();
+
+        for (size_t i = begin; i < end; i += 4) {
+            __m128 x = _mm_loadu_ps(&px[i]), y = _mm_loadu_ps(&py[i]), z = _mm_loadu_ps(&pz[i]);
+            __m128 u = _mm_loadu_ps(&vx[i]), v = _mm_loadu_ps(&vy[i]), w = _mm_loadu_ps(&vz[i]);
+
+            u = _mm_add_ps(u, gx);
+            v = _mm_add_ps(v, gy);
+            w = _mm_add_ps(w, gz);
+            x = _mm_add_ps(x, _mm_mul_ps(u, t));
+            y = _mm_add_ps(y, _mm_mul_ps(v, t));
+            z = _mm_add_ps(z, _mm_mul_ps(w, t));
+
+            for (const auto& plane : settings.planes) {
+                __m128 nx = _mm_set1_ps(plane.x), ny = _mm_set1_ps(plane.y), nz = _mm_set1_ps(plane.z);
+                __m128 d = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, x), _mm_mul_ps(ny, y)), _mm_mul_ps(nz, z)), _mm_set1_ps(plane.w));
+                __m128 hit = _mm_cmplt_ps(d, zero);
+                __m128 push = _mm_and_ps(hit, d);
+                x = _mm_sub_ps(x, _mm_mul_ps(nx, push));
+                y = _mm_sub_ps(y, _mm_mul_ps(ny, push));
+                z = _mm_sub_ps(z, _mm_mul_ps(nz, push));
+                reflect(hit, nx, ny, nz, u, v, w, bounce);
+            }
+
+            for (const auto& sphere : settings.spheres) {
+                __m128 cx = _mm_set1_ps(sphere.x), cy = _mm_set1_ps(sphere.y), cz = _mm_set1_ps(sphere.z);
+                __m128 radius = _mm_set1_ps(sphere.w);
+                __m128 ox = _mm_sub_ps(x, cx), oy = _mm_sub_ps(y, cy), oz = _mm_sub_ps(z, cz);
+                __m128 dist2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ox, ox), _mm_mul_ps(oy, oy)), _mm_mul_ps(oz, oz));
+                __m128 hit = _mm_and_ps(_mm_cmplt_ps(dist2, _mm_mul_ps(radius, radius)), _mm_cmpgt_ps(dist2, _mm_set1_ps(1e-12f)));
+                if (_mm_movemask_ps(hit) == 0) continue;
+
+                __m128 inverse = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(_mm_max_ps(dist2, _mm_set1_ps(1e-12f))));
+                __m128 nx = _mm_mul_ps(ox, inverse), ny = _mm_mul_ps(oy, inverse), nz = _mm_mul_ps(oz, inverse);
+                x = select(hit, _mm_add_ps(cx, _mm_mul_ps(nx, radius)), x);
+                y = select(hit, _mm_add_ps(cy, _mm_mul_ps(ny, radius)), y);
+                z = select(hit, _mm_add_ps(cz, _mm_mul_ps(nz, radius)), z);
+                reflect(hit, nx, ny, nz, u, v, w, bounce);
+            }
+
+            __m128 remaining = _mm_sub_ps(_mm_loadu_ps(&life[i]), t);
+
+            _mm_storeu_ps(&px[i], x); _mm_storeu_ps(&py[i], y); _mm_storeu_ps(&pz[i], z);
+            _mm_storeu_ps(&vx[i], u); _mm_storeu_ps(&vy[i], v); _mm_storeu_ps(&vz[i], w);
+            _mm_storeu_ps(&life[i], remaining);
+
+            int expired = _mm_movemask_ps(_mm_cmple_ps(remaining, zero));
+            for (int lane = 0; lane < 4 && expired != 0; lane++) {
+                if ((expired & (1 << lane)) && i + lane < end) {
+                    respawn(static_cast<uint32_t>(i + lane), seed, settings);
+                    life[i + lane] += settings.lifetime;
+                }
+            }
+        }
+    }
+};
+
+// A rigid joint transform; skinning palettes are built from these so the
+// same pose can feed either linear blend or dual-quaternion skinning.
+struct RigidTransform {
+    glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+    glm::vec3 translation = glm::vec3(0.0f);
+};
+
+inline RigidTransform operator*(const RigidTransform& a, const RigidTransform& b) {
+    RigidTransform result;
+    result.rotation = a.rotation * b.rotation;
+    result.translation = a.translation + a.rotation * b.translation;
+    return result;
+}
+
+struct Skeleton {
+    // parents precede their children, the root has parent -1
+    std::vector<int32_t> parents;
+    std::vector<RigidTransform> inverseBind;
+
+    uint32_t jointCount() const {
+        return static_cast<uint32_t>(parents.size());
+    }
+};
+
+struct SkinnedVertex {
+    glm::vec4 position;
+    glm::vec4 normal;
+    glm::vec4 weights;
+    glm::uvec4 joints;
+};
+
+struct SkinnedOutputVertex {
+    glm::vec4 position;
+    glm::vec4 normal;
+};
+
+// Header in front of the palette in the storage buffer read by skinned.vert.
+struct SkinningPaletteHeader {
+    glm::uvec4 params; // x joint count, y method
+};
+
+// A crowd of characters sharing one skeleton and mesh. Joint palettes are
+// computed by a flat pass over each character's joints (parents first), and
+// vertices can be pre-skinned on the CPU or left to the vertex shader.
+//
+// Palette layout per joint: Linear stores the rows of the 3x4 affine skinning
+// matrix (glm::mat3x4 holding the transpose), DualQuaternion stores the real
+// and dual parts of a glm::dualquat, both as xyzw vec4s.
+class SkinnedCrowd {
+public:
+    static const uint32_t CHARACTERS_PER_TASK = 16;
+    static const uint32_t VERTICES_PER_TASK = 1024;
+
+    static uint32_t paletteStride(SkinningMethod method) {
+        return method == SkinningMethod::Linear ? 3 : 2;
+    }
+
+    void init(uint32_t characterCount) {
+        this->characterCount = characterCount;
+        buildCharacter();
+
+        uint32_t jointCount = skeleton.jointCount();
+        localPoses.assign(characterCount * jointCount, RigidTransform());
+        worldPoses.assign(characterCount * jointCount, RigidTransform());
+        palette.assign(characterCount * jointCount * paletteStride(SkinningMethod::Linear), glm::vec4(0.0f));
+    }
+
+    uint32_t size() const {
+        return characterCount;
+    }
+
+    const std::vector<SkinnedVertex>& meshVertices() const {
+        return vertices;
+    }
+
+    const std::vector<uint32_t>& meshIndices() const {
+        return indices;
+    }
+
+    uint32_t jointCount() const {
+        return skeleton.jointCount();
+    }
+
+    const glm::vec4* paletteData() const {
+        return palette.data();
+    }
+
+    size_t paletteSize(SkinningMethod method) const {
+        return characterCount * skeleton.jointCount() * paletteStride(method) * sizeof(glm::vec4);
+    }
+
+    // Procedural idle sway: each joint bends around z with a per-character phase.
+    void animate(float time) {
+        uint32_t tasks = (characterCount + CHARACTERS_PER_TASK - 1) / CHARACTERS_PER_TASK;
+        workerPool().run(tasks, [this, time](size_t task) {
+            uint32_t begin = static_cast<uint32_t>(task) * CHARACTERS_PER_TASK;
+            uint32_t end = std::min(begin + CHARACTERS_PER_TASK, characterCount);
+            uint32_t jointCount = skeleton.jointCount();
+            uint32_t columns = static_cast<uint32_t>(std::ceil(std::sqrt(float(characterCount))));
+            float spacing = 2.0f / columns;
+
+            for (uint32_t c = begin; c < end; c++) {
+                RigidTransform* pose = &localPoses[c * jointCount];
+                pose[0].translation = glm::vec3(-1.0f + (c % columns + 0.5f) * spacing, -1.0f + (c / columns + 0.75f) * spacing, 0.5f);
+                pose[0].rotation = glm::angleAxis(glm::pi<float>() + 0.2f * std::sin(time + c * 0.7f), glm::vec3(0.0f, 0.0f, 1.0f));
+                for (uint32_t j = 1; j < jointCount; j++) {
+                    float angle = 0.5f * std::sin(time * 2.0f + c * 0.7f + j);
+                    pose[j].translation = glm::vec3(0.0f, SEGMENT_LENGTH * spacing, 0.0f);
+                    pose[j].rotation = glm::angleAxis(angle, glm::vec3(0.0f, 0.0f, 1.0f));
+                }
+            }
+        });
+    }
+
+    void computePalettes(SkinningMethod method) {
+        uint32_t tasks = (characterCount + CHARACTERS_PER_TASK - 1) / CHARACTERS_PER_TASK;
+        workerPool().run(tasks, [this, method](size_t task) {
+            uint32_t begin = static_cast<uint32_t>(task) * CHARACTERS_PER_TASK;
+            uint32_t end = std::min(begin + CHARACTERS_PER_TASK, characterCount);
+            computePaletteRange(method, begin, end);
+        });
+    }
+
+    // Writes characterCount * vertexCount skinned vertices, character-major.
+    void skin(SkinningMethod method, SkinnedOutputVertex* out) const {
+        uint32_t vertexCount = static_cast<uint32_t>(vertices.size());
+        uint32_t chunksPerCharacter = (vertexCount + VERTICES_PER_TASK - 1) / VERTICES_PER_TASK;
+        workerPool().run(characterCount * chunksPerCharacter, [this, method, out, vertexCount, chunksPerCharacter](size_t task) {
+            uint32_t character = static_cast<uint32_t>(task / chunksPerCharacter);
+            uint32_t begin = static_cast<uint32_t>(task % chunksPerCharacter) * VERTICES_PER_TASK;
+            uint32_t end = std::min(begin + VERTICES_PER_TASK, vertexCount);
+            const glm::vec4* joints = &palette[character * skeleton.jointCount() * paletteStride(method)];
+            SkinnedOutputVertex* dst = out + character * vertexCount;
+            if (method == SkinningMethod::Linear) {
+                skinLinear(joints, begin, end, dst);
+            }
+            else {
+                skinDualQuaternion(joints, begin, end, dst);
+            }
+        });
+    }
+
+private:
+    static const uint32_t JOINT_COUNT = 4;
+    static const uint32_t RINGS = 16;
+    static const uint32_t SIDES = 8;
+    // in units of the grid cell a character stands in
+    static constexpr float SEGMENT_LENGTH = 0.15f;
+    static constexpr float RADIUS = 0.04f;
+
+    uint32_t characterCount = 0;
+    Skeleton skeleton;
+    std::vector<SkinnedVertex> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<RigidTransform> localPoses;
+    std::vector<RigidTransform> worldPoses;
+    std::vector<glm::vec4> palette;
+
+    // A tube along +y rigged to a chain of joints, sized to the grid cell each
+    // character stands in.
+    void buildCharacter() {
+        uint32_t columns = static_cast<uint32_t>(std::ceil(std::sqrt(float(std::max(characterCount, 1u)))));
+        float scale = 2.0f / columns;
+        float segment = SEGMENT_LENGTH * scale;
+        float height = segment * JOINT_COUNT;
+
+        skeleton.parents.resize(JOINT_COUNT);
+        skeleton.inverseBind.resize(JOINT_COUNT);
+        for (uint32_t j = 0; j < JOINT_COUNT; j++) {
+            skeleton.parents[j] = static_cast<int32_t>(j) - 1;
+            skeleton.inverseBind[j].translation = glm::vec3(0.0f, -segment * j, 0.0f);
+        }
+
+        vertices.clear();
+        for (uint32_t ring = 0; ring <= RINGS; ring++) {
+            float y = height * ring / RINGS;
+            float s = glm::clamp(y / segment - 0.5f, 0.0f, float(JOINT_COUNT - 1));
+            uint32_t j0 = std::min(static_cast<uint32_t>(s), JOINT_COUNT - 1);
+            uint32_t j1 = std::min(j0 + 1, JOINT_COUNT - 1);
+            float t = s - j0;
+
+            for (uint32_t side = 0; side < SIDES; side++) {
+                float angle = 2.0f * glm::pi<float>() * side / SIDES;
+                glm::vec3 normal(std::cos(angle), 0.0f, std::sin(angle));
+
+                SkinnedVertex vertex;
+                vertex.position = glm::vec4(normal * RADIUS * scale + glm::vec3(0.0f, y, 0.0f), 1.0f);
+                vertex.normal = glm::vec4(normal, 0.0f);
+                vertex.weights = glm::vec4(1.0f - t, t, 0.0f, 0.0f);
+                vertex.joints = glm::uvec4(j0, j1, 0, 0);
+                vertices.push_back(vertex);
+            }
+        }
+
+        indices.clear();
+        for (uint32_t ring = 0; ring < RINGS; ring++) {
+            for (uint32_t side = 0; side < SIDES; side++) {
+                uint32_t a = ring * SIDES + side;
+                uint32_t b = ring * SIDES + (side + 1) % SIDES;
+                uint32_t c = a + SIDES;
+                uint32_t d = b + SIDES;
+                uint32_t quad[] = { a, c, b, b, c, d };
+                indices.insert(indices.end(), quad, quad + 6);
+            }
+        }
+    }
+
+    void computePaletteRange(SkinningMethod method, uint32_t begin, uint32_t end) {
+        uint32_t jointCount = skeleton.jointCount();
+        uint32_t stride = paletteStride(method);
+
+        for (uint32_t c = begin; c < end; c++) {
+            const RigidTransform* local = &localPoses[c * jointCount];
+            RigidTransform* world = &worldPoses[c * jointCount];
+            glm::vec4* out = &palette[c * jointCount * stride];
+
+            for (uint32_t j = 0; j < jointCount; j++) {
+                int32_t parent = skeleton.parents[j];
+                world[j] = parent < 0 ? local[j] : world[parent] * local[j];
+                RigidTransform skinning = world[j] * skeleton.inverseBind[j];
+
+                if (method == SkinningMethod::Linear) {
+                    glm::mat4 matrix = glm::mat4_cast(skinning.rotation);
+                    matrix[3] = glm::vec4(skinning.translation, 1.0f);
+                    glm::mat3x4 rows = glm::mat3x4(glm::transpose(matrix));
+                    out[j * 3 + 0] = rows[0];
+                    out[j * 3 + 1] = rows[1];
+                    out[j * 3 + 2] = rows[2];
+                }
+                else {
+                    glm::dualquat dq(skinning.rotation, skinning.translation);
+                    out[j * 2 + 0] = glm::vec4(dq.real.x, dq.real.y, dq.real.z, dq.real.w);
+                    out[j * 2 + 1] = glm::vec4(dq.dual.x, dq.dual.y, dq.dual.z, dq.dual.w);
+                }
+            }
+        }
+    }
+
+    void skinLinear(const glm::vec4* joints, uint32_t begin, uint32_t end, SkinnedOutputVertex* out) const {
+        for (uint32_t i = begin; i < end; i++) {
+            const SkinnedVertex& v = vertices[i];
+
+            // blend the palette rows of the influencing joints
+            __m128 row0 = _mm_setzero_ps();
+            __m128 row1 = _mm_setzero_ps();
+            __m128 row2 = _mm_setzero_ps();
+            for (uint32_t k = 0; k < 4; k++) {
+                if (v.weights[k] == 0.0f) continue;
+                __m128 w = _mm_set1_ps(v.weights[k]);
+                const float* rows = &joints[v.joints[k] * 3].x;
+                row0 = _mm_add_ps(row0, _mm_mul_ps(w, _mm_loadu_ps(rows)));
+                row1 = _mm_add_ps(row1, _mm_mul_ps(w, _mm_loadu_ps(rows + 4)));
+                row2 = _mm_add_ps(row2, _mm_mul_ps(w, _mm_loadu_ps(rows + 8)));
+            }
+
+            _mm_storeu_ps(&out[i].position.x, transformRows(row0, row1, row2, _mm_loadu_ps(&v.position.x)));
+            out[i].position.w = 1.0f;
+            glm::vec4 normal;
+            _mm_storeu_ps(&normal.x, transformRows(row0, row1, row2, _mm_loadu_ps(&v.normal.x)));
+            out[i].normal = glm::vec4(glm::normalize(glm::vec3(normal)), 0.0f);
+        }
+    }
+
+    // (dot(row0, p), dot(row1, p), dot(row2, p), 0)
+    static __m128 transformRows(__m128 row0, __m128 row1, __m128 row2, __m128 p) {
+        __m128 x = _mm_mul_ps(row0, p);
+        __m128 y = _mm_mul_ps(row1, p);
+        __m128 z = _mm_mul_ps(row2, p);
+        __m128 w = _mm_setzero_ps();
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+        return _mm_add_ps(_mm_add_ps(x, y), _mm_add_ps(z, w));
+    }
+
+    void skinDualQuaternion(const glm::vec4* joints, uint32_t begin, uint32_t end, SkinnedOutputVertex* out) const {
+        for (uint32_t i = begin; i < end; i++) {
+            const SkinnedVertex& v = vertices[i];
+            const glm::vec4& pivot = joints[v.joints[0] * 2];
+
+            // blend in the hemisphere of the first joint so antipodal
+            // quaternions don't cancel out
+            __m128 real = _mm_setzero_ps();
+            __m128 dual = _mm_setzero_ps();
+            for (uint32_t k = 0; k < 4; k++) {
+                if (v.weights[k] == 0.0f) continue;
+                const glm::vec4* dq = &joints[v.joints[k] * 2];
+                float w = glm::dot(pivot, dq[0]) < 0.0f ? -v.weights[k] : v.weights[k];
+                __m128 weight = _mm_set1_ps(w);
+                real = _mm_add_ps(real, _mm_mul_ps(weight, _mm_loadu_ps(&dq[0].x)));
+                dual = _mm_add_ps(dual, _mm_mul_ps(weight, _mm_loadu_ps(&dq[1].x)));
+            }
+
+            glm::vec4 r, d;
+            _mm_storeu_ps(&r.x, real);
+            _mm_storeu_ps(&d.x, dual);
+            float inverseLength = 1.0f / glm::length(r);
+            r *= inverseLength;
+            d *= inverseLength;
+
+            glm::vec3 rv(r), dv(d);
+            glm::vec3 p(v.position), n(v.normal);
+            glm::vec3 translation = 2.0f * (r.w * dv - d.w * rv + glm::cross(rv, dv));
+            p += 2.0f * glm::cross(rv, glm::cross(rv, p) + r.w * p) + translation;
+            n += 2.0f * glm::cross(rv, glm::cross(rv, n) + r.w * n);
+
+            out[i].position = glm::vec4(p, 1.0f);
+            out[i].normal = glm::vec4(n, 0.0f);
+        }
+    }
+};
+
+// Transform hierarchy with local TRS in SoA arrays, laid out level by level
+// (depth order) with each node's children contiguous in the next level.
+// setLocal only flags the node; update() walks just the flagged subtrees one
+// level at a time, composing world matrices on the worker pool.
+//
+// Node ids returned by add() stay valid; the arrays behind them are re-laid
+// out on the next update() after nodes were added.
+class SceneGraph {
+public:
+    static constexpr uint32_t NO_PARENT = ~0u;
+    static const uint32_t PARALLEL_BATCH = 1024;
+
+    uint32_t add(uint32_t parent, const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale) {
+        uint32_t id = static_cast<uint32_t>(parentIds.size());
+        uint32_t index = static_cast<uint32_t>(ids.size());
+        parentIds.push_back(parent);
+        nodeIndex.push_back(index);
+
+        ids.push_back(id);
+        parents.push_back(parent == NO_PARENT ? NO_PARENT : nodeIndex[parent]);
+        depths.push_back(parent == NO_PARENT ? 0 : depths[nodeIndex[parent]] + 1);
+        firstChild.push_back(0);
+        childCount.push_back(0);
+        tx.push_back(0.0f); ty.push_back(0.0f); tz.push_back(0.0f);
+        rx.push_back(0.0f); ry.push_back(0.0f); rz.push_back(0.0f); rw.push_back(1.0f);
+        sx.push_back(1.0f); sy.push_back(1.0f); sz.push_back(1.0f);
+        worlds.push_back(glm::mat4(1.0f));
+        dirty.push_back(0);
+
+        layoutDirty = true;
+        setLocal(id, translation, rotation, scale);
+        return id;
+    }
+
+    void setLocal(uint32_t node, const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale) {
+        uint32_t i = nodeIndex[node];
+        tx[i] = translation.x; ty[i] = translation.y; tz[i] = translation.z;
+        rx[i] = rotation.x; ry[i] = rotation.y; rz[i] = rotation.z; rw[i] = rotation.w;
+        sx[i] = scale.x; sy[i] = scale.y; sz[i] = scale.z;
+        markDirty(i);
+    }
+
+    void setTranslation(uint32_t node, const glm::vec3& translation) {
+        uint32_t i = nodeIndex[node];
+        tx[i] = translation.x; ty[i] = translation.y; tz[i] = translation.z;
+        markDirty(i);
+    }
+
+    const glm::mat4& world(uint32_t node) const {
+        return worlds[nodeIndex[node]];
+    }
+
+    size_t size() const {
+        return ids.size();
+    }
+
+    // world matrices recomputed by the last update()
+    size_t lastUpdateCount() const {
+        return updated;
+    }
+
+    void update() {
+        if (layoutDirty) {
+            rebuildLayout();
+        }
+
+        updated = 0;
+        for (uint32_t level = 0; level < levelQueues.size(); level++) {
+            std::vector<uint32_t>& queue = levelQueues[level];
+            if (queue.empty()) continue;
+
+            composeLevel(queue);
+            updated += queue.size();
+
+            // a recomputed node invalidates all of its children
+            if (level + 1 < levelQueues.size()) {
+                std::vector<uint32_t>& next = levelQueues[level + 1];
+                for (uint32_t i : queue) {
+                    for (uint32_t child = firstChild[i]; child < firstChild[i] + childCount[i]; child++) {
+                        if (!dirty[child]) {
+                            dirty[child] = 1;
+                            next.push_back(child);
+                        }
+                    }
+                }
+            }
+
+            for (uint32_t i : queue) {
+                dirty[i] = 0;
+            }
+            queue.clear();
+        }
+    }
+
+private:
+    // by node id
+    std::vector<uint32_t> parentIds;
+    std::vector<uint32_t> nodeIndex;
+
+    // by index, depth-sorted once the layout is rebuilt
+    std::vector<uint32_t> ids, parents, depths, firstChild, childCount;
+    std::vector<float> tx, ty, tz, rx, ry, rz, rw, sx, sy, sz;
+    std::vector<glm::mat4> worlds;
+    std::vector<uint8_t> dirty;
+
+    std::vector<std::vector<uint32_t>> levelQueues;
+    bool layoutDirty = false;
+    size_t updated = 0;
+
+    void markDirty(uint32_t i) {
+        if (dirty[i] || layoutDirty) return;
+        dirty[i] = 1;
+        levelQueues[depths[i]].push_back(i);
+    }
+
+    void composeLevel(const std::vector<uint32_t>& queue) {
+        size_t count = queue.size();
+        if (count < PARALLEL_BATCH) {
+            for (uint32_t i : queue) {
+                compose(i);
+            }
+            return;
+        }
+
+        size_t tasks = (count + PARALLEL_BATCH - 1) / PARALLEL_BATCH;
+        workerPool().run(tasks, [this, &queue, count](size_t task) {
+            size_t end = std::min(count, (task + 1) * PARALLEL_BATCH);
+            for (size_t k = task * PARALLEL_BATCH; k < end; k++) {
+                compose(queue[k]);
+            }
+        });
+    }
+
+    // world = parentWorld * T * R * S; the local columns are the scaled
+    // rotation axes and the translation, so each world column is a sum of
+    // parent columns.
+    void compose(uint32_t i) {
+        glm::mat3 r = glm::mat3_cast(glm::quat(rw[i], rx[i], ry[i], rz[i]));
+        float* out = &worlds[i][0][0];
+
+        if (parents[i] == NO_PARENT) {
+            _mm_storeu_ps(out, _mm_setr_ps(r[0][0] * sx[i], r[0][1] * sx[i], r[0][2] * sx[i], 0.0f));
+            _mm_storeu_ps(out + 4, _mm_setr_ps(r[1][0] * sy[i], r[1][1] * sy[i], r[1][2] * sy[i], 0.0f));
+            _mm_storeu_ps(out + 8, _mm_setr_ps(r[2][0] * sz[i], r[2][1] * sz[i], r[2][2] * sz[i], 0.0f));
+            _mm_storeu_ps(out + 12, _mm_setr_ps(tx[i], ty[i], tz[i], 1.0f));
+            return;
+        }
+
+        const float* parent = &worlds[parents[i]][0][0];
+        __m128 p0 = _mm_loadu_ps(parent);
+        __m128 p1 = _mm_loadu_ps(parent + 4);
+        __m128 p2 = _mm_loadu_ps(parent + 8);
+        __m128 p3 = _mm_loadu_ps(parent + 12);
+
+        float scale[3] = { sx[i], sy[i], sz[i] };
+        for (int column = 0; column < 3; column++) {
+            __m128 s = _mm_set1_ps(scale[column]);
+            __m128 x = _mm_mul_ps(p0, _mm_mul_ps(_mm_set1_ps(r[column][0]), s));
+            __m128 y = _mm_mul_ps(p1, _mm_mul_ps(_mm_set1_ps(r[column][1]), s));
+            __m128 z = _mm_mul_ps(p2, _mm_mul_ps(_mm_set1_ps(r[column][2]), s));
+            _mm_storeu_ps(out + column * 4, _mm_add_ps(_mm_add_ps(x, y), z));
+        }
+
+        __m128 x = _mm_mul_ps(p0, _mm_set1_ps(tx[i]));
+        __m128 y = _mm_mul_ps(p1, _mm_set1_ps(ty[i]));
+        __m128 z = _mm_mul_ps(p2, _mm_set1_ps(tz[i]));
+        _mm_storeu_ps(out + 12, _mm_add_ps(_mm_add_ps(x, y), _mm_add_ps(z, p3)));
+    }
+
+    template<typename T>
+    static void permute(std::vector<T>& values, const std::vector<uint32_t>& order) {
+        std::vector<T> sorted(values.size());
+        for (size_t k = 0; k < order.size(); k++) {
+            sorted[k] = values[order[k]];
+        }
+        values.swap(sorted);
+    }
+
+    // Breadth-first order: roots, then the children of each level-l node in
+    // turn. Every node is recomputed on the following update.
+    void rebuildLayout() {
+        uint32_t count = static_cast<uint32_t>(ids.size());
+
+        // children per node id, compressed
+        std::vector<uint32_t> childStart(count + 1, 0);
+        for (uint32_t id = 0; id < count; id++) {
+            if (parentIds[id] != NO_PARENT) childStart[parentIds[id] + 1]++;
+        }
+        for (uint32_t id = 0; id < count; id++) {
+            childStart[id + 1] += childStart[id];
+        }
+        std::vector<uint32_t> children(childStart[count]);
+        std::vector<uint32_t> fill(childStart.begin(), childStart.end() - 1);
+        for (uint32_t id = 0; id < count; id++) {
+            if (parentIds[id] != NO_PARENT) children[fill[parentIds[id]]++] = id;
+        }
+
+        std::vector<uint32_t> orderIds;
+        orderIds.reserve(count);
+        for (uint32_t id = 0; id < count; id++) {
+            if (parentIds[id] == NO_PARENT) orderIds.push_back(id);
+        }
+        for (size_t k = 0; k < orderIds.size(); k++) {
+            uint32_t id = orderIds[k];
+            orderIds.insert(orderIds.end(), children.begin() + childStart[id], children.begin() + childStart[id + 1]);
+        }
+
+        // order holds old indices, then ids and parents are rewritten by id
+        std::vector<uint32_t> order(count);
+        for (uint32_t k = 0; k < count; k++) {
+            order[k] = nodeIndex[orderIds[k]];
+        }
+        for (auto* values : { &tx, &ty, &tz, &rx, &ry, &rz, &rw, &sx, &sy, &sz }) {
+            permute(*values, order);
+        }
+        permute(worlds, order);
+
+        ids = orderIds;
+        for (uint32_t k = 0; k < count; k++) {
+            nodeIndex[ids[k]] = k;
+        }
+
+        uint32_t levelCount = 0;
+        for (uint32_t k = 0; k < count; k++) {
+            uint32_t parentId = parentIds[ids[k]];
+            parents[k] = parentId == NO_PARENT ? NO_PARENT : nodeIndex[parentId];
+            depths[k] = parentId == NO_PARENT ? 0 : depths[parents[k]] + 1;
+            levelCount = std::max(levelCount, depths[k] + 1);
+
+            // breadth-first order keeps each node's children together
+            uint32_t id = ids[k];
+            childCount[k] = childStart[id + 1] - childStart[id];
+            firstChild[k] = childCount[k] > 0 ? nodeIndex[children[childStart[id]]] : 0;
+        }
+
+        levelQueues.resize(levelCount);
+        for (auto& queue : levelQueues) {
+            queue.clear();
+        }
+        for (uint32_t k = 0; k < count; k++) {
+            dirty[k] = 1;
+            levelQueues[depths[k]].push_back(k);
+        }
+        layoutDirty = false;
+    }
+};
+
+struct Frustum {
+    // inside when dot(plane.xyz, p) + plane.w >= 0
+    glm::vec4 planes[6];
+
+    // Planes of a 0..1 depth clip space, unnormalized.
+    static Frustum fromMatrix(const glm::mat4& viewProjection) {
+        glm::vec4 rows[4];
+        for (int i = 0; i < 4; i++) {
+            rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+        }
+
+        Frustum frustum;
+        frustum.planes[0] = rows[3] + rows[0];
+        frustum.planes[1] = rows[3] - rows[0];
+        frustum.planes[2] = rows[3] + rows[1];
+        frustum.planes[3] = rows[3] - rows[1];
+        frustum.planes[4] = rows[2];
+        frustum.planes[5] = rows[3] - rows[2];
+        return frustum;
+    }
+
+    bool intersects(const AABB& box) const {
+        for (const auto& plane : planes) {
+            // the corner furthest along the plane normal
+            glm::vec3 p(plane.x >= 0.0f ? box.max.x : box.min.x,
+                plane.y >= 0.0f ? box.max.y : box.min.y,
+                plane.z >= 0.0f ? box.max.z : box.min.z);
+            if (glm::dot(glm::vec3(plane), p) + plane.w < 0.0f) return false;
+        }
+        return true;
+    }
+};
+
+struct Sphere {
+    glm::vec3 center;
+    float radius;
+
+    bool intersects(const AABB& box) const {
+        glm::vec3 closest = glm::clamp(center, box.min, box.max);
+        glm::vec3 offset = closest - center;
+        return glm::dot(offset, offset) <= radius * radius;
+    }
+};
+
+struct Ray {
+    glm::vec3 origin;
+    glm::vec3 direction;
+    float maxDistance = FLT_MAX;
+
+    // Slab test; the entry distance is written to distance. Axes the ray is
+    // parallel to are checked against the slab directly, since 1/0 would
+    // turn an origin on the slab plane into 0*inf = NaN.
+    bool intersects(const AABB& box, float& distance) const {
+        float enter = 0.0f;
+        float exit = maxDistance;
+        for (int axis = 0; axis < 3; axis++) {
+            if (direction[axis] == 0.0f) {
+                if (origin[axis] < box.min[axis] || origin[axis] > box.max[axis]) return false;
+                continue;
+            }
+            float inverse = 1.0f / direction[axis];
+            float t0 = (box.min[axis] - origin[axis]) * inverse;
+            float t1 = (box.max[axis] - origin[axis]) * inverse;
+            enter = std::max(enter, std::min(t0, t1));
+            exit = std::min(exit, std::max(t0, t1));
+        }
+        distance = enter;
+        return enter <= exit;
+    }
+};
+
+struct RayHit {
+    uint32_t object;
+    float distance;
+};
+
+// Narrow phase for ray queries: nearest hit against an indexed triangle mesh.
+inline bool intersectRayTriangles(const Ray& ray, const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices, float& distance) {
+    bool hit = false;
+    distance = ray.maxDistance;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        glm::vec2 barycentric;
+        float t;
+        if (glm::intersectRayTriangle(ray.origin, ray.direction, positions[indices[i]], positions[indices[i + 1]], positions[indices[i + 2]], barycentric, t)
+            && t >= 0.0f && t < distance) {
+            distance = t;
+            hit = true;
+        }
+    }
+    return hit;
+}
+
+// Loose octree over object bounds. An object lives in the deepest cell whose
+// size still covers its largest extent, picked by its center; cell bounds are
+// loosened to twice their size so that is always enough. Insert, move and
+// remove walk at most maxDepth levels (a move inside the same cell only
+// updates the bounds), and queries only descend into non-empty cells that
+// touch the query volume.
+//
+// Queries are const and keep no state, so any number of threads may run them
+// at once as long as nothing inserts, moves or removes meanwhile.
+class LooseOctree {
+public:
+    static constexpr uint32_t NO_OBJECT = ~0u;
+    static const uint32_t MAX_DEPTH = 10;
+    static const uint32_t QUERIES_PER_TASK = 4;
+
+    LooseOctree(const glm::vec3& center = glm::vec3(0.0f), float halfSize = 1024.0f, uint32_t maxDepth = 8)
+        : maxDepth(std::min(maxDepth, MAX_DEPTH)) {
+        nodes.push_back(Node(center, halfSize, -1));
+    }
+
+    uint32_t insert(const AABB& bounds) {
+        uint32_t object;
+        if (freeObjects.empty()) {
+            object = static_cast<uint32_t>(objects.size());
+            objects.push_back(Object());
+        }
+        else {
+            object = freeObjects.back();
+            freeObjects.pop_back();
+        }
+        objects[object].bounds = bounds;
+        link(object, findNode(bounds));
+        liveObjects++;
+        return object;
+    }
+
+    void move(uint32_t object, const AABB& bounds) {
+        Object& o = objects[object];
+        o.bounds = bounds;
+        int32_t node = findNode(bounds);
+        if (node != o.node) {
+            unlink(object);
+            link(object, node);
+        }
+    }
+
+    void remove(uint32_t object) {
+        unlink(object);
+        objects[object].node = -1;
+        freeObjects.push_back(object);
+        liveObjects--;
+    }
+
+    const AABB& bounds(uint32_t object) const {
+        return objects[object].bounds;
+    }
+
+    size_t size() const {
+        return liveObjects;
+    }
+
+    // Appends the objects touching the volume to results.
+    void query(const Frustum& frustum, std::vector<uint32_t>& results) const {
+        visit(frustum, [&](uint32_t object) { results.push_back(object); });
+    }
+
+    void query(const Sphere& sphere, std::vector<uint32_t>& results) const {
+        visit(sphere, [&](uint32_t object) { results.push_back(object); });
+    }
+
+    // Hits on object bounds, nearest first; run a narrow phase such as
+    // intersectRayTriangles on them for exact picking.
+    void query(const Ray& ray, std::vector<RayHit>& hits) const {
+        size_t first = hits.size();
+        int32_t stack[STACK_SIZE];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+
+        while (stackSize > 0) {
+            int32_t index = stack[--stackSize];
+            const Node& node = nodes[index];
+            float distance;
+            if (node.subtreeCount == 0 || (index != 0 && !ray.intersects(node.looseBounds(), distance))) continue;
+
+            for (uint32_t object : node.objects) {
+                if (ray.intersects(objects[object].bounds, distance)) {
+                    hits.push_back({ object, distance });
+                }
+            }
+            pushChildren(node, stack, stackSize);
+        }
+
+        std::sort(hits.begin() + first, hits.end(), [](const RayHit& a, const RayHit& b) { return a.distance < b.distance; });
+    }
+
+    // Batched queries, spread over the worker pool; results[i] is cleared and
+    // filled for queries[i].
+    template<typename Query, typename Result>
+    void queryBatch(const Query* queries, size_t count, std::vector<Result>* results) const {
+        size_t tasks = (count + QUERIES_PER_TASK - 1) / QUERIES_PER_TASK;
+        workerPool().run(tasks, [this, queries, count, results](size_t task) {
+            size_t end = std::min(count, (task + 1) * QUERIES_PER_TASK);
+            for (size_t i = task * QUERIES_PER_TASK; i < end; i++) {
+                results[i].clear();
+                query(queries[i], results[i]);
+            }
+        });
+    }
+
+private:
+    static const int STACK_SIZE = 8 * MAX_DEPTH + 1;
+
+    struct Node {
+        glm::vec3 center;
+        float halfSize;
+        int32_t parent;
+        int32_t children[8];
+        // objects in this node and all of its descendants
+        uint32_t subtreeCount = 0;
+        std::vector<uint32_t> objects;
+
+        Node(const glm::vec3& center, float halfSize, int32_t parent) : center(center), halfSize(halfSize), parent(parent) {
+            std::fill(children, children + 8, -1);
+        }
+
+        AABB looseBounds() const {
+            glm::vec3 extent(halfSize * 2.0f);
+            return { center - extent, center + extent };
+        }
+    };
+
+    struct Object {
+        AABB bounds;
+        int32_t node = -1;
+        // position in the node's object list
+        uint32_t slot = 0;
+    };
+
+    uint32_t maxDepth;
+    std::vector<Node> nodes;
+    std::vector<Object> objects;
+    std::vector<uint32_t> freeObjects;
+    size_t liveObjects = 0;
+
+    int32_t findNode(const AABB& bounds) {
+        glm::vec3 center = (bounds.min + bounds.max) * 0.5f;
+        glm::vec3 size = bounds.max - bounds.min;
+        float extent = std::max(std::max(size.x, size.y), size.z);
+
+        // objects centered outside the root cell stay in it; the root is
+        // never culled
+        glm::vec3 fromRoot = glm::abs(center - nodes[0].center);
+        if (std::max(std::max(fromRoot.x, fromRoot.y), fromRoot.z) > nodes[0].halfSize) {
+            return 0;
+        }
+
+        int32_t index = 0;
+        for (uint32_t depth = 0; depth < maxDepth; depth++) {
+            // the child's loose bounds reach halfSize past its own half size,
+            // so the object fits as long as its extent is within that
+            float childHalf = nodes[index].halfSize * 0.5f;
+            if (extent > childHalf) break;
+
+            glm::vec3 nodeCenter = nodes[index].center;
+            int octant = (center.x >= nodeCenter.x ? 1 : 0) | (center.y >= nodeCenter.y ? 2 : 0) | (center.z >= nodeCenter.z ? 4 : 0);
+            if (nodes[index].children[octant] < 0) {
+                glm::vec3 offset((octant & 1) ? childHalf : -childHalf, (octant & 2) ? childHalf : -childHalf, (octant & 4) ? childHalf : -childHalf);
+                int32_t child = static_cast<int32_t>(nodes.size());
+                nodes.push_back(Node(nodeCenter + offset, childHalf, index));
+                nodes[index].children[octant] = child;
+            }
+            index = nodes[index].children[octant];
+        }
+        return index;
+    }
+
+    void link(uint32_t object, int32_t node) {
+        objects[object].node = node;
+        objects[object].slot = static_cast<uint32_t>(nodes[node].objects.size());
+        nodes[node].objects.push_back(object);
+        for (int32_t n = node; n >= 0; n = nodes[n].parent) {
+            nodes[n].subtreeCount++;
+        }
+    }
+
+    void unlink(uint32_t object) {
+        Object& o = objects[object];
+        auto& list = nodes[o.node].objects;
+        uint32_t last = list.back();
+        list[o.slot] = last;
+        objects[last].slot = o.slot;
+        list.pop_back();
+        for (int32_t n = o.node; n >= 0; n = nodes[n].parent) {
+            nodes[n].subtreeCount--;
+        }
+    }
+
+    static void pushChildren(const Node& node, int32_t* stack, int& stackSize) {
+        for (int32_t child : node.children) {
+            if (child >= 0) stack[stackSize++] = child;
+        }
+    }
+
+    template<typename Volume, typename Callback>
+    void visit(const Volume& volume, Callback callback) const {
+        int32_t stack[STACK_SIZE];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+
+        while (stackSize > 0) {
+            int32_t index = stack[--stackSize];
+            const Node& node = nodes[index];
+            if (node.subtreeCount == 0 || (index != 0 && !volume.intersects(node.looseBounds()))) continue;
+
+            for (uint32_t object : node.objects) {
+                if (volume.intersects(objects[object].bounds)) {
+                    callback(object);
+                }
+            }
+            pushChildren(node, stack, stackSize);
+        }
+    }
+};
+
+enum MaterialFeature : uint32_t {
+    MATERIAL_TINT = 1 << 0,
+    MATERIAL_STRIPES = 1 << 1,
+    MATERIAL_VIGNETTE = 1 << 2,
+    MATERIAL_NOISE = 1 << 3,
+    MATERIAL_GRADE = 1 << 4
+};
+
+struct Material {
+    uint32_t features;
+    glm::vec4 tint;
+};
+
+// std140 layout of MaterialParams in material.frag.
+struct MaterialParams {
+    glm::vec4 tint;
+    uint32_t features;
+    uint32_t padding[3];
+};
+
+// Specialization constants of material.frag, in constant_id order.
+struct MaterialSpecialization {
+    uint32_t features;
+    VkBool32 uber;
+    float viewportWidth;
+    float viewportHeight;
+};
+
+// Shader variant keys in first-requested order. Materials with the same
+// feature bits get the same slot, so each bitmask is compiled only once.
+class ShaderVariantSet {
+public:
+    // key of the variant that branches on the material's bits at runtime
+    static constexpr uint32_t UBER_VARIANT = 1u << 31;
+
+    uint32_t request(uint32_t key) {
+        auto it = std::find(variantKeys.begin(), variantKeys.end(), key);
+        if (it != variantKeys.end()) {
+            return static_cast<uint32_t>(it - variantKeys.begin());
+        }
+        variantKeys.push_back(key);
+        return static_cast<uint32_t>(variantKeys.size() - 1);
+    }
+
+    const std::vector<uint32_t>& keys() const {
+        return variantKeys;
+    }
+
+    size_t size() const {
+        return variantKeys.size();
+    }
+
+private:
+    std::vector<uint32_t> variantKeys;
+};
+
+// Read-only mapping of a whole file. Nothing is read up front; pages come
+// in from the OS page cache (or disk) the first time they're touched.
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        close();
+    }
+
+    bool open(const std::string& path) {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+            close();
+            return false;
+        }
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+        if (view == nullptr) {
+            close();
+            return false;
+        }
+        bytes = static_cast<const uint8_t*>(view);
+        length = static_cast<size_t>(fileSize.QuadPart);
+#else
+        int descriptor = ::open(path.c_str(), O_RDONLY);
+        if (descriptor < 0) return false;
+        struct stat status;
+        if (fstat(descriptor, &status) != 0 || status.st_size == 0) {
+            ::close(descriptor);
+            return false;
+        }
+        // the mapping keeps the file referenced after the descriptor closes
+        void* view = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+        ::close(descriptor);
+        if (view == MAP_FAILED) return false;
+        bytes = static_cast<const uint8_t*>(view);
+        length = static_cast<size_t>(status.st_size);
+#endif
+        return true;
+    }
+
+    void close() {
+#ifdef _WIN32
+        if (bytes) UnmapViewOfFile(bytes);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        mapping = nullptr;
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (bytes) munmap(const_cast<uint8_t*>(bytes), length);
+#endif
+        bytes = nullptr;
+        length = 0;
+    }
+
+    const uint8_t* data() const {
+        return bytes;
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+private:
+    const uint8_t* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+};
+
+// An array stored elsewhere in the same archive, addressed relative to the
+// field itself so the data works wherever it's mapped.
+template<typename T>
+struct RelativeArray {
+    int64_t offset;
+    uint64_t count;
+
+    const T* data() const {
+        return reinterpret_cast<const T*>(reinterpret_cast<const uint8_t*>(this) + offset);
+    }
+
+    const T& operator[](size_t i) const {
+        return data()[i];
+    }
+
+    size_t size() const {
+        return static_cast<size_t>(count);
+    }
+
+    const T* begin() const {
+        return data();
+    }
+
+    const T* end() const {
+        return data() + count;
+    }
+};
+
+// strings keep their terminator, so data() is a C string
+typedef RelativeArray<char> RelativeString;
+
+const uint32_t SCENE_ARCHIVE_MAGIC = 0x414e4353; // "SCNA"
+const uint32_t SCENE_ARCHIVE_BYTE_ORDER = 0x01020304;
+// Readers reject other major versions; a newer minor version only appends
+// header fields, which older readers skip through headerSize.
+const uint16_t SCENE_ARCHIVE_MAJOR = 1;
+const uint16_t SCENE_ARCHIVE_MINOR = 0;
+const uint32_t NO_ARCHIVE_REFERENCE = ~0u;
+
+// Nodes are stored breadth first: parents come before their children, and
+// each node's children are contiguous.
+struct SceneArchiveNode {
+    uint32_t parent;
+    uint32_t firstChild;
+    uint32_t childCount;
+    uint32_t mesh;
+    uint32_t material;
+    uint32_t padding[3];
+};
+
+struct SceneArchiveMesh {
+    RelativeString path;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+};
+
+struct SceneArchiveMaterial {
+    RelativeString name;
+    glm::vec4 tint;
+    uint32_t features;
+    uint32_t padding[3];
+};
+
+// Local transforms are SoA TRS, one entry per node in node order, with
+// rotations as x, y, z, w.
+struct SceneArchiveHeader {
+    uint32_t magic;
+    uint16_t major;
+    uint16_t minor;
+    uint32_t byteOrder;
+    uint32_t headerSize;
+    uint64_t fileSize;
+    RelativeArray<SceneArchiveNode> nodes;
+    RelativeArray<glm::vec3> translations;
+    RelativeArray<glm::vec4> rotations;
+    RelativeArray<glm::vec3> scales;
+    RelativeArray<SceneArchiveMesh> meshes;
+    RelativeArray<SceneArchiveMaterial> materials;
+};
+
+// Collects a scene and lays it out as an archive: one buffer, header first,
+// then each array 16-byte aligned, then the strings.
+class SceneArchiveWriter {
+public:
+    uint32_t addMesh(const std::string& path, uint32_t vertexCount, uint32_t indexCount) {
+        meshes.push_back({ path, vertexCount, indexCount });
+        return static_cast<uint32_t>(meshes.size() - 1);
+    }
+
+    uint32_t addMaterial(const std::string& name, const Material& material) {
+        materials.push_back({ name, material });
+        return static_cast<uint32_t>(materials.size() - 1);
+    }
+
+    // parent is an id returned earlier, or NO_ARCHIVE_REFERENCE for a root
+    uint32_t addNode(uint32_t parent, const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale,
+        uint32_t mesh = NO_ARCHIVE_REFERENCE, uint32_t material = NO_ARCHIVE_REFERENCE) {
+        nodes.push_back({ parent, translation, glm::vec4(rotation.x, rotation.y, rotation.z, rotation.w), scale, mesh, material });
+        return static_cast<uint32_t>(nodes.size() - 1);
+    }
+
+    // The archive's index of each added node after breadth-first ordering.
+    const std::vector<uint32_t>& archiveIndices() const {
+        return archiveIndex;
+    }
+
+    bool write(const std::string& path) {
+        std::vector<uint8_t> buffer;
+        build(buffer);
+        std::ofstream file(path, std::ios::binary);
+        if (!file.is_open()) return false;
+        file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+        return file.good();
+    }
+
+    void build(std::vector<uint8_t>& buffer) {
+        size_t count = nodes.size();
+
+        // breadth-first order keeps every node's children together
+        std::vector<std::vector<uint32_t>> children(count);
+        std::vector<uint32_t> order;
+        order.reserve(count);
+        for (uint32_t i = 0; i < count; i++) {
+            if (nodes[i].parent == NO_ARCHIVE_REFERENCE) {
+                order.push_back(i);
+            }
+            else {
+                children[nodes[i].parent].push_back(i);
+            }
+        }
+        for (size_t next = 0; next < order.size(); next++) {
+            order.insert(order.end(), children[order[next]].begin(), children[order[next]].end());
+        }
+        archiveIndex.assign(count, 0);
+        for (uint32_t i = 0; i < order.size(); i++) {
+            archiveIndex[order[i]] = i;
+        }
+
+        buffer.assign(sizeof(SceneArchiveHeader), 0);
+        size_t nodesAt = append(buffer, count * sizeof(SceneArchiveNode));
+        size_t translationsAt = append(buffer, count * sizeof(glm::vec3));
+        size_t rotationsAt = append(buffer, count * sizeof(glm::vec4));
+        size_t scalesAt = append(buffer, count * sizeof(glm::vec3));
+        size_t meshesAt = append(buffer, meshes.size() * sizeof(SceneArchiveMesh));
+        size_t materialsAt = append(buffer, materials.size() * sizeof(SceneArchiveMaterial));
+
+        for (uint32_t i = 0; i < order.size(); i++) {
+            const Node& source = nodes[order[i]];
+            const auto& kids = children[order[i]];
+            SceneArchiveNode node = {};
+            node.parent = source.parent == NO_ARCHIVE_REFERENCE ? NO_ARCHIVE_REFERENCE : archiveIndex[source.parent];
+            node.firstChild = kids.empty() ? 0 : archiveIndex[kids[0]];
+            node.childCount = static_cast<uint32_t>(kids.size());
+            node.mesh = source.mesh;
+            node.material = source.material;
+            store(buffer, nodesAt + i * sizeof(SceneArchiveNode), node);
+            store(buffer, translationsAt + i * sizeof(glm::vec3), source.translation);
+            store(buffer, rotationsAt + i * sizeof(glm::vec4), source.rotation);
+            store(buffer, scalesAt + i * sizeof(glm::vec3), source.scale);
+        }
+
+        for (size_t i = 0; i < meshes.size(); i++) {
+            SceneArchiveMesh mesh = {};
+            size_t at = meshesAt + i * sizeof(SceneArchiveMesh);
+            mesh.path = appendString(buffer, at + offsetof(SceneArchiveMesh, path), meshes[i].path);
+            mesh.vertexCount = meshes[i].vertexCount;
+            mesh.indexCount = meshes[i].indexCount;
+            store(buffer, at, mesh);
+        }
+
+        for (size_t i = 0; i < materials.size(); i++) {
+            SceneArchiveMaterial material = {};
+            size_t at = materialsAt + i * sizeof(SceneArchiveMaterial);
+            material.name = appendString(buffer, at + offsetof(SceneArchiveMaterial, name), materials[i].name);
+            material.tint = materials[i].material.tint;
+            material.features = materials[i].material.features;
+            store(buffer, at, material);
+        }
+
+        SceneArchiveHeader header = {};
+        header.magic = SCENE_ARCHIVE_MAGIC;
+        header.major = SCENE_ARCHIVE_MAJOR;
+        header.minor = SCENE_ARCHIVE_MINOR;
+        header.byteOrder = SCENE_ARCHIVE_BYTE_ORDER;
+        header.headerSize = sizeof(SceneArchiveHeader);
+        header.fileSize = buffer.size();
+        header.nodes = relative<SceneArchiveNode>(offsetof(SceneArchiveHeader, nodes), nodesAt, count);
+        header.translations = relative<glm::vec3>(offsetof(SceneArchiveHeader, translations), translationsAt, count);
+        header.rotations = relative<glm::vec4>(offsetof(SceneArchiveHeader, rotations), rotationsAt, count);
+        header.scales = relative<glm::vec3>(offsetof(SceneArchiveHeader, scales), scalesAt, count);
+        header.meshes = relative<SceneArchiveMesh>(offsetof(SceneArchiveHeader, meshes), meshesAt, meshes.size());
+        header.materials = relative<SceneArchiveMaterial>(offsetof(SceneArchiveHeader, materials), materialsAt, materials.size());
+        store(buffer, 0, header);
+    }
+
+private:
+    struct Node {
+        uint32_t parent;
+        glm::vec3 translation;
+        glm::vec4 rotation;
+        glm::vec3 scale;
+        uint32_t mesh;
+        uint32_t material;
+    };
+
+    struct Mesh {
+        std::string path;
+        uint32_t vertexCount;
+        uint32_t indexCount;
+    };
+
+    struct NamedMaterial {
+        std::string name;
+        Material material;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<Mesh> meshes;
+    std::vector<NamedMaterial> materials;
+    std::vector<uint32_t> archiveIndex;
+
+    static size_t append(std::vector<uint8_t>& buffer, size_t bytes) {
+        size_t at = (buffer.size() + 15) & ~size_t(15);
+        buffer.resize(at + bytes, 0);
+        return at;
+    }
+
+    template<typename T>
+    static void store(std::vector<uint8_t>& buffer, size_t at, const T& value) {
+        memcpy(&buffer[at], &value, sizeof(T));
+    }
+
+    template<typename T>
+    static RelativeArray<T> relative(size_t fieldAt, size_t dataAt, size_t count) {
+        RelativeArray<T> array;
+        array.offset = int64_t(dataAt) - int64_t(fieldAt);
+        array.count = count;
+        return array;
+    }
+
+    static RelativeString appendString(std::vector<uint8_t>& buffer, size_t fieldAt, const std::string& text) {
+        size_t at = buffer.size();
+        buffer.insert(buffer.end(), text.begin(), text.end());
+        buffer.push_back(0);
+        return relative<char>(fieldAt, at, text.size() + 1);
+    }
+};
+
+// A scene archive used in place: open() maps the file and checks every
+// offset, count and reference once, after which the accessors read straight
+// from the mapping. Nothing is parsed or copied, so a cold load costs the
+// page-ins of whatever is actually read.
+class SceneArchive {
+public:
+    void open(const std::string& path) {
+        archive = nullptr;
+        if (!file.open(path)) {
+            throw std::runtime_error("failed to map scene archive " + path + "!");
+        }
+        validate();
+        archive = reinterpret_cast<const SceneArchiveHeader*>(file.data());
+    }
+
+    const SceneArchiveHeader& header() const {
+        return *archive;
+    }
+
+    size_t nodeCount() const {
+        return archive->nodes.size();
+    }
+
+    const SceneArchiveNode& node(size_t i) const {
+        return archive->nodes[i];
+    }
+
+    glm::vec3 translation(size_t i) const {
+        return archive->translations[i];
+    }
+
+    glm::quat rotation(size_t i) const {
+        const glm::vec4& r = archive->rotations[i];
+        return glm::quat(r.w, r.x, r.y, r.z);
+    }
+
+    glm::vec3 scale(size_t i) const {
+        return archive->scales[i];
+    }
+
+    const SceneArchiveMesh& mesh(size_t i) const {
+        return archive->meshes[i];
+    }
+
+    const SceneArchiveMaterial& material(size_t i) const {
+        return archive->materials[i];
+    }
+
+private:
+    MappedFile file;
+    const SceneArchiveHeader* archive = nullptr;
+
+    // the array lies inside the file and is aligned for its element type
+    template<typename T>
+    bool inBounds(const RelativeArray<T>& array) const {
+        const uint8_t* begin = file.data();
+        const uint8_t* field = reinterpret_cast<const uint8_t*>(&array);
+        int64_t start = int64_t(field - begin) + array.offset;
+        if (start < 0 || uint64_t(start) > file.size()) return false;
+        if (array.count > (file.size() - uint64_t(start)) / sizeof(T)) return false;
+        return uint64_t(start) % alignof(T) == 0;
+    }
+
+    bool validString(const RelativeString& text) const {
+        return inBounds(text) && text.count > 0 && text[text.size() - 1] == 0;
+    }
+
+    void validate() const {
+        if (file.size() < 16) {
+            throw std::runtime_error("scene archive is truncated!");
+        }
+        const SceneArchiveHeader* header = reinterpret_cast<const SceneArchiveHeader*>(file.data());
+        if (header->magic != SCENE_ARCHIVE_MAGIC) {
+            throw std::runtime_error("not a scene archive!");
+        }
+        if (header->byteOrder != SCENE_ARCHIVE_BYTE_ORDER) {
+            throw std::runtime_error("scene archive has the wrong byte order!");
+        }
+        if (header->major != SCENE_ARCHIVE_MAJOR) {
+            throw std::runtime_error("unsupported scene archive version " + std::to_string(header->major) + "." + std::to_string(header->minor) + "!");
+        }
+        if (header->headerSize < sizeof(SceneArchiveHeader) || file.size() < header->headerSize || header->fileSize != file.size()) {
+            throw std::runtime_error("scene archive is truncated!");
+        }
+
+        size_t count = header->nodes.size();
+        if (!inBounds(header->nodes) || !inBounds(header->translations) || !inBounds(header->rotations) || !inBounds(header->scales) ||
+            !inBounds(header->meshes) || !inBounds(header->materials) ||
+            header->translations.size() != count || header->rotations.size() != count || header->scales.size() != count) {
+            throw std::runtime_error("scene archive arrays are out of bounds!");
+        }
+
+        for (const auto& mesh : header->meshes) {
+            if (!validString(mesh.path)) {
+                throw std::runtime_error("scene archive mesh path is out of bounds!");
+            }
+        }
+        for (const auto& material : header->materials) {
+            if (!validString(material.name)) {
+                throw std::runtime_error("scene archive material name is out of bounds!");
+            }
+        }
+
+        const SceneArchiveNode* nodes = header->nodes.data();
+        for (size_t i = 0; i < count; i++) {
+            const SceneArchiveNode& node = nodes[i];
+            bool parentValid = node.parent == NO_ARCHIVE_REFERENCE || node.parent < i;
+            bool childrenValid = node.childCount == 0 || (node.firstChild > i && node.firstChild <= count && node.childCount <= count - node.firstChild);
+            bool meshValid = node.mesh == NO_ARCHIVE_REFERENCE || node.mesh < header->meshes.size();
+            bool materialValid = node.material == NO_ARCHIVE_REFERENCE || node.material < header->materials.size();
+            if (!parentValid || !childrenValid || !meshValid || !materialValid) {
+                throw std::runtime_error("scene archive node " + std::to_string(i) + " is invalid!");
+            }
+            for (uint32_t c = 0; c < node.childCount; c++) {
+                if (nodes[node.firstChild + c].parent != i) {
+                    throw std::runtime_error("scene archive node " + std::to_string(i) + " is invalid!");
+                }
+            }
+        }
+    }
+};
+
+// Sleeps until the deadline; the OS sleep is coarse, so the last stretch
+// yields instead.
+inline void sleepPrecise(double milliseconds) {
+    if (milliseconds <= 0.0) return;
+    auto deadline = std::chrono::high_resolution_clock::now() + std::chrono::duration<double, std::milli>(milliseconds);
+    if (milliseconds > 2.0) {
+        std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(milliseconds - 2.0));
+    }
+    while (std::chrono::high_resolution_clock::now() < deadline) {
+        std::this_thread::yield();
+    }
+}
+
+// Just-in-time frame pacing. Rather than sampling input and then blocking on
+// the frame fence, the main loop sleeps for as long as the fence is expected
+// to stay unsignaled and samples input afterwards. The expectation is the
+// smallest idle time (sleep plus whatever wait was left) over the last few
+// frames, less a safety margin; a frame that finds its fence already
+// signaled counts as a shorter idle time, so the pacer backs off instead of
+// starving the GPU.
+class FramePacer {
+public:
+    static const int HISTORY = 16;
+
+    bool enabled = true;
+    double marginMilliseconds = 1.0;
+
+    double plannedSleep() const {
+        if (!enabled) return 0.0;
+        return std::max(0.0, predictedIdle - marginMilliseconds);
+    }
+
+    void recordIdle(double sleptMilliseconds, double waitedMilliseconds) {
+        // without any wait left the fence signaled at some unknown point
+        // during the sleep, so only part of it was really idle
+        const double noWait = 0.05;
+        double idle = waitedMilliseconds > noWait ? sleptMilliseconds + waitedMilliseconds : sleptMilliseconds * 0.75;
+        history[historyIndex] = idle;
+        historyIndex = (historyIndex + 1) % HISTORY;
+        historyCount = std::min(historyCount + 1, HISTORY);
+
+        predictedIdle = idle;
+        for (int i = 0; i < historyCount; i++) {
+            predictedIdle = std::min(predictedIdle, history[i]);
+        }
+    }
+
+    void recordLatency(double milliseconds) {
+        latencyTotal += milliseconds;
+        latencyMax = std::max(latencyMax, milliseconds);
+        latencySamples++;
+    }
+
+    double averageLatency() const {
+        return latencySamples > 0 ? latencyTotal / latencySamples : 0.0;
+    }
+
+    double maxLatency() const {
+        return latencyMax;
+    }
+
+    void resetLatency() {
+        latencyTotal = 0.0;
+        latencyMax = 0.0;
+        latencySamples = 0;
+    }
+
+private:
+    double history[HISTORY] = {};
+    int historyIndex = 0;
+    int historyCount = 0;
+    double predictedIdle = 0.0;
+
+    double latencyTotal = 0.0;
+    double latencyMax = 0.0;
+    uint64_t latencySamples = 0;
+};
+
+// Histogram with four buckets per power of two from 2^-8 to 2^36, plus a
+// bucket for zero. Buckets include their upper bound, as Prometheus' le
+// does; a percentile read from it is a bucket's upper bound, so within 25%
+// of the true value. Fixed size, so recording never allocates.
+class TelemetryHistogram {
+public:
+    static const int SUB_BUCKETS = 4;
+    static const int MIN_EXPONENT = -8;
+    static const int OCTAVES = 44;
+    static const int BUCKETS = 1 + OCTAVES * SUB_BUCKETS;
+
+    void add(double value) {
+        counts[bucket(value)]++;
+        count++;
+        sum += value;
+        max = std::max(max, value);
+    }
+
+    void merge(const TelemetryHistogram& other) {
+        for (int i = 0; i < BUCKETS; i++) {
+            counts[i] += other.counts[i];
+        }
+        count += other.count;
+        sum += other.sum;
+        max = std::max(max, other.max);
+    }
+
+    void clear() {
+        *this = TelemetryHistogram();
+    }
+
+    // Upper bound of the bucket holding the sample at fraction p (0..1).
+    double percentile(double p) const {
+        if (count == 0) return 0.0;
+        uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(p * count)));
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; i++) {
+            seen += counts[i];
+            if (seen >= rank) return std::min(upperBound(i), max);
+        }
+        return max;
+    }
+
+    static double upperBound(int bucket) {
+        if (bucket == 0) return 0.0;
+        int octave = (bucket - 1) / SUB_BUCKETS + MIN_EXPONENT;
+        int sub = (bucket - 1) % SUB_BUCKETS;
+        return std::ldexp(1.0 + double(sub + 1) / SUB_BUCKETS, octave);
+    }
+
+    // values below 2^MIN_EXPONENT share the first octave's first bucket and
+    // values past the last octave its last one
+    static int bucket(double value) {
+        if (!(value > 0.0)) return 0;
+        int exponent;
+        double mantissa = std::frexp(value, &exponent);
+        int octave = exponent - 1 - MIN_EXPONENT;
+        if (octave < 0) return 1;
+        if (octave >= OCTAVES) return BUCKETS - 1;
+        int sub = std::min(SUB_BUCKETS - 1, static_cast<int>((mantissa * 2.0 - 1.0) * SUB_BUCKETS));
+        int index = 1 + octave * SUB_BUCKETS + sub;
+        // a value on a boundary belongs to the bucket below it
+        return index > 1 && value == upperBound(index - 1) ? index - 1 : index;
+    }
+
+    uint64_t counts[BUCKETS] = {};
+    uint64_t count = 0;
+    double sum = 0.0;
+    double max = 0.0;
+};
+
+// Always-on per-frame counters. The render thread adds to the current
+// frame's values and closes the frame with endFrame(), which folds them into
+// per-counter histograms. Histograms are kept per TELEMETRY_EXPORT_SECONDS
+// slot, and each JSON-lines export covers the last TELEMETRY_WINDOW_SLOTS of
+// them. Prometheus exports instead cover everything since start, because its
+// histogram series are counters and must never go down. An export hands a
+// merged snapshot to a writer thread, which appends it to a JSON-lines file
+// or rewrites a Prometheus text file. If the writer is still
+// busy with the previous snapshot, that export is skipped, so a slow disk
+// never holds up a frame.
+class Telemetry {
+public:
+    enum Format { JsonLines, Prometheus };
+
+    ~Telemetry() {
+        stop();
+    }
+
+    void start(const std::string& path, Format format) {
+        this->path = path;
+        this->format = format;
+        running = true;
+        slotStart = std::chrono::high_resolution_clock::now();
+        writer = std::thread([this]() { writeLoop(); });
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!running) return;
+            running = false;
+        }
+        condition.notify_one();
+        writer.join();
+    }
+
+    void add(TelemetryCounter counter, double value) {
+        frame[static_cast<size_t>(counter)] += value;
+    }
+
+    void endFrame() {
+        Slot& slot = slots[currentSlot];
+        for (size_t c = 0; c < COUNTERS; c++) {
+            slot.histograms[c].add(frame[c]);
+            frame[c] = 0.0;
+        }
+        slot.frames++;
+
+        auto now = std::chrono::high_resolution_clock::now();
+        if (!running || now - slotStart < std::chrono::duration<double>(TELEMETRY_EXPORT_SECONDS)) return;
+        slotStart = now;
+        merge(total, slots[currentSlot]);
+
+        std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+        if (lock.owns_lock() && !snapshotPending) {
+            if (format == Prometheus) {
+                snapshot = total;
+            }
+            else {
+                snapshot = Slot();
+                for (const Slot& s : slots) {
+                    merge(snapshot, s);
+                }
+            }
+            snapshotPending = true;
+            lock.unlock();
+            condition.notify_one();
+        }
+        else {
+            skippedExports++;
+        }
+
+        currentSlot = (currentSlot + 1) % TELEMETRY_WINDOW_SLOTS;
+        slots[currentSlot] = Slot();
+    }
+
+    uint64_t skipped() const {
+        return skippedExports;
+    }
+
+private:
+    static const size_t COUNTERS = static_cast<size_t>(TelemetryCounter::Count);
+
+    struct Slot {
+        TelemetryHistogram histograms[COUNTERS];
+        uint64_t frames = 0;
+    };
+
+    double frame[COUNTERS] = {};
+    Slot slots[TELEMETRY_WINDOW_SLOTS];
+    size_t currentSlot = 0;
+    Slot total;
+    std::chrono::high_resolution_clock::time_point slotStart;
+
+    std::string path;
+    Format format = JsonLines;
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable condition;
+    Slot snapshot;
+    bool snapshotPending = false;
+    bool running = false;
+    std::atomic<uint64_t> skippedExports{ 0 };
+
+    static void merge(Slot& into, const Slot& from) {
+        into.frames += from.frames;
+        for (size_t c = 0; c < COUNTERS; c++) {
+            into.histograms[c].merge(from.histograms[c]);
+        }
+    }
+
+    static const char* name(size_t counter) {
+        static const char* names[COUNTERS] = {
+            "frame_time_ms", "fence_wait_ms", "acquire_ms", "draws", "triangles", "binds",
+            "descriptor_allocations", "upload_bytes", "pipeline_compiles", "occluded_draws"
+        };
+        return names[counter];
+    }
+
+    void writeLoop() {
+        PROFILE_THREAD("telemetry writer");
+        std::unique_ptr<Slot> local(new Slot());
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [this]() { return snapshotPending || !running; });
+                if (!snapshotPending) return;
+                *local = snapshot;
+                snapshotPending = false;
+            }
+            PROFILE_ZONE("telemetry export");
+            if (format == JsonLines) {
+                writeJsonLine(*local);
+            }
+            else {
+                writePrometheus(*local);
+            }
+        }
+    }
+
+    void writeJsonLine(const Slot& window) {
+        std::ofstream file(path, std::ios::app);
+        double time = std::chrono::duration<double>(std::chrono::system_clock::now().time_since_epoch()).count();
+        file.precision(15);
+        file << "{\"time\":" << time << ",\"window_seconds\":" << TELEMETRY_EXPORT_SECONDS * TELEMETRY_WINDOW_SLOTS
+            << ",\"frames\":" << window.frames;
+        file.precision(6);
+        for (size_t c = 0; c < COUNTERS; c++) {
+            const TelemetryHistogram& h = window.histograms[c];
+            file << ",\"" << name(c) << "\":{\"mean\":" << (h.count ? h.sum / h.count : 0.0)
+                << ",\"p50\":" << h.percentile(0.5) << ",\"p90\":" << h.percentile(0.9)
+                << ",\"p99\":" << h.percentile(0.99) << ",\"max\":" << h.max << ",\"sum\":" << h.sum << "}";
+        }
+        file << "}" << std::endl;
+    }
+
+    // Buckets at each power of two up to the largest sample so far, which the
+    // histogram counts exactly. Written next to the target and renamed over
+    // it, so a scraper never reads half a file.
+    void writePrometheus(const Slot& total) {
+        std::string temporary = path + ".tmp";
+        {
+            std::ofstream file(temporary);
+            for (size_t c = 0; c < COUNTERS; c++) {
+                const TelemetryHistogram& h = total.histograms[c];
+                std::string metric = std::string("vulkanwin_") + name(c);
+                file << "# TYPE " << metric << " histogram\n";
+                uint64_t cumulative = h.counts[0];
+                file << metric << "_bucket{le=\"0\"} " << cumulative << "\n";
+                for (int i = 1; i < TelemetryHistogram::BUCKETS && cumulative < h.count; i++) {
+                    cumulative += h.counts[i];
+                    if (i % TelemetryHistogram::SUB_BUCKETS == 0) {
+                        file << metric << "_bucket{le=\"" << TelemetryHistogram::upperBound(i) << "\"} " << cumulative << "\n";
+                    }
+                }
+                file << metric << "_bucket{le=\"+Inf\"} " << h.count << "\n";
+                file << metric << "_sum " << h.sum << "\n";
+                file << metric << "_count " << h.count << "\n";
+            }
+            file << "# TYPE vulkanwin_frames_total counter\n";
+            file << "vulkanwin_frames_total " << total.frames << "\n";
+        }
+#ifdef _WIN32
+        MoveFileExA(temporary.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING);
+#else
+        std::rename(temporary.c_str(), path.c_str());
+#endif
+    }
+};
+
+// Single-producer, single-consumer triple buffer. The producer always owns a
+// slot to write into and the consumer a slot to read from; publishing and
+// picking up swap the caller's slot with the shared middle one, so neither
+// side ever waits for the other. The consumer sees the newest published
+// value, and intermediate ones are skipped when it falls behind.
+template<typename T>
+class TripleBuffer {
+public:
+    T& writeSlot() {
+        return slots[writeIndex];
+    }
+
+    void publish() {
+        writeIndex = middle.exchange(static_cast<uint8_t>(writeIndex | FRESH), std::memory_order_acq_rel) & INDEX_MASK;
+    }
+
+    // Moves to the newest published value; false if nothing new since last time.
+    bool update() {
+        if ((middle.load(std::memory_order_acquire) & FRESH) == 0) return false;
+        readIndex = middle.exchange(readIndex, std::memory_order_acq_rel) & INDEX_MASK;
+        return true;
+    }
+
+    const T& readSlot() const {
+        return slots[readIndex];
+    }
+
+private:
+    static const uint8_t INDEX_MASK = 3;
+    static const uint8_t FRESH = 4;
+
+    T slots[3] = {};
+    uint8_t writeIndex = 0;
+    uint8_t readIndex = 1;
+    std::atomic<uint8_t> middle{ 2 };
+};
+
+// A frame copied back from the GPU, valid only during FrameConsumer::consume.
+struct CapturedFrame {
+    const uint8_t* pixels;
+    uint32_t width;
+    uint32_t height;
+    uint32_t rowPitch;
+    // swap chain formats are usually BGRA
+    bool bgra;
+    uint64_t frame;
+
+    void rgb(uint32_t x, uint32_t y, uint8_t* out) const {
+        const uint8_t* p = pixels + y * rowPitch + x * 4;
+        out[0] = p[bgra ? 2 : 0];
+        out[1] = p[1];
+        out[2] = p[bgra ? 0 : 2];
+    }
+};
+
+class FrameConsumer {
+public:
+    virtual ~FrameConsumer() {}
+    virtual void consume(const CapturedFrame& frame) = 0;
+};
+
+inline uint32_t crc32(const uint8_t* data, size_t size, uint32_t crc = 0) {
+    static uint32_t table[256];
+    static bool tableReady = false;
+    if (!tableReady) {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+        tableReady = true;
+    }
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+// Writes an 8-bit RGB PNG. The zlib stream uses stored (uncompressed) blocks:
+// captures are meant to be fast to write and exact, not small.
+inline bool writePng(const std::string& path, const CapturedFrame& frame) {
+    std::vector<uint8_t> raw;
+    raw.reserve((frame.width * 3 + 1) * frame.height);
+    for (uint32_t y = 0; y < frame.height; y++) {
+        raw.push_back(0);
+        for (uint32_t x = 0; x < frame.width; x++) {
+            uint8_t rgb[3];
+            frame.rgb(x, y, rgb);
+            raw.insert(raw.end(), rgb, rgb + 3);
+        }
+    }
+
+    std::vector<uint8_t> zlib = { 0x78, 0x01 };
+    for (size_t offset = 0; offset < raw.size() || offset == 0; offset += 65535) {
+        size_t length = std::min<size_t>(65535, raw.size() - offset);
+        bool last = offset + length >= raw.size();
+        uint8_t header[5] = { uint8_t(last ? 1 : 0), uint8_t(length), uint8_t(length >> 8), uint8_t(~length), uint8_t(~length >> 8) };
+        zlib.insert(zlib.end(), header, header + 5);
+        zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + length);
+        if (last) break;
+    }
+    uint32_t a = 1, b = 0;
+    for (uint8_t byte : raw) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    uint32_t adler = (b << 16) | a;
+    uint8_t adlerBytes[4] = { uint8_t(adler >> 24), uint8_t(adler >> 16), uint8_t(adler >> 8), uint8_t(adler) };
+    zlib.insert(zlib.end(), adlerBytes, adlerBytes + 4);
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open()) return false;
+
+    auto writeChunk = [&file](const char* type, const uint8_t* data, size_t size) {
+        uint8_t length[4] = { uint8_t(size >> 24), uint8_t(size >> 16), uint8_t(size >> 8), uint8_t(size) };
+        file.write(reinterpret_cast<const char*>(length), 4);
+        std::vector<uint8_t> body(type, type + 4);
+        body.insert(body.end(), data, data + size);
+        file.write(reinterpret_cast<const char*>(body.data()), body.size());
+        uint32_t crc = crc32(body.data(), body.size());
+        uint8_t crcBytes[4] = { uint8_t(crc >> 24), uint8_t(crc >> 16), uint8_t(crc >> 8), uint8_t(crc) };
+        file.write(reinterpret_cast<const char*>(crcBytes), 4);
+    };
+
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    file.write(reinterpret_cast<const char*>(signature), 8);
+    uint8_t ihdr[13] = {
+        uint8_t(frame.width >> 24), uint8_t(frame.width >> 16), uint8_t(frame.width >> 8), uint8_t(frame.width),
+        uint8_t(frame.height >> 24), uint8_t(frame.height >> 16), uint8_t(frame.height >> 8), uint8_t(frame.height),
+        8, 2, 0, 0, 0
+    };
+    writeChunk("IHDR", ihdr, sizeof(ihdr));
+    writeChunk("IDAT", zlib.data(), zlib.size());
+    writeChunk("IEND", nullptr, 0);
+    return file.good();
+}
+
+// Canonical Huffman code for inflate. Codes up to FAST_BITS long resolve
+// with one table lookup; longer ones walk the per-length counts, as zlib's
+// puff.c does.
+struct InflateHuffman {
+    static const int FAST_BITS = 10;
+    static const int MAX_BITS = 15;
+
+    uint16_t fast[1 << FAST_BITS]; // symbol << 4 | length, 0 for longer codes
+    uint16_t counts[MAX_BITS + 1];
+    uint16_t symbols[288];
+
+    // false for an over-subscribed code; incomplete ones are allowed
+    bool build(const uint8_t* lengths, int count) {
+        memset(counts, 0, sizeof(counts));
+        for (int i = 0; i < count; i++) {
+            counts[lengths[i]]++;
+        }
+        counts[0] = 0;
+        int left = 1;
+        for (int length = 1; length <= MAX_BITS; length++) {
+            left = (left << 1) - counts[length];
+            if (left < 0) return false;
+        }
+
+        uint16_t offsets[MAX_BITS + 2] = {};
+        for (int length = 1; length <= MAX_BITS; length++) {
+            offsets[length + 1] = offsets[length] + counts[length];
+        }
+        for (int i = 0; i < count; i++) {
+            if (lengths[i]) symbols[offsets[lengths[i]]++] = static_cast<uint16_t>(i);
+        }
+
+        // deflate sends codes most significant bit first into an LSB-first
+        // stream, so table indices are the bit-reversed codes
+        memset(fast, 0, sizeof(fast));
+        int code = 0, index = 0;
+        for (int length = 1; length <= FAST_BITS; length++) {
+            for (int k = 0; k < counts[length]; k++, code++) {
+                int reversed = 0;
+                for (int bit = 0; bit < length; bit++) {
+                    reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+                }
+                uint16_t entry = static_cast<uint16_t>(symbols[index++] << 4 | length);
+                for (int fill = reversed; fill < (1 << FAST_BITS); fill += 1 << length) {
+                    fast[fill] = entry;
+                }
+            }
+            code <<= 1;
+        }
+        return true;
+    }
+};
+
+// Inflates a zlib stream (RFC 1950/1951) into out, which it appends to.
+// The Adler-32 trailer is not checked; PNG chunks carry their own CRCs.
+inline bool inflateZlib(const uint8_t* data, size_t size, std::vector<uint8_t>& out) {
+    if (size < 2 || (data[0] & 0x0F) != 8 || (data[0] * 256 + data[1]) % 31 != 0 || (data[1] & 0x20)) return false;
+
+    size_t position = 2;
+    uint64_t bits = 0;
+    int bitCount = 0;
+    // past the end of the stream refill reads zeros; overrun() catches it
+    auto refill = [&]() {
+        while (bitCount <= 56) {
+            bits |= uint64_t(position < size ? data[position] : 0) << bitCount;
+            position++;
+            bitCount += 8;
+        }
+    };
+    auto take = [&](int count) {
+        if (bitCount < count) refill();
+        uint32_t value = static_cast<uint32_t>(bits & ((uint64_t(1) << count) - 1));
+        bits >>= count;
+        bitCount -= count;
+        return value;
+    };
+    auto overrun = [&]() {
+        return position - bitCount / 8 > size;
+    };
+    auto decode = [&](const InflateHuffman& huffman) -> int {
+        if (bitCount < InflateHuffman::MAX_BITS) refill();
+        uint16_t entry = huffman.fast[bits & ((1 << InflateHuffman::FAST_BITS) - 1)];
+        if (entry) {
+            bits >>= entry & 15;
+            bitCount -= entry & 15;
+            return entry >> 4;
+        }
+        int code = 0, first = 0, index = 0;
+        for (int length = 1; length <= InflateHuffman::MAX_BITS; length++) {
+            code |= static_cast<int>((bits >> (length - 1)) & 1);
+            int count = huffman.counts[length];
+            if (code - count < first) {
+                bits >>= length;
+                bitCount -= length;
+                return huffman.symbols[index + (code - first)];
+            }
+            index += count;
+            first = (first + count) << 1;
+            code <<= 1;
+        }
+        return -1;
+    };
+
+    static const uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static const uint8_t lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    static const uint16_t distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+        4097, 6145, 8193, 12289, 16385, 24577 };
+    static const uint8_t distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+    static const uint8_t codeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+    std::unique_ptr<InflateHuffman> literals(new InflateHuffman()), distances(new InflateHuffman());
+    bool last = false;
+    while (!last) {
+        last = take(1) != 0;
+        uint32_t type = take(2);
+
+        if (type == 0) {
+            // stored: drop to the byte boundary and copy straight from the input
+            take(bitCount & 7);
+            position -= bitCount / 8;
+            bits = 0;
+            bitCount = 0;
+            if (position + 4 > size) return false;
+            size_t length = data[position] | (data[position + 1] << 8);
+            size_t complement = data[position + 2] | (data[position + 3] << 8);
+            position += 4;
+            if (length != (~complement & 0xFFFF) || position + length > size) return false;
+            out.insert(out.end(), data + position, data + position + length);
+            position += length;
+            continue;
+        }
+
+        uint8_t lengths[288 + 32];
+        if (type == 1) {
+            for (int i = 0; i < 288; i++) {
+                lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+            }
+            literals->build(lengths, 288);
+            memset(lengths, 5, 30);
+            distances->build(lengths, 30);
+        }
+        else if (type == 2) {
+            int literalCount = take(5) + 257;
+            int distanceCount = take(5) + 1;
+            int codeLengthCount = take(4) + 4;
+            if (literalCount > 286 || distanceCount > 30) return false;
+
+            uint8_t codeLengthLengths[19] = {};
+            for (int i = 0; i < codeLengthCount; i++) {
+                codeLengthLengths[codeLengthOrder[i]] = static_cast<uint8_t>(take(3));
+            }
+            InflateHuffman codeLengths;
+            if (!codeLengths.build(codeLengthLengths, 19)) return false;
+
+            for (int i = 0; i < literalCount + distanceCount;) {
+                int symbol = decode(codeLengths);
+                if (symbol < 0) return false;
+                if (symbol < 16) {
+                    lengths[i++] = static_cast<uint8_t>(symbol);
+                    continue;
+                }
+                uint8_t value = 0;
+                int repeat;
+                if (symbol == 16) {
+                    if (i == 0) return false;
+                    value = lengths[i - 1];
+                    repeat = 3 + take(2);
+                }
+                else if (symbol == 17) {
+                    repeat = 3 + take(3);
+                }
+                else {
+                    repeat = 11 + take(7);
+                }
+                if (i + repeat > literalCount + distanceCount) return false;
+                memset(lengths + i, value, repeat);
+                i += repeat;
+            }
+            if (lengths[256] == 0) return false;
+            if (!literals->build(lengths, literalCount) || !distances->build(lengths + literalCount, distanceCount)) return false;
+        }
+        else {
+            return false;
+        }
+
+        for (;;) {
+            int symbol = decode(*literals);
+            if (symbol < 0 || overrun()) return false;
+            if (symbol < 256) {
+                out.push_back(static_cast<uint8_t>(symbol));
+                continue;
+            }
+            if (symbol == 256) break;
+
+            symbol -= 257;
+            if (symbol >= 29) return false;
+            size_t length = lengthBase[symbol] + take(lengthExtra[symbol]);
+            int distanceSymbol = decode(*distances);
+            if (distanceSymbol < 0 || distanceSymbol >= 30) return false;
+            size_t distance = distanceBase[distanceSymbol] + take(distanceExtra[distanceSymbol]);
+            if (distance > out.size()) return false;
+            // byte by byte: the source may overlap what is being written
+            size_t from = out.size() - distance;
+            for (size_t i = 0; i < length; i++) {
+                out.push_back(out[from + i]);
+            }
+        }
+    }
+    return !overrun();
+}
+
+// Decodes a non-interlaced PNG of any color type and bit depth into RGBA8.
+// 16-bit samples keep their high byte; palette and color-key transparency
+// (tRNS) become alpha. Adam7-interlaced images are rejected.
+inline bool decodePng(const std::vector<uint8_t>& data, std::vector<uint8_t>& rgba, uint32_t& width, uint32_t& height) {
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    if (data.size() < 8 || memcmp(data.data(), signature, 8) != 0) return false;
+
+    auto be32 = [&data](size_t at) {
+        return (uint32_t(data[at]) << 24) | (uint32_t(data[at + 1]) << 16) | (uint32_t(data[at + 2]) << 8) | uint32_t(data[at + 3]);
+    };
+
+    std::vector<uint8_t> zlib;
+    uint8_t palette[256][4];
+    uint32_t paletteSize = 0;
+    bool colorKey = false;
+    uint16_t key[3] = {};
+    int depth = 0, colorType = -1;
+    width = height = 0;
+    for (size_t at = 8; at + 12 <= data.size();) {
+        uint32_t length = be32(at);
+        if (length > data.size() - at - 12) return false;
+        const uint8_t* type = &data[at + 4];
+        const uint8_t* body = &data[at + 8];
+        if (memcmp(type, "IHDR", 4) == 0 && length >= 13) {
+            width = be32(at + 8);
+            height = be32(at + 12);
+            depth = body[8];
+            colorType = body[9];
+            if (body[10] != 0 || body[11] != 0 || body[12] != 0) return false;
+        }
+        else if (memcmp(type, "PLTE", 4) == 0) {
+            paletteSize = std::min<uint32_t>(256, length / 3);
+            for (uint32_t i = 0; i < paletteSize; i++) {
+                palette[i][0] = body[i * 3];
+                palette[i][1] = body[i * 3 + 1];
+                palette[i][2] = body[i * 3 + 2];
+                palette[i][3] = 255;
+            }
+        }
+        else if (memcmp(type, "tRNS", 4) == 0) {
+            if (colorType == 3) {
+                for (uint32_t i = 0; i < std::min(length, paletteSize); i++) {
+                    palette[i][3] = body[i];
+                }
+            }
+            else if ((colorType == 0 && length >= 2) || (colorType == 2 && length >= 6)) {
+                colorKey = true;
+                for (uint32_t c = 0; c < length / 2 && c < 3; c++) {
+                    key[c] = static_cast<uint16_t>(body[c * 2] << 8 | body[c * 2 + 1]);
+                }
+            }
+        }
+        else if (memcmp(type, "IDAT", 4) == 0) {
+            zlib.insert(zlib.end(), body, body + length);
+        }
+        else if (memcmp(type, "IEND", 4) == 0) {
+            break;
+        }
+        at += 12 + length;
+    }
+
+    int channels;
+    switch (colorType) {
+    case 0: channels = 1; break;
+    case 2: channels = 3; break;
+    case 3: channels = 1; break;
+    case 4: channels = 2; break;
+    case 6: channels = 4; break;
+    default: return false;
+    }
+    bool validDepth = depth == 8 || (depth == 16 && colorType != 3) || ((depth == 1 || depth == 2 || depth == 4) && (colorType == 0 || colorType == 3));
+    if (!validDepth || width == 0 || height == 0 || uint64_t(width) * height > (uint64_t(1) << 28)) return false;
+    if (colorType == 3 && paletteSize == 0) return false;
+
+    size_t bitsPerPixel = size_t(channels) * depth;
+    size_t pixelBytes = std::max<size_t>(1, bitsPerPixel / 8);
+    size_t stride = (width * bitsPerPixel + 7) / 8;
+
+    std::vector<uint8_t> raw;
+    raw.reserve((stride + 1) * height);
+    if (!inflateZlib(zlib.data(), zlib.size(), raw) || raw.size() < (stride + 1) * height) return false;
+
+    // undo the per-row filters in place; row y - 1 is already unfiltered
+    for (uint32_t y = 0; y < height; y++) {
+        uint8_t* row = &raw[y * (stride + 1) + 1];
+        const uint8_t* above = y > 0 ? row - (stride + 1) : nullptr;
+        uint8_t filter = row[-1];
+        for (size_t i = 0; i < stride; i++) {
+            int a = i >= pixelBytes ? row[i - pixelBytes] : 0;
+            int b = above ? above[i] : 0;
+            int c = above && i >= pixelBytes ? above[i - pixelBytes] : 0;
+            switch (filter) {
+            case 0: break;
+            case 1: row[i] = uint8_t(row[i] + a); break;
+            case 2: row[i] = uint8_t(row[i] + b); break;
+            case 3: row[i] = uint8_t(row[i] + ((a + b) >> 1)); break;
+            case 4: {
+                int p = a + b - c;
+                int pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+                row[i] = uint8_t(row[i] + (pa <= pb && pa <= pc ? a : pb <= pc ? b : c));
+                break;
+            }
+            default: return false;
+            }
+        }
+    }
+
+    rgba.resize(size_t(width) * height * 4);
+    int maxSample = (1 << depth) - 1;
+    for (uint32_t y = 0; y < height; y++) {
+        const uint8_t* row = &raw[y * (stride + 1) + 1];
+        // sample c of pixel x at the image's depth, unscaled
+        auto sample = [&](uint32_t x, int c) -> uint32_t {
+            size_t index = size_t(x) * channels + c;
+            if (depth == 8) return row[index];
+            if (depth == 16) return uint32_t(row[index * 2]) << 8 | row[index * 2 + 1];
+            size_t bit = index * depth;
+            return (row[bit / 8] >> (8 - depth - bit % 8)) & maxSample;
+        };
+        auto to8 = [&](uint32_t value) -> uint8_t {
+            return static_cast<uint8_t>(depth == 16 ? value >> 8 : depth == 8 ? value : value * 255 / maxSample);
+        };
+
+        uint8_t* out = &rgba[size_t(y) * width * 4];
+        for (uint32_t x = 0; x < width; x++, out += 4) {
+            if (colorType == 3) {
+                uint32_t index = sample(x, 0);
+                if (index >= paletteSize) return false;
+                memcpy(out, palette[index], 4);
+            }
+            else if (colorType == 0 || colorType == 4) {
+                uint32_t gray = sample(x, 0);
+                out[0] = out[1] = out[2] = to8(gray);
+                out[3] = colorType == 4 ? to8(sample(x, 1)) : colorKey && gray == key[0] ? 0 : 255;
+            }
+            else {
+                uint32_t r = sample(x, 0), g = sample(x, 1), b = sample(x, 2);
+                out[0] = to8(r);
+                out[1] = to8(g);
+                out[2] = to8(b);
+                out[3] = colorType == 6 ? to8(sample(x, 3)) : colorKey && r == key[0] && g == key[1] && b == key[2] ? 0 : 255;
+            }
+        }
+    }
+    return true;
+}
+
+inline bool readPng(const std::string& path, std::vector<uint8_t>& rgba, uint32_t& width, uint32_t& height) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) return false;
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    return decodePng(data, rgba, width, height);
+}
+
+class PngFrameWriter : public FrameConsumer {
+public:
+    PngFrameWriter(const std::string& prefix) : prefix(prefix) {}
+
+    void consume(const CapturedFrame& frame) override {
+        char name[32];
+        snprintf(name, sizeof(name), "%06llu.png", static_cast<unsigned long long>(frame.frame));
+        if (!writePng(prefix + name, frame)) {
+            std::cerr << "failed to write " << prefix + name << std::endl;
+        }
+    }
+
+private:
+    std::string prefix;
+};
+
+// Raw YUV4MPEG2 (4:2:0) stream; ffmpeg and most players take it directly and
+// can encode it further.
+class Y4mVideoWriter : public FrameConsumer {
+public:
+    Y4mVideoWriter(const std::string& path) : file(path, std::ios::binary) {}
+
+    void consume(const CapturedFrame& frame) override {
+        if (!file.is_open()) return;
+
+        uint32_t width = frame.width & ~1u;
+        uint32_t height = frame.height & ~1u;
+        if (!headerWritten) {
+            file << "YUV4MPEG2 W" << width << " H" << height << " F60:1 Ip A1:1 C420jpeg\n";
+            headerWritten = true;
+            streamWidth = width;
+            streamHeight = height;
+        }
+        // the stream's size is fixed by its header; frames after a resize are left out
+        if (width != streamWidth || height != streamHeight) return;
+
+        planes.resize(width * height * 3 / 2);
+        uint8_t* luma = planes.data();
+        uint8_t* cb = luma + width * height;
+        uint8_t* cr = cb + width * height / 4;
+        for (uint32_t y = 0; y < height; y += 2) {
+            for (uint32_t x = 0; x < width; x += 2) {
+                int sumB = 0, sumR = 0;
+                for (uint32_t k = 0; k < 4; k++) {
+                    uint8_t rgb[3];
+                    frame.rgb(x + (k & 1), y + (k >> 1), rgb);
+                    int value = (77 * rgb[0] + 150 * rgb[1] + 29 * rgb[2]) >> 8;
+                    luma[(y + (k >> 1)) * width + x + (k & 1)] = uint8_t(value);
+                    sumB += rgb[2] - value;
+                    sumR += rgb[0] - value;
+                }
+                cb[(y / 2) * (width / 2) + x / 2] = uint8_t(glm::clamp(128 + sumB * 144 / (4 * 256), 0, 255));
+                cr[(y / 2) * (width / 2) + x / 2] = uint8_t(glm::clamp(128 + sumR * 182 / (4 * 256), 0, 255));
+            }
+        }
+
+        file << "FRAME\n";
+        file.write(reinterpret_cast<const char*>(planes.data()), planes.size());
+    }
+
+private:
+    std::ofstream file;
+    bool headerWritten = false;
+    uint32_t streamWidth = 0, streamHeight = 0;
+    std::vector<uint8_t> planes;
+};
+
+// Compares a capture against a golden image. Luma differences are taken
+// after a 3x3 box blur, so single-pixel rasterization noise is tolerated
+// while anything a viewer would notice is not.
+class GoldenImageComparer : public FrameConsumer {
+public:
+    std::atomic<int> result{ -1 }; // -1 pending, 0 mismatch, 1 match
+
+    GoldenImageComparer(const std::string& path, bool writeGolden, int lumaThreshold = 8, double maxDifferingFraction = 0.001)
+        : path(path), writeGolden(writeGolden), lumaThreshold(lumaThreshold), maxDifferingFraction(maxDifferingFraction) {}
+
+    void consume(const CapturedFrame& frame) override {
+        if (result != -1) return;
+
+        if (writeGolden) {
+            result = writePng(path, frame) ? 1 : 0;
+            std::cout << (result ? "wrote golden image " : "failed to write golden image ") << path << std::endl;
+            return;
+        }
+
+        std::vector<uint8_t> golden;
+        uint32_t width, height;
+        if (!readPng(path, golden, width, height) || width != frame.width || height != frame.height) {
+            std::cout << "golden image " << path << " is missing or has a different size" << std::endl;
+            result = 0;
+            return;
+        }
+
+        std::vector<int> actualLuma(width * height), goldenLuma(width * height);
+        for (uint32_t y = 0; y < height; y++) {
+            for (uint32_t x = 0; x < width; x++) {
+                uint8_t rgb[3];
+                frame.rgb(x, y, rgb);
+                const uint8_t* g = &golden[(y * width + x) * 4];
+                actualLuma[y * width + x] = 77 * rgb[0] + 150 * rgb[1] + 29 * rgb[2];
+                goldenLuma[y * width + x] = 77 * g[0] + 150 * g[1] + 29 * g[2];
+            }
+        }
+
+        size_t differing = 0;
+        int maxDifference = 0;
+        for (uint32_t y = 1; y + 1 < height; y++) {
+            for (uint32_t x = 1; x + 1 < width; x++) {
+                int difference = 0;
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dx = -1; dx <= 1; dx++) {
+                        size_t i = (y + dy) * width + x + dx;
+                        difference += actualLuma[i] - goldenLuma[i];
+                    }
+                }
+                // 9 samples, luma scaled by 256
+                difference = std::abs(difference) / (9 * 256);
+                maxDifference = std::max(maxDifference, difference);
+                if (difference > lumaThreshold) differing++;
+            }
+        }
+
+        double fraction = double(differing) / (double(width) * height);
+        result = fraction <= maxDifferingFraction ? 1 : 0;
+        std::cout << "golden image " << path << ": " << differing << " pixels differ (max luma delta " << maxDifference << "), "
+            << (result ? "match" : "MISMATCH") << std::endl;
+    }
+
+private:
+    std::string path;
+    bool writeGolden;
+    int lumaThreshold;
+    double maxDifferingFraction;
+};
+
+// Host side of the readback ring. Slots go Free -> Pending (copy submitted)
+// -> Ready (its frame fence passed, queued for the consumer thread) -> Free.
+// When every slot is busy a capture is dropped rather than stalling the frame.
+class ReadbackRing {
+public:
+    enum SlotState { Free, Pending, Ready };
+
+    struct Slot {
+        const uint8_t* pixels = nullptr;
+        uint64_t frame = 0;
+        std::atomic<int> state{ Free };
+    };
+
+    ~ReadbackRing() {
+        stop();
+    }
+
+    void start(size_t slotCount, uint32_t width, uint32_t height, uint32_t rowPitch, bool bgra) {
+        slots = std::vector<Slot>(slotCount);
+        this->width = width;
+        this->height = height;
+        this->rowPitch = rowPitch;
+        this->bgra = bgra;
+        // markReady runs on the render thread and must not allocate
+        readyQueue.reserve(slotCount);
+        running = true;
+        worker = std::thread([this]() { consumeLoop(); });
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!running) return;
+            running = false;
+        }
+        condition.notify_one();
+        worker.join();
+    }
+
+    void addConsumer(FrameConsumer* consumer) {
+        consumers.push_back(consumer);
+    }
+
+    Slot& slot(size_t index) {
+        return slots[index];
+    }
+
+    size_t size() const {
+        return slots.size();
+    }
+
+    // A free slot for this frame's copy, or -1 to skip capturing it.
+    int acquire(uint64_t frame) {
+        for (size_t i = 0; i < slots.size(); i++) {
+            int expected = Free;
+            if (slots[i].state.compare_exchange_strong(expected, Pending)) {
+                slots[i].frame = frame;
+                captured++;
+                return static_cast<int>(i);
+            }
+        }
+        dropped++;
+        return -1;
+    }
+
+    // The copy into the slot has completed on the GPU.
+    void markReady(int index) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            slots[index].state = Ready;
+            readyQueue.push_back(index);
+        }
+        condition.notify_one();
+    }
+
+    uint64_t capturedCount() const {
+        return captured;
+    }
+
+    uint64_t droppedCount() const {
+        return dropped;
+    }
+
+private:
+    std::vector<Slot> slots;
+    std::vector<FrameConsumer*> consumers;
+    uint32_t width = 0, height = 0, rowPitch = 0;
+    bool bgra = true;
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::vector<int> readyQueue;
+    bool running = false;
+
+    std::atomic<uint64_t> captured{ 0 };
+    std::atomic<uint64_t> dropped{ 0 };
+
+    // Drains everything already queued before exiting.
+    void consumeLoop() {
+        PROFILE_THREAD("readback");
+        std::vector<int> batch;
+        batch.reserve(slots.size());
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                condition.wait(lock, [this]() { return !readyQueue.empty() || !running; });
+                if (readyQueue.empty()) return;
+                batch.swap(readyQueue);
+            }
+
+            for (int index : batch) {
+                PROFILE_ZONE("consume captured frame");
+                Slot& slot = slots[index];
+                CapturedFrame frame = { slot.pixels, width, height, rowPitch, bgra, slot.frame };
+                for (FrameConsumer* consumer : consumers) {
+                    consumer->consume(frame);
+                }
+                slot.state = Free;
+            }
+            batch.clear();
+        }
+    }
+};
+
+// Layout of the Camera block in shaders/clustered.vert.
+struct LightCamera {
+    glm::mat4 view;
+    glm::mat4 projection;
+};
+
+// std430-compatible, as read by shaders/clustered.frag.
+struct PointLight {
+    glm::vec4 positionRadius;
+    glm::vec4 color;
+};
+
+struct LightCluster {
+    uint32_t offset;
+    uint32_t count;
+};
+
+// Assigns point lights to a froxel grid: GRID_X x GRID_Y screen tiles (rows
+// top-down, as gl_FragCoord counts them) times GRID_Z exponential depth
+// slices between the projection's near and far planes. Tile boundaries are
+// planes through the eye, so a light's tile range comes from its signed
+// distances to them, four planes per SSE op. Lights are ranged in parallel,
+// then each depth slice is filled by its own task and the slices are
+// concatenated, giving per-cluster index lists ordered by light index.
+class LightClusterer {
+public:
+    static const uint32_t GRID_X = 16;
+    static const uint32_t GRID_Y = 9;
+    static const uint32_t GRID_Z = 24;
+    static const uint32_t CLUSTER_COUNT = GRID_X * GRID_Y * GRID_Z;
+
+    void setProjection(float fovY, float aspect, float zNear, float zFar) {
+        this->zNear = zNear;
+        this->zFar = zFar;
+        sliceScale = GRID_Z / std::log(zFar / zNear);
+        tanY = std::tan(fovY * 0.5f);
+        tanX = tanY * aspect;
+
+        // interior boundaries only, padded with planes whose distance is always 0
+        for (uint32_t i = 0; i < PLANES_X; i++) {
+            float k = i + 1 < GRID_X ? tanX * (2.0f * (i + 1) / GRID_X - 1.0f) : 0.0f;
+            float scale = i + 1 < GRID_X ? 1.0f / std::sqrt(1.0f + k * k) : 0.0f;
+            columnX[i] = scale;
+            columnZ[i] = k * scale;
+        }
+        for (uint32_t j = 0; j < PLANES_Y; j++) {
+            float t = j + 1 < GRID_Y ? tanY * (1.0f - 2.0f * (j + 1) / GRID_Y) : 0.0f;
+            float scale = j + 1 < GRID_Y ? 1.0f / std::sqrt(1.0f + t * t) : 0.0f;
+            rowY[j] = -scale;
+            rowZ[j] = -t * scale;
+        }
+    }
+
+    // Lights are in world space; view is the camera's glm::lookAt matrix.
+    void build(const PointLight* lights, size_t count, const glm::mat4& view) {
+        viewLights.resize(count);
+        ranges.resize(count);
+
+        const size_t chunk = 256;
+        workerPool().run((count + chunk - 1) / chunk, [&](size_t task) {
+            size_t end = std::min(count, (task + 1) * chunk);
+            for (size_t i = task * chunk; i < end; i++) {
+                glm::vec3 position = glm::vec3(view * glm::vec4(glm::vec3(lights[i].positionRadius), 1.0f));
+                viewLights[i].positionRadius = glm::vec4(position, lights[i].positionRadius.w);
+                viewLights[i].color = lights[i].color;
+                ranges[i] = range(position, lights[i].positionRadius.w);
+            }
+        });
+
+        sliceIndices.resize(GRID_Z);
+        clusters.resize(CLUSTER_COUNT);
+        workerPool().run(GRID_Z, [&](size_t slice) {
+            fillSlice(static_cast<uint32_t>(slice));
+        });
+
+        size_t total = 0;
+        for (uint32_t z = 0; z < GRID_Z; z++) {
+            sliceOffsets[z] = total;
+            total += sliceIndices[z].size();
+        }
+        indices.resize(total);
+        workerPool().run(GRID_Z, [&](size_t slice) {
+            std::copy(sliceIndices[slice].begin(), sliceIndices[slice].end(), indices.begin() + sliceOffsets[slice]);
+            LightCluster* cell = &clusters[slice * GRID_X * GRID_Y];
+            for (uint32_t c = 0; c < GRID_X * GRID_Y; c++) {
+                cell[c].offset += static_cast<uint32_t>(sliceOffsets[slice]);
+            }
+        });
+    }
+
+    uint32_t clusterIndex(uint32_t x, uint32_t y, uint32_t z) const {
+        return (z * GRID_Y + y) * GRID_X + x;
+    }
+
+    // The cluster a view-space point falls in, or -1 outside the frustum.
+    int clusterAt(const glm::vec3& position) const {
+        float depth = -position.z;
+        if (depth < zNear || depth >= zFar) return -1;
+        float u = position.x / depth / tanX * 0.5f + 0.5f;
+        float v = 0.5f - position.y / depth / tanY * 0.5f;
+        if (u < 0.0f || u >= 1.0f || v < 0.0f || v >= 1.0f) return -1;
+        uint32_t z = std::min(GRID_Z - 1, static_cast<uint32_t>(std::log(depth / zNear) * sliceScale));
+        return clusterIndex(static_cast<uint32_t>(u * GRID_X), static_cast<uint32_t>(v * GRID_Y), z);
+    }
+
+    const std::vector<LightCluster>& clusterGrid() const {
+        return clusters;
+    }
+
+    const std::vector<uint32_t>& lightIndices() const {
+        return indices;
+    }
+
+    // view-space copies of the lights, in the order lightIndices refers to
+    const std::vector<PointLight>& lightsInView() const {
+        return viewLights;
+    }
+
+private:
+    static const uint32_t PLANES_X = (GRID_X - 1 + 3) & ~3u;
+    static const uint32_t PLANES_Y = (GRID_Y - 1 + 3) & ~3u;
+
+    struct LightRange {
+        uint8_t x0, x1, y0, y1, z0, z1;
+        bool visible;
+    };
+
+    float zNear = 0.1f, zFar = 100.0f, sliceScale = 1.0f;
+    float tanX = 1.0f, tanY = 1.0f;
+    alignas(16) float columnX[PLANES_X], columnZ[PLANES_X];
+    alignas(16) float rowY[PLANES_Y], rowZ[PLANES_Y];
+
+    std::vector<PointLight> viewLights;
+    std::vector<LightRange> ranges;
+    std::vector<std::vector<uint32_t>> sliceIndices;
+    size_t sliceOffsets[GRID_Z];
+    std::vector<LightCluster> clusters;
+    std::vector<uint32_t> indices;
+
+    // Number of planes the sphere lies wholly on the positive side of, and
+    // wholly on the negative side of.
+    static void countSides(const float* planeA, const float* planeZ, uint32_t planeCount, float a, float z, float radius, int& positive, int& negative) {
+        const __m128 va = _mm_set1_ps(a), vz = _mm_set1_ps(z);
+        const __m128 r = _mm_set1_ps(radius), minusR = _mm_set1_ps(-radius);
+        positive = negative = 0;
+        for (uint32_t i = 0; i < planeCount; i += 4) {
+            __m128 d = _mm_add_ps(_mm_mul_ps(_mm_load_ps(planeA + i), va), _mm_mul_ps(_mm_load_ps(planeZ + i), vz));
+            int above = _mm_movemask_ps(_mm_cmpgt_ps(d, r));
+            int below = _mm_movemask_ps(_mm_cmplt_ps(d, minusR));
+            positive += ((above & 1) + ((above >> 1) & 1)) + (((above >> 2) & 1) + ((above >> 3) & 1));
+            negative += ((below & 1) + ((below >> 1) & 1)) + (((below >> 2) & 1) + ((below >> 3) & 1));
+        }
+    }
+
+    LightRange range(const glm::vec3& p, float radius) const {
+        LightRange result = {};
+        float depth = -p.z;
+        if (depth + radius < zNear || depth - radius > zFar) return result;
+
+        // the outer frustum planes reject lights entirely off screen
+        float outerX = 1.0f / std::sqrt(1.0f + tanX * tanX), outerY = 1.0f / std::sqrt(1.0f + tanY * tanY);
+        if ((p.x - tanX * depth) * outerX > radius || (-p.x - tanX * depth) * outerX > radius ||
+            (p.y - tanY * depth) * outerY > radius || (-p.y - tanY * depth) * outerY > radius) {
+            return result;
+        }
+
+        int right, left, below, above;
+        countSides(columnX, columnZ, PLANES_X, p.x, p.z, radius, right, left);
+        countSides(rowY, rowZ, PLANES_Y, p.y, p.z, radius, below, above);
+
+        auto slice = [this](float d) {
+            if (d <= zNear) return 0u;
+            return std::min(GRID_Z - 1, static_cast<uint32_t>(std::log(d / zNear) * sliceScale));
+        };
+
+        result.x0 = static_cast<uint8_t>(right);
+        result.x1 = static_cast<uint8_t>(GRID_X - 1 - left);
+        result.y0 = static_cast<uint8_t>(below);
+        result.y1 = static_cast<uint8_t>(GRID_Y - 1 - above);
+        result.z0 = static_cast<uint8_t>(slice(depth - radius));
+        result.z1 = static_cast<uint8_t>(slice(depth + radius));
+        result.visible = true;
+        return result;
+    }
+
+    // Counts, then fills: the slice's lists are contiguous in sliceIndices[z]
+    // and cluster offsets are relative to the slice until build() rebases them.
+    void fillSlice(uint32_t z) {
+        LightCluster* cell = &clusters[z * GRID_X * GRID_Y];
+        for (uint32_t c = 0; c < GRID_X * GRID_Y; c++) {
+            cell[c] = { 0, 0 };
+        }
+
+        for (const LightRange& r : ranges) {
+            if (!r.visible || z < r.z0 || z > r.z1) continue;
+            for (uint32_t y = r.y0; y <= r.y1; y++) {
+                for (uint32_t x = r.x0; x <= r.x1; x++) {
+                    cell[y * GRID_X + x].count++;
+                }
+            }
+        }
+
+        uint32_t offset = 0;
+        for (uint32_t c = 0; c < GRID_X * GRID_Y; c++) {
+            cell[c].offset = offset;
+            offset += cell[c].count;
+            cell[c].count = 0;
+        }
+
+        std::vector<uint32_t>& out = sliceIndices[z];
+        out.resize(offset);
+        for (uint32_t i = 0; i < ranges.size(); i++) {
+            const LightRange& r = ranges[i];
+            if (!r.visible || z < r.z0 || z > r.z1) continue;
+            for (uint32_t y = r.y0; y <= r.y1; y++) {
+                for (uint32_t x = r.x0; x <= r.x1; x++) {
+                    LightCluster& target = cell[y * GRID_X + x];
+                    out[target.offset + target.count++] = i;
+                }
+            }
+        }
+    }
+};
+
+// Everything the render thread needs from one simulation step: input, the
+// camera, and the results of the CPU systems, ready to copy into the frame's
+// buffers. A system's vectors stay empty when it is off or runs on the GPU.
+// Packets are immutable once published; the slots keep their capacity, so
+// steps after the first few don't allocate.
+struct FramePacket {
+    uint64_t step;
+    double time;
+    std::chrono::high_resolution_clock::time_point inputTime;
+    glm::dvec2 cursor;
+    glm::mat4 view;
+
+    std::vector<ParticleVertex> particleVertices;
+    // skinned vertices on the CPU path, joint palettes on the vertex shader path
+    std::vector<SkinnedOutputVertex> skinnedVertices;
+    std::vector<glm::vec4> skinningPalettes;
+    // clusters already clamped to MAX_LIGHT_INDICES
+    std::vector<PointLight> viewLights;
+    std::vector<LightCluster> lightClusters;
+    std::vector<uint32_t> lightIndices;
+};
+
+struct SoftwareVertex {
+    glm::vec3 position;
+    glm::vec3 color;
+};
+
+// The triangle bucket drawn by the Vulkan path; mirrors shaders/shader.vert.
+inline void trianglePassScene(std::vector<SoftwareVertex>& vertices, std::vector<uint32_t>& indices) {
+    vertices = {
+        { glm::vec3(0.0f, -0.5f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f) },
+        { glm::vec3(0.5f, 0.5f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f) },
+        { glm::vec3(-0.5f, 0.5f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f) },
+    };
+    indices = { 0, 1, 2 };
+}
+
+// CPU implementation of the graphics pipeline as the Vulkan path configures
+// it: Vulkan clip space (y down, depth 0..1), clockwise front faces, back-face
+// culling, the first vertex as the provoking vertex and a top-left fill rule.
+// draw() transforms, clips and bins triangles into screen tiles in submission
+// order; finish() rasterizes the tiles in parallel, four pixels at a time,
+// so the output does not depend on the thread count.
+class SoftwareRasterizer {
+public:
+    enum Shading { Flat, Interpolated };
+
+    static const int TILE_SIZE = 64;
+
+    SoftwareRasterizer(uint32_t width, uint32_t height)
+        : width(width), height(height), stride((width + 3) & ~3u),
+          tilesX((width + TILE_SIZE - 1) / TILE_SIZE), tilesY((height + TILE_SIZE - 1) / TILE_SIZE),
+          color(stride * height), depth(stride * height), bins(tilesX * tilesY) {}
+
+    void clear(const glm::vec4& clearColor, float clearDepth = 1.0f) {
+        std::fill(color.begin(), color.end(), packColor(clearColor));
+        std::fill(depth.begin(), depth.end(), clearDepth);
+    }
+
+    void draw(const SoftwareVertex* vertices, const uint32_t* indices, size_t indexCount, const glm::mat4& mvp,
+        Shading shading = Interpolated, bool cullBack = true, bool depthTest = false) {
+        for (size_t i = 0; i + 2 < indexCount; i += 3) {
+            ClipVertex polygon[MAX_CLIPPED_VERTICES];
+            for (int k = 0; k < 3; k++) {
+                const SoftwareVertex& v = vertices[indices[i + k]];
+                polygon[k].position = mvp * glm::vec4(v.position, 1.0f);
+                polygon[k].color = v.color;
+            }
+            glm::vec3 flatColor = polygon[0].color;
+
+            int count = clip(polygon);
+            for (int k = 1; k + 1 < count; k++) {
+                setup(polygon[0], polygon[k], polygon[k + 1], shading == Flat ? &flatColor : nullptr, cullBack, depthTest);
+            }
+        }
+    }
+
+    void finish() {
+        workerPool().run(bins.size(), [this](size_t tile) {
+            rasterizeTile(tile);
+        });
+        for (auto& bin : bins) {
+            bin.clear();
+        }
+        trianglesDrawn += triangles.size();
+        triangles.clear();
+    }
+
+    CapturedFrame frame(uint64_t frameNumber = 0) const {
+        return { reinterpret_cast<const uint8_t*>(color.data()), width, height, stride * 4, false, frameNumber };
+    }
+
+    // triangles that survived clipping and culling, across all finish() calls
+    uint64_t trianglesRasterized() const {
+        return trianglesDrawn;
+    }
+
+private:
+    struct ClipVertex {
+        glm::vec4 position;
+        glm::vec3 color;
+    };
+
+    // a triangle clipped by all six planes becomes at most a 9-gon
+    static const int MAX_CLIPPED_VERTICES = 9;
+
+    // Edge k is opposite vertex k: E = a*x + b*y + c, positive inside. The
+    // other planes give depth, 1/w and color/w, linear in screen space.
+    struct Triangle {
+        float a[3], b[3], c[3];
+        bool topLeft[3];
+        float z[3];
+        float invW[3];
+        float colorOverW[3][3];
+        int x0, y0, x1, y1;
+        bool depthTest;
+    };
+
+    uint32_t width, height, stride;
+    uint32_t tilesX, tilesY;
+    std::vector<uint32_t> color;
+    std::vector<float> depth;
+    std::vector<Triangle> triangles;
+    std::vector<std::vector<uint32_t>> bins;
+    uint64_t trianglesDrawn = 0;
+
+    static uint32_t packColor(const glm::vec4& c) {
+        glm::vec4 v = glm::clamp(c, 0.0f, 1.0f) * 255.0f + 0.5f;
+        return uint32_t(v.r) | (uint32_t(v.g) << 8) | (uint32_t(v.b) << 16) | (uint32_t(v.a) << 24);
+    }
+
+    // Sutherland-Hodgman against -w <= x, y <= w and 0 <= z <= w.
+    static int clip(ClipVertex* polygon) {
+        auto distance = [](const glm::vec4& p, int plane) {
+            switch (plane) {
+            case 0: return p.w + p.x;
+            case 1: return p.w - p.x;
+            case 2: return p.w + p.y;
+            case 3: return p.w - p.y;
+            case 4: return p.z;
+            default: return p.w - p.z;
+            }
+        };
+
+        int count = 3;
+        for (int plane = 0; plane < 6; plane++) {
+            bool allInside = true;
+            for (int i = 0; i < count; i++) {
+                allInside &= distance(polygon[i].position, plane) >= 0.0f;
+            }
+            if (allInside) continue;
+
+            ClipVertex input[MAX_CLIPPED_VERTICES];
+            std::copy(polygon, polygon + count, input);
+            int output = 0;
+            for (int i = 0; i < count; i++) {
+                const ClipVertex& current = input[i];
+                const ClipVertex& next = input[(i + 1) % count];
+                float d0 = distance(current.position, plane);
+                float d1 = distance(next.position, plane);
+                if (d0 >= 0.0f) {
+                    polygon[output++] = current;
+                }
+                if ((d0 >= 0.0f) != (d1 >= 0.0f)) {
+                    float t = d0 / (d0 - d1);
+                    polygon[output].position = glm::mix(current.position, next.position, t);
+                    polygon[output].color = glm::mix(current.color, next.color, t);
+                    output++;
+                }
+            }
+            count = output;
+            if (count < 3) return 0;
+        }
+        return count;
+    }
+
+    void setup(const ClipVertex& v0, const ClipVertex& v1, const ClipVertex& v2, const glm::vec3* flatColor, bool cullBack, bool depthTest) {
+        const ClipVertex* v[3] = { &v0, &v1, &v2 };
+        float x[3], y[3];
+        Triangle tri;
+        for (int k = 0; k < 3; k++) {
+            float invW = 1.0f / v[k]->position.w;
+            x[k] = (v[k]->position.x * invW * 0.5f + 0.5f) * width;
+            y[k] = (v[k]->position.y * invW * 0.5f + 0.5f) * height;
+            tri.z[k] = v[k]->position.z * invW;
+            tri.invW[k] = invW;
+            glm::vec3 c = flatColor ? *flatColor : v[k]->color;
+            for (int channel = 0; channel < 3; channel++) {
+                tri.colorOverW[channel][k] = c[channel] * invW;
+            }
+        }
+
+        // with y pointing down, positive area is clockwise: a front face
+        float area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+        if (area == 0.0f || (cullBack && area < 0.0f)) {
+            return;
+        }
+        if (area < 0.0f) {
+            std::swap(x[1], x[2]);
+            std::swap(y[1], y[2]);
+            std::swap(tri.z[1], tri.z[2]);
+            std::swap(tri.invW[1], tri.invW[2]);
+            for (int channel = 0; channel < 3; channel++) {
+                std::swap(tri.colorOverW[channel][1], tri.colorOverW[channel][2]);
+            }
+            area = -area;
+        }
+
+        for (int k = 0; k < 3; k++) {
+            int i = (k + 1) % 3, j = (k + 2) % 3;
+            tri.a[k] = y[i] - y[j];
+            tri.b[k] = x[j] - x[i];
+            tri.c[k] = -(tri.a[k] * x[i] + tri.b[k] * y[i]);
+            // pixels exactly on an edge belong to the triangle to its right or below
+            tri.topLeft[k] = tri.a[k] > 0.0f || (tri.a[k] == 0.0f && tri.b[k] > 0.0f);
+        }
+
+        // turn the per-vertex values into plane equations: q = E0*q0 + E1*q1 + E2*q2, normalized
+        auto plane = [&tri, area](float* q) {
+            float qa = (tri.a[0] * q[0] + tri.a[1] * q[1] + tri.a[2] * q[2]) / area;
+            float qb = (tri.b[0] * q[0] + tri.b[1] * q[1] + tri.b[2] * q[2]) / area;
+            float qc = (tri.c[0] * q[0] + tri.c[1] * q[1] + tri.c[2] * q[2]) / area;
+            q[0] = qa; q[1] = qb; q[2] = qc;
+        };
+        plane(tri.z);
+        plane(tri.invW);
+        for (int channel = 0; channel < 3; channel++) {
+            plane(tri.colorOverW[channel]);
+        }
+
+        tri.x0 = std::max(0, static_cast<int>(std::floor(std::min({ x[0], x[1], x[2] }))));
+        tri.y0 = std::max(0, static_cast<int>(std::floor(std::min({ y[0], y[1], y[2] }))));
+        tri.x1 = std::min(static_cast<int>(width) - 1, static_cast<int>(std::max({ x[0], x[1], x[2] })));
+        tri.y1 = std::min(static_cast<int>(height) - 1, static_cast<int>(std::max({ y[0], y[1], y[2] })));
+        if (tri.x0 > tri.x1 || tri.y0 > tri.y1) {
+            return;
+        }
+        tri.depthTest = depthTest;
+
+        uint32_t index = static_cast<uint32_t>(triangles.size());
+        triangles.push_back(tri);
+        for (int ty = tri.y0 / TILE_SIZE; ty <= tri.y1 / TILE_SIZE; ty++) {
+            for (int tx = tri.x0 / TILE_SIZE; tx <= tri.x1 / TILE_SIZE; tx++) {
+                bins[ty * tilesX + tx].push_back(index);
+            }
+        }
+    }
+
+    void rasterizeTile(size_t tile) {
+        int tileX = static_cast<int>(tile % tilesX) * TILE_SIZE;
+        int tileY = static_cast<int>(tile / tilesX) * TILE_SIZE;
+
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 scale = _mm_set1_ps(255.0f);
+        const __m128i alpha = _mm_set1_epi32(0xFF000000u);
+
+        for (uint32_t index : bins[tile]) {
+            const Triangle& tri = triangles[index];
+            int x0 = std::max(tri.x0, tileX) & ~3;
+            int x1 = std::min(tri.x1, tileX + TILE_SIZE - 1);
+            int y0 = std::max(tri.y0, tileY);
+            int y1 = std::min(tri.y1, tileY + TILE_SIZE - 1);
+
+            __m128 a[3], b[3], c[3], topLeft[3];
+            for (int k = 0; k < 3; k++) {
+                a[k] = _mm_set1_ps(tri.a[k]);
+                b[k] = _mm_set1_ps(tri.b[k]);
+                c[k] = _mm_set1_ps(tri.c[k]);
+                topLeft[k] = _mm_castsi128_ps(_mm_set1_epi32(tri.topLeft[k] ? -1 : 0));
+            }
+            auto evaluate = [](const float* q, __m128 px, __m128 py) {
+                return _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(q[0]), px), _mm_mul_ps(_mm_set1_ps(q[1]), py)), _mm_set1_ps(q[2]));
+            };
+
+            const __m128 px0 = _mm_add_ps(_mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f), _mm_set1_ps(x0 + 0.5f));
+
+            for (int y = y0; y <= y1; y++) {
+                const __m128 py = _mm_set1_ps(y + 0.5f);
+                __m128 px = px0;
+                uint32_t* colorRow = &color[y * stride];
+                float* depthRow = &depth[y * stride];
+
+                for (int x = x0; x <= x1; x += 4, px = _mm_add_ps(px, _mm_set1_ps(4.0f))) {
+                    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+                    for (int k = 0; k < 3; k++) {
+                        __m128 e = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[k], px), _mm_mul_ps(b[k], py)), c[k]);
+                        __m128 covered = _mm_or_ps(_mm_cmpgt_ps(e, zero), _mm_and_ps(_mm_cmpeq_ps(e, zero), topLeft[k]));
+                        inside = _mm_and_ps(inside, covered);
+                    }
+                    if (_mm_movemask_ps(inside) == 0) continue;
+
+                    __m128 z = evaluate(tri.z, px, py);
+                    if (tri.depthTest) {
+                        __m128 current = _mm_loadu_ps(depthRow + x);
+                        inside = _mm_and_ps(inside, _mm_cmplt_ps(z, current));
+                        if (_mm_movemask_ps(inside) == 0) continue;
+                        _mm_storeu_ps(depthRow + x, _mm_or_ps(_mm_and_ps(inside, z), _mm_andnot_ps(inside, current)));
+                    }
+
+                    __m128 w = _mm_div_ps(one, evaluate(tri.invW, px, py));
+                    __m128i packed = alpha;
+                    for (int channel = 0; channel < 3; channel++) {
+                        __m128 value = _mm_mul_ps(evaluate(tri.colorOverW[channel], px, py), w);
+                        value = _mm_min_ps(_mm_max_ps(value, zero), one);
+                        packed = _mm_or_si128(packed, _mm_slli_epi32(_mm_cvtps_epi32(_mm_mul_ps(value, scale)), channel * 8));
+                    }
+
+                    __m128i mask = _mm_castps_si128(inside);
+                    __m128i current = _mm_loadu_si128(reinterpret_cast<const __m128i*>(colorRow + x));
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(colorRow + x), _mm_or_si128(_mm_and_si128(mask, packed), _mm_andnot_si128(mask, current)));
+                }
+            }
+        }
+    }
+};
+
+// Block-compressed texture encoder. Every 4x4 block is encoded on its own,
+// so images are split into rows of blocks across the worker pool and written
+// straight to the destination, which may be a mapped staging buffer: each
+// output byte is written once, in order, and never read back. BC7 blocks all
+// use mode 6 (one RGBA subset, 7.7.7.7 endpoints with p-bits, 4-bit
+// indices), which handles most content well and keeps the search small.
+//
+// Endpoints are the extreme projections onto an axis through the block's
+// mean: Fast takes the bounding box diagonal, oriented by how each channel
+// correlates with the widest one; Normal and High take the principal axis
+// and refit the endpoints by least squares for the chosen indices, once for
+// Normal and until the error stops improving for High. High also tries all
+// four BC7 p-bit combinations instead of rounding each endpoint on its own.
+// The search is SSE2 only, with no AVX path: the Win32 build targets the
+// default architecture, as for the occlusion culler and software rasterizer.
+class BlockEncoder {
+public:
+    BlockEncoder(BlockFormat format, BlockQuality quality, bool parallel = true) : format(format), quality(quality), parallel(parallel) {}
+
+    static size_t blockBytes(BlockFormat format) {
+        return format == BlockFormat::BC1 ? 8 : 16;
+    }
+
+    static size_t encodedSize(BlockFormat format, uint32_t width, uint32_t height) {
+        return size_t((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+    }
+
+    static VkFormat vulkanFormat(BlockFormat format) {
+        switch (format) {
+        case BlockFormat::BC1: return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+        case BlockFormat::BC3: return VK_FORMAT_BC3_UNORM_BLOCK;
+        default: return VK_FORMAT_BC7_UNORM_BLOCK;
+        }
+    }
+
+    // Tightly packed RGBA rows; edge blocks repeat the last column and row.
+    void encode(const uint8_t* rgba, uint32_t width, uint32_t height, uint8_t* out) const {
+        encodeImage(rgba, width, height, out);
+    }
+
+    // Float images are clamped to 0..1 and rounded per block as they're read.
+    void encode(const float* rgba, uint32_t width, uint32_t height, uint8_t* out) const {
+        encodeImage(rgba, width, height, out);
+    }
+
+    // Reference decoder for validation; BC7 handles mode 6 only and
+    // decodes other modes to transparent black.
+    static void decodeBlock(BlockFormat format, const uint8_t* block, uint8_t rgba[64]) {
+        if (format == BlockFormat::BC7) {
+            decodeMode6(block, rgba);
+            return;
+        }
+
+        const uint8_t* color = format == BlockFormat::BC3 ? block + 8 : block;
+        uint16_t c0 = color[0] | (color[1] << 8);
+        uint16_t c1 = color[2] | (color[3] << 8);
+        int palette[4][4];
+        expand565(c0, palette[0]);
+        expand565(c1, palette[1]);
+        // BC3 color is always four-color, whatever the endpoint order
+        bool fourColor = c0 > c1 || format == BlockFormat::BC3;
+        for (int c = 0; c < 3; c++) {
+            palette[2][c] = fourColor ? (2 * palette[0][c] + palette[1][c]) / 3 : (palette[0][c] + palette[1][c]) / 2;
+            palette[3][c] = fourColor ? (palette[0][c] + 2 * palette[1][c]) / 3 : 0;
+        }
+        palette[0][3] = palette[1][3] = palette[2][3] = 255;
+        palette[3][3] = fourColor ? 255 : 0;
+
+        uint32_t indices = color[4] | (color[5] << 8) | (color[6] << 16) | (uint32_t(color[7]) << 24);
+        for (int i = 0; i < 16; i++) {
+            const int* entry = palette[(indices >> (2 * i)) & 3];
+            for (int c = 0; c < 4; c++) {
+                rgba[i * 4 + c] = static_cast<uint8_t>(entry[c]);
+            }
+        }
+
+        if (format == BlockFormat::BC3) {
+            int alpha[8];
+            alphaPalette(block[0], block[1], alpha);
+            uint64_t bits = 0;
+            for (int b = 0; b < 6; b++) {
+                bits |= uint64_t(block[2 + b]) << (8 * b);
+            }
+            for (int i = 0; i < 16; i++) {
+                rgba[i * 4 + 3] = static_cast<uint8_t>(alpha[(bits >> (3 * i)) & 7]);
+            }
+        }
+    }
+
+private:
+    // channels split out for SSE, plus the per-channel bounding box
+    struct Block {
+        alignas(16) float channel[4][16];
+        uint8_t min[4];
+        uint8_t max[4];
+    };
+
+    BlockFormat format;
+    BlockQuality quality;
+    bool parallel;
+
+    static constexpr int BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+    static void loadPixel(const uint8_t* source, uint8_t* pixel) {
+        memcpy(pixel, source, 4);
+    }
+
+    static void loadPixel(const float* source, uint8_t* pixel) {
+        for (int c = 0; c < 4; c++) {
+            pixel[c] = static_cast<uint8_t>(std::min(std::max(source[c], 0.0f), 1.0f) * 255.0f + 0.5f);
+        }
+    }
+
+    template<typename T>
+    void encodeImage(const T* rgba, uint32_t width, uint32_t height, uint8_t* out) const {
+        uint32_t blocksWide = (width + 3) / 4;
+        uint32_t blocksHigh = (height + 3) / 4;
+        size_t bytes = blockBytes(format);
+
+        auto encodeRow = [&](size_t row) {
+            alignas(16) uint8_t pixels[64];
+            uint32_t by = static_cast<uint32_t>(row);
+            for (uint32_t bx = 0; bx < blocksWide; bx++) {
+                for (uint32_t i = 0; i < 16; i++) {
+                    uint32_t x = std::min(bx * 4 + (i & 3), width - 1);
+                    uint32_t y = std::min(by * 4 + (i >> 2), height - 1);
+                    loadPixel(rgba + (size_t(y) * width + x) * 4, pixels + i * 4);
+                }
+                encodeBlock(pixels, out + (size_t(by) * blocksWide + bx) * bytes);
+            }
+        };
+
+        // workerPool() runs one job at a time for the simulation and render
+        // threads; a background caller encodes serially rather than hold it
+        // for a whole texture and stall both frame loops
+        if (parallel) {
+            workerPool().run(blocksHigh, encodeRow);
+        }
+        else {
+            for (size_t row = 0; row < blocksHigh; row++) {
+                encodeRow(row);
+            }
+        }
+    }
+
+    void encodeBlock(const uint8_t* pixels, uint8_t* out) const {
+        Block block;
+        __m128i p0 = _mm_load_si128(reinterpret_cast<const __m128i*>(pixels));
+        __m128i p1 = _mm_load_si128(reinterpret_cast<const __m128i*>(pixels + 16));
+        __m128i p2 = _mm_load_si128(reinterpret_cast<const __m128i*>(pixels + 32));
+        __m128i p3 = _mm_load_si128(reinterpret_cast<const __m128i*>(pixels + 48));
+        __m128i low = _mm_min_epu8(_mm_min_epu8(p0, p1), _mm_min_epu8(p2, p3));
+        __m128i high = _mm_max_epu8(_mm_max_epu8(p0, p1), _mm_max_epu8(p2, p3));
+        low = _mm_min_epu8(low, _mm_srli_si128(low, 8));
+        low = _mm_min_epu8(low, _mm_srli_si128(low, 4));
+        high = _mm_max_epu8(high, _mm_srli_si128(high, 8));
+        high = _mm_max_epu8(high, _mm_srli_si128(high, 4));
+        int lowBits = _mm_cvtsi128_si32(low);
+        int highBits = _mm_cvtsi128_si32(high);
+        memcpy(block.min, &lowBits, 4);
+        memcpy(block.max, &highBits, 4);
+
+        for (int i = 0; i < 16; i++) {
+            for (int c = 0; c < 4; c++) {
+                block.channel[c][i] = pixels[i * 4 + c];
+            }
+        }
+
+        switch (format) {
+        case BlockFormat::BC1:
+            encodeColor(block, true, out);
+            break;
+        case BlockFormat::BC3:
+            encodeAlpha(block, out);
+            encodeColor(block, false, out + 8);
+            break;
+        case BlockFormat::BC7:
+            encodeMode6(block, out);
+            break;
+        }
+    }
+
+    static float horizontalSum(__m128 v) {
+        v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+        v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+        return _mm_cvtss_f32(v);
+    }
+
+    static float sum16(const float* v) {
+        return horizontalSum(_mm_add_ps(_mm_add_ps(_mm_load_ps(v), _mm_load_ps(v + 4)), _mm_add_ps(_mm_load_ps(v + 8), _mm_load_ps(v + 12))));
+    }
+
+    // sum of (a - meanA) * (b - meanB) over the block
+    static float covariance16(const float* a, float meanA, const float* b, float meanB) {
+        __m128 ma = _mm_set1_ps(meanA), mb = _mm_set1_ps(meanB);
+        __m128 sum = _mm_setzero_ps();
+        for (int i = 0; i < 16; i += 4) {
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_sub_ps(_mm_load_ps(a + i), ma), _mm_sub_ps(_mm_load_ps(b + i), mb)));
+        }
+        return horizontalSum(sum);
+    }
+
+    // t[i] = dot(pixel[i] - origin, axis) over the first `channels` channels
+    static void project(const Block& block, int channels, const float* origin, const float* axis, float* t) {
+        for (int i = 0; i < 16; i += 4) {
+            __m128 dot = _mm_setzero_ps();
+            for (int c = 0; c < channels; c++) {
+                __m128 d = _mm_sub_ps(_mm_load_ps(block.channel[c] + i), _mm_set1_ps(origin[c]));
+                dot = _mm_add_ps(dot, _mm_mul_ps(d, _mm_set1_ps(axis[c])));
+            }
+            _mm_store_ps(t + i, dot);
+        }
+    }
+
+    // Nearest of steps + 1 evenly spaced points from e0 to e1 for each pixel.
+    static void selectIndices(const Block& block, int channels, const float* e0, const float* e1, int steps, int* k) {
+        float axis[4] = {};
+        float lengthSquared = 0.0f;
+        for (int c = 0; c < channels; c++) {
+            axis[c] = e1[c] - e0[c];
+            lengthSquared += axis[c] * axis[c];
+        }
+        if (lengthSquared < 1e-6f) {
+            std::fill(k, k + 16, 0);
+            return;
+        }
+
+        alignas(16) float t[16];
+        project(block, channels, e0, axis, t);
+        __m128 scale = _mm_set1_ps(steps / lengthSquared);
+        __m128 top = _mm_set1_ps(static_cast<float>(steps));
+        for (int i = 0; i < 16; i += 4) {
+            __m128 position = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_load_ps(t + i), scale), _mm_setzero_ps()), top);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(k + i), _mm_cvtps_epi32(position));
+        }
+    }
+
+    void findEndpoints(const Block& block, int channels, float* e0, float* e1) const {
+        float mean[4], axis[4];
+        int widest = 0;
+        for (int c = 0; c < channels; c++) {
+            mean[c] = sum16(block.channel[c]) * (1.0f / 16.0f);
+            axis[c] = float(block.max[c] - block.min[c]);
+            if (axis[c] > axis[widest]) widest = c;
+        }
+
+        float covariance[4][4];
+        for (int a = 0; a < channels; a++) {
+            for (int b = a; b < channels; b++) {
+                covariance[a][b] = covariance[b][a] = covariance16(block.channel[a], mean[a], block.channel[b], mean[b]);
+            }
+        }
+
+        // the box diagonal runs the same way as the data in every channel
+        for (int c = 0; c < channels; c++) {
+            if (c != widest && covariance[c][widest] < 0.0f) axis[c] = -axis[c];
+        }
+
+        if (quality != BlockQuality::Fast) {
+            // power iteration towards the principal axis
+            for (int iteration = 0; iteration < 8; iteration++) {
+                float next[4] = {};
+                float largest = 0.0f;
+                for (int a = 0; a < channels; a++) {
+                    for (int b = 0; b < channels; b++) {
+                        next[a] += covariance[a][b] * axis[b];
+                    }
+                    largest = std::max(largest, std::abs(next[a]));
+                }
+                if (largest < 1e-6f) break;
+                for (int c = 0; c < channels; c++) {
+                    axis[c] = next[c] / largest;
+                }
+            }
+        }
+
+        alignas(16) float t[16];
+        project(block, channels, mean, axis, t);
+        float tMin = t[0], tMax = t[0];
+        for (int i = 1; i < 16; i++) {
+            tMin = std::min(tMin, t[i]);
+            tMax = std::max(tMax, t[i]);
+        }
+
+        float lengthSquared = 0.0f;
+        for (int c = 0; c < channels; c++) {
+            lengthSquared += axis[c] * axis[c];
+        }
+        if (lengthSquared < 1e-6f) {
+            lengthSquared = 1.0f;
+        }
+        for (int c = 0; c < channels; c++) {
+            e0[c] = std::min(std::max(mean[c] + axis[c] * tMin / lengthSquared, 0.0f), 255.0f);
+            e1[c] = std::min(std::max(mean[c] + axis[c] * tMax / lengthSquared, 0.0f), 255.0f);
+        }
+    }
+
+    // Least-squares endpoints for fixed interpolation weights; pixels whose
+    // weight is negative are left out. False when the weights can't
+    // separate two endpoints (all pixels on one index).
+    static bool fitEndpoints(const Block& block, int channels, const float* weights, float* e0, float* e1) {
+        float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+        float ax[4] = {}, bx[4] = {};
+        for (int i = 0; i < 16; i++) {
+            float b = weights[i];
+            if (b < 0.0f) continue;
+            float a = 1.0f - b;
+            aa += a * a;
+            bb += b * b;
+            ab += a * b;
+            for (int c = 0; c < channels; c++) {
+                ax[c] += a * block.channel[c][i];
+                bx[c] += b * block.channel[c][i];
+            }
+        }
+
+        float determinant = aa * bb - ab * ab;
+        if (std::abs(determinant) < 1e-4f) return false;
+
+        for (int c = 0; c < channels; c++) {
+            e0[c] = std::min(std::max((ax[c] * bb - bx[c] * ab) / determinant, 0.0f), 255.0f);
+            e1[c] = std::min(std::max((bx[c] * aa - ax[c] * ab) / determinant, 0.0f), 255.0f);
+        }
+        return true;
+    }
+
+    int refinements() const {
+        return quality == BlockQuality::Fast ? 0 : quality == BlockQuality::Normal ? 1 : 8;
+    }
+
+    static void expand565(uint16_t color, int* rgb) {
+        int r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+        rgb[0] = (r << 3) | (r >> 2);
+        rgb[1] = (g << 2) | (g >> 4);
+        rgb[2] = (b << 3) | (b >> 2);
+    }
+
+    static uint16_t quantize565(const float* rgb) {
+        int r = static_cast<int>(rgb[0] * (31.0f / 255.0f) + 0.5f);
+        int g = static_cast<int>(rgb[1] * (63.0f / 255.0f) + 0.5f);
+        int b = static_cast<int>(rgb[2] * (31.0f / 255.0f) + 0.5f);
+        return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+    }
+
+    struct ColorFit {
+        uint16_t c0, c1;
+        int k[16];
+        float error;
+    };
+
+    // Quantizes the endpoints and picks indices along them; k is the
+    // position from c0 (0) to c1 (steps), -1 for transparent pixels.
+    static void fitColor(const Block& block, const float* e0, const float* e1, int steps, bool transparent, ColorFit& fit) {
+        fit.c0 = quantize565(e0);
+        fit.c1 = quantize565(e1);
+        int q0[3], q1[3];
+        expand565(fit.c0, q0);
+        expand565(fit.c1, q1);
+        float f0[3] = { float(q0[0]), float(q0[1]), float(q0[2]) };
+        float f1[3] = { float(q1[0]), float(q1[1]), float(q1[2]) };
+        selectIndices(block, 3, f0, f1, steps, fit.k);
+
+        // the palette the hardware decodes, not the ideal one
+        int palette[4][3];
+        for (int c = 0; c < 3; c++) {
+            palette[0][c] = q0[c];
+            palette[steps][c] = q1[c];
+            if (steps == 3) {
+                palette[1][c] = (2 * q0[c] + q1[c]) / 3;
+                palette[2][c] = (q0[c] + 2 * q1[c]) / 3;
+            }
+            else {
+                palette[1][c] = (q0[c] + q1[c]) / 2;
+            }
+        }
+
+        fit.error = 0.0f;
+        for (int i = 0; i < 16; i++) {
+            if (transparent && block.channel[3][i] < 128.0f) {
+                fit.k[i] = -1;
+                continue;
+            }
+            for (int c = 0; c < 3; c++) {
+                float d = palette[fit.k[i]][c] - block.channel[c][i];
+                fit.error += d * d;
+            }
+        }
+    }
+
+    // BC1 block, or the color half of BC3. BC1 switches to three colors plus
+    // transparent when any pixel has alpha below 128.
+    void encodeColor(const Block& block, bool allowTransparent, uint8_t* out) const {
+        bool transparent = allowTransparent && block.min[3] < 128;
+        int steps = transparent ? 2 : 3;
+
+        float e0[4], e1[4];
+        findEndpoints(block, 3, e0, e1);
+        ColorFit best;
+        fitColor(block, e0, e1, steps, transparent, best);
+
+        for (int iteration = 0; iteration < refinements(); iteration++) {
+            float weights[16];
+            for (int i = 0; i < 16; i++) {
+                weights[i] = best.k[i] < 0 ? -1.0f : float(best.k[i]) / steps;
+            }
+            if (!fitEndpoints(block, 3, weights, e0, e1)) break;
+
+            ColorFit candidate;
+            fitColor(block, e0, e1, steps, transparent, candidate);
+            if (candidate.error >= best.error) break;
+            best = candidate;
+        }
+
+        // four colors need c0 > c1 and three need c0 <= c1; swapping the
+        // endpoints reverses the positions
+        uint16_t c0 = best.c0, c1 = best.c1;
+        bool reverse = transparent ? c0 > c1 : c0 < c1;
+        if (reverse) {
+            std::swap(c0, c1);
+        }
+
+        static const int fourColorIndex[4] = { 0, 2, 3, 1 };
+        static const int threeColorIndex[3] = { 0, 2, 1 };
+        uint32_t indices = 0;
+        for (int i = 0; i < 16; i++) {
+            int k = best.k[i];
+            int index;
+            if (k < 0) {
+                index = 3;
+            }
+            else {
+                if (reverse) k = steps - k;
+                index = transparent ? threeColorIndex[k] : c0 == c1 ? 0 : fourColorIndex[k];
+            }
+            indices |= uint32_t(index) << (2 * i);
+        }
+
+        out[0] = static_cast<uint8_t>(c0);
+        out[1] = static_cast<uint8_t>(c0 >> 8);
+        out[2] = static_cast<uint8_t>(c1);
+        out[3] = static_cast<uint8_t>(c1 >> 8);
+        for (int b = 0; b < 4; b++) {
+            out[4 + b] = static_cast<uint8_t>(indices >> (8 * b));
+        }
+    }
+
+    static void alphaPalette(int a0, int a1, int* alpha) {
+        alpha[0] = a0;
+        alpha[1] = a1;
+        if (a0 > a1) {
+            for (int i = 1; i < 7; i++) {
+                alpha[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+            }
+        }
+        else {
+            for (int i = 1; i < 5; i++) {
+                alpha[i + 1] = ((5 - i) * a0 + i * a1) / 5;
+            }
+            alpha[6] = 0;
+            alpha[7] = 255;
+        }
+    }
+
+    // BC3 alpha: the block's alpha range split into eight steps.
+    static void encodeAlpha(const Block& block, uint8_t* out) {
+        int a0 = block.max[3], a1 = block.min[3];
+        out[0] = static_cast<uint8_t>(a0);
+        out[1] = static_cast<uint8_t>(a1);
+
+        uint64_t bits = 0;
+        if (a0 > a1) {
+            float scale = 7.0f / (a0 - a1);
+            for (int i = 0; i < 16; i++) {
+                int k = static_cast<int>((a0 - block.channel[3][i]) * scale + 0.5f);
+                int index = k == 0 ? 0 : k == 7 ? 1 : k + 1;
+                bits |= uint64_t(index) << (3 * i);
+            }
+        }
+        for (int b = 0; b < 6; b++) {
+            out[2 + b] = static_cast<uint8_t>(bits >> (8 * b));
+        }
+    }
+
+    struct Mode6Fit {
+        int q0[4], q1[4];
+        int p0, p1;
+        int k[16];
+        float error;
+    };
+
+    static void quantizeMode6(const float* e, int p, int* q) {
+        for (int c = 0; c < 4; c++) {
+            q[c] = std::min(std::max(static_cast<int>((e[c] - p) * 0.5f + 0.5f), 0), 127);
+        }
+    }
+
+    static float quantizationError(const float* e, const int* q, int p) {
+        float error = 0.0f;
+        for (int c = 0; c < 4; c++) {
+            float d = float(q[c] * 2 + p) - e[c];
+            error += d * d;
+        }
+        return error;
+    }
+
+    static void fitMode6(const Block& block, const float* e0, const float* e1, int p0, int p1, Mode6Fit& fit) {
+        fit.p0 = p0;
+        fit.p1 = p1;
+        quantizeMode6(e0, p0, fit.q0);
+        quantizeMode6(e1, p1, fit.q1);
+
+        int v0[4], v1[4];
+        float f0[4], f1[4];
+        for (int c = 0; c < 4; c++) {
+            v0[c] = fit.q0[c] * 2 + p0;
+            v1[c] = fit.q1[c] * 2 + p1;
+            f0[c] = float(v0[c]);
+            f1[c] = float(v1[c]);
+        }
+        selectIndices(block, 4, f0, f1, 15, fit.k);
+
+        fit.error = 0.0f;
+        for (int i = 0; i < 16; i++) {
+            int w = BC7_WEIGHTS[fit.k[i]];
+            for (int c = 0; c < 4; c++) {
+                float d = float(((64 - w) * v0[c] + w * v1[c] + 32) >> 6) - block.channel[c][i];
+                fit.error += d * d;
+            }
+        }
+    }
+
+    void bestMode6(const Block& block, const float* e0, const float* e1, Mode6Fit& best) const {
+        if (quality == BlockQuality::High) {
+            fitMode6(block, e0, e1, 0, 0, best);
+            for (int p = 1; p < 4; p++) {
+                Mode6Fit candidate;
+                fitMode6(block, e0, e1, p & 1, p >> 1, candidate);
+                if (candidate.error < best.error) best = candidate;
+            }
+            return;
+        }
+
+        // each endpoint takes the p-bit that rounds it best
+        int p[2];
+        const float* endpoints[2] = { e0, e1 };
+        for (int e = 0; e < 2; e++) {
+            int q0[4], q1[4];
+            quantizeMode6(endpoints[e], 0, q0);
+            quantizeMode6(endpoints[e], 1, q1);
+            p[e] = quantizationError(endpoints[e], q1, 1) < quantizationError(endpoints[e], q0, 0) ? 1 : 0;
+        }
+        fitMode6(block, e0, e1, p[0], p[1], best);
+    }
+
+    void encodeMode6(const Block& block, uint8_t* out) const {
+        float e0[4], e1[4];
+        findEndpoints(block, 4, e0, e1);
+        Mode6Fit best;
+        bestMode6(block, e0, e1, best);
+
+        for (int iteration = 0; iteration < refinements(); iteration++) {
+            float weights[16];
+            for (int i = 0; i < 16; i++) {
+                weights[i] = BC7_WEIGHTS[best.k[i]] * (1.0f / 64.0f);
+            }
+            if (!fitEndpoints(block, 4, weights, e0, e1)) break;
+
+            Mode6Fit candidate;
+            bestMode6(block, e0, e1, candidate);
+            if (candidate.error >= best.error) break;
+            best = candidate;
+        }
+
+        // the first pixel's index drops its top bit, so it must be below 8
+        if (best.k[0] >= 8) {
+            std::swap(best.q0, best.q1);
+            std::swap(best.p0, best.p1);
+            for (int i = 0; i < 16; i++) {
+                best.k[i] = 15 - best.k[i];
+            }
+        }
+
+        memset(out, 0, 16);
+        uint32_t position = 0;
+        auto put = [&](uint32_t value, uint32_t bits) {
+            for (uint32_t b = 0; b < bits; b++, position++) {
+                out[position >> 3] |= static_cast<uint8_t>(((value >> b) & 1) << (position & 7));
+            }
+        };
+
+        put(1 << 6, 7);
+        for (int c = 0; c < 4; c++) {
+            put(best.q0[c], 7);
+            put(best.q1[c], 7);
+        }
+        put(best.p0, 1);
+        put(best.p1, 1);
+        put(best.k[0], 3);
+        for (int i = 1; i < 16; i++) {
+            put(best.k[i], 4);
+        }
+    }
+
+    static void decodeMode6(const uint8_t* block, uint8_t* rgba) {
+        uint32_t position = 0;
+        auto get = [&](uint32_t bits) {
+            uint32_t value = 0;
+            for (uint32_t b = 0; b < bits; b++, position++) {
+                value |= ((block[position >> 3] >> (position & 7)) & 1u) << b;
+            }
+            return value;
+        };
+
+        if (get(7) != (1 << 6)) {
+            memset(rgba, 0, 64);
+            return;
+        }
+
+        int v0[4], v1[4];
+        for (int c = 0; c < 4; c++) {
+            v0[c] = get(7) << 1;
+            v1[c] = get(7) << 1;
+        }
+        uint32_t p0 = get(1), p1 = get(1);
+        for (int c = 0; c < 4; c++) {
+            v0[c] |= p0;
+            v1[c] |= p1;
+        }
+
+        for (int i = 0; i < 16; i++) {
+            int w = BC7_WEIGHTS[get(i == 0 ? 3 : 4)];
+            for (int c = 0; c < 4; c++) {
+                rgba[i * 4 + c] = static_cast<uint8_t>(((64 - w) * v0[c] + w * v1[c] + 32) >> 6);
+            }
+        }
+    }
+};
+
+// Mixed test content for the encoder: smooth gradients, fine detail, hard
+// edges and an alpha ramp with a cut-out.
+inline void proceduralTexture(uint32_t size, std::vector<uint8_t>& rgba) {
+    uint32_t state = 13;
+    auto random = [&state]() {
+        state = state * 1664525u + 1013904223u;
+        return (state >> 8) * (1.0f / 16777216.0f);
+    };
+
+    rgba.resize(size_t(size) * size * 4);
+    for (uint32_t y = 0; y < size; y++) {
+        for (uint32_t x = 0; x < size; x++) {
+            float u = float(x) / size, v = float(y) / size;
+            glm::vec3 color(0.5f + 0.5f * std::sin(u * 9.0f), 0.5f + 0.5f * std::sin(v * 7.0f + 1.0f), 0.5f + 0.5f * std::cos((u + v) * 5.0f));
+            if (((x / 64) + (y / 64)) % 2 == 0) {
+                color = glm::vec3(1.0f) - color;
+            }
+            if (u > 0.5f && v > 0.5f) {
+                color *= 0.8f + 0.2f * random();
+            }
+            float radius = glm::length(glm::vec2(u - 0.5f, v - 0.5f));
+            float alpha = radius < 0.1f ? 0.0f : std::min(1.0f, radius * 1.5f);
+
+            uint8_t* pixel = &rgba[(size_t(y) * size + x) * 4];
+            pixel[0] = static_cast<uint8_t>(color.r * 255.0f + 0.5f);
+            pixel[1] = static_cast<uint8_t>(color.g * 255.0f + 0.5f);
+            pixel[2] = static_cast<uint8_t>(color.b * 255.0f + 0.5f);
+            pixel[3] = static_cast<uint8_t>(alpha * 255.0f + 0.5f);
+        }
+    }
+}
+
+// Writes encoded blocks as a DDS file: DXT1/DXT5 four-CCs for BC1/BC3 and
+// the DX10 extension header for BC7.
+inline bool writeDds(const std::string& path, BlockFormat format, uint32_t width, uint32_t height, const uint8_t* blocks) {
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open()) return false;
+
+    uint32_t header[32] = {};
+    memcpy(&header[0], "DDS ", 4);
+    header[1] = 124;
+    header[2] = 0x1 | 0x2 | 0x4 | 0x1000 | 0x80000; // caps, height, width, pixel format, linear size
+    header[3] = height;
+    header[4] = width;
+    header[5] = static_cast<uint32_t>(BlockEncoder::encodedSize(format, width, height));
+    header[7] = 1;
+    header[19] = 32;
+    header[20] = 0x4; // four-CC
+    memcpy(&header[21], format == BlockFormat::BC1 ? "DXT1" : format == BlockFormat::BC3 ? "DXT5" : "DX10", 4);
+    header[27] = 0x1000; // texture
+    file.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+    if (format == BlockFormat::BC7) {
+        uint32_t dx10[5] = { 98, 3, 0, 1, 0 }; // BC7_UNORM, 2D, no flags, one layer
+        file.write(reinterpret_cast<const char*>(dx10), sizeof(dx10));
+    }
+
+    file.write(reinterpret_cast<const char*>(blocks), header[5]);
+    return file.good();
+}
+
+struct Texture {
+    VkImage image;
+    VkDeviceMemory memory;
+    VkImageView view;
+    VkFormat format;
+};
+
+// A texture copy recorded on the render thread; its staging buffer and
+// command buffer live until the frame slot that submitted it comes round.
+struct StagingUpload {
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+    VkCommandBuffer commandBuffer;
+};
+
+// Reads whole files with chunk-aligned positional reads. On Linux the chunks
+// go through an io_uring so a file has several reads in flight at once;
+// where the kernel refuses the ring (or IORING_OP_READ), and on other
+// platforms, they are plain pread/ReadFile calls. One reader per thread.
+class FileReader {
+public:
+    FileReader() {
+#ifdef ASSET_IO_URING
+        openRing(ASSET_READ_QUEUE_DEPTH);
+#endif
+    }
+
+    ~FileReader() {
+#ifdef ASSET_IO_URING
+        closeRing();
+#endif
+    }
+
+    FileReader(const FileReader&) = delete;
+    FileReader& operator=(const FileReader&) = delete;
+
+    bool usingRing() const {
+#ifdef ASSET_IO_URING
+        return ring >= 0;
+#else
+        return false;
+#endif
+    }
+
+    bool read(const std::string& path, std::vector<uint8_t>& data) {
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER size;
+        bool ok = GetFileSizeEx(file, &size) != 0;
+        if (ok) {
+            data.resize(static_cast<size_t>(size.QuadPart));
+            for (size_t offset = 0; ok && offset < data.size(); offset += ASSET_READ_CHUNK) {
+                DWORD length = static_cast<DWORD>(std::min(ASSET_READ_CHUNK, data.size() - offset));
+                OVERLAPPED position = {};
+                position.Offset = static_cast<DWORD>(offset);
+                position.OffsetHigh = static_cast<DWORD>(uint64_t(offset) >> 32);
+                DWORD got = 0;
+                ok = ReadFile(file, data.data() + offset, length, &got, &position) && got == length;
+            }
+        }
+        CloseHandle(file);
+        return ok;
+#else
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return false;
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            ::close(fd);
+            return false;
+        }
+        data.resize(static_cast<size_t>(info.st_size));
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+        bool ok = false;
+#ifdef ASSET_IO_URING
+        ok = ring >= 0 && readRing(fd, data.data(), data.size());
+#endif
+        // a failed or short ring read falls back to reading it all again
+        if (!ok) {
+            ok = true;
+            for (size_t offset = 0; ok && offset < data.size();) {
+                size_t length = std::min(ASSET_READ_CHUNK, data.size() - offset);
+                ssize_t got = pread(fd, data.data() + offset, length, static_cast<off_t>(offset));
+                if (got < 0 && errno == EINTR) continue;
+                ok = got > 0;
+                offset += ok ? size_t(got) : 0;
+            }
+        }
+        ::close(fd);
+        return ok;
+#endif
+    }
+
+private:
+#ifdef ASSET_IO_URING
+    int ring = -1;
+    unsigned entries = 0;
+    void* sqRing = MAP_FAILED;
+    void* cqRing = MAP_FAILED;
+    size_t sqRingSize = 0, cqRingSize = 0, sqesSize = 0;
+    unsigned* sqTail = nullptr;
+    unsigned* sqMask = nullptr;
+    unsigned* sqArray = nullptr;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned* cqMask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+    void openRing(unsigned depth) {
+        io_uring_params params = {};
+        ring = static_cast<int>(syscall(__NR_io_uring_setup, depth, &params));
+        if (ring < 0) return;
+        entries = params.sq_entries;
+
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) {
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        }
+        sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+        cqRing = single ? sqRing : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+        sqes = static_cast<io_uring_sqe*>(mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQES));
+        if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqes == MAP_FAILED) {
+            closeRing();
+            return;
+        }
+
+        uint8_t* sq = static_cast<uint8_t*>(sqRing);
+        uint8_t* cq = static_cast<uint8_t*>(cqRing);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    }
+
+    void closeRing() {
+        if (sqes != MAP_FAILED) munmap(sqes, sqesSize);
+        if (cqRing != MAP_FAILED && cqRing != sqRing) munmap(cqRing, cqRingSize);
+        if (sqRing != MAP_FAILED) munmap(sqRing, sqRingSize);
+        sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+        sqRing = cqRing = MAP_FAILED;
+        if (ring >= 0) ::close(ring);
+        ring = -1;
+    }
+
+    // Keeps up to `entries` chunk reads in flight until the file is in;
+    // false on any error or short read. A failing io_uring_enter retires the
+    // ring, and this reader uses pread from then on.
+    bool readRing(int fd, uint8_t* buffer, size_t size) {
+        size_t chunks = (size + ASSET_READ_CHUNK - 1) / ASSET_READ_CHUNK;
+        size_t next = 0;
+        unsigned inFlight = 0, unsubmitted = 0;
+        bool ok = true, unsupported = false, broken = false;
+
+        while (inFlight > 0 || (ok && next < chunks)) {
+            while (ok && next < chunks && inFlight < entries) {
+                unsigned tail = *sqTail;
+                unsigned index = tail & *sqMask;
+                size_t offset = next * ASSET_READ_CHUNK;
+                io_uring_sqe& sqe = sqes[index];
+                memset(&sqe, 0, sizeof(sqe));
+                sqe.opcode = IORING_OP_READ;
+                sqe.fd = fd;
+                sqe.off = offset;
+                sqe.addr = reinterpret_cast<uint64_t>(buffer + offset);
+                sqe.len = static_cast<uint32_t>(std::min(ASSET_READ_CHUNK, size - offset));
+                sqe.user_data = next;
+                sqArray[index] = index;
+                __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+                next++;
+                inFlight++;
+                unsubmitted++;
+            }
+
+            if (!broken) {
+                long entered = syscall(__NR_io_uring_enter, ring, unsubmitted, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+                if (entered >= 0) {
+                    unsubmitted -= std::min<unsigned>(unsubmitted, static_cast<unsigned>(entered));
+                }
+                else if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                    // the kernel never took the unsubmitted entries, but reads
+                    // it did take still land in the buffer: wait them out on
+                    // the completion ring before read() reuses it for pread
+                    broken = true;
+                    ok = false;
+                    inFlight -= unsubmitted;
+                    unsubmitted = 0;
+                }
+            }
+            else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+
+            unsigned head = *cqHead;
+            unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            for (; head != tail; head++) {
+                const io_uring_cqe& cqe = cqes[head & *cqMask];
+                size_t offset = size_t(cqe.user_data) * ASSET_READ_CHUNK;
+                unsupported |= cqe.res == -EINVAL;
+                ok &= cqe.res >= 0 && size_t(cqe.res) == std::min(ASSET_READ_CHUNK, size - offset);
+                inFlight--;
+            }
+            __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        }
+
+        // kernels before 5.6 have the ring but not IORING_OP_READ
+        if (unsupported || broken) closeRing();
+        return ok;
+    }
+#endif
+};
+
+// Work done for one asset once its bytes are in memory. decode runs on one
+// of the loader's decoder threads and may replace the bytes with their
+// decompressed form; complete and fail run on the render thread, inside
+// AssetLoader::deliver.
+class AssetJob {
+public:
+    virtual ~AssetJob() {}
+    virtual bool decode(std::vector<uint8_t>&) { return true; }
+    virtual void complete(std::vector<uint8_t>& data) = 0;
+    virtual void fail(const std::string& path) {
+        std::cerr << "failed to load " << path << std::endl;
+    }
+};
+
+struct AssetLoaderStats {
+    uint64_t requested = 0;
+    uint64_t delivered = 0;
+    uint64_t failed = 0;
+    uint64_t late = 0;
+    uint64_t bytesRead = 0;
+    double readSeconds = 0.0;
+};
+
+// Loads files off the render thread. Reader threads take requests by
+// priority, then earliest deadline, decoder threads decode them in the same
+// order, and the render thread picks up finished assets with deliver(),
+// which never waits on the loader: when a decoder holds the completion
+// lock, that frame simply delivers nothing. An asset delivered after its
+// deadline counts as late.
+class AssetLoader {
+public:
+    typedef std::chrono::high_resolution_clock::time_point Deadline;
+
+    ~AssetLoader() {
+        stop();
+    }
+
+    void start(unsigned readerCount, unsigned decoderCount) {
+        running = true;
+        for (unsigned i = 0; i < readerCount; i++) {
+            readers.emplace_back([this]() { readLoop(); });
+        }
+        for (unsigned i = 0; i < decoderCount; i++) {
+            decoders.emplace_back([this]() { decodeLoop(); });
+        }
+    }
+
+    // Requests not yet read or decoded are dropped.
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!running) return;
+            running = false;
+        }
+        readReady.notify_all();
+        decodeReady.notify_all();
+        for (auto& thread : readers) thread.join();
+        for (auto& thread : decoders) thread.join();
+        readers.clear();
+        decoders.clear();
+    }
+
+    // Higher priorities are read first; deadlines order equal priorities.
+    void load(const std::string& path, int priority, Deadline deadline, std::unique_ptr<AssetJob> job) {
+        std::unique_ptr<Request> request(new Request());
+        request->path = path;
+        request->priority = priority;
+        request->deadline = deadline;
+        request->job = std::move(job);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            request->sequence = nextSequence++;
+            push(readQueue, std::move(request));
+        }
+        requested++;
+        readReady.notify_one();
+    }
+
+    // Completes up to maxCount finished assets, most urgent first, on the
+    // calling thread. Allocation-free when there is nothing to deliver.
+    size_t deliver(size_t maxCount) {
+        std::unique_lock<std::mutex> lock(completedMutex, std::try_to_lock);
+        if (!lock.owns_lock() || completed.empty()) return 0;
+        while (!completed.empty() && delivering.size() < maxCount) {
+            delivering.push_back(pop(completed));
+        }
+        lock.unlock();
+
+        auto now = std::chrono::high_resolution_clock::now();
+        for (auto& request : delivering) {
+            if (request->ok) {
+                request->job->complete(request->data);
+            }
+            else {
+                failed++;
+                request->job->fail(request->path);
+            }
+            late += now > request->deadline ? 1 : 0;
+            delivered++;
+        }
+        size_t count = delivering.size();
+        delivering.clear();
+        return count;
+    }
+
+    // Requested but not yet delivered.
+    size_t pending() const {
+        return static_cast<size_t>(requested - delivered);
+    }
+
+    AssetLoaderStats stats() const {
+        AssetLoaderStats result;
+        result.requested = requested;
+        result.delivered = delivered;
+        result.failed = failed;
+        result.late = late;
+        result.bytesRead = bytesRead;
+        result.readSeconds = readNanoseconds * 1e-9;
+        return result;
+    }
+
+private:
+    struct Request {
+        std::string path;
+        int priority = 0;
+        Deadline deadline;
+        uint64_t sequence = 0;
+        std::unique_ptr<AssetJob> job;
+        std::vector<uint8_t> data;
+        bool ok = false;
+    };
+
+    // heap order: the front is the highest priority, then earliest deadline
+    struct LessUrgent {
+        bool operator()(const std::unique_ptr<Request>& a, const std::unique_ptr<Request>& b) const {
+            if (a->priority != b->priority) return a->priority < b->priority;
+            if (a->deadline != b->deadline) return a->deadline > b->deadline;
+            return a->sequence > b->sequence;
+        }
+    };
+
+    std::vector<std::thread> readers;
+    std::vector<std::thread> decoders;
+    std::mutex mutex;
+    std::condition_variable readReady;
+    std::condition_variable decodeReady;
+    std::vector<std::unique_ptr<Request>> readQueue;
+    std::vector<std::unique_ptr<Request>> decodeQueue;
+    uint64_t nextSequence = 0;
+    bool running = false;
+
+    std::mutex completedMutex;
+    std::vector<std::unique_ptr<Request>> completed;
+    // render thread only
+    std::vector<std::unique_ptr<Request>> delivering;
+
+    std::atomic<uint64_t> requested{ 0 };
+    std::atomic<uint64_t> delivered{ 0 };
+    std::atomic<uint64_t> failed{ 0 };
+    std::atomic<uint64_t> late{ 0 };
+    std::atomic<uint64_t> bytesRead{ 0 };
+    std::atomic<uint64_t> readNanoseconds{ 0 };
+
+    static void push(std::vector<std::unique_ptr<Request>>& heap, std::unique_ptr<Request> request) {
+        heap.push_back(std::move(request));
+        std::push_heap(heap.begin(), heap.end(), LessUrgent());
+    }
+
+    static std::unique_ptr<Request> pop(std::vector<std::unique_ptr<Request>>& heap) {
+        std::pop_heap(heap.begin(), heap.end(), LessUrgent());
+        std::unique_ptr<Request> request = std::move(heap.back());
+        heap.pop_back();
+        return request;
+    }
+
+    void readLoop() {
+        PROFILE_THREAD("asset reader");
+        FileReader reader;
+        for (;;) {
+            std::unique_ptr<Request> request;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                readReady.wait(lock, [this]() { return !readQueue.empty() || !running; });
+                if (!running) return;
+                request = pop(readQueue);
+            }
+
+            auto start = std::chrono::high_resolution_clock::now();
+            {
+                PROFILE_ZONE("read asset");
+                try {
+                    request->ok = reader.read(request->path, request->data);
+                }
+                catch (const std::exception&) {
+                    request->ok = false;
+                }
+            }
+            auto end = std::chrono::high_resolution_clock::now();
+            readNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+            bytesRead += request->ok ? request->data.size() : 0;
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                push(decodeQueue, std::move(request));
+            }
+            decodeReady.notify_one();
+        }
+    }
+
+    void decodeLoop() {
+        PROFILE_THREAD("asset decoder");
+        for (;;) {
+            std::unique_ptr<Request> request;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                decodeReady.wait(lock, [this]() { return !decodeQueue.empty() || !running; });
+                if (!running) return;
+                request = pop(decodeQueue);
+            }
+
+            if (request->ok) {
+                PROFILE_ZONE("decode asset");
+                try {
+                    request->ok = request->job->decode(request->data);
+                }
+                catch (const std::exception&) {
+                    request->ok = false;
+                }
+            }
+
+            std::lock_guard<std::mutex> lock(completedMutex);
+            push(completed, std::move(request));
+        }
+    }
+};
+
+// A texture decoded and, when the device samples block formats, block
+// compressed on a decoder thread, waiting for the render thread to upload it.
+struct DecodedTexture {
+    std::string path;
+    uint32_t width;
+    uint32_t height;
+    VkFormat format;
+    std::vector<uint8_t> data;
+};
+
+// Loads a PNG as a texture in `format` (RGBA8 or TEXTURE_FORMAT's block
+// format) and hands the result to the app's upload list.
+class TextureAssetJob : public AssetJob {
+public:
+    TextureAssetJob(const std::string& path, VkFormat format, std::vector<DecodedTexture>* uploads)
+        : path(path), format(format), uploads(uploads) {}
+
+    bool decode(std::vector<uint8_t>& data) override {
+        std::vector<uint8_t> rgba;
+        if (!decodePng(data, rgba, width, height)) return false;
+
+        if (format == VK_FORMAT_R8G8B8A8_UNORM) {
+            data.swap(rgba);
+        }
+        else {
+            data.resize(BlockEncoder::encodedSize(TEXTURE_FORMAT, width, height));
+            BlockEncoder(TEXTURE_FORMAT, TEXTURE_QUALITY, false).encode(rgba.data(), width, height, data.data());
+        }
+        return true;
+    }
+
+    void complete(std::vector<uint8_t>& data) override {
+        uploads->push_back({ path, width, height, format, std::move(data) });
+    }
+
+private:
+    std::string path;
+    VkFormat format;
+    std::vector<DecodedTexture>* uploads;
+    uint32_t width = 0;
+    uint32_t height = 0;
+};
+
+// A group of draws (one material or spatial cell) recorded into its own
+// secondary command buffers, so only buckets that changed get re-recorded.
+struct DrawBucket {
+    DrawList draws;
+    std::vector<VkCommandBuffer> commandBuffers;
+    std::vector<bool> dirty;
+    // per image, as last recorded
+    std::vector<DrawStats> stats;
+
+    void markDirty() {
+        std::fill(dirty.begin(), dirty.end(), true);
+    }
+};
+
+class HelloTriangleApplication {
+public:
+    bool validateParticlesOnStart = false;
+    bool benchmarkVariants = false;
+    bool framePacing = true;
+    std::string capturePngPrefix;
+    std::string captureVideoPath;
+    int captureEvery = 1;
+    std::string goldenImagePath;
+    bool writeGoldenImage = false;
+    bool decoupledThreads = true;
+    bool idleMode = false;
+    bool printStats = false;
+    bool benchmarkDispatch = false;
+    bool asyncComputeAllowed = true;
+    std::vector<std::string> texturePaths;
+    std::string telemetryPath;
+    std::string profilePath;
+    Telemetry::Format telemetryFormat = Telemetry::JsonLines;
+
+    void run() {
+        PROFILE_THREAD("main");
+        if (!profilePath.empty()) {
+            profiler().start(profilePath);
+        }
+        if (!telemetryPath.empty()) {
+            telemetry.start(telemetryPath, telemetryFormat);
+        }
+        initWindow();
+        initVulkan();
+        if (validateParticlesOnStart) {
+            validateParticles(120);
+        }
+        if (benchmarkDispatch) {
+            runDispatchBenchmark();
+        }
+        else {
+            mainLoop();
+        }
+        cleanup();
+        if (!profilePath.empty()) {
+            profiler().stop();
+            if (uint64_t dropped = profiler().droppedEvents()) {
+                std::cout << "profiler dropped " << dropped << " zones" << std::endl;
+            }
+        }
+    }
+
+    bool goldenImageFailed() const {
+        return goldenComparer && goldenComparer->result != 1;
+    }
+
+private:
+    GLFWwindow * window;
+
+    VkInstance instance;
+    VkDebugUtilsMessengerEXT callback;
+    VkSurfaceKHR surface;
+
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    VkDevice device;
+
+    VkQueue graphicsQueue;
+    VkQueue presentQueue;
+
+    // Compute passes run on a dedicated compute family when there is one;
+    // otherwise these alias the graphics queue and pool.
+    bool asyncCompute = false;
+    uint32_t graphicsQueueFamily = 0;
+    uint32_t computeQueueFamily = 0;
+    VkQueue computeQueue;
+    VkCommandPool computeCommandPool;
+    std::vector<VkSemaphore> computeFinishedSemaphores;
+
+    VkSwapchainKHR swapChain;
+    std::vector<VkImage> swapChainImages;
+    VkFormat swapChainImageFormat;
+    VkExtent2D swapChainExtent;
+    std::vector<VkImageView> swapChainImageViews;
+    std::vector<VkFramebuffer> swapChainFramebuffers;
+
+    VkRenderPass renderPass;
+    VkPipelineLayout pipelineLayout;
+    VkPipeline graphicsPipeline;
+
+    VkCommandPool commandPool;
+    std::vector<VkCommandBuffer> commandBuffers;
+    std::vector<bool> commandBuffersDirty;
+
+    std::vector<DrawBucket> drawBuckets;
+    size_t bucketsRecorded = 0;
+    DrawStats drawStats;
+
+    Telemetry telemetry;
+    std::chrono::high_resolution_clock::time_point lastFrameStart;
+
+    OcclusionCuller occlusionCuller;
+
+    std::vector<VkSemaphore> imageAvailableSemaphores;
+    std::vector<VkSemaphore> renderFinishedSemaphores;
+    std::vector<VkFence> inFlightFences;
+    std::vector<VkFence> imagesInFlight;
+    size_t currentFrame  = 0;
+
+    std::vector<FrameArena> frameArenas;
+
+    // static meshes (bind-pose skinned vertices) share one vertex and one index buffer
+    GeometryArena geometryArena{ sizeof(SkinnedVertex), GEOMETRY_ARENA_VERTICES, GEOMETRY_ARENA_INDICES };
+    VkBuffer arenaVertexBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory arenaVertexBufferMemory;
+    VkBuffer arenaIndexBuffer = VK_NULL_HANDLE;
+    VkDeviceMemory arenaIndexBufferMemory;
+
+    SubmitBatcher submitBatcher;
+
+    std::chrono::high_resolution_clock::time_point lastFrameTime = std::chrono::high_resolution_clock::now();
+    float frameDeltaTime = 0.0f;
+
+    // The simulation (main thread, which owns GLFW events) publishes packets
+    // that the render thread picks up; lockstep mode runs both on one thread.
+    // cpuParticles, skinnedCrowd, lights and lightClusterer belong to the
+    // simulation once the loop is running.
+    TripleBuffer<FramePacket> framePackets;
+    uint64_t simulationStep = 0;
+    double simulationTime = 0.0;
+    // the swap chain's aspect, for the simulation's light clustering
+    std::atomic<float> cameraAspect{ float(WIDTH) / HEIGHT };
+    float clusteredAspect = 0.0f;
+    double lastRenderedTime = 0.0;
+    std::atomic<bool> rendering{ false };
+    std::exception_ptr renderError;
+    std::atomic<uint64_t> simulationSteps{ 0 };
+    uint64_t staleFrames = 0;
+    // the newest cursor position from the main thread's callback; the render
+    // thread samples it after pacing, as GLFW can only be polled from main.
+    // x and y may come from neighbouring events.
+    std::atomic<double> latestCursorX{ 0.0 };
+    std::atomic<double> latestCursorY{ 0.0 };
+
+    // idle mode: set by input and window callbacks and by scene changes
+    bool damaged = true;
+    uint64_t idleWakeups = 0;
+
+    ParticleSettings particleSettings;
+    CpuParticleSystem cpuParticles;
+    uint32_t particleSeed = 0;
+    VkPipelineLayout particlePipelineLayout = VK_NULL_HANDLE;
+    VkPipeline particlePipeline = VK_NULL_HANDLE;
+    std::vector<VkBuffer> particleVertexBuffers;
+    std::vector<VkDeviceMemory> particleVertexBuffersMemory;
+    std::vector<void*> particleVertexBuffersMapped;
+    VkBuffer particleStorageBuffer;
+    VkDeviceMemory particleStorageBufferMemory;
+    VkDescriptorSetLayout particleComputeSetLayout;
+    VkDescriptorPool particleDescriptorPool;
+    VkDescriptorSet particleComputeSet;
+    VkPipelineLayout particleComputePipelineLayout;
+    VkPipeline particleComputePipeline;
+    std::vector<VkCommandBuffer> particleComputeCommandBuffers;
+
+    SkinnedCrowd skinnedCrowd;
+    float skinningTime = 0.0f;
+    VkDescriptorSetLayout skinningSetLayout;
+    VkDescriptorPool skinningDescriptorPool;
+    std::vector<VkDescriptorSet> skinningDescriptorSets;
+    VkPipelineLayout skinnedPipelineLayout = VK_NULL_HANDLE;
+    VkPipeline skinnedPipeline = VK_NULL_HANDLE;
+    uint32_t skinnedMesh = GeometryArena::INVALID;
+    size_t skinnedBucket = 0;
+    // per swap chain image: the palette for VertexShader, skinned vertices for Cpu
+    std::vector<VkBuffer> skinningBuffers;
+    std::vector<VkDeviceMemory> skinningBuffersMemory;
+    std::vector<void*> skinningBuffersMapped;
+
+    // slots in the pipeline and descriptor set tables handed to DrawList::record
+    static const uint16_t FIRST_MATERIAL_PIPELINE = 5;
+    static const uint16_t FIRST_MATERIAL_SET = 3;
+
+    std::vector<Material> materials;
+    std::vector<uint32_t> materialVariantIndices;
+    uint32_t uberVariantIndex = 0;
+    ShaderVariantSet materialVariants;
+    std::vector<VkPipeline> materialPipelines;
+    VkPipelineLayout materialPipelineLayout = VK_NULL_HANDLE;
+    VkDescriptorSetLayout materialSetLayout;
+    VkDescriptorPool materialDescriptorPool;
+    std::vector<VkDescriptorSet> materialDescriptorSets;
+    VkBuffer materialBuffer;
+    VkDeviceMemory materialBufferMemory;
+    size_t materialBucket = 0;
+    bool useUberShader = false;
+    uint32_t materialOverdraw = 1;
+
+    // per swap chain image: lights, cluster grid, light index lists and camera
+    std::vector<PointLight> lights;
+    LightClusterer lightClusterer;
+    std::vector<VkBuffer> lightBuffers;
+    std::vector<VkDeviceMemory> lightBuffersMemory;
+    std::vector<void*> lightBuffersMapped;
+    VkDescriptorSetLayout lightSetLayout;
+    VkDescriptorPool lightDescriptorPool;
+    std::vector<VkDescriptorSet> lightDescriptorSets;
+    VkPipelineLayout litPipelineLayout = VK_NULL_HANDLE;
+    VkPipeline litPipeline = VK_NULL_HANDLE;
+
+    // sphere props and blocks: meshes in the geometry arena, and per swap
+    // chain image the camera plus every prop's placement, fade and color
+    std::vector<LodChain> propLodChains;
+    std::vector<LodInstance> propInstances;
+    LodSelector lodSelector;
+    uint32_t propMesh = GeometryArena::INVALID;
+    // the blocks' mesh, also kept on the CPU as the culler's occluder
+    std::vector<glm::vec3> blockPositions;
+    std::vector<uint32_t> blockIndices;
+    std::vector<glm::vec3> blockCenters;
+    uint32_t blockMesh = GeometryArena::INVALID;
+    size_t propBucket = 0;
+    // what the bucket was last filled for: the view it is sorted by and each
+    // prop's level and previous level
+    glm::mat4 propBucketView = glm::mat4(0.0f);
+    std::vector<glm::uvec2> propBucketLevels;
+    std::vector<VkBuffer> propBuffers;
+    std::vector<VkDeviceMemory> propBuffersMemory;
+    std::vector<void*> propBuffersMapped;
+    VkDescriptorSetLayout propSetLayout;
+    VkDescriptorPool propDescriptorPool;
+    std::vector<VkDescriptorSet> propDescriptorSets;
+    VkPipelineLayout propPipelineLayout = VK_NULL_HANDLE;
+    VkPipeline propPipeline = VK_NULL_HANDLE;
+
+    bool textureCompressionBC = false;
+    std::vector<Texture> textures;
+
+    // texturePaths load in the background; finished ones wait in
+    // decodedTextures until drawFrame records their uploads
+    AssetLoader assetLoader;
+    std::vector<DecodedTexture> decodedTextures;
+    std::vector<std::vector<StagingUpload>> frameUploads;
+    std::vector<VkCommandBuffer> uploadCommandBuffers;
+    size_t assetsDelivered = 0;
+
+    // render pass begin/end timestamps, two per swap chain image
+    VkQueryPool timestampQueryPool = VK_NULL_HANDLE;
+    float timestampPeriod = 0.0f;
+    std::vector<bool> timestampsWritten;
+    double gpuMilliseconds = 0.0;
+    double gpuMillisecondsTotal = 0.0;
+    // async compute begin/end timestamps, two per frame in flight
+    VkQueryPool computeTimestampQueryPool = VK_NULL_HANDLE;
+    std::vector<bool> computeTimestampsWritten;
+    QueueOverlap queueOverlap;
+
+    int benchmarkFrame = 0;
+    double benchmarkGpuTotals[2] = {};
+    uint64_t frameCount = 0;
+    SubmitStats submitTotals;
+    std::chrono::high_resolution_clock::time_point lastReport = std::chrono::high_resolution_clock::now();
+
+    FramePacer framePacer;
+    double pacerSleepMilliseconds = 0.0;
+    // the input the frame being drawn responds to, and when it was sampled
+    std::chrono::high_resolution_clock::time_point frameInputTime;
+    glm::dvec2 frameCursor;
+    // input time of the frame last submitted from each frame slot
+    std::vector<std::chrono::high_resolution_clock::time_point> slotInputTimes;
+    std::vector<bool> slotInputValid;
+
+    // set when acquire or present reports the swap chain out of date or
+    // suboptimal; the next frame recreates it first
+    bool swapChainOutOfDate = false;
+
+    bool presentWaitEnabled = false;
+    uint64_t presentCounter = 0;
+    std::chrono::high_resolution_clock::time_point presentInputTime;
+#ifdef VK_KHR_present_wait
+    PFN_vkWaitForPresentKHR waitForPresent = nullptr;
+#endif
+
+    bool captureSupported = false;
+    ReadbackRing readbackRing;
+    std::vector<VkBuffer> readbackBuffers;
+    std::vector<VkDeviceMemory> readbackMemory;
+    // one pre-recorded copy per (ring slot, swap chain image)
+    std::vector<VkCommandBuffer> readbackCommandBuffers;
+    // ring slot each frame slot's last submit copied into, or -1
+    std::vector<int> slotReadback;
+    std::vector<std::unique_ptr<FrameConsumer>> frameConsumers;
+    GoldenImageComparer* goldenComparer = nullptr;
+    uint64_t captureFrameIndex = 0;
+
+    void initWindow() {
+        glfwInit();
+
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+        glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+        if (!goldenImagePath.empty()) {
+            // golden-image runs only need the swap chain, not a visible window
+            glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        }
+
+        window = glfwCreateWindow(WIDTH, HEIGHT, "Vulkan", nullptr, nullptr);
+
+        if (idleMode) {
+            installDamageCallbacks();
+        }
+        else if (decoupledThreads) {
+            glfwSetWindowUserPointer(window, this);
+            glfwSetCursorPosCallback(window, [](GLFWwindow* w, double x, double y) {
+                auto app = static_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(w));
+                app->latestCursorX = x;
+                app->latestCursorY = y;
+            });
+        }
+    }
+
+    // Anything the user can see change marks the window damaged.
+    void installDamageCallbacks() {
+        glfwSetWindowUserPointer(window, this);
+        glfwSetCursorPosCallback(window, [](GLFWwindow* w, double, double) { damage(w); });
+        glfwSetMouseButtonCallback(window, [](GLFWwindow* w, int, int, int) { damage(w); });
+        glfwSetScrollCallback(window, [](GLFWwindow* w, double, double) { damage(w); });
+        glfwSetKeyCallback(window, [](GLFWwindow* w, int, int, int, int) { damage(w); });
+        glfwSetCharCallback(window, [](GLFWwindow* w, unsigned int) { damage(w); });
+        glfwSetWindowFocusCallback(window, [](GLFWwindow* w, int) { damage(w); });
+        glfwSetWindowIconifyCallback(window, [](GLFWwindow* w, int) { damage(w); });
+        glfwSetWindowRefreshCallback(window, [](GLFWwindow* w) { damage(w); });
+        glfwSetFramebufferSizeCallback(window, [](GLFWwindow* w, int, int) { damage(w); });
+    }
+
+    static void damage(GLFWwindow* window) {
+        static_cast<HelloTriangleApplication*>(glfwGetWindowUserPointer(window))->damaged = true;
+    }
+
+    void initVulkan() {
+        PROFILE_FUNCTION();
+        createInstance();
+        setupDebugCallback();
+        createSurface();
+        pickPhysicalDevice();
+        createLogicalDevice();
+        createSwapChain();
+        createImageViews();
+        createRenderPass();
+        createGraphicsPipeline();
+        createParticlePipeline();
+        createFramebuffers();
+        createCommandPool();
+        createGeometryArena();
+        createParticles();
+        createSkinning();
+        createSkinnedPipeline();
+        createMaterials();
+        createLights();
+        createLitPipeline();
+        createProps();
+        createPropPipeline();
+        createTextures();
+        createMaterialPipelines();
+        createTimestampQueries();
+        createDrawBuckets();
+        createCommandBuffers();
+        createSyncObjects();
+        createReadback();
+    }
+
+    void mainLoop() {
+        framePacer.enabled = framePacing && !goldenComparer;
+        // golden images need every frame to see exactly one simulation step
+        if (idleMode && !goldenComparer) {
+            runIdle();
+        }
+        else if (decoupledThreads && !goldenComparer) {
+            runDecoupled();
+        }
+        else {
+            while (!finished()) {
+                paceFrame();
+                glfwPollEvents();
+                simulate();
+                takeFramePacket(false);
+                renderFrame();
+            }
+        }
+        vkd.vkDeviceWaitIdle(device);
+    }
+
+    bool finished() const {
+        return glfwWindowShouldClose(window) || (goldenComparer && goldenComparer->result != -1);
+    }
+
+    // Dashboard mode: sleeps in glfwWaitEventsTimeout and draws a frame only
+    // when something is damaged, the scene is animating or the redraw timer
+    // is due. Otherwise the identical command buffers are not resubmitted.
+    void runIdle() {
+        framePacer.enabled = false;
+        auto lastDraw = std::chrono::high_resolution_clock::now();
+        while (!finished()) {
+            auto now = std::chrono::high_resolution_clock::now();
+            double sinceDraw = std::chrono::duration<double>(now - lastDraw).count();
+            if (damaged || sceneAnimating()) {
+                glfwPollEvents();
+            }
+            else if (sinceDraw < IDLE_REDRAW_SECONDS) {
+                glfwWaitEventsTimeout(IDLE_REDRAW_SECONDS - sinceDraw);
+                now = std::chrono::high_resolution_clock::now();
+                sinceDraw = std::chrono::duration<double>(now - lastDraw).count();
+            }
+
+            if (!damaged && !sceneAnimating() && sinceDraw < IDLE_REDRAW_SECONDS) {
+                idleWakeups++;
+                continue;
+            }
+
+            // the time since the slot's last frame is idle time, not latency
+            if (sinceDraw > 0.1) {
+                slotInputValid.assign(MAX_FRAMES_IN_FLIGHT, false);
+            }
+            damaged = false;
+            simulate();
+            takeFramePacket(false);
+            renderFrame();
+            lastDraw = now;
+        }
+    }
+
+    // Whether frames differ from one another without any outside change.
+    bool sceneAnimating() const {
+        return PARTICLE_BACKEND != ParticleBackend::None || SKINNING_PATH != SkinningPath::None || LIGHTING_ENABLED || PROPS_ENABLED ||
+            benchmarkVariants || !frameConsumers.empty() || assetLoader.pending() > 0;
+    }
+
+    // The main thread owns events and steps the simulation at SIMULATION_RATE
+    // while the render thread draws whatever packet is newest, so a stall on
+    // either side (a long acquire, a slow step) holds up only that side.
+    // Input is still sampled just in time: after pacing, the render thread
+    // reads the cursor the main thread last received instead of the packet's.
+    void runDecoupled() {
+        rendering = true;
+        std::thread renderThread([this]() {
+            PROFILE_THREAD("render");
+            try {
+                while (rendering) {
+                    paceFrame();
+                    takeFramePacket(true);
+                    renderFrame();
+                }
+            }
+            catch (...) {
+                renderError = std::current_exception();
+                rendering = false;
+            }
+        });
+
+        const auto stepPeriod = std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(std::chrono::duration<double>(1.0 / SIMULATION_RATE));
+        auto nextStep = std::chrono::high_resolution_clock::now();
+        while (rendering && !finished()) {
+            auto now = std::chrono::high_resolution_clock::now();
+            if (now < nextStep) {
+                // handles events as they arrive, so the cursor callback stays current between steps
+                glfwWaitEventsTimeout(std::chrono::duration<double>(nextStep - now).count());
+                continue;
+            }
+
+            glfwPollEvents();
+            simulate();
+            nextStep += stepPeriod;
+            if (nextStep < now) {
+                nextStep = now;
+            }
+        }
+
+        rendering = false;
+        renderThread.join();
+        if (renderError) {
+            std::rethrow_exception(renderError);
+        }
+    }
+
+    // One simulation step: samples input, advances the clock and camera, runs
+    // the CPU particles, skinning and light clustering, and publishes the
+    // results for the render thread.
+    void simulate() {
+        PROFILE_FUNCTION();
+        auto now = std::chrono::high_resolution_clock::now();
+        double deltaTime = std::min(std::chrono::duration<double>(now - lastFrameTime).count(), 0.1);
+        lastFrameTime = now;
+        if (goldenComparer) {
+            // golden images must not depend on how fast frames happen to run
+            deltaTime = 1.0 / 60.0;
+        }
+
+        simulationStep++;
+        simulationTime += deltaTime;
+
+        FramePacket& state = framePackets.writeSlot();
+        state.step = simulationStep;
+        state.time = simulationTime;
+        state.inputTime = now;
+        glfwGetCursorPos(window, &state.cursor.x, &state.cursor.y);
+
+        float orbit = static_cast<float>(state.time) * 0.1f;
+        glm::vec3 eye(std::cos(orbit) * 40.0f, 12.0f, std::sin(orbit) * 40.0f);
+        state.view = glm::lookAt(eye, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+        simulateParticles(state, static_cast<float>(deltaTime));
+        simulateSkinning(state, static_cast<float>(deltaTime));
+        simulateLights(state);
+
+        framePackets.publish();
+        simulationSteps++;
+    }
+
+    // The render thread's view of the simulation: the packet it last took.
+    const FramePacket& renderPacket() const {
+        return framePackets.readSlot();
+    }
+
+    // Moves to the newest packet without waiting for one. sampleInput takes
+    // the cursor the main thread last received, for a render thread that
+    // can't poll GLFW itself.
+    void takeFramePacket(bool sampleInput) {
+        if (!framePackets.update()) {
+            staleFrames++;
+        }
+        frameCursor = renderPacket().cursor;
+        frameInputTime = renderPacket().inputTime;
+        if (sampleInput) {
+            frameCursor = glm::dvec2(latestCursorX.load(), latestCursorY.load());
+            frameInputTime = std::chrono::high_resolution_clock::now();
+        }
+    }
+
+    void renderFrame() {
+        drawFrame();
+        reportStats();
+        if (benchmarkVariants) {
+            stepVariantBenchmark();
+        }
+    }
+
+    void reportStats()
+    {
+        const SubmitStats& stats = submitBatcher.stats();
+        frameCount++;
+        submitTotals.submits += stats.submits;
+        submitTotals.submitMilliseconds += stats.submitMilliseconds;
+
+        auto now = std::chrono::high_resolution_clock::now();
+        if (now - lastReport < std::chrono::seconds(1)) return;
+
+        if (printStats) {
+            std::cout << "frames: " << frameCount
+                << " submits/frame: " << double(submitTotals.submits) / frameCount
+                << " submit ms/frame: " << submitTotals.submitMilliseconds / frameCount
+                << " gpu ms/frame: " << gpuMillisecondsTotal / frameCount
+                << (presentWaitEnabled ? " input-to-present ms: " : " input-to-gpu-done ms: ") << framePacer.averageLatency()
+                << " (max " << framePacer.maxLatency() << ")"
+                << " pacing sleep ms: " << pacerSleepMilliseconds
+                << " sim steps: " << simulationSteps.exchange(0)
+                << " stale frames: " << staleFrames;
+            if (idleMode) {
+                std::cout << " idle wakeups: " << idleWakeups;
+            }
+            if (!frameConsumers.empty()) {
+                std::cout << " captured: " << readbackRing.capturedCount() << " dropped: " << readbackRing.droppedCount();
+            }
+            if (!texturePaths.empty()) {
+                AssetLoaderStats assets = assetLoader.stats();
+                std::cout << " assets: " << assets.delivered << "/" << assets.requested
+                    << " late: " << assets.late << " failed: " << assets.failed
+                    << " read MiB: " << assets.bytesRead / double(1 << 20);
+            }
+            if (computeTimestampQueryPool != VK_NULL_HANDLE) {
+                uint64_t computeTicks = queueOverlap.busy(QueueOverlap::Compute);
+                std::cout << " async compute ms/frame: " << computeTicks * timestampPeriod * 1e-6 / frameCount
+                    << " overlapped with graphics: " << (computeTicks ? 100.0 * queueOverlap.overlap() / computeTicks : 0.0) << "%";
+            }
+            std::cout << std::endl;
+        }
+
+        frameCount = 0;
+        submitTotals = SubmitStats();
+        gpuMillisecondsTotal = 0.0;
+        framePacer.resetLatency();
+        staleFrames = 0;
+        idleWakeups = 0;
+        queueOverlap.resetTotals();
+        lastReport = now;
+    }
+
+    void cleanup() {
+        telemetry.stop();
+
+        destroyReadback();
+        cleanupSwapChain();
+
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            vkd.vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
+            vkd.vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
+            vkd.vkDestroyFence(device, inFlightFences[i], nullptr);
+        }
+
+        destroyParticles();
+        destroySkinning();
+        destroyProps();
+        destroyGeometryArena();
+        destroyMaterials();
+        destroyLights();
+        destroyTextures();
+        if (timestampQueryPool != VK_NULL_HANDLE) {
+            vkd.vkDestroyQueryPool(device, timestampQueryPool, nullptr);
+        }
+        if (computeTimestampQueryPool != VK_NULL_HANDLE) {
+            vkd.vkDestroyQueryPool(device, computeTimestampQueryPool, nullptr);
+        }
+        for (VkSemaphore semaphore : computeFinishedSemaphores) {
+            vkd.vkDestroySemaphore(device, semaphore, nullptr);
+        }
+
+        if (asyncCompute) {
+            vkd.vkDestroyCommandPool(device, computeCommandPool, nullptr);
+        }
+        vkd.vkDestroyCommandPool(device, commandPool, nullptr);
+
+        vkd.vkDestroyDevice(device, nullptr);
+
+        if (enableValidationLayers) {
+            DestroyDebugUtilsMessengerEXT(instance, callback, nullptr);
+        }
+
+        vkDestroySurfaceKHR(instance, surface, nullptr);
+        vkDestroyInstance(instance, nullptr);
+
+        glfwDestroyWindow(window);
+
+        glfwTerminate();
+    }
+
+    // Returns false while the surface has no area (a minimized window),
+    // leaving the old swap chain in place to try again later.
+    bool recreateSwapChain()
+    {
+        VkSurfaceCapabilitiesKHR capabilities;
+        vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface, &capabilities);
+        if (capabilities.currentExtent.width == 0 || capabilities.currentExtent.height == 0) {
+            return false;
+        }
+
+        vkd.vkDeviceWaitIdle(device);
+
+        VkExtent2D oldExtent = swapChainExtent;
+        VkFormat oldFormat = swapChainImageFormat;
+        size_t oldImageCount = swapChainImages.size();
+
+        cleanupSwapChain();
+        createSwapChain();
+        // particle, skinning and timestamp resources are per image and made once
+        if (swapChainImages.size() != oldImageCount) {
+            throw std::runtime_error("swap chain image count changed on recreation!");
+        }
+        // present ids count per swap chain
+        presentCounter = 0;
+        createImageViews();
+        createRenderPass();
+        createGraphicsPipeline();
+        createParticlePipeline();
+        createSkinnedPipeline();
+        // the light projection, image count and viewport may all have changed
+        destroyLights();
+        createLights();
+        createLitPipeline();
+        destroyProps();
+        createProps();
+        createPropPipeline();
+        createMaterialPipelines();
+        createFramebuffers();
+        createCommandBuffers();
+        // the props' meshes were uploaded again and may have moved in the arena
+        if (PROPS_ENABLED) {
+            fillPropBucket();
+        }
+
+        // readback buffers and the ring's pitch follow the swap chain's size
+        // and format; everything in flight has landed after the wait above
+        if (!readbackBuffers.empty() && (swapChainExtent.width != oldExtent.width || swapChainExtent.height != oldExtent.height ||
+            swapChainImageFormat != oldFormat)) {
+            destroyReadback();
+            createReadbackBuffers();
+        }
+        else {
+            createReadbackCommandBuffers();
+        }
+
+        imagesInFlight.assign(swapChainImages.size(), VK_NULL_HANDLE);
+        swapChainOutOfDate = false;
+        return true;
+    }
+
+    void cleanupSwapChain()
+    {
+        for (size_t i = 0; i < swapChainFramebuffers.size(); i++) {
+            vkd.vkDestroyFramebuffer(device, swapChainFramebuffers[i], nullptr);
+        }
+
+        for (auto& bucket : drawBuckets) {
+            vkd.vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(bucket.commandBuffers.size()), bucket.commandBuffers.data());
+        }
+        vkd.vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
+        if (!readbackCommandBuffers.empty()) {
+            vkd.vkFreeCommandBuffers(device, commandPool, static_cast<uint32_t>(readbackCommandBuffers.size()), readbackCommandBuffers.data());
+            readbackCommandBuffers.clear();
+        }
+
+        vkd.vkDestroyPipeline(device, graphicsPipeline, nullptr);
+        vkd.vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+        if (PARTICLE_BACKEND != ParticleBackend::None) {
+            vkd.vkDestroyPipeline(device, particlePipeline, nullptr);
+            vkd.vkDestroyPipelineLayout(device, particlePipelineLayout, nullptr);
+        }
+        if (SKINNING_PATH != SkinningPath::None) {
+            vkd.vkDestroyPipeline(device, skinnedPipeline, nullptr);
+            vkd.vkDestroyPipelineLayout(device, skinnedPipelineLayout, nullptr);
+        }
+        if (LIGHTING_ENABLED) {
+            vkd.vkDestroyPipeline(device, litPipeline, nullptr);
+            vkd.vkDestroyPipelineLayout(device, litPipelineLayout, nullptr);
+        }
+        if (PROPS_ENABLED) {
+            vkd.vkDestroyPipeline(device, propPipeline, nullptr);
+            vkd.vkDestroyPipelineLayout(device, propPipelineLayout, nullptr);
+        }
+        for (VkPipeline pipeline : materialPipelines) {
+            vkd.vkDestroyPipeline(device, pipeline, nullptr);
+        }
+        materialPipelines.clear();
+        if (materialPipelineLayout != VK_NULL_HANDLE) {
+            vkd.vkDestroyPipelineLayout(device, materialPipelineLayout, nullptr);
+            materialPipelineLayout = VK_NULL_HANDLE;
+        }
+        vkd.vkDestroyRenderPass(device, renderPass, nullptr);
+
+        for (size_t i = 0; i < swapChainImageViews.size(); i++) {
+            vkd.vkDestroyImageView(device, swapChainImageViews[i], nullptr);
+        }
+
+        vkd.vkDestroySwapchainKHR(device, swapChain, nullptr);
+    }
+    
+
+
+    void drawFrame()
+    {
+        PROFILE_FUNCTION();
+#ifndef NDEBUG
+        size_t allocationsBefore = heapAllocationCount;
+#endif
+
+        auto frameStart = std::chrono::high_resolution_clock::now();
+        if (lastFrameStart.time_since_epoch().count() != 0) {
+            telemetry.add(TelemetryCounter::FrameTime, std::chrono::duration<double, std::milli>(frameStart - lastFrameStart).count());
+        }
+        lastFrameStart = frameStart;
+
+        // animation advances by simulated time; a repeated packet advances nothing
+        if (swapChainOutOfDate && !recreateSwapChain()) {
+            // nothing to present to until the window has an area again
+            sleepPrecise(10.0);
+            return;
+        }
+
+        frameDeltaTime = static_cast<float>(std::min(std::max(renderPacket().time - lastRenderedTime, 0.0), 0.1));
+        lastRenderedTime = renderPacket().time;
+
+        auto waitStart = std::chrono::high_resolution_clock::now();
+        {
+            PROFILE_ZONE("wait for frame fence");
+            vkd.vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, std::numeric_limits<uint64_t>::max());
+        }
+        auto waitEnd = std::chrono::high_resolution_clock::now();
+        telemetry.add(TelemetryCounter::FenceWait, std::chrono::duration<double, std::milli>(waitEnd - waitStart).count());
+
+        framePacer.recordIdle(pacerSleepMilliseconds, std::chrono::duration<double, std::milli>(waitEnd - waitStart).count());
+        // without present wait, the slot's last frame finishing on the GPU
+        // is the closest thing to a photon we can observe
+        if (!presentWaitEnabled && slotInputValid[currentFrame]) {
+            framePacer.recordLatency(std::chrono::duration<double, std::milli>(waitEnd - slotInputTimes[currentFrame]).count());
+        }
+        slotInputTimes[currentFrame] = frameInputTime;
+        slotInputValid[currentFrame] = true;
+
+        // the slot's fence covers its capture copy too
+        if (slotReadback[currentFrame] >= 0) {
+            readbackRing.markReady(slotReadback[currentFrame]);
+            slotReadback[currentFrame] = -1;
+        }
+
+        // everything this frame slot used last time is done now
+        frameArenas[currentFrame].reset();
+        releaseUploads(currentFrame);
+
+        uint32_t imageIndex; 
+        auto acquireStart = std::chrono::high_resolution_clock::now();
+        VkResult acquired;
+        {
+            PROFILE_ZONE("vkAcquireNextImageKHR");
+            acquired = vkd.vkAcquireNextImageKHR(device, swapChain, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);
+        }
+        telemetry.add(TelemetryCounter::Acquire, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - acquireStart).count());
+
+        // the slot's fence stays signaled, so the retry doesn't wait on it;
+        // a suboptimal image is still drawn and presented
+        if (acquired == VK_ERROR_OUT_OF_DATE_KHR) {
+            swapChainOutOfDate = true;
+            slotInputValid[currentFrame] = false;
+            return;
+        }
+        if (acquired != VK_SUCCESS && acquired != VK_SUBOPTIMAL_KHR) {
+            throw std::runtime_error("failed to acquire swap chain image!");
+        }
+
+        // the image's command buffers may still be pending from an older frame
+        if (imagesInFlight[imageIndex] != VK_NULL_HANDLE) {
+            vkd.vkWaitForFences(device, 1, &imagesInFlight[imageIndex], VK_TRUE, std::numeric_limits<uint64_t>::max());
+        }
+        imagesInFlight[imageIndex] = inFlightFences[currentFrame];
+        vkd.vkResetFences(device, 1, &inFlightFences[currentFrame]);
+        readTimestamps(imageIndex);
+        readComputeTimestamps();
+
+        updateProps(imageIndex);
+        updateCommandBuffers(imageIndex);
+        updateParticles(imageIndex);
+        updateSkinning(imageIndex);
+        updateLights(imageIndex);
+        deliverAssets();
+        countDraws(imageIndex);
+
+        VkSemaphore waitSemaphores[] = { imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE };
+        VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT };
+        uint32_t waitCount = 1;
+        VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[currentFrame] };
+
+        // uploads go ahead of the frame on the graphics queue, under its fence
+        if (!uploadCommandBuffers.empty()) {
+            submitBatcher.add(graphicsQueue, static_cast<uint32_t>(uploadCommandBuffers.size()), uploadCommandBuffers.data(), 0, nullptr, nullptr, 0, nullptr);
+            uploadCommandBuffers.clear();
+        }
+
+        // async compute only holds up graphics once the particles are drawn
+        if (asyncCompute) {
+            waitSemaphores[waitCount++] = computeFinishedSemaphores[currentFrame];
+            submitBatcher.add(computeQueue, 1, &particleComputeCommandBuffers[currentFrame], 0, nullptr, nullptr, 1, &computeFinishedSemaphores[currentFrame]);
+        }
+        else if (PARTICLE_BACKEND == ParticleBackend::Gpu) {
+            submitBatcher.add(graphicsQueue, 1, &particleComputeCommandBuffers[currentFrame], 0, nullptr, nullptr, 0, nullptr);
+        }
+        int readbackSlot = captureThisFrame() ? readbackRing.acquire(captureFrameIndex) : -1;
+        captureFrameIndex++;
+        if (readbackSlot >= 0) {
+            // the copy joins the same VkSubmitInfo and takes over the present signal
+            submitBatcher.add(graphicsQueue, 1, &commandBuffers[imageIndex], waitCount, waitSemaphores, waitStages, 0, nullptr);
+            submitBatcher.add(graphicsQueue, 1, &readbackCommandBuffers[readbackSlot * swapChainImages.size() + imageIndex], 0, nullptr, nullptr, 1, signalSemaphores);
+            slotReadback[currentFrame] = readbackSlot;
+        }
+        else {
+            submitBatcher.add(graphicsQueue, 1, &commandBuffers[imageIndex], waitCount, waitSemaphores, waitStages, 1, signalSemaphores);
+        }
+        submitBatcher.flush(graphicsQueue, inFlightFences[currentFrame]);
+
+        VkPresentInfoKHR presentInfo = {};
+        presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+        presentInfo.waitSemaphoreCount = 1;
+        presentInfo.pWaitSemaphores = signalSemaphores;
+
+        VkSwapchainKHR swapChains[] = { swapChain };
+        presentInfo.swapchainCount = 1;
+        presentInfo.pSwapchains = swapChains;
+        presentInfo.pImageIndices = &imageIndex;
+
+        presentInfo.pResults = nullptr;
+
+#ifdef VK_KHR_present_wait
+        VkPresentIdKHR presentId = {};
+        uint64_t presentIdValue = presentCounter + 1;
+        if (presentWaitEnabled) {
+            presentId.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+            presentId.swapchainCount = 1;
+            presentId.pPresentIds = &presentIdValue;
+            presentInfo.pNext = &presentId;
+        }
+#endif
+
+        VkResult presented;
+        {
+            PROFILE_ZONE("vkQueuePresentKHR");
+            presented = vkd.vkQueuePresentKHR(presentQueue, &presentInfo);
+        }
+        if (presented != VK_SUCCESS && presented != VK_SUBOPTIMAL_KHR && presented != VK_ERROR_OUT_OF_DATE_KHR) {
+            throw std::runtime_error("failed to present swap chain image!");
+        }
+        if (presented != VK_SUCCESS || acquired == VK_SUBOPTIMAL_KHR) {
+            swapChainOutOfDate = true;
+        }
+        presentCounter++;
+        presentInputTime = frameInputTime;
+       // vkQueueWaitIdle(presentQueue);
+
+        currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+        telemetry.endFrame();
+
+#ifndef NDEBUG
+        // only recording and arriving assets may allocate; a frame that reuses
+        // its command buffers must not
+        if (bucketsRecorded == 0 && assetsDelivered == 0 && heapAllocationCount != allocationsBefore) {
+            throw std::runtime_error("steady-state frame allocated from the heap!");
+        }
+#endif
+
+    }
+
+    // What the image's command buffers draw, reused buckets included.
+    void countDraws(uint32_t imageIndex) {
+        DrawStats executed;
+        for (const auto& bucket : drawBuckets) {
+            executed += bucket.stats[imageIndex];
+        }
+        telemetry.add(TelemetryCounter::Draws, executed.draws);
+        telemetry.add(TelemetryCounter::Triangles, static_cast<double>(executed.triangles));
+        telemetry.add(TelemetryCounter::Binds, executed.binds());
+        telemetry.add(TelemetryCounter::OccludedDraws, executed.occluded);
+    }
+
+    bool captureThisFrame() const {
+        if (frameConsumers.empty() || readbackCommandBuffers.empty()) return false;
+        if (goldenComparer) return captureFrameIndex == GOLDEN_CAPTURE_FRAME;
+        return captureFrameIndex % captureEvery == 0;
+    }
+
+    void createReadback()
+    {
+        slotReadback.assign(MAX_FRAMES_IN_FLIGHT, -1);
+
+        if (!goldenImagePath.empty()) {
+            auto comparer = std::unique_ptr<GoldenImageComparer>(new GoldenImageComparer(goldenImagePath, writeGoldenImage));
+            goldenComparer = comparer.get();
+            frameConsumers.push_back(std::move(comparer));
+        }
+        else {
+            if (!capturePngPrefix.empty()) {
+                frameConsumers.push_back(std::unique_ptr<FrameConsumer>(new PngFrameWriter(capturePngPrefix)));
+            }
+            if (!captureVideoPath.empty()) {
+                frameConsumers.push_back(std::unique_ptr<FrameConsumer>(new Y4mVideoWriter(captureVideoPath)));
+            }
+        }
+        if (frameConsumers.empty()) return;
+
+        if (!captureSupported) {
+            throw std::runtime_error("swap chain images cannot be copied for frame capture!");
+        }
+
+        for (auto& consumer : frameConsumers) {
+            readbackRing.addConsumer(consumer.get());
+        }
+
+        createReadbackBuffers();
+    }
+
+    // Sized for the current swap chain; starts the ring's consumer thread.
+    void createReadbackBuffers()
+    {
+        uint32_t rowPitch = swapChainExtent.width * 4;
+        VkDeviceSize size = VkDeviceSize(rowPitch) * swapChainExtent.height;
+        bool bgra = swapChainImageFormat == VK_FORMAT_B8G8R8A8_UNORM || swapChainImageFormat == VK_FORMAT_B8G8R8A8_SRGB;
+        readbackRing.start(READBACK_RING_SIZE, swapChainExtent.width, swapChainExtent.height, rowPitch, bgra);
+
+        readbackBuffers.resize(READBACK_RING_SIZE);
+        readbackMemory.resize(READBACK_RING_SIZE);
+        for (int i = 0; i < READBACK_RING_SIZE; i++) {
+            createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                readbackBuffers[i], readbackMemory[i]);
+
+            // stays mapped; the consumer thread reads it once the slot is Ready
+            void* mapped;
+            vkd.vkMapMemory(device, readbackMemory[i], 0, size, 0, &mapped);
+            readbackRing.slot(i).pixels = static_cast<const uint8_t*>(mapped);
+        }
+
+        createReadbackCommandBuffers();
+    }
+
+    void createReadbackCommandBuffers()
+    {
+        if (readbackBuffers.empty()) return;
+
+        readbackCommandBuffers.resize(readbackBuffers.size() * swapChainImages.size());
+
+        VkCommandBufferAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = static_cast<uint32_t>(readbackCommandBuffers.size());
+
+        if (vkd.vkAllocateCommandBuffers(device, &allocInfo, readbackCommandBuffers.data()) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate readback command buffers!");
+        }
+
+        for (size_t slot = 0; slot < readbackBuffers.size(); slot++) {
+            for (size_t image = 0; image < swapChainImages.size(); image++) {
+                recordReadback(readbackCommandBuffers[slot * swapChainImages.size() + image], swapChainImages[image], readbackBuffers[slot]);
+            }
+        }
+    }
+
+    // Copies a presentable image into a readback buffer and hands the image
+    // back in PRESENT_SRC layout, ready for the present that follows.
+    void recordReadback(VkCommandBuffer commandBuffer, VkImage image, VkBuffer buffer)
+    {
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+
+        if (vkd.vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+            throw std::runtime_error("failed to begin recording readback command buffer!");
+        }
+
+        VkImageMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image;
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.levelCount = 1;
+        barrier.subresourceRange.layerCount = 1;
+        vkd.vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+            0, nullptr, 0, nullptr, 1, &barrier);
+
+        VkBufferImageCopy region = {};
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent = { swapChainExtent.width, swapChainExtent.height, 1 };
+        vkd.vkCmdCopyImageToBuffer(commandBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer, 1, &region);
+
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+        barrier.dstAccessMask = 0;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+        VkBufferMemoryBarrier bufferBarrier = {};
+        bufferBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        bufferBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        bufferBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        bufferBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferBarrier.buffer = buffer;
+        bufferBarrier.size = VK_WHOLE_SIZE;
+        vkd.vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0,
+            0, nullptr, 1, &bufferBarrier, 1, &barrier);
+
+        if (vkd.vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record readback command buffer!");
+        }
+    }
+
+    // Called after a vkDeviceWaitIdle: every copy has landed, so the pending
+    // ones are handed over and the consumer thread drains them all.
+    void destroyReadback()
+    {
+        for (int& slot : slotReadback) {
+            if (slot >= 0) {
+                readbackRing.markReady(slot);
+                slot = -1;
+            }
+        }
+        readbackRing.stop();
+
+        for (size_t i = 0; i < readbackBuffers.size(); i++) {
+            vkd.vkUnmapMemory(device, readbackMemory[i]);
+            vkd.vkDestroyBuffer(device, readbackBuffers[i], nullptr);
+            vkd.vkFreeMemory(device, readbackMemory[i], nullptr);
+        }
+        readbackBuffers.clear();
+        readbackMemory.clear();
+    }
+
+    // Runs before input is sampled: with present wait, block until the last
+    // frame is on screen; then sleep for the idle time the pacer predicts.
+    void paceFrame()
+    {
+#ifdef VK_KHR_present_wait
+        if (presentWaitEnabled && presentCounter > 0) {
+            const uint64_t timeout = 100000000;
+            if (waitForPresent(device, swapChain, presentCounter, timeout) == VK_SUCCESS) {
+                framePacer.recordLatency(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - presentInputTime).count());
+            }
+        }
+#endif
+        pacerSleepMilliseconds = framePacer.plannedSleep();
+        sleepPrecise(pacerSleepMilliseconds);
+    }
+
+    void createSyncObjects()
+    {
+        imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+        renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+        inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+        imagesInFlight.resize(swapChainImages.size(), VK_NULL_HANDLE);
+        slotInputTimes.resize(MAX_FRAMES_IN_FLIGHT);
+        slotInputValid.assign(MAX_FRAMES_IN_FLIGHT, false);
+
+        for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            frameArenas.emplace_back(FRAME_ARENA_SIZE);
+        }
+
+        VkSemaphoreCreateInfo semaphoreInfo = {};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+        VkFenceCreateInfo fenceInfo = {};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+        for(int i=0;i<MAX_FRAMES_IN_FLIGHT; i++)
+        {
+            if (vkd.vkCreateSemaphore(device, &semaphoreInfo, nullptr, &imageAvailableSemaphores[i]) != VK_SUCCESS ||
+                vkd.vkCreateSemaphore(device, &semaphoreInfo, nullptr, &renderFinishedSemaphores[i]) != VK_SUCCESS ||
+                vkd.vkCreateFence(device, &fenceInfo, nullptr, &inFlightFences[i]) != VK_SUCCESS
+                )
+            {
+                throw std::runtime_error("failed to create synchronization objects for a frame!");
+            }
+        }
+
+        // async compute hands the frame's particles to graphics through these
+        if (asyncCompute) {
+            computeFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
+            for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+                if (vkd.vkCreateSemaphore(device, &semaphoreInfo, nullptr, &computeFinishedSemaphores[i]) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to create synchronization objects for a frame!");
+                }
+            }
+        }
+    }
+
+    void createCommandPool()
+    {
+        QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+        
+        VkCommandPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+        if (vkd.vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to craeate command pool!");
+        }
+
+        computeCommandPool = commandPool;
+        if (asyncCompute) {
+            poolInfo.queueFamilyIndex = computeQueueFamily;
+            if (vkd.vkCreateCommandPool(device, &poolInfo, nullptr, &computeCommandPool) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create compute command pool!");
+            }
+        }
+    }
+
+    void createDrawBuckets()
+    {
+        // there is no depth buffer, so the ground goes first to stay behind everything
+        if (LIGHTING_ENABLED) {
+            DrawBucket ground;
+            ground.draws.add(3, 1, NO_MESH, 0.0f, { 6, 1, 0, 0, 0, 0, 0 });
+            drawBuckets.push_back(ground);
+        }
+
+        // refilled by updateProps whenever the camera moves or a LOD changes
+        if (PROPS_ENABLED) {
+            propBucket = drawBuckets.size();
+            drawBuckets.push_back(DrawBucket());
+        }
+
+        DrawBucket triangle;
+        triangle.draws.add(0, NO_DESCRIPTOR_SET, NO_MESH, 0.0f, { 3, 1, 0, 0, 0, 0, 0 });
+        drawBuckets.push_back(triangle);
+
+        // the particle buffers change every frame, but the draw referencing them doesn't
+        if (PARTICLE_BACKEND != ParticleBackend::None) {
+            DrawBucket particles;
+            particles.draws.add(1, NO_DESCRIPTOR_SET, 0, 0.0f, { PARTICLE_COUNT, 1, 0, 0, 0, 0, 0 });
+            drawBuckets.push_back(particles);
+        }
+
+        // the whole crowd is one instanced draw when skinned in the vertex
+        // shader; pre-skinned characters each have their own vertex range
+        if (SKINNING_PATH != SkinningPath::None) {
+            skinnedBucket = drawBuckets.size();
+            drawBuckets.push_back(DrawBucket());
+            fillSkinnedBucket();
+        }
+
+        if (MATERIALS_ENABLED) {
+            materialBucket = drawBuckets.size();
+            drawBuckets.push_back(DrawBucket());
+            fillMaterialBucket();
+        }
+    }
+
+    // Draws take their index range from the geometry arena, so they are
+    // rebuilt whenever the arena is compacted.
+    void fillSkinnedBucket()
+    {
+        DrawBucket& bucket = drawBuckets[skinnedBucket];
+        bucket.draws.clear();
+
+        const MeshRange& mesh = geometryArena.mesh(skinnedMesh);
+        if (SKINNING_PATH == SkinningPath::VertexShader) {
+            bucket.draws.add(2, 0, 1, 0.0f, { 0, skinnedCrowd.size(), 0, 0, mesh.indexCount, mesh.firstIndex, static_cast<int32_t>(mesh.firstVertex) });
+        }
+        else {
+            int32_t vertexCount = static_cast<int32_t>(skinnedCrowd.meshVertices().size());
+            for (uint32_t c = 0; c < skinnedCrowd.size(); c++) {
+                bucket.draws.add(2, NO_DESCRIPTOR_SET, 1, 0.0f, { 0, 1, 0, 0, mesh.indexCount, mesh.firstIndex, vertexCount * static_cast<int32_t>(c) });
+            }
+        }
+        markBucketDirty(skinnedBucket);
+    }
+
+    void markBucketDirty(size_t bucket)
+    {
+        drawBuckets[bucket].markDirty();
+        damaged = true;
+    }
+
+    void createCommandBuffers()
+    {
+        commandBuffers.resize(swapChainFramebuffers.size());
+        commandBuffersDirty.assign(commandBuffers.size(), true);
+
+        VkCommandBufferAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = (uint32_t)commandBuffers.size();
+        if (vkd.vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to allocate command buffers!");
+        }
+
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        for (auto& bucket : drawBuckets)
+        {
+            bucket.commandBuffers.resize(commandBuffers.size());
+            bucket.dirty.assign(commandBuffers.size(), true);
+            bucket.stats.assign(commandBuffers.size(), DrawStats());
+            if (vkd.vkAllocateCommandBuffers(device, &allocInfo, bucket.commandBuffers.data()) != VK_SUCCESS)
+            {
+                throw std::runtime_error("failed to allocate secondary command buffers!");
+            }
+        }
+    }
+
+    // Re-records the dirty buckets for this image, then the primary buffer if
+    // any of the secondaries it executes was replaced.
+    void updateCommandBuffers(uint32_t imageIndex)
+    {
+        PROFILE_FUNCTION();
+        bucketsRecorded = 0;
+        drawStats = DrawStats();
+
+        if (!occlusionCuller.empty())
+        {
+            occlusionCuller.rasterize();
+            for (auto& bucket : drawBuckets)
+            {
+                if (bucket.draws.updateVisibility(occlusionCuller))
+                {
+                    bucket.markDirty();
+                }
+            }
+        }
+
+        for (auto& bucket : drawBuckets)
+        {
+            if (bucket.dirty[imageIndex])
+            {
+                recordBucket(bucket, imageIndex);
+                bucket.dirty[imageIndex] = false;
+                commandBuffersDirty[imageIndex] = true;
+                bucketsRecorded++;
+            }
+        }
+
+        if (commandBuffersDirty[imageIndex])
+        {
+            recordPrimaryCommandBuffer(imageIndex);
+            commandBuffersDirty[imageIndex] = false;
+        }
+    }
+
+    void recordBucket(DrawBucket& bucket, uint32_t imageIndex)
+    {
+        PROFILE_FUNCTION();
+        VkCommandBuffer commandBuffer = bucket.commandBuffers[imageIndex];
+
+        VkCommandBufferInheritanceInfo inheritanceInfo = {};
+        inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        inheritanceInfo.renderPass = renderPass;
+        inheritanceInfo.subpass = 0;
+        inheritanceInfo.framebuffer = swapChainFramebuffers[imageIndex];
+
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+        beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+        if (vkd.vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to record secondary command buffer!");
+        }
+
+        ArenaVector<VkPipeline> pipelines(frameArenas[currentFrame]);
+        ArenaVector<VkPipelineLayout> layouts(frameArenas[currentFrame]);
+        ArenaVector<VkPrimitiveTopology> topologies(frameArenas[currentFrame]);
+        pipelines.assign({ graphicsPipeline, particlePipeline, skinnedPipeline, litPipeline, propPipeline });
+        layouts.assign({ pipelineLayout, particlePipelineLayout, skinnedPipelineLayout, litPipelineLayout, propPipelineLayout });
+        topologies.assign({ VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, VK_PRIMITIVE_TOPOLOGY_POINT_LIST, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+            VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST });
+        for (VkPipeline pipeline : materialPipelines) {
+            pipelines.push_back(pipeline);
+            layouts.push_back(materialPipelineLayout);
+            topologies.push_back(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+        }
+
+        ArenaVector<VkDescriptorSet> descriptorSets(frameArenas[currentFrame]);
+        descriptorSets.push_back(SKINNING_PATH == SkinningPath::VertexShader ? skinningDescriptorSets[imageIndex] : VK_NULL_HANDLE);
+        descriptorSets.push_back(LIGHTING_ENABLED ? lightDescriptorSets[imageIndex] : VK_NULL_HANDLE);
+        descriptorSets.push_back(PROPS_ENABLED ? propDescriptorSets[imageIndex] : VK_NULL_HANDLE);
+        descriptorSets.insert(descriptorSets.end(), materialDescriptorSets.begin(), materialDescriptorSets.end());
+        VkBuffer vertexBuffers[] = {
+            PARTICLE_BACKEND == ParticleBackend::Gpu ? particleStorageBuffer : VK_NULL_HANDLE,
+            SKINNING_PATH == SkinningPath::VertexShader ? arenaVertexBuffer : VK_NULL_HANDLE,
+            arenaVertexBuffer
+        };
+        VkBuffer indexBuffers[] = { VK_NULL_HANDLE, SKINNING_PATH != SkinningPath::None ? arenaIndexBuffer : VK_NULL_HANDLE, arenaIndexBuffer };
+        // the CPU backend and async compute both fill a buffer per image
+        if (!particleVertexBuffers.empty()) {
+            vertexBuffers[0] = particleVertexBuffers[imageIndex];
+        }
+        if (SKINNING_PATH == SkinningPath::Cpu) {
+            vertexBuffers[1] = skinningBuffers[imageIndex];
+        }
+        bucket.stats[imageIndex] = DrawStats();
+        bucket.draws.record(commandBuffer, layouts.data(), pipelines.data(), topologies.data(), descriptorSets.data(), vertexBuffers, indexBuffers, bucket.stats[imageIndex]);
+        drawStats += bucket.stats[imageIndex];
+
+        if (vkd.vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to record secondary command buffer!");
+        }
+    }
+
+    void recordPrimaryCommandBuffer(uint32_t imageIndex)
+    {
+        PROFILE_FUNCTION();
+        VkCommandBuffer commandBuffer = commandBuffers[imageIndex];
+
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = 0;
+        beginInfo.pInheritanceInfo = nullptr;
+
+        if (vkd.vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to record command buffer!");
+        }
+
+        VkRenderPassBeginInfo renderPassInfo = {};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderPass = renderPass;
+        renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
+        renderPassInfo.renderArea.offset = { 0,0 };
+        renderPassInfo.renderArea.extent = swapChainExtent;
+
+        VkClearValue clearColor = { 0.0f, 0.0f, 0.0f, 1.0f };
+        renderPassInfo.clearValueCount = 1;
+        renderPassInfo.pClearValues = &clearColor;
+
+        if (timestampQueryPool != VK_NULL_HANDLE) {
+            vkd.vkCmdResetQueryPool(commandBuffer, timestampQueryPool, imageIndex * 2, 2);
+            vkd.vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampQueryPool, imageIndex * 2);
+        }
+
+        if (asyncCompute) {
+            recordParticleAcquire(commandBuffer, imageIndex);
+        }
+
+        vkd.vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+        ArenaVector<VkCommandBuffer> secondaries(frameArenas[currentFrame]);
+        secondaries.reserve(drawBuckets.size());
+        for (const auto& bucket : drawBuckets)
+        {
+            secondaries.push_back(bucket.commandBuffers[imageIndex]);
+        }
+        if (!secondaries.empty())
+        {
+            vkd.vkCmdExecuteCommands(commandBuffer, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+        }
+
+        vkd.vkCmdEndRenderPass(commandBuffer);
+
+        if (timestampQueryPool != VK_NULL_HANDLE) {
+            vkd.vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampQueryPool, imageIndex * 2 + 1);
+        }
+
+        if (vkd.vkEndCommandBuffer(commandBuffer) != VK_SUCCESS)
+        {
+            throw std::runtime_error("failed to record command buffer!");
+        }
     }
 
     void createInstance() {
@@ -339,396 +7693,2318 @@ private:
             throw std::runtime_error("validation layers requested, but not available!");
         }
 
-        VkApplicationInfo appInfo = {};
-        appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-        appInfo.pApplicationName = "Hello Triangle";
-        appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
-        appInfo.pEngineName = "No Engine";
-        appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-        appInfo.apiVersion = VK_API_VERSION_1_0;
+        VkApplicationInfo appInfo = {};
+        appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+        appInfo.pApplicationName = "Hello Triangle";
+        appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+        appInfo.pEngineName = "No Engine";
+        appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+        appInfo.apiVersion = VK_API_VERSION_1_0;
+
+        VkInstanceCreateInfo createInfo = {};
+        createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+        createInfo.pApplicationInfo = &appInfo;
+
+        auto extensions = getRequiredExtensions();
+        createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+        createInfo.ppEnabledExtensionNames = extensions.data();
+
+        if (enableValidationLayers) {
+            createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
+            createInfo.ppEnabledLayerNames = validationLayers.data();
+        }
+        else {
+            createInfo.enabledLayerCount = 0;
+        }
+
+        if (vkCreateInstance(&createInfo, nullptr, &instance) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create instance!");
+        }
+    }
+
+    void setupDebugCallback() {
+        if (!enableValidationLayers) return;
+
+        VkDebugUtilsMessengerCreateInfoEXT createInfo = {};
+        createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+        createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+        createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+        createInfo.pfnUserCallback = debugCallback;
+
+        if (CreateDebugUtilsMessengerEXT(instance, &createInfo, nullptr, &callback) != VK_SUCCESS) {
+            throw std::runtime_error("failed to set up debug callback!");
+        }
+    }
+
+    void createSurface() {
+        if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create window surface!");
+        }
+    }
+
+    void pickPhysicalDevice() {
+        uint32_t deviceCount = 0;
+        vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+
+        if (deviceCount == 0) {
+            throw std::runtime_error("failed to find GPUs with Vulkan support!");
+        }
+
+        std::vector<VkPhysicalDevice> devices(deviceCount);
+        vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+
+        for (const auto& device : devices) {
+            if (isDeviceSuitable(device)) {
+                physicalDevice = device;
+                break;
+            }
+        }
+
+        if (physicalDevice == VK_NULL_HANDLE) {
+            throw std::runtime_error("failed to find a suitable GPU!");
+        }
+    }
+
+    void createLogicalDevice() {
+        QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+
+        std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
+        std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily.value(), indices.presentFamily.value() };
+
+        // the GPU particle simulation is the only compute pass so far
+        asyncCompute = asyncComputeAllowed && PARTICLE_BACKEND == ParticleBackend::Gpu && indices.computeFamily.has_value();
+        graphicsQueueFamily = indices.graphicsFamily.value();
+        computeQueueFamily = asyncCompute ? indices.computeFamily.value() : graphicsQueueFamily;
+        uniqueQueueFamilies.insert(computeQueueFamily);
+
+        float queuePriority = 1.0f;
+        for (uint32_t queueFamily : uniqueQueueFamilies) {
+            VkDeviceQueueCreateInfo queueCreateInfo = {};
+            queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+            queueCreateInfo.queueFamilyIndex = queueFamily;
+            queueCreateInfo.queueCount = 1;
+            queueCreateInfo.pQueuePriorities = &queuePriority;
+            queueCreateInfos.push_back(queueCreateInfo);
+        }
+
+        VkPhysicalDeviceFeatures supportedFeatures;
+        vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+
+        VkPhysicalDeviceFeatures deviceFeatures = {};
+        deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+        textureCompressionBC = supportedFeatures.textureCompressionBC == VK_TRUE;
+
+        VkDeviceCreateInfo createInfo = {};
+        createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+
+        createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
+        createInfo.pQueueCreateInfos = queueCreateInfos.data();
+
+        createInfo.pEnabledFeatures = &deviceFeatures;
+
+        std::vector<const char*> extensions(deviceExtensions.begin(), deviceExtensions.end());
+
+#ifdef VK_KHR_present_wait
+        VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures = {};
+        presentIdFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+        VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures = {};
+        presentWaitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+        presentWaitFeatures.pNext = &presentIdFeatures;
+
+        if (supportsPresentWait()) {
+            extensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+            extensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+            presentIdFeatures.presentId = VK_TRUE;
+            presentWaitFeatures.presentWait = VK_TRUE;
+            createInfo.pNext = &presentWaitFeatures;
+            presentWaitEnabled = true;
+        }
+#endif
+
+        createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+        createInfo.ppEnabledExtensionNames = extensions.data();
+
+        if (enableValidationLayers) {
+            createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
+            createInfo.ppEnabledLayerNames = validationLayers.data();
+        }
+        else {
+            createInfo.enabledLayerCount = 0;
+        }
+
+        if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &device) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create logical device!");
+        }
+
+        vkd.load(device);
+
+        vkd.vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
+        vkd.vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+        vkd.vkGetDeviceQueue(device, computeQueueFamily, 0, &computeQueue);
+
+#ifdef VK_KHR_present_wait
+        if (presentWaitEnabled) {
+            waitForPresent = (PFN_vkWaitForPresentKHR)vkGetDeviceProcAddr(device, "vkWaitForPresentKHR");
+            presentWaitEnabled = waitForPresent != nullptr;
+        }
+#endif
+    }
+
+#ifdef VK_KHR_present_wait
+    // Both extensions and features have to be there; the feature query needs
+    // VK_KHR_get_physical_device_properties2 on a 1.0 instance.
+    bool supportsPresentWait() {
+        uint32_t extensionCount;
+        vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, nullptr);
+        std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+        vkEnumerateDeviceExtensionProperties(physicalDevice, nullptr, &extensionCount, availableExtensions.data());
+
+        int found = 0;
+        for (const auto& extension : availableExtensions) {
+            if (strcmp(extension.extensionName, VK_KHR_PRESENT_ID_EXTENSION_NAME) == 0 || strcmp(extension.extensionName, VK_KHR_PRESENT_WAIT_EXTENSION_NAME) == 0) {
+                found++;
+            }
+        }
+        if (found != 2) return false;
+
+        auto getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2KHR");
+        if (getFeatures2 == nullptr) return false;
+
+        VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures = {};
+        presentIdFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+        VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures = {};
+        presentWaitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+        presentWaitFeatures.pNext = &presentIdFeatures;
+        VkPhysicalDeviceFeatures2 features = {};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &presentWaitFeatures;
+        getFeatures2(physicalDevice, &features);
+
+        return presentIdFeatures.presentId && presentWaitFeatures.presentWait;
+    }
+#endif
+
+    void createSwapChain() {
+        SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice);
+
+        VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
+        VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
+        VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
+
+        uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
+        if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount) {
+            imageCount = swapChainSupport.capabilities.maxImageCount;
+        }
+
+        VkSwapchainCreateInfoKHR createInfo = {};
+        createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+        createInfo.surface = surface;
+
+        createInfo.minImageCount = imageCount;
+        createInfo.imageFormat = surfaceFormat.format;
+        createInfo.imageColorSpace = surfaceFormat.colorSpace;
+        createInfo.imageExtent = extent;
+        createInfo.imageArrayLayers = 1;
+        createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        // frame capture copies straight out of the swap chain images
+        captureSupported = (swapChainSupport.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) != 0 &&
+            (surfaceFormat.format == VK_FORMAT_B8G8R8A8_UNORM || surfaceFormat.format == VK_FORMAT_B8G8R8A8_SRGB ||
+             surfaceFormat.format == VK_FORMAT_R8G8B8A8_UNORM || surfaceFormat.format == VK_FORMAT_R8G8B8A8_SRGB);
+        if (captureSupported) {
+            createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        }
+
+        QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+        uint32_t queueFamilyIndices[] = { indices.graphicsFamily.value(), indices.presentFamily.value() };
+
+        if (indices.graphicsFamily != indices.presentFamily) {
+            createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+            createInfo.queueFamilyIndexCount = 2;
+            createInfo.pQueueFamilyIndices = queueFamilyIndices;
+        }
+        else {
+            createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        }
+
+        createInfo.preTransform = swapChainSupport.capabilities.currentTransform;
+        createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+        createInfo.presentMode = presentMode;
+        createInfo.clipped = VK_TRUE;
+
+        createInfo.oldSwapchain = VK_NULL_HANDLE;
+
+        if (vkd.vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create swap chain!");
+        }
+
+        vkd.vkGetSwapchainImagesKHR(device, swapChain, &imageCount, nullptr);
+        swapChainImages.resize(imageCount);
+        vkd.vkGetSwapchainImagesKHR(device, swapChain, &imageCount, swapChainImages.data());
+
+        swapChainImageFormat = surfaceFormat.format;
+        swapChainExtent = extent;
+        cameraAspect = extent.width / static_cast<float>(extent.height);
+    }
+
+    void createImageViews() {
+        swapChainImageViews.resize(swapChainImages.size());
+
+        for (size_t i = 0; i < swapChainImages.size(); i++) {
+            VkImageViewCreateInfo createInfo = {};
+            createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            createInfo.image = swapChainImages[i];
+            createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            createInfo.format = swapChainImageFormat;
+            createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+            createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            createInfo.subresourceRange.baseMipLevel = 0;
+            createInfo.subresourceRange.levelCount = 1;
+            createInfo.subresourceRange.baseArrayLayer = 0;
+            createInfo.subresourceRange.layerCount = 1;
+
+            if (vkd.vkCreateImageView(device, &createInfo, nullptr, &swapChainImageViews[i]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create image views!");
+            }
+        }
+    }
+
+    void createRenderPass() {
+        VkAttachmentDescription colorAttachment = {};
+        colorAttachment.format = swapChainImageFormat;
+        colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+        VkAttachmentReference colorAttachmentRef = {};
+        colorAttachmentRef.attachment = 0;
+        colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+        VkSubpassDescription subpass = {};
+        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.colorAttachmentCount = 1;
+        subpass.pColorAttachments = &colorAttachmentRef;
+
+        VkSubpassDependency dependency = {};
+        dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+        dependency.dstSubpass = 0;
+        dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependency.srcAccessMask = 0;
+        dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+
+        VkRenderPassCreateInfo renderPassInfo = {};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        renderPassInfo.attachmentCount = 1;
+        renderPassInfo.pAttachments = &colorAttachment;
+        renderPassInfo.subpassCount = 1;
+        renderPassInfo.pSubpasses = &subpass;
+        renderPassInfo.dependencyCount = 1;
+        renderPassInfo.pDependencies = &dependency;
+
+        if (vkd.vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create render pass!");
+        }
+
+        
+
+    }
+
+    void createGraphicsPipeline() {
+        PROFILE_FUNCTION();
+        auto vertShaderCode = readFile("shaders/vert.spv");
+        auto fragShaderCode = readFile("shaders/frag.spv");
+
+        VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
+        VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
+
+        VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
+        vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+        vertShaderStageInfo.module = vertShaderModule;
+        vertShaderStageInfo.pName = "main";
+
+        VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
+        fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        fragShaderStageInfo.module = fragShaderModule;
+        fragShaderStageInfo.pName = "main";
+
+        VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
+
+        VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+        vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+        vertexInputInfo.vertexBindingDescriptionCount = 0;
+        vertexInputInfo.vertexAttributeDescriptionCount = 0;
+
+        VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+        inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+        inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+        VkViewport viewport = {};
+        viewport.x = 0.0f;
+        viewport.y = 0.0f;
+        viewport.width = (float)swapChainExtent.width;
+        viewport.height = (float)swapChainExtent.height;
+        viewport.minDepth = 0.0f;
+        viewport.maxDepth = 1.0f;
+
+        VkRect2D scissor = {};
+        scissor.offset = { 0, 0 };
+        scissor.extent = swapChainExtent;
+
+        VkPipelineViewportStateCreateInfo viewportState = {};
+        viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        viewportState.viewportCount = 1;
+        viewportState.pViewports = &viewport;
+        viewportState.scissorCount = 1;
+        viewportState.pScissors = &scissor;
+
+        VkPipelineRasterizationStateCreateInfo rasterizer = {};
+        rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        rasterizer.depthClampEnable = VK_FALSE;
+        rasterizer.rasterizerDiscardEnable = VK_FALSE;
+        rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+        rasterizer.lineWidth = 1.0f;
+        rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+        rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
+        rasterizer.depthBiasEnable = VK_FALSE;
+
+        VkPipelineMultisampleStateCreateInfo multisampling = {};
+        multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+        multisampling.sampleShadingEnable = VK_FALSE;
+        multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+        VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+        colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+        colorBlendAttachment.blendEnable = VK_FALSE;
+
+        VkPipelineColorBlendStateCreateInfo colorBlending = {};
+        colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+        colorBlending.logicOpEnable = VK_FALSE;
+        colorBlending.logicOp = VK_LOGIC_OP_COPY;
+        colorBlending.attachmentCount = 1;
+        colorBlending.pAttachments = &colorBlendAttachment;
+        colorBlending.blendConstants[0] = 0.0f;
+        colorBlending.blendConstants[1] = 0.0f;
+        colorBlending.blendConstants[2] = 0.0f;
+        colorBlending.blendConstants[3] = 0.0f;
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 0;
+        pipelineLayoutInfo.pushConstantRangeCount = 0;
+
+        if (vkd.vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create pipeline layout!");
+        }
+
+        VkGraphicsPipelineCreateInfo pipelineInfo = {};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        pipelineInfo.stageCount = 2;
+        pipelineInfo.pStages = shaderStages;
+        pipelineInfo.pVertexInputState = &vertexInputInfo;
+        pipelineInfo.pInputAssemblyState = &inputAssembly;
+        pipelineInfo.pViewportState = &viewportState;
+        pipelineInfo.pRasterizationState = &rasterizer;
+        pipelineInfo.pMultisampleState = &multisampling;
+        pipelineInfo.pColorBlendState = &colorBlending;
+        pipelineInfo.layout = pipelineLayout;
+        pipelineInfo.renderPass = renderPass;
+        pipelineInfo.subpass = 0;
+        pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+
+        if (vkd.vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create graphics pipeline!");
+        }
+        telemetry.add(TelemetryCounter::PipelineCompiles, 1);
+
+        vkd.vkDestroyShaderModule(device, fragShaderModule, nullptr);
+        vkd.vkDestroyShaderModule(device, vertShaderModule, nullptr);
+    }
+
+    void createFramebuffers() {
+        swapChainFramebuffers.resize(swapChainImageViews.size());
+
+        for (size_t i = 0; i < swapChainImageViews.size(); i++) {
+            VkImageView attachments[] = {
+                swapChainImageViews[i]
+            };
+
+            VkFramebufferCreateInfo framebufferInfo = {};
+            framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+            framebufferInfo.renderPass = renderPass;
+            framebufferInfo.attachmentCount = 1;
+            framebufferInfo.pAttachments = attachments;
+            framebufferInfo.width = swapChainExtent.width;
+            framebufferInfo.height = swapChainExtent.height;
+            framebufferInfo.layers = 1;
+
+            if (vkd.vkCreateFramebuffer(device, &framebufferInfo, nullptr, &swapChainFramebuffers[i]) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create framebuffer!");
+            }
+        }
+    }
+
+    VkShaderModule createShaderModule(const std::vector<char>& code) {
+        VkShaderModuleCreateInfo createInfo = {};
+        createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        createInfo.codeSize = code.size();
+        createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+
+        VkShaderModule shaderModule;
+        if (vkd.vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create shader module!");
+        }
+
+        return shaderModule;
+    }
+
+    void createParticlePipeline() {
+        if (PARTICLE_BACKEND == ParticleBackend::None) return;
+
+        VkVertexInputBindingDescription bindingDescription = {};
+        bindingDescription.binding = 0;
+        bindingDescription.stride = sizeof(ParticleVertex);
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+        VkVertexInputAttributeDescription attributeDescription = {};
+        attributeDescription.location = 0;
+        attributeDescription.binding = 0;
+        attributeDescription.format = VK_FORMAT_R32G32B32A32_SFLOAT;
+        attributeDescription.offset = offsetof(ParticleVertex, position);
+
+        VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+        vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+        vertexInputInfo.vertexBindingDescriptionCount = 1;
+        vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+        vertexInputInfo.vertexAttributeDescriptionCount = 1;
+        vertexInputInfo.pVertexAttributeDescriptions = &attributeDescription;
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+
+        if (vkd.vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &particlePipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create particle pipeline layout!");
+        }
+
+        particlePipeline = createPipeline("shaders/particle_vert.spv", "shaders/particle_frag.spv", vertexInputInfo,
+            VK_PRIMITIVE_TOPOLOGY_POINT_LIST, particlePipelineLayout);
+    }
+
+    void createSkinnedPipeline() {
+        if (SKINNING_PATH == SkinningPath::None) return;
+
+        VkVertexInputBindingDescription bindingDescription = {};
+        bindingDescription.binding = 0;
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+        VkVertexInputAttributeDescription attributeDescriptions[4] = {};
+        for (uint32_t i = 0; i < 4; i++) {
+            attributeDescriptions[i].location = i;
+            attributeDescriptions[i].binding = 0;
+            attributeDescriptions[i].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+        }
+
+        VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+        vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+        vertexInputInfo.vertexBindingDescriptionCount = 1;
+        vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+        vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions;
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+
+        const char* vertPath;
+        if (SKINNING_PATH == SkinningPath::VertexShader) {
+            bindingDescription.stride = sizeof(SkinnedVertex);
+            attributeDescriptions[0].offset = offsetof(SkinnedVertex, position);
+            attributeDescriptions[1].offset = offsetof(SkinnedVertex, normal);
+            attributeDescriptions[2].offset = offsetof(SkinnedVertex, weights);
+            attributeDescriptions[3].offset = offsetof(SkinnedVertex, joints);
+            attributeDescriptions[3].format = VK_FORMAT_R32G32B32A32_UINT;
+            vertexInputInfo.vertexAttributeDescriptionCount = 4;
+            pipelineLayoutInfo.setLayoutCount = 1;
+            pipelineLayoutInfo.pSetLayouts = &skinningSetLayout;
+            vertPath = "shaders/skinned_vert.spv";
+        }
+        else {
+            bindingDescription.stride = sizeof(SkinnedOutputVertex);
+            attributeDescriptions[0].offset = offsetof(SkinnedOutputVertex, position);
+            attributeDescriptions[1].offset = offsetof(SkinnedOutputVertex, normal);
+            vertexInputInfo.vertexAttributeDescriptionCount = 2;
+            vertPath = "shaders/skinned_static_vert.spv";
+        }
+
+        if (vkd.vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &skinnedPipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create skinned pipeline layout!");
+        }
+
+        skinnedPipeline = createPipeline(vertPath, "shaders/frag.spv", vertexInputInfo,
+            VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, skinnedPipelineLayout);
+    }
+
+    // Fixed-function state shared by the extra pipelines: full-window viewport,
+    // no blending, and no culling unless asked for.
+    VkPipeline createPipeline(const char* vertPath, const char* fragPath, const VkPipelineVertexInputStateCreateInfo& vertexInputInfo,
+        VkPrimitiveTopology topology, VkPipelineLayout layout, const VkSpecializationInfo* fragmentSpecialization = nullptr,
+        VkCullModeFlags cullMode = VK_CULL_MODE_NONE) {
+        auto vertShaderCode = readFile(vertPath);
+        auto fragShaderCode = readFile(fragPath);
+
+        VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
+        VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
+
+        VkPipelineShaderStageCreateInfo shaderStages[2] = {};
+        shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+        shaderStages[0].module = vertShaderModule;
+        shaderStages[0].pName = "main";
+        shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        shaderStages[1].module = fragShaderModule;
+        shaderStages[1].pName = "main";
+        shaderStages[1].pSpecializationInfo = fragmentSpecialization;
+
+        VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
+        inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+        inputAssembly.topology = topology;
+        inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+        VkViewport viewport = { 0.0f, 0.0f, (float)swapChainExtent.width, (float)swapChainExtent.height, 0.0f, 1.0f };
+        VkRect2D scissor = { { 0, 0 }, swapChainExtent };
+
+        VkPipelineViewportStateCreateInfo viewportState = {};
+        viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        viewportState.viewportCount = 1;
+        viewportState.pViewports = &viewport;
+        viewportState.scissorCount = 1;
+        viewportState.pScissors = &scissor;
+
+        VkPipelineRasterizationStateCreateInfo rasterizer = {};
+        rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+        rasterizer.lineWidth = 1.0f;
+        rasterizer.cullMode = cullMode;
+        // meshes wind counter-clockwise seen from outside, and the world
+        // camera's flipped y keeps them that way on screen
+        rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+
+        VkPipelineMultisampleStateCreateInfo multisampling = {};
+        multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+        multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+        VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
+        colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+        colorBlendAttachment.blendEnable = VK_FALSE;
+
+        VkPipelineColorBlendStateCreateInfo colorBlending = {};
+        colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+        colorBlending.attachmentCount = 1;
+        colorBlending.pAttachments = &colorBlendAttachment;
+
+        VkPipeline pipeline;
+        VkGraphicsPipelineCreateInfo pipelineInfo = {};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        pipelineInfo.stageCount = 2;
+        pipelineInfo.pStages = shaderStages;
+        pipelineInfo.pVertexInputState = &vertexInputInfo;
+        pipelineInfo.pInputAssemblyState = &inputAssembly;
+        pipelineInfo.pViewportState = &viewportState;
+        pipelineInfo.pRasterizationState = &rasterizer;
+        pipelineInfo.pMultisampleState = &multisampling;
+        pipelineInfo.pColorBlendState = &colorBlending;
+        pipelineInfo.layout = layout;
+        pipelineInfo.renderPass = renderPass;
+        pipelineInfo.subpass = 0;
+
+        if (vkd.vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create graphics pipeline!");
+        }
+        telemetry.add(TelemetryCounter::PipelineCompiles, 1);
+
+        vkd.vkDestroyShaderModule(device, fragShaderModule, nullptr);
+        vkd.vkDestroyShaderModule(device, vertShaderModule, nullptr);
+
+        return pipeline;
+    }
+
+    void createMaterials() {
+        if (!MATERIALS_ENABLED) return;
+
+        // the second tint material shares its bitmask, and so its variant, with the first
+        materials = {
+            { MATERIAL_TINT, glm::vec4(1.0f, 0.6f, 0.6f, 1.0f) },
+            { MATERIAL_TINT | MATERIAL_STRIPES, glm::vec4(0.6f, 1.0f, 0.6f, 1.0f) },
+            { MATERIAL_VIGNETTE | MATERIAL_GRADE, glm::vec4(1.0f) },
+            { MATERIAL_TINT | MATERIAL_NOISE | MATERIAL_GRADE, glm::vec4(0.6f, 0.6f, 1.0f, 1.0f) },
+            { MATERIAL_TINT, glm::vec4(1.0f, 1.0f, 0.6f, 1.0f) },
+        };
+
+        materialVariantIndices.clear();
+        for (const auto& material : materials) {
+            materialVariantIndices.push_back(materialVariants.request(material.features));
+        }
+        uberVariantIndex = materialVariants.request(ShaderVariantSet::UBER_VARIANT);
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        VkDeviceSize alignment = std::max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment, 1);
+        VkDeviceSize stride = (sizeof(MaterialParams) + alignment - 1) / alignment * alignment;
+        VkDeviceSize bufferSize = stride * materials.size();
+
+        createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            materialBuffer, materialBufferMemory);
+
+        void* data;
+        vkd.vkMapMemory(device, materialBufferMemory, 0, bufferSize, 0, &data);
+        for (size_t m = 0; m < materials.size(); m++) {
+            MaterialParams params = {};
+            params.tint = materials[m].tint;
+            params.features = materials[m].features;
+            memcpy(static_cast<char*>(data) + stride * m, &params, sizeof(params));
+        }
+        vkd.vkUnmapMemory(device, materialBufferMemory);
+        telemetry.add(TelemetryCounter::UploadBytes, static_cast<double>(bufferSize));
+
+        VkDescriptorSetLayoutBinding binding = {};
+        binding.binding = 0;
+        binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        binding.descriptorCount = 1;
+        binding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = 1;
+        layoutInfo.pBindings = &binding;
+
+        if (vkd.vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &materialSetLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create material descriptor set layout!");
+        }
+
+        uint32_t setCount = static_cast<uint32_t>(materials.size());
+        VkDescriptorPoolSize poolSize = { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, setCount };
+
+        VkDescriptorPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.maxSets = setCount;
+        poolInfo.poolSizeCount = 1;
+        poolInfo.pPoolSizes = &poolSize;
+
+        if (vkd.vkCreateDescriptorPool(device, &poolInfo, nullptr, &materialDescriptorPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create material descriptor pool!");
+        }
+
+        std::vector<VkDescriptorSetLayout> layouts(setCount, materialSetLayout);
+        VkDescriptorSetAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = materialDescriptorPool;
+        allocInfo.descriptorSetCount = setCount;
+        allocInfo.pSetLayouts = layouts.data();
+
+        materialDescriptorSets.resize(setCount);
+        if (vkd.vkAllocateDescriptorSets(device, &allocInfo, materialDescriptorSets.data()) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate material descriptor sets!");
+        }
+        telemetry.add(TelemetryCounter::DescriptorAllocations, allocInfo.descriptorSetCount);
+
+        for (uint32_t m = 0; m < setCount; m++) {
+            VkDescriptorBufferInfo bufferInfo = { materialBuffer, stride * m, sizeof(MaterialParams) };
+
+            VkWriteDescriptorSet descriptorWrite = {};
+            descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrite.dstSet = materialDescriptorSets[m];
+            descriptorWrite.dstBinding = 0;
+            descriptorWrite.descriptorCount = 1;
+            descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            descriptorWrite.pBufferInfo = &bufferInfo;
+            vkd.vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+        }
+    }
+
+    // Compiles every variant up front, one pipeline per distinct bitmask plus
+    // the uber variant, so nothing is compiled once frames are running.
+    void createMaterialPipelines() {
+        if (!MATERIALS_ENABLED) return;
+        PROFILE_FUNCTION();
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &materialSetLayout;
+
+        if (vkd.vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &materialPipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create material pipeline layout!");
+        }
+
+        VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+        vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+        VkSpecializationMapEntry entries[] = {
+            { 0, offsetof(MaterialSpecialization, features), sizeof(uint32_t) },
+            { 1, offsetof(MaterialSpecialization, uber), sizeof(VkBool32) },
+            { 2, offsetof(MaterialSpecialization, viewportWidth), sizeof(float) },
+            { 3, offsetof(MaterialSpecialization, viewportHeight), sizeof(float) },
+        };
+
+        for (uint32_t key : materialVariants.keys()) {
+            MaterialSpecialization specialization = {};
+            specialization.uber = key == ShaderVariantSet::UBER_VARIANT ? VK_TRUE : VK_FALSE;
+            specialization.features = specialization.uber ? 0 : key;
+            specialization.viewportWidth = static_cast<float>(swapChainExtent.width);
+            specialization.viewportHeight = static_cast<float>(swapChainExtent.height);
+
+            VkSpecializationInfo specializationInfo = {};
+            specializationInfo.mapEntryCount = 4;
+            specializationInfo.pMapEntries = entries;
+            specializationInfo.dataSize = sizeof(specialization);
+            specializationInfo.pData = &specialization;
+
+            materialPipelines.push_back(createPipeline("shaders/vert.spv", "shaders/material_frag.spv", vertexInputInfo,
+                VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, materialPipelineLayout, &specializationInfo));
+        }
+    }
+
+    void destroyMaterials() {
+        if (!MATERIALS_ENABLED) return;
+
+        vkd.vkDestroyDescriptorPool(device, materialDescriptorPool, nullptr);
+        vkd.vkDestroyDescriptorSetLayout(device, materialSetLayout, nullptr);
+        vkd.vkDestroyBuffer(device, materialBuffer, nullptr);
+        vkd.vkFreeMemory(device, materialBufferMemory, nullptr);
+    }
+
+    // Projection of the world camera. Vulkan clip space has y pointing down.
+    glm::mat4 cameraProjection() const {
+        float aspect = swapChainExtent.width / static_cast<float>(swapChainExtent.height);
+        glm::mat4 projection = glm::perspective(glm::radians(CAMERA_FOV), aspect, CAMERA_Z_NEAR, CAMERA_Z_FAR);
+        projection[1][1] *= -1.0f;
+        return projection;
+    }
+
+    // Three storage buffers per swap chain image, matching the bindings in
+    // shaders/clustered.frag, and the camera for shaders/clustered.vert. Like
+    // the skinning palettes, an image's buffers are rewritten once its last
+    // frame is done, and its cached command buffers keep the same set.
+    void createLights() {
+        if (!LIGHTING_ENABLED) return;
+
+        // placed once: after that the simulation owns them, also across swap chain recreation
+        if (lights.empty()) {
+            lights.resize(LIGHT_COUNT);
+            for (uint32_t i = 0; i < LIGHT_COUNT; i++) {
+                float angle = i * 2.39996323f;
+                float distance = 4.0f + 60.0f * std::sqrt((i + 0.5f) / LIGHT_COUNT);
+                lights[i].positionRadius = glm::vec4(std::cos(angle) * distance, 0.5f + (i % 7) * 0.5f, std::sin(angle) * distance, 2.0f + (i % 5));
+                lights[i].color = glm::vec4(0.5f + 0.5f * std::cos(angle), 0.5f + 0.5f * std::sin(angle * 3.0f), 0.5f + 0.5f * std::cos(angle * 5.0f), 1.0f);
+            }
+        }
+
+        const VkDeviceSize sizes[] = {
+            sizeof(PointLight) * LIGHT_COUNT,
+            sizeof(LightCluster) * LightClusterer::CLUSTER_COUNT,
+            sizeof(uint32_t) * MAX_LIGHT_INDICES,
+            sizeof(LightCamera),
+        };
+        const VkDescriptorType types[] = {
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+        };
+        const uint32_t bufferCount = 4;
+        uint32_t imageCount = static_cast<uint32_t>(swapChainImages.size());
+
+        lightBuffers.resize(imageCount * bufferCount);
+        lightBuffersMemory.resize(lightBuffers.size());
+        lightBuffersMapped.resize(lightBuffers.size());
+        for (size_t i = 0; i < lightBuffers.size(); i++) {
+            VkBufferUsageFlags usage = types[i % bufferCount] == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER ? VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT : VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+            createBuffer(sizes[i % bufferCount], usage, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                lightBuffers[i], lightBuffersMemory[i]);
+            vkd.vkMapMemory(device, lightBuffersMemory[i], 0, sizes[i % bufferCount], 0, &lightBuffersMapped[i]);
+        }
+
+        VkDescriptorSetLayoutBinding bindings[bufferCount] = {};
+        for (uint32_t b = 0; b < bufferCount; b++) {
+            bindings[b].binding = b;
+            bindings[b].descriptorType = types[b];
+            bindings[b].descriptorCount = 1;
+            bindings[b].stageFlags = types[b] == VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER ? VK_SHADER_STAGE_VERTEX_BIT : VK_SHADER_STAGE_FRAGMENT_BIT;
+        }
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = bufferCount;
+        layoutInfo.pBindings = bindings;
 
-        VkInstanceCreateInfo createInfo = {};
-        createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-        createInfo.pApplicationInfo = &appInfo;
+        if (vkd.vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &lightSetLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create light descriptor set layout!");
+        }
 
-        auto extensions = getRequiredExtensions();
-        createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
-        createInfo.ppEnabledExtensionNames = extensions.data();
+        VkDescriptorPoolSize poolSizes[] = {
+            { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, imageCount * 3 },
+            { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, imageCount },
+        };
 
-        if (enableValidationLayers) {
-            createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
-            createInfo.ppEnabledLayerNames = validationLayers.data();
+        VkDescriptorPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.maxSets = imageCount;
+        poolInfo.poolSizeCount = 2;
+        poolInfo.pPoolSizes = poolSizes;
+
+        if (vkd.vkCreateDescriptorPool(device, &poolInfo, nullptr, &lightDescriptorPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create light descriptor pool!");
+        }
+
+        std::vector<VkDescriptorSetLayout> layouts(imageCount, lightSetLayout);
+        VkDescriptorSetAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = lightDescriptorPool;
+        allocInfo.descriptorSetCount = imageCount;
+        allocInfo.pSetLayouts = layouts.data();
+
+        lightDescriptorSets.resize(imageCount);
+        if (vkd.vkAllocateDescriptorSets(device, &allocInfo, lightDescriptorSets.data()) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate light descriptor sets!");
+        }
+        telemetry.add(TelemetryCounter::DescriptorAllocations, allocInfo.descriptorSetCount);
+
+        for (uint32_t i = 0; i < imageCount; i++) {
+            VkDescriptorBufferInfo bufferInfos[bufferCount];
+            VkWriteDescriptorSet descriptorWrites[bufferCount] = {};
+            for (uint32_t b = 0; b < bufferCount; b++) {
+                bufferInfos[b] = { lightBuffers[i * bufferCount + b], 0, VK_WHOLE_SIZE };
+                descriptorWrites[b].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptorWrites[b].dstSet = lightDescriptorSets[i];
+                descriptorWrites[b].dstBinding = b;
+                descriptorWrites[b].descriptorCount = 1;
+                descriptorWrites[b].descriptorType = types[b];
+                descriptorWrites[b].pBufferInfo = &bufferInfos[b];
+            }
+            vkd.vkUpdateDescriptorSets(device, bufferCount, descriptorWrites, 0, nullptr);
+        }
+    }
+
+    // The ground plane: vertices come from gl_VertexIndex, and the fragment
+    // shader is specialized with the clusterer's grid and depth range.
+    void createLitPipeline() {
+        if (!LIGHTING_ENABLED) return;
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &lightSetLayout;
+
+        if (vkd.vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &litPipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create lit pipeline layout!");
+        }
+
+        VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+        vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+        // constant_id order of clustered.frag
+        struct {
+            uint32_t grid[3];
+            float viewport[2];
+            float depthRange[2];
+        } constants = {
+            { LightClusterer::GRID_X, LightClusterer::GRID_Y, LightClusterer::GRID_Z },
+            { static_cast<float>(swapChainExtent.width), static_cast<float>(swapChainExtent.height) },
+            { CAMERA_Z_NEAR, CAMERA_Z_FAR },
+        };
+        VkSpecializationMapEntry entries[7];
+        for (uint32_t i = 0; i < 7; i++) {
+            entries[i] = { i, i * 4, 4 };
+        }
+
+        VkSpecializationInfo specializationInfo = {};
+        specializationInfo.mapEntryCount = 7;
+        specializationInfo.pMapEntries = entries;
+        specializationInfo.dataSize = sizeof(constants);
+        specializationInfo.pData = &constants;
+
+        litPipeline = createPipeline("shaders/clustered_vert.spv", "shaders/clustered_frag.spv", vertexInputInfo,
+            VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, litPipelineLayout, &specializationInfo);
+    }
+
+    void createTextures() {
+        frameUploads.resize(MAX_FRAMES_IN_FLIGHT);
+        if (!texturePaths.empty()) {
+            assetLoader.start(ASSET_READER_THREADS, ASSET_DECODER_THREADS);
+            // in command-line order, each due a frame after the last
+            VkFormat format = textureFormat(TEXTURE_FORMAT);
+            auto now = std::chrono::high_resolution_clock::now();
+            for (size_t i = 0; i < texturePaths.size(); i++) {
+                std::unique_ptr<AssetJob> job(new TextureAssetJob(texturePaths[i], format, &decodedTextures));
+                assetLoader.load(texturePaths[i], 0, now + std::chrono::milliseconds(16 * (i + 1)), std::move(job));
+            }
+        }
+
+        if (!TEXTURES_ENABLED) return;
+
+        const uint32_t size = 1024;
+        std::vector<uint8_t> pixels;
+        proceduralTexture(size, pixels);
+        textures.push_back(uploadTexture(pixels.data(), size, size, TEXTURE_FORMAT, TEXTURE_QUALITY));
+    }
+
+    void destroyTextures() {
+        assetLoader.stop();
+        for (size_t i = 0; i < frameUploads.size(); i++) {
+            releaseUploads(i);
+        }
+        for (const auto& texture : textures) {
+            vkd.vkDestroyImageView(device, texture.view, nullptr);
+            vkd.vkDestroyImage(device, texture.image, nullptr);
+            vkd.vkFreeMemory(device, texture.memory, nullptr);
+        }
+        textures.clear();
+    }
+
+    // TEXTURE_FORMAT's block format when the device can sample it, else RGBA8.
+    VkFormat textureFormat(BlockFormat format) {
+        if (textureCompressionBC) {
+            VkFormatProperties properties;
+            vkGetPhysicalDeviceFormatProperties(physicalDevice, BlockEncoder::vulkanFormat(format), &properties);
+            if (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) {
+                return BlockEncoder::vulkanFormat(format);
+            }
+        }
+        return VK_FORMAT_R8G8B8A8_UNORM;
+    }
+
+    // Block-compresses straight into the mapped staging buffer, so there is
+    // no CPU-side copy of the encoded texture. Falls back to RGBA8 when the
+    // device can't sample the block format.
+    Texture uploadTexture(const uint8_t* rgba, uint32_t width, uint32_t height, BlockFormat format, BlockQuality quality) {
+        PROFILE_FUNCTION();
+        VkFormat imageFormat = textureFormat(format);
+        VkDeviceSize size = imageFormat == VK_FORMAT_R8G8B8A8_UNORM ? VkDeviceSize(width) * height * 4 : BlockEncoder::encodedSize(format, width, height);
+
+        VkBuffer stagingBuffer;
+        VkDeviceMemory stagingBufferMemory;
+        createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+
+        void* data;
+        vkd.vkMapMemory(device, stagingBufferMemory, 0, size, 0, &data);
+        if (imageFormat == VK_FORMAT_R8G8B8A8_UNORM) {
+            memcpy(data, rgba, static_cast<size_t>(size));
         }
         else {
-            createInfo.enabledLayerCount = 0;
+            BlockEncoder(format, quality).encode(rgba, width, height, static_cast<uint8_t*>(data));
         }
+        vkd.vkUnmapMemory(device, stagingBufferMemory);
+        telemetry.add(TelemetryCounter::UploadBytes, static_cast<double>(size));
 
-        if (vkCreateInstance(&createInfo, nullptr, &instance) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create instance!");
+        Texture texture = createTextureImage(imageFormat, width, height);
+
+        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+        recordTextureCopy(commandBuffer, stagingBuffer, texture, width, height);
+        endSingleTimeCommands(commandBuffer);
+
+        vkd.vkDestroyBuffer(device, stagingBuffer, nullptr);
+        vkd.vkFreeMemory(device, stagingBufferMemory, nullptr);
+
+        createTextureView(texture);
+        return texture;
+    }
+
+    // Records a texture the asset loader decoded for this frame's submit;
+    // nothing here waits on the GPU.
+    void uploadTextureAsync(const DecodedTexture& decoded) {
+        PROFILE_FUNCTION();
+        StagingUpload upload;
+        VkDeviceSize size = decoded.data.size();
+        createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, upload.buffer, upload.memory);
+
+        void* data;
+        vkd.vkMapMemory(device, upload.memory, 0, size, 0, &data);
+        memcpy(data, decoded.data.data(), decoded.data.size());
+        vkd.vkUnmapMemory(device, upload.memory);
+        telemetry.add(TelemetryCounter::UploadBytes, static_cast<double>(size));
+
+        Texture texture = createTextureImage(decoded.format, decoded.width, decoded.height);
+
+        VkCommandBufferAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandPool = commandPool;
+        allocInfo.commandBufferCount = 1;
+        vkd.vkAllocateCommandBuffers(device, &allocInfo, &upload.commandBuffer);
+
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkd.vkBeginCommandBuffer(upload.commandBuffer, &beginInfo);
+        recordTextureCopy(upload.commandBuffer, upload.buffer, texture, decoded.width, decoded.height);
+        vkd.vkEndCommandBuffer(upload.commandBuffer);
+
+        createTextureView(texture);
+        textures.push_back(texture);
+        frameUploads[currentFrame].push_back(upload);
+        uploadCommandBuffers.push_back(upload.commandBuffer);
+    }
+
+    // Takes this frame's share of finished assets off the loader and records
+    // their uploads.
+    void deliverAssets() {
+        assetsDelivered = assetLoader.deliver(ASSET_DELIVERIES_PER_FRAME);
+        if (assetsDelivered == 0) return;
+        PROFILE_FUNCTION();
+        for (const auto& decoded : decodedTextures) {
+            uploadTextureAsync(decoded);
         }
+        decodedTextures.clear();
     }
 
-    void setupDebugCallback() {
-        if (!enableValidationLayers) return;
+    // Called once the frame slot's fence has passed.
+    void releaseUploads(size_t frame) {
+        for (const auto& upload : frameUploads[frame]) {
+            vkd.vkFreeCommandBuffers(device, commandPool, 1, &upload.commandBuffer);
+            vkd.vkDestroyBuffer(device, upload.buffer, nullptr);
+            vkd.vkFreeMemory(device, upload.memory, nullptr);
+        }
+        frameUploads[frame].clear();
+    }
 
-        VkDebugUtilsMessengerCreateInfoEXT createInfo = {};
-        createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
-        createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
-        createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
-        createInfo.pfnUserCallback = debugCallback;
+    Texture createTextureImage(VkFormat format, uint32_t width, uint32_t height) {
+        Texture texture = {};
+        texture.format = format;
+
+        VkImageCreateInfo imageInfo = {};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = texture.format;
+        imageInfo.extent = { width, height, 1 };
+        imageInfo.mipLevels = 1;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        if (vkd.vkCreateImage(device, &imageInfo, nullptr, &texture.image) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create texture image!");
+        }
 
-        if (CreateDebugUtilsMessengerEXT(instance, &createInfo, nullptr, &callback) != VK_SUCCESS) {
-            throw std::runtime_error("failed to set up debug callback!");
+        VkMemoryRequirements memRequirements;
+        vkd.vkGetImageMemoryRequirements(device, texture.image, &memRequirements);
+
+        VkMemoryAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = memRequirements.size;
+        allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        if (vkd.vkAllocateMemory(device, &allocInfo, nullptr, &texture.memory) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate texture image memory!");
         }
+        vkd.vkBindImageMemory(device, texture.image, texture.memory, 0);
+        return texture;
     }
 
-    void createSurface() {
-        if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create window surface!");
+    // Leaves the texture in SHADER_READ_ONLY_OPTIMAL.
+    void recordTextureCopy(VkCommandBuffer commandBuffer, VkBuffer stagingBuffer, const Texture& texture, uint32_t width, uint32_t height) {
+        VkImageMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = texture.image;
+        barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+        vkd.vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+        // block formats copy whole blocks; the extent stays in texels
+        VkBufferImageCopy region = {};
+        region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+        region.imageExtent = { width, height, 1 };
+        vkd.vkCmdCopyBufferToImage(commandBuffer, stagingBuffer, texture.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        vkd.vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+    }
+
+    void createTextureView(Texture& texture) {
+        VkImageViewCreateInfo viewInfo = {};
+        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image = texture.image;
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format = texture.format;
+        viewInfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+        if (vkd.vkCreateImageView(device, &viewInfo, nullptr, &texture.view) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create texture image view!");
         }
     }
 
-    void pickPhysicalDevice() {
-        uint32_t deviceCount = 0;
-        vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+    void destroyLights() {
+        if (!LIGHTING_ENABLED) return;
+
+        vkd.vkDestroyDescriptorPool(device, lightDescriptorPool, nullptr);
+        vkd.vkDestroyDescriptorSetLayout(device, lightSetLayout, nullptr);
+        for (size_t i = 0; i < lightBuffers.size(); i++) {
+            vkd.vkUnmapMemory(device, lightBuffersMemory[i]);
+            vkd.vkDestroyBuffer(device, lightBuffers[i], nullptr);
+            vkd.vkFreeMemory(device, lightBuffersMemory[i], nullptr);
+        }
+    }
+
+    // Simulation side: bins the lights for the step's camera, clamping
+    // clusters that would run past MAX_LIGHT_INDICES.
+    void simulateLights(FramePacket& state) {
+        if (!LIGHTING_ENABLED) return;
+        PROFILE_FUNCTION();
+
+        float aspect = cameraAspect;
+        if (aspect != clusteredAspect) {
+            lightClusterer.setProjection(glm::radians(CAMERA_FOV), aspect, CAMERA_Z_NEAR, CAMERA_Z_FAR);
+            clusteredAspect = aspect;
+        }
+        lightClusterer.build(lights.data(), lights.size(), state.view);
+
+        state.viewLights = lightClusterer.lightsInView();
+        const auto& clusters = lightClusterer.clusterGrid();
+        state.lightClusters.resize(clusters.size());
+        for (size_t c = 0; c < clusters.size(); c++) {
+            LightCluster cluster = clusters[c];
+            cluster.count = cluster.offset < MAX_LIGHT_INDICES ? std::min(cluster.count, MAX_LIGHT_INDICES - cluster.offset) : 0;
+            state.lightClusters[c] = cluster;
+        }
+        const auto& indices = lightClusterer.lightIndices();
+        state.lightIndices.assign(indices.begin(), indices.begin() + std::min<size_t>(indices.size(), MAX_LIGHT_INDICES));
+    }
+
+    // Writes the packet's binned lights and the camera into the image's buffers.
+    void updateLights(uint32_t imageIndex) {
+        if (!LIGHTING_ENABLED) return;
+        PROFILE_FUNCTION();
+
+        const FramePacket& packet = renderPacket();
+        void* const* mapped = &lightBuffersMapped[imageIndex * 4];
+        LightCamera camera = { packet.view, cameraProjection() };
+        memcpy(mapped[3], &camera, sizeof(camera));
+        memcpy(mapped[0], packet.viewLights.data(), sizeof(PointLight) * packet.viewLights.size());
+        memcpy(mapped[1], packet.lightClusters.data(), sizeof(LightCluster) * packet.lightClusters.size());
+        memcpy(mapped[2], packet.lightIndices.data(), sizeof(uint32_t) * packet.lightIndices.size());
+        telemetry.add(TelemetryCounter::UploadBytes, static_cast<double>(sizeof(PointLight) * packet.viewLights.size() + sizeof(LightCluster) * packet.lightClusters.size() +
+            sizeof(uint32_t) * packet.lightIndices.size() + sizeof(camera)));
+    }
+
+    // The props share one icosphere LOD chain in the geometry arena, and the
+    // blocks one box. Every swap chain image has a storage buffer for lod.vert
+    // with the camera and each prop's placement, fade and color; the props'
+    // part is rewritten every frame like the lights.
+    void createProps() {
+        if (!PROPS_ENABLED) return;
+
+        std::vector<glm::vec3> positions;
+        std::vector<uint32_t> indices;
+        propLodChains.resize(1);
+        buildIcosphereChain(PROP_SUBDIVISIONS, PROP_RADIUS, positions, indices, propLodChains[0]);
+
+        // unit sphere: the position doubles as the normal
+        std::vector<SkinnedVertex> vertices(positions.size());
+        for (size_t i = 0; i < positions.size(); i++) {
+            vertices[i].position = glm::vec4(positions[i], 1.0f);
+            vertices[i].normal = glm::vec4(positions[i], 0.0f);
+            vertices[i].weights = glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+            vertices[i].joints = glm::uvec4(0);
+        }
+        propMesh = uploadMesh(vertices.data(), static_cast<uint32_t>(vertices.size()), indices.data(), static_cast<uint32_t>(indices.size()));
+
+        std::vector<glm::vec3> normals;
+        buildBox(BLOCK_EXTENT * 0.5f, blockPositions, normals, blockIndices);
+        vertices.resize(blockPositions.size());
+        for (size_t i = 0; i < blockPositions.size(); i++) {
+            vertices[i].position = glm::vec4(blockPositions[i], 1.0f);
+            vertices[i].normal = glm::vec4(normals[i], 0.0f);
+            vertices[i].weights = glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+            vertices[i].joints = glm::uvec4(0);
+        }
+        blockMesh = uploadMesh(vertices.data(), static_cast<uint32_t>(vertices.size()), blockIndices.data(), static_cast<uint32_t>(blockIndices.size()));
+
+        // in every third gap between the props, standing on the ground
+        blockCenters.resize(BLOCK_COUNT);
+        for (uint32_t i = 0; i < BLOCK_COUNT; i++) {
+            float x = (i % BLOCK_GRID - (BLOCK_GRID - 1) * 0.5f) * 3.0f * PROP_SPACING;
+            float z = (i / BLOCK_GRID - (BLOCK_GRID - 1) * 0.5f) * 3.0f * PROP_SPACING;
+            blockCenters[i] = glm::vec3(x, BLOCK_EXTENT.y * 0.5f, z);
+        }
+
+        // the orbiting camera sees the grid from a few units to past a hundred away
+        uint32_t coarsest = static_cast<uint32_t>(propLodChains[0].levels.size() - 1);
+        propInstances.resize(PROP_COUNT);
+        for (uint32_t i = 0; i < PROP_COUNT; i++) {
+            LodInstance& prop = propInstances[i];
+            float x = (i % PROP_GRID - (PROP_GRID - 1) * 0.5f) * PROP_SPACING;
+            float z = (i / PROP_GRID - (PROP_GRID - 1) * 0.5f) * PROP_SPACING;
+            prop.center = glm::vec3(x, PROP_RADIUS, z);
+            prop.radius = PROP_RADIUS;
+            prop.chain = 0;
+            prop.level = coarsest;
+            prop.previousLevel = coarsest;
+            prop.fade = 1.0f;
+        }
+        propBucketView = glm::mat4(0.0f);
+        propBucketLevels.assign(PROP_COUNT, glm::uvec2(~0u));
+
+        // the props' current level instances, their outgoing level's, then the blocks
+        VkDeviceSize bufferSize = sizeof(glm::mat4) + sizeof(glm::vec4) * 2 * (2 * PROP_COUNT + BLOCK_COUNT);
+        propBuffers.resize(swapChainImages.size());
+        propBuffersMemory.resize(propBuffers.size());
+        propBuffersMapped.resize(propBuffers.size());
+        for (size_t i = 0; i < propBuffers.size(); i++) {
+            createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                propBuffers[i], propBuffersMemory[i]);
+            vkd.vkMapMemory(device, propBuffersMemory[i], 0, bufferSize, 0, &propBuffersMapped[i]);
+
+            // the blocks never move, so theirs are written once
+            glm::vec4* records = reinterpret_cast<glm::vec4*>(static_cast<char*>(propBuffersMapped[i]) + sizeof(glm::mat4)) + 4 * PROP_COUNT;
+            for (uint32_t b = 0; b < BLOCK_COUNT; b++) {
+                records[b * 2] = glm::vec4(blockCenters[b], 1.0f);
+                records[b * 2 + 1] = glm::vec4(1.0f, 0.6f, 0.6f, 0.6f);
+            }
+        }
+
+        VkDescriptorSetLayoutBinding binding = {};
+        binding.binding = 0;
+        binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        binding.descriptorCount = 1;
+        binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = 1;
+        layoutInfo.pBindings = &binding;
+
+        if (vkd.vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &propSetLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create prop descriptor set layout!");
+        }
+
+        uint32_t imageCount = static_cast<uint32_t>(swapChainImages.size());
+        VkDescriptorPoolSize poolSize = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, imageCount };
+
+        VkDescriptorPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.maxSets = imageCount;
+        poolInfo.poolSizeCount = 1;
+        poolInfo.pPoolSizes = &poolSize;
+
+        if (vkd.vkCreateDescriptorPool(device, &poolInfo, nullptr, &propDescriptorPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create prop descriptor pool!");
+        }
+
+        std::vector<VkDescriptorSetLayout> layouts(imageCount, propSetLayout);
+        VkDescriptorSetAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = propDescriptorPool;
+        allocInfo.descriptorSetCount = imageCount;
+        allocInfo.pSetLayouts = layouts.data();
+
+        propDescriptorSets.resize(imageCount);
+        if (vkd.vkAllocateDescriptorSets(device, &allocInfo, propDescriptorSets.data()) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate prop descriptor sets!");
+        }
+        telemetry.add(TelemetryCounter::DescriptorAllocations, allocInfo.descriptorSetCount);
+
+        for (uint32_t i = 0; i < imageCount; i++) {
+            VkDescriptorBufferInfo bufferInfo = { propBuffers[i], 0, VK_WHOLE_SIZE };
+            VkWriteDescriptorSet descriptorWrite = {};
+            descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrite.dstSet = propDescriptorSets[i];
+            descriptorWrite.dstBinding = 0;
+            descriptorWrite.descriptorCount = 1;
+            descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorWrite.pBufferInfo = &bufferInfo;
+            vkd.vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+        }
+    }
+
+    void createPropPipeline() {
+        if (!PROPS_ENABLED) return;
+
+        VkVertexInputBindingDescription bindingDescription = {};
+        bindingDescription.binding = 0;
+        bindingDescription.stride = sizeof(SkinnedVertex);
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+        VkVertexInputAttributeDescription attributeDescriptions[2] = {};
+        for (uint32_t i = 0; i < 2; i++) {
+            attributeDescriptions[i].location = i;
+            attributeDescriptions[i].binding = 0;
+            attributeDescriptions[i].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+        }
+        attributeDescriptions[0].offset = offsetof(SkinnedVertex, position);
+        attributeDescriptions[1].offset = offsetof(SkinnedVertex, normal);
+
+        VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
+        vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+        vertexInputInfo.vertexBindingDescriptionCount = 1;
+        vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+        vertexInputInfo.vertexAttributeDescriptionCount = 2;
+        vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions;
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &propSetLayout;
+
+        if (vkd.vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &propPipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create prop pipeline layout!");
+        }
+
+        // without a depth buffer, culling the back faces is what keeps each sphere's far side hidden
+        propPipeline = createPipeline("shaders/lod_vert.spv", "shaders/lod_frag.spv", vertexInputInfo,
+            VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST, propPipelineLayout, nullptr, VK_CULL_MODE_BACK_BIT);
+    }
+
+    void destroyProps() {
+        if (!PROPS_ENABLED) return;
+
+        vkd.vkDestroyDescriptorPool(device, propDescriptorPool, nullptr);
+        vkd.vkDestroyDescriptorSetLayout(device, propSetLayout, nullptr);
+        for (size_t i = 0; i < propBuffers.size(); i++) {
+            vkd.vkUnmapMemory(device, propBuffersMemory[i]);
+            vkd.vkDestroyBuffer(device, propBuffers[i], nullptr);
+            vkd.vkFreeMemory(device, propBuffersMemory[i], nullptr);
+        }
+        geometryArena.remove(propMesh);
+        geometryArena.remove(blockMesh);
+        propMesh = GeometryArena::INVALID;
+        blockMesh = GeometryArena::INVALID;
+    }
+
+    // Picks every prop's LOD for this frame's camera, refills the bucket if
+    // that changed what is drawn or the draw order, and writes the image's
+    // prop buffer with the current fades. The blocks go to the occlusion
+    // culler, which updateCommandBuffers then tests the props against.
+    void updateProps(uint32_t imageIndex) {
+        if (!PROPS_ENABLED || renderPacket().step == 0) return;
+        PROFILE_FUNCTION();
+
+        glm::mat4 projection = cameraProjection();
+        lodSelector.setCamera(renderPacket().view, projection, static_cast<float>(swapChainExtent.height));
+        lodSelector.select(propInstances, propLodChains, frameDeltaTime);
+
+        bool refill = renderPacket().view != propBucketView;
+        for (size_t i = 0; i < propInstances.size() && !refill; i++) {
+            refill = propBucketLevels[i] != glm::uvec2(propInstances[i].level, propInstances[i].previousLevel);
+        }
+        if (refill) {
+            fillPropBucket();
+        }
+
+        glm::mat4 viewProjection = projection * renderPacket().view;
+        occlusionCuller.clearOccluders();
+        occlusionCuller.setViewProjection(viewProjection);
+        for (const glm::vec3& center : blockCenters) {
+            occlusionCuller.addOccluder(blockPositions, blockIndices, glm::translate(glm::mat4(1.0f), center));
+        }
+
+        char* mapped = static_cast<char*>(propBuffersMapped[imageIndex]);
+        memcpy(mapped, &viewProjection, sizeof(viewProjection));
+        glm::vec4* records = reinterpret_cast<glm::vec4*>(mapped + sizeof(glm::mat4));
+        for (size_t i = 0; i < propInstances.size(); i++) {
+            const LodInstance& prop = propInstances[i];
+            glm::vec4 sphere(prop.center, prop.radius);
+            // lod.frag keeps the incoming level's share of the pixels for fade >= 0 and the rest for fade - 1
+            float fade = prop.previousLevel != prop.level ? prop.fade : 1.0f;
+            records[i * 2] = sphere;
+            records[i * 2 + 1] = glm::vec4(fade, 0.5f, 0.7f, 0.9f);
+            records[(PROP_COUNT + i) * 2] = sphere;
+            records[(PROP_COUNT + i) * 2 + 1] = glm::vec4(fade - 1.0f, 0.5f, 0.7f, 0.9f);
+        }
+        telemetry.add(TelemetryCounter::UploadBytes, static_cast<double>(sizeof(glm::mat4) + sizeof(glm::vec4) * 4 * PROP_COUNT));
+    }
+
+    // Without a depth buffer the props and blocks have to go back to front.
+    // Each prop draws the index range of its selected level from the shared
+    // chain, with bounds for the occlusion culler; the blocks are the
+    // occluders, so they are always drawn.
+    void fillPropBucket() {
+        DrawBucket& bucket = drawBuckets[propBucket];
+        bucket.draws.clear();
+
+        const MeshRange& mesh = geometryArena.mesh(propMesh);
+        glm::vec3 eye = glm::vec3(glm::inverse(renderPacket().view)[3]);
+        for (uint32_t i = 0; i < propInstances.size(); i++) {
+            const LodInstance& prop = propInstances[i];
+            float depth = 1.0f - glm::distance(eye, prop.center) / CAMERA_Z_FAR;
+            DrawCommand base = { 0, 1, 0, i, 0, mesh.firstIndex, static_cast<int32_t>(mesh.firstVertex) };
+            AABB bounds = { prop.center - glm::vec3(prop.radius), prop.center + glm::vec3(prop.radius) };
+            addLodDraws(bucket.draws, prop, propLodChains[prop.chain], 4, 2, 2, depth, base, PROP_COUNT, &bounds);
+            propBucketLevels[i] = glm::uvec2(prop.level, prop.previousLevel);
+        }
+
+        const MeshRange& block = geometryArena.mesh(blockMesh);
+        for (uint32_t b = 0; b < BLOCK_COUNT; b++) {
+            float depth = 1.0f - glm::distance(eye, blockCenters[b]) / CAMERA_Z_FAR;
+            bucket.draws.add(4, 2, 2, depth, { 0, 1, 0, 2 * PROP_COUNT + b, block.indexCount, block.firstIndex, static_cast<int32_t>(block.firstVertex) });
+        }
+        propBucketView = renderPacket().view;
+        markBucketDirty(propBucket);
+    }
+
+    void fillMaterialBucket() {
+        DrawBucket& bucket = drawBuckets[materialBucket];
+        bucket.draws.clear();
+        for (size_t m = 0; m < materials.size(); m++) {
+            uint32_t variant = useUberShader ? uberVariantIndex : materialVariantIndices[m];
+            bucket.draws.add(static_cast<uint16_t>(FIRST_MATERIAL_PIPELINE + variant), static_cast<uint16_t>(FIRST_MATERIAL_SET + m), NO_MESH, 0.0f,
+                { 3, materialOverdraw, 0, 0, 0, 0, 0 });
+        }
+        bucket.markDirty();
+    }
+
+    void createTimestampQueries() {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        if (!properties.limits.timestampComputeAndGraphics) return;
+        timestampPeriod = properties.limits.timestampPeriod;
+
+        VkQueryPoolCreateInfo queryPoolInfo = {};
+        queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryPoolInfo.queryCount = static_cast<uint32_t>(swapChainImages.size() * 2);
+
+        if (vkd.vkCreateQueryPool(device, &queryPoolInfo, nullptr, &timestampQueryPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create timestamp query pool!");
+        }
+        timestampsWritten.assign(swapChainImages.size(), false);
+
+        // timestampComputeAndGraphics covers the compute-only family too
+        if (asyncCompute) {
+            queryPoolInfo.queryCount = MAX_FRAMES_IN_FLIGHT * 2;
+            if (vkd.vkCreateQueryPool(device, &queryPoolInfo, nullptr, &computeTimestampQueryPool) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create timestamp query pool!");
+            }
+            computeTimestampsWritten.assign(MAX_FRAMES_IN_FLIGHT, false);
+        }
+    }
+
+    // Called once the image's previous submission has finished, so its
+    // timestamps are available without waiting.
+    void readTimestamps(uint32_t imageIndex) {
+        if (timestampQueryPool == VK_NULL_HANDLE) return;
+
+        if (timestampsWritten[imageIndex]) {
+            uint64_t timestamps[2];
+            if (vkd.vkGetQueryPoolResults(device, timestampQueryPool, imageIndex * 2, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+                VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+                gpuMilliseconds = (timestamps[1] - timestamps[0]) * timestampPeriod * 1e-6;
+                gpuMillisecondsTotal += gpuMilliseconds;
+                queueOverlap.add(QueueOverlap::Graphics, timestamps[0], timestamps[1]);
+            }
+        }
+        timestampsWritten[imageIndex] = true;
+    }
+
+    // The frame slot's fence covers its compute submit, which the graphics
+    // submit waited on.
+    void readComputeTimestamps() {
+        if (computeTimestampQueryPool == VK_NULL_HANDLE || !computeTimestampsWritten[currentFrame]) return;
+
+        uint64_t timestamps[2];
+        if (vkd.vkGetQueryPoolResults(device, computeTimestampQueryPool, static_cast<uint32_t>(currentFrame * 2), 2, sizeof(timestamps), timestamps,
+            sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+            queueOverlap.add(QueueOverlap::Compute, timestamps[0], timestamps[1]);
+        }
+    }
+
+    // Records the same bind + draw stream into a secondary command buffer
+    // through the loader's exported functions and through the device table.
+    // Only CPU recording time is measured; nothing is submitted.
+    void runDispatchBenchmark() {
+        const int draws = 100000;
+        const int rounds = 20;
+
+        VkCommandBufferAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = commandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        allocInfo.commandBufferCount = 1;
+
+        VkCommandBuffer commandBuffer;
+        if (vkd.vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate benchmark command buffer!");
+        }
+
+        VkCommandBufferInheritanceInfo inheritanceInfo = {};
+        inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        inheritanceInfo.renderPass = renderPass;
+
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+        beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+        double nanoseconds[2] = {};
+        for (int round = 0; round < rounds; round++) {
+            for (int direct = 0; direct < 2; direct++) {
+                vkd.vkBeginCommandBuffer(commandBuffer, &beginInfo);
+                auto start = std::chrono::high_resolution_clock::now();
+                if (direct) {
+                    for (int i = 0; i < draws; i++) {
+                        vkd.vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+                        vkd.vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+                    }
+                }
+                else {
+                    for (int i = 0; i < draws; i++) {
+                        ::vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+                        ::vkCmdDraw(commandBuffer, 3, 1, 0, 0);
+                    }
+                }
+                auto end = std::chrono::high_resolution_clock::now();
+                vkd.vkEndCommandBuffer(commandBuffer);
+                // the first round warms up the command pool's memory
+                if (round > 0) {
+                    nanoseconds[direct] += std::chrono::duration<double, std::nano>(end - start).count();
+                }
+            }
+        }
+
+        vkd.vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+
+        double calls = 2.0 * draws * (rounds - 1);
+        std::cout << "command recording, " << draws << " bind+draw pairs: loader " << nanoseconds[0] / calls << " ns/call, device table "
+            << nanoseconds[1] / calls << " ns/call" << (enableValidationLayers ? " (validation layers on)" : "") << std::endl;
+    }
+
+    // Renders the materials with heavy overdraw, first through the uber
+    // variant and then through the specialized ones, and compares GPU time.
+    void stepVariantBenchmark() {
+        const int warmupFrames = 60;
+        const int measuredFrames = 300;
+        const int phaseFrames = warmupFrames + measuredFrames;
+
+        if (!MATERIALS_ENABLED || timestampQueryPool == VK_NULL_HANDLE) {
+            std::cout << "variant benchmark needs MATERIALS_ENABLED and timestamp queries" << std::endl;
+            glfwSetWindowShouldClose(window, GLFW_TRUE);
+            return;
+        }
+
+        int phase = benchmarkFrame / phaseFrames;
+        if (benchmarkFrame % phaseFrames == 0) {
+            useUberShader = phase == 0;
+            materialOverdraw = 64;
+            fillMaterialBucket();
+        }
+        else if (benchmarkFrame % phaseFrames >= warmupFrames) {
+            benchmarkGpuTotals[phase] += gpuMilliseconds;
+        }
+
+        benchmarkFrame++;
+        if (benchmarkFrame == phaseFrames * 2) {
+            std::cout << "uber shader: " << benchmarkGpuTotals[0] / measuredFrames << " gpu ms/frame, "
+                << "specialized variants (" << materialVariants.size() - 1 << "): " << benchmarkGpuTotals[1] / measuredFrames << " gpu ms/frame" << std::endl;
+            glfwSetWindowShouldClose(window, GLFW_TRUE);
+        }
+    }
+
+    void createParticles() {
+        if (PARTICLE_BACKEND == ParticleBackend::None) return;
+
+        // the CPU system also provides the initial state for the GPU buffer
+        cpuParticles.init(PARTICLE_COUNT, particleSettings);
+        VkDeviceSize bufferSize = sizeof(ParticleVertex) * PARTICLE_COUNT;
+
+        if (PARTICLE_BACKEND == ParticleBackend::Cpu) {
+            particleVertexBuffers.resize(swapChainImages.size());
+            particleVertexBuffersMemory.resize(swapChainImages.size());
+            particleVertexBuffersMapped.resize(swapChainImages.size());
+
+            for (size_t i = 0; i < swapChainImages.size(); i++) {
+                createBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                    particleVertexBuffers[i], particleVertexBuffersMemory[i]);
+                vkd.vkMapMemory(device, particleVertexBuffersMemory[i], 0, bufferSize, 0, &particleVertexBuffersMapped[i]);
+            }
+            return;
+        }
+
+        createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, particleStorageBuffer, particleStorageBufferMemory);
+
+        VkBuffer stagingBuffer;
+        VkDeviceMemory stagingBufferMemory;
+        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+
+        void* data;
+        vkd.vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
+        cpuParticles.writeVertices(static_cast<ParticleVertex*>(data), false, glm::vec3(0.0f));
+        vkd.vkUnmapMemory(device, stagingBufferMemory);
+        telemetry.add(TelemetryCounter::UploadBytes, static_cast<double>(bufferSize));
+
+        // the simulation state never leaves the compute queue's family
+        copyBuffer(stagingBuffer, particleStorageBuffer, bufferSize, computeCommandPool, computeQueue);
+
+        vkd.vkDestroyBuffer(device, stagingBuffer, nullptr);
+        vkd.vkFreeMemory(device, stagingBufferMemory, nullptr);
+
+        // On a separate compute queue each frame's particles are copied out
+        // and handed to graphics, so the next step can run while this frame
+        // is still drawing them.
+        if (asyncCompute) {
+            particleVertexBuffers.resize(swapChainImages.size());
+            particleVertexBuffersMemory.resize(swapChainImages.size());
+            for (size_t i = 0; i < swapChainImages.size(); i++) {
+                createBuffer(bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                    particleVertexBuffers[i], particleVertexBuffersMemory[i]);
+            }
+        }
+
+        VkDescriptorSetLayoutBinding binding = {};
+        binding.binding = 0;
+        binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        binding.descriptorCount = 1;
+        binding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = 1;
+        layoutInfo.pBindings = &binding;
+
+        if (vkd.vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &particleComputeSetLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create particle descriptor set layout!");
+        }
+
+        VkDescriptorPoolSize poolSize = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1 };
+
+        VkDescriptorPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.maxSets = 1;
+        poolInfo.poolSizeCount = 1;
+        poolInfo.pPoolSizes = &poolSize;
+
+        if (vkd.vkCreateDescriptorPool(device, &poolInfo, nullptr, &particleDescriptorPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create particle descriptor pool!");
+        }
+
+        VkDescriptorSetAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = particleDescriptorPool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &particleComputeSetLayout;
+
+        if (vkd.vkAllocateDescriptorSets(device, &allocInfo, &particleComputeSet) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate particle descriptor set!");
+        }
+        telemetry.add(TelemetryCounter::DescriptorAllocations, allocInfo.descriptorSetCount);
+
+        VkDescriptorBufferInfo bufferInfo = { particleStorageBuffer, 0, bufferSize };
+
+        VkWriteDescriptorSet descriptorWrite = {};
+        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet = particleComputeSet;
+        descriptorWrite.dstBinding = 0;
+        descriptorWrite.descriptorCount = 1;
+        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrite.pBufferInfo = &bufferInfo;
+        vkd.vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+
+        VkPushConstantRange pushConstantRange = { VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ParticlePushConstants) };
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &particleComputeSetLayout;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+        if (vkd.vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &particleComputePipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create particle compute pipeline layout!");
+        }
+
+        auto computeShaderCode = readFile("shaders/particle_comp.spv");
+        VkShaderModule computeShaderModule = createShaderModule(computeShaderCode);
+
+        VkComputePipelineCreateInfo pipelineInfo = {};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineInfo.stage.module = computeShaderModule;
+        pipelineInfo.stage.pName = "main";
+        pipelineInfo.layout = particleComputePipelineLayout;
+
+        if (vkd.vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &particleComputePipeline) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create particle compute pipeline!");
+        }
+        telemetry.add(TelemetryCounter::PipelineCompiles, 1);
+
+        vkd.vkDestroyShaderModule(device, computeShaderModule, nullptr);
+
+        particleComputeCommandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+
+        VkCommandBufferAllocateInfo commandBufferInfo = {};
+        commandBufferInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        commandBufferInfo.commandPool = computeCommandPool;
+        commandBufferInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        commandBufferInfo.commandBufferCount = MAX_FRAMES_IN_FLIGHT;
+        if (vkd.vkAllocateCommandBuffers(device, &commandBufferInfo, particleComputeCommandBuffers.data()) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate particle command buffers!");
+        }
+    }
+
+    void destroyParticles() {
+        for (size_t i = 0; i < particleVertexBuffers.size(); i++) {
+            if (PARTICLE_BACKEND == ParticleBackend::Cpu) {
+                vkd.vkUnmapMemory(device, particleVertexBuffersMemory[i]);
+            }
+            vkd.vkDestroyBuffer(device, particleVertexBuffers[i], nullptr);
+            vkd.vkFreeMemory(device, particleVertexBuffersMemory[i], nullptr);
+        }
+
+        if (PARTICLE_BACKEND == ParticleBackend::Gpu) {
+            vkd.vkDestroyPipeline(device, particleComputePipeline, nullptr);
+            vkd.vkDestroyPipelineLayout(device, particleComputePipelineLayout, nullptr);
+            vkd.vkDestroyDescriptorPool(device, particleDescriptorPool, nullptr);
+            vkd.vkDestroyDescriptorSetLayout(device, particleComputeSetLayout, nullptr);
+            vkd.vkDestroyBuffer(device, particleStorageBuffer, nullptr);
+            vkd.vkFreeMemory(device, particleStorageBufferMemory, nullptr);
+        }
+    }
+
+    ParticlePushConstants particlePushConstants(float dt) {
+        ParticlePushConstants constants = {};
+        constants.emitter = glm::vec4(particleSettings.emitterPosition, particleSettings.emitSpeed);
+        constants.gravity = glm::vec4(particleSettings.gravity, particleSettings.lifetime);
+        constants.params = glm::vec4(dt, particleSettings.restitution, 0.0f, 0.0f);
+        constants.counts = glm::uvec4(PARTICLE_COUNT, particleSeed, 0, 0);
+        for (int i = 0; i < MAX_PARTICLE_COLLIDERS; i++) {
+            constants.planes[i] = particleSettings.planes[i];
+            constants.spheres[i] = particleSettings.spheres[i];
+        }
+        return constants;
+    }
+
+    void recordParticleDispatch(VkCommandBuffer commandBuffer, float dt) {
+        // a compute-only queue has no vertex input stage; there the buffer
+        // is only read by the next step and the copy out to graphics
+        VkPipelineStageFlags readers = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT;
+        VkAccessFlags readAccess = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+        if (!asyncCompute) {
+            readers |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+            readAccess |= VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+        }
+
+        // the previous frame may still be reading the buffer
+        vkd.vkCmdPipelineBarrier(commandBuffer, readers, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+        ParticlePushConstants constants = particlePushConstants(dt);
+        vkd.vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, particleComputePipeline);
+        vkd.vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, particleComputePipelineLayout, 0, 1, &particleComputeSet, 0, nullptr);
+        vkd.vkCmdPushConstants(commandBuffer, particleComputePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants), &constants);
+        vkd.vkCmdDispatch(commandBuffer, (PARTICLE_COUNT + 255) / 256, 1, 1);
+
+        VkBufferMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = readAccess;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = particleStorageBuffer;
+        barrier.offset = 0;
+        barrier.size = VK_WHOLE_SIZE;
+        vkd.vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, readers, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+    }
+
+    // Copies the step's result into the image's vertex buffer and releases
+    // it to the graphics family; the primary command buffer acquires it.
+    // Nothing on the way back needs preserving, so graphics never releases.
+    void recordParticleHandOff(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+        VkBufferCopy copyRegion = {};
+        copyRegion.size = sizeof(ParticleVertex) * PARTICLE_COUNT;
+        vkd.vkCmdCopyBuffer(commandBuffer, particleStorageBuffer, particleVertexBuffers[imageIndex], 1, &copyRegion);
+
+        VkBufferMemoryBarrier release = {};
+        release.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        release.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        release.dstAccessMask = 0;
+        release.srcQueueFamilyIndex = computeQueueFamily;
+        release.dstQueueFamilyIndex = graphicsQueueFamily;
+        release.buffer = particleVertexBuffers[imageIndex];
+        release.offset = 0;
+        release.size = VK_WHOLE_SIZE;
+        vkd.vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1, &release, 0, nullptr);
+    }
+
+    void recordParticleAcquire(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+        VkBufferMemoryBarrier acquire = {};
+        acquire.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        acquire.srcAccessMask = 0;
+        acquire.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT;
+        acquire.srcQueueFamilyIndex = computeQueueFamily;
+        acquire.dstQueueFamilyIndex = graphicsQueueFamily;
+        acquire.buffer = particleVertexBuffers[imageIndex];
+        acquire.offset = 0;
+        acquire.size = VK_WHOLE_SIZE;
+        vkd.vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 0, nullptr, 1, &acquire, 0, nullptr);
+    }
+
+    // Simulation side of the CPU backend; the GPU backend steps in
+    // updateParticles, with the render thread's frame time.
+    void simulateParticles(FramePacket& state, float deltaTime) {
+        if (PARTICLE_BACKEND != ParticleBackend::Cpu) return;
+        PROFILE_FUNCTION();
+
+        particleSeed++;
+        cpuParticles.update(deltaTime, particleSeed, particleSettings);
+        state.particleVertices.resize(PARTICLE_COUNT);
+        cpuParticles.writeVertices(state.particleVertices.data(), true, glm::vec3(0.0f, 0.0f, -1.0f));
+    }
 
-        if (deviceCount == 0) {
-            throw std::runtime_error("failed to find GPUs with Vulkan support!");
+    void updateParticles(uint32_t imageIndex) {
+        if (PARTICLE_BACKEND == ParticleBackend::None) return;
+        PROFILE_FUNCTION();
+
+        if (PARTICLE_BACKEND == ParticleBackend::Cpu) {
+            const auto& vertices = renderPacket().particleVertices;
+            memcpy(particleVertexBuffersMapped[imageIndex], vertices.data(), sizeof(ParticleVertex) * vertices.size());
+            telemetry.add(TelemetryCounter::UploadBytes, static_cast<double>(sizeof(ParticleVertex) * vertices.size()));
+            return;
         }
 
-        std::vector<VkPhysicalDevice> devices(deviceCount);
-        vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+        particleSeed++;
 
-        for (const auto& device : devices) {
-            if (isDeviceSuitable(device)) {
-                physicalDevice = device;
-                break;
-            }
-        }
+        VkCommandBuffer commandBuffer = particleComputeCommandBuffers[currentFrame];
 
-        if (physicalDevice == VK_NULL_HANDLE) {
-            throw std::runtime_error("failed to find a suitable GPU!");
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+        if (vkd.vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record particle command buffer!");
+        }
+        uint32_t firstQuery = static_cast<uint32_t>(currentFrame * 2);
+        if (computeTimestampQueryPool != VK_NULL_HANDLE) {
+            vkd.vkCmdResetQueryPool(commandBuffer, computeTimestampQueryPool, firstQuery, 2);
+            vkd.vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, computeTimestampQueryPool, firstQuery);
+        }
+        recordParticleDispatch(commandBuffer, frameDeltaTime);
+        if (asyncCompute) {
+            recordParticleHandOff(commandBuffer, imageIndex);
+        }
+        if (computeTimestampQueryPool != VK_NULL_HANDLE) {
+            vkd.vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, computeTimestampQueryPool, firstQuery + 1);
+            computeTimestampsWritten[currentFrame] = true;
+        }
+        if (vkd.vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record particle command buffer!");
         }
     }
 
-    void createLogicalDevice() {
-        QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+    // Steps the GPU and CPU backends side by side with a fixed time step and
+    // reports how far the compute results drift from the CPU reference.
+    void validateParticles(uint32_t steps) {
+        if (PARTICLE_BACKEND != ParticleBackend::Gpu) {
+            std::cout << "particle validation needs the GPU backend" << std::endl;
+            return;
+        }
 
-        std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-        std::set<uint32_t> uniqueQueueFamilies = { indices.graphicsFamily.value(), indices.presentFamily.value() };
+        const float dt = 1.0f / 60.0f;
+        for (uint32_t step = 0; step < steps; step++) {
+            particleSeed++;
+            VkCommandBuffer commandBuffer = beginSingleTimeCommands(computeCommandPool);
+            recordParticleDispatch(commandBuffer, dt);
+            endSingleTimeCommands(commandBuffer, computeCommandPool, computeQueue);
+            cpuParticles.update(dt, particleSeed, particleSettings);
+        }
 
-        float queuePriority = 1.0f;
-        for (uint32_t queueFamily : uniqueQueueFamilies) {
-            VkDeviceQueueCreateInfo queueCreateInfo = {};
-            queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-            queueCreateInfo.queueFamilyIndex = queueFamily;
-            queueCreateInfo.queueCount = 1;
-            queueCreateInfo.pQueuePriorities = &queuePriority;
-            queueCreateInfos.push_back(queueCreateInfo);
+        VkDeviceSize bufferSize = sizeof(ParticleVertex) * PARTICLE_COUNT;
+        VkBuffer stagingBuffer;
+        VkDeviceMemory stagingBufferMemory;
+        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+        copyBuffer(particleStorageBuffer, stagingBuffer, bufferSize, computeCommandPool, computeQueue);
+
+        void* data;
+        vkd.vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
+        const ParticleVertex* gpu = static_cast<const ParticleVertex*>(data);
+
+        float maxError = 0.0f;
+        uint32_t mismatches = 0;
+        for (uint32_t i = 0; i < PARTICLE_COUNT; i++) {
+            float error = glm::length(glm::vec3(gpu[i].position) - glm::vec3(cpuParticles.position(i)));
+            maxError = std::max(maxError, error);
+            if (error > 1e-3f) mismatches++;
         }
 
-        VkPhysicalDeviceFeatures deviceFeatures = {};
+        vkd.vkUnmapMemory(device, stagingBufferMemory);
+        vkd.vkDestroyBuffer(device, stagingBuffer, nullptr);
+        vkd.vkFreeMemory(device, stagingBufferMemory, nullptr);
 
-        VkDeviceCreateInfo createInfo = {};
-        createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        std::cout << "particle validation: max error " << maxError << ", " << mismatches << " of " << PARTICLE_COUNT << " particles off by more than 1e-3" << std::endl;
+    }
 
-        createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
-        createInfo.pQueueCreateInfos = queueCreateInfos.data();
+    void createSkinning() {
+        if (SKINNING_PATH == SkinningPath::None) return;
 
-        createInfo.pEnabledFeatures = &deviceFeatures;
+        skinnedCrowd.init(SKINNED_CHARACTER_COUNT);
 
-        createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-        createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+        // pre-skinned characters only need the indices; their vertices change every frame
+        const auto& indices = skinnedCrowd.meshIndices();
+        const auto& vertices = skinnedCrowd.meshVertices();
+        bool staticVertices = SKINNING_PATH == SkinningPath::VertexShader;
+        skinnedMesh = uploadMesh(vertices.data(), staticVertices ? static_cast<uint32_t>(vertices.size()) : 0,
+            indices.data(), static_cast<uint32_t>(indices.size()));
 
-        if (enableValidationLayers) {
-            createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
-            createInfo.ppEnabledLayerNames = validationLayers.data();
+        VkDeviceSize bufferSize;
+        VkBufferUsageFlags usage;
+        if (SKINNING_PATH == SkinningPath::VertexShader) {
+            bufferSize = sizeof(SkinningPaletteHeader) + skinnedCrowd.paletteSize(SKINNING_METHOD);
+            usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
         }
         else {
-            createInfo.enabledLayerCount = 0;
+            bufferSize = sizeof(SkinnedOutputVertex) * skinnedCrowd.meshVertices().size() * skinnedCrowd.size();
+            usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
         }
 
-        if (vkCreateDevice(physicalDevice, &createInfo, nullptr, &device) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create logical device!");
+        skinningBuffers.resize(swapChainImages.size());
+        skinningBuffersMemory.resize(swapChainImages.size());
+        skinningBuffersMapped.resize(swapChainImages.size());
+        for (size_t i = 0; i < swapChainImages.size(); i++) {
+            createBuffer(bufferSize, usage, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                skinningBuffers[i], skinningBuffersMemory[i]);
+            vkd.vkMapMemory(device, skinningBuffersMemory[i], 0, bufferSize, 0, &skinningBuffersMapped[i]);
         }
 
-        vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
-        vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
-    }
+        if (SKINNING_PATH != SkinningPath::VertexShader) return;
 
-    void createSwapChain() {
-        SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice);
+        VkDescriptorSetLayoutBinding binding = {};
+        binding.binding = 0;
+        binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        binding.descriptorCount = 1;
+        binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
-        VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
-        VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
-        VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
+        VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = 1;
+        layoutInfo.pBindings = &binding;
 
-        uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
-        if (swapChainSupport.capabilities.maxImageCount > 0 && imageCount > swapChainSupport.capabilities.maxImageCount) {
-            imageCount = swapChainSupport.capabilities.maxImageCount;
+        if (vkd.vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &skinningSetLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create skinning descriptor set layout!");
         }
 
-        VkSwapchainCreateInfoKHR createInfo = {};
-        createInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-        createInfo.surface = surface;
+        uint32_t setCount = static_cast<uint32_t>(swapChainImages.size());
+        VkDescriptorPoolSize poolSize = { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, setCount };
 
-        createInfo.minImageCount = imageCount;
-        createInfo.imageFormat = surfaceFormat.format;
-        createInfo.imageColorSpace = surfaceFormat.colorSpace;
-        createInfo.imageExtent = extent;
-        createInfo.imageArrayLayers = 1;
-        createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        VkDescriptorPoolCreateInfo poolInfo = {};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.maxSets = setCount;
+        poolInfo.poolSizeCount = 1;
+        poolInfo.pPoolSizes = &poolSize;
 
-        QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
-        uint32_t queueFamilyIndices[] = { indices.graphicsFamily.value(), indices.presentFamily.value() };
+        if (vkd.vkCreateDescriptorPool(device, &poolInfo, nullptr, &skinningDescriptorPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create skinning descriptor pool!");
+        }
 
-        if (indices.graphicsFamily != indices.presentFamily) {
-            createInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
-            createInfo.queueFamilyIndexCount = 2;
-            createInfo.pQueueFamilyIndices = queueFamilyIndices;
+        std::vector<VkDescriptorSetLayout> layouts(setCount, skinningSetLayout);
+        VkDescriptorSetAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = skinningDescriptorPool;
+        allocInfo.descriptorSetCount = setCount;
+        allocInfo.pSetLayouts = layouts.data();
+
+        skinningDescriptorSets.resize(setCount);
+        if (vkd.vkAllocateDescriptorSets(device, &allocInfo, skinningDescriptorSets.data()) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate skinning descriptor sets!");
         }
-        else {
-            createInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        telemetry.add(TelemetryCounter::DescriptorAllocations, allocInfo.descriptorSetCount);
+
+        for (uint32_t i = 0; i < setCount; i++) {
+            VkDescriptorBufferInfo bufferInfo = { skinningBuffers[i], 0, bufferSize };
+
+            VkWriteDescriptorSet descriptorWrite = {};
+            descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrite.dstSet = skinningDescriptorSets[i];
+            descriptorWrite.dstBinding = 0;
+            descriptorWrite.descriptorCount = 1;
+            descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorWrite.pBufferInfo = &bufferInfo;
+            vkd.vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
         }
+    }
 
-        createInfo.preTransform = swapChainSupport.capabilities.currentTransform;
-        createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-        createInfo.presentMode = presentMode;
-        createInfo.clipped = VK_TRUE;
-
-        createInfo.oldSwapchain = VK_NULL_HANDLE;
+    void destroySkinning() {
+        if (SKINNING_PATH == SkinningPath::None) return;
 
-        if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create swap chain!");
+        for (size_t i = 0; i < skinningBuffers.size(); i++) {
+            vkd.vkUnmapMemory(device, skinningBuffersMemory[i]);
+            vkd.vkDestroyBuffer(device, skinningBuffers[i], nullptr);
+            vkd.vkFreeMemory(device, skinningBuffersMemory[i], nullptr);
         }
 
-        vkGetSwapchainImagesKHR(device, swapChain, &imageCount, nullptr);
-        swapChainImages.resize(imageCount);
-        vkGetSwapchainImagesKHR(device, swapChain, &imageCount, swapChainImages.data());
+        geometryArena.remove(skinnedMesh);
 
-        swapChainImageFormat = surfaceFormat.format;
-        swapChainExtent = extent;
+        if (SKINNING_PATH == SkinningPath::VertexShader) {
+            vkd.vkDestroyDescriptorPool(device, skinningDescriptorPool, nullptr);
+            vkd.vkDestroyDescriptorSetLayout(device, skinningSetLayout, nullptr);
+        }
     }
 
-    void createImageViews() {
-        swapChainImageViews.resize(swapChainImages.size());
+    // Simulation side: poses the crowd and either skins it or keeps the
+    // palettes for the vertex shader.
+    void simulateSkinning(FramePacket& state, float deltaTime) {
+        if (SKINNING_PATH == SkinningPath::None) return;
+        PROFILE_FUNCTION();
 
-        for (size_t i = 0; i < swapChainImages.size(); i++) {
-            VkImageViewCreateInfo createInfo = {};
-            createInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-            createInfo.image = swapChainImages[i];
-            createInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-            createInfo.format = swapChainImageFormat;
-            createInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-            createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            createInfo.subresourceRange.baseMipLevel = 0;
-            createInfo.subresourceRange.levelCount = 1;
-            createInfo.subresourceRange.baseArrayLayer = 0;
-            createInfo.subresourceRange.layerCount = 1;
+        skinningTime += deltaTime;
+        skinnedCrowd.animate(skinningTime);
+        skinnedCrowd.computePalettes(SKINNING_METHOD);
 
-            if (vkCreateImageView(device, &createInfo, nullptr, &swapChainImageViews[i]) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create image views!");
-            }
+        if (SKINNING_PATH == SkinningPath::Cpu) {
+            state.skinnedVertices.resize(skinnedCrowd.meshVertices().size() * skinnedCrowd.size());
+            skinnedCrowd.skin(SKINNING_METHOD, state.skinnedVertices.data());
+            return;
         }
+
+        const glm::vec4* palettes = skinnedCrowd.paletteData();
+        state.skinningPalettes.assign(palettes, palettes + skinnedCrowd.paletteSize(SKINNING_METHOD) / sizeof(glm::vec4));
     }
 
-    void createRenderPass() {
-        VkAttachmentDescription colorAttachment = {};
-        colorAttachment.format = swapChainImageFormat;
-        colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-        colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-        colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    void updateSkinning(uint32_t imageIndex) {
+        if (SKINNING_PATH == SkinningPath::None) return;
+        PROFILE_FUNCTION();
 
-        VkAttachmentReference colorAttachmentRef = {};
-        colorAttachmentRef.attachment = 0;
-        colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        const FramePacket& packet = renderPacket();
+        if (SKINNING_PATH == SkinningPath::Cpu) {
+            memcpy(skinningBuffersMapped[imageIndex], packet.skinnedVertices.data(), sizeof(SkinnedOutputVertex) * packet.skinnedVertices.size());
+            telemetry.add(TelemetryCounter::UploadBytes, static_cast<double>(sizeof(SkinnedOutputVertex) * packet.skinnedVertices.size()));
+            return;
+        }
 
-        VkSubpassDescription subpass = {};
-        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-        subpass.colorAttachmentCount = 1;
-        subpass.pColorAttachments = &colorAttachmentRef;
+        SkinningPaletteHeader header;
+        header.params = glm::uvec4(skinnedCrowd.jointCount(), SKINNING_METHOD == SkinningMethod::Linear ? 0 : 1, 0, 0);
+        char* data = static_cast<char*>(skinningBuffersMapped[imageIndex]);
+        size_t paletteSize = sizeof(glm::vec4) * packet.skinningPalettes.size();
+        memcpy(data, &header, sizeof(header));
+        memcpy(data + sizeof(header), packet.skinningPalettes.data(), paletteSize);
+        telemetry.add(TelemetryCounter::UploadBytes, static_cast<double>(sizeof(header) + paletteSize));
+    }
 
-        VkSubpassDependency dependency = {};
-        dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-        dependency.dstSubpass = 0;
-        dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        dependency.srcAccessMask = 0;
-        dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
-            VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    void createDeviceLocalBuffer(const void* contents, VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+        VkBuffer stagingBuffer;
+        VkDeviceMemory stagingBufferMemory;
+        createBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
 
+        void* data;
+        vkd.vkMapMemory(device, stagingBufferMemory, 0, size, 0, &data);
+        memcpy(data, contents, static_cast<size_t>(size));
+        vkd.vkUnmapMemory(device, stagingBufferMemory);
+        telemetry.add(TelemetryCounter::UploadBytes, static_cast<double>(size));
 
-        VkRenderPassCreateInfo renderPassInfo = {};
-        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-        renderPassInfo.attachmentCount = 1;
-        renderPassInfo.pAttachments = &colorAttachment;
-        renderPassInfo.subpassCount = 1;
-        renderPassInfo.pSubpasses = &subpass;
-        renderPassInfo.dependencyCount = 1;
-        renderPassInfo.pDependencies = &dependency;
+        createBuffer(size, usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, bufferMemory);
+        copyBuffer(stagingBuffer, buffer, size);
 
-        if (vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create render pass!");
-        }
+        vkd.vkDestroyBuffer(device, stagingBuffer, nullptr);
+        vkd.vkFreeMemory(device, stagingBufferMemory, nullptr);
+    }
 
-        
+    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
+        VkPhysicalDeviceMemoryProperties memProperties;
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+        for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+            if ((typeFilter & (1 << i)) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+                return i;
+            }
+        }
 
+        throw std::runtime_error("failed to find suitable memory type!");
     }
 
-    void createGraphicsPipeline() {
-        auto vertShaderCode = readFile("shaders/vert.spv");
-        auto fragShaderCode = readFile("shaders/frag.spv");
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+        VkBufferCreateInfo bufferInfo = {};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = size;
+        bufferInfo.usage = usage;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-        VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
-        VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
+        if (vkd.vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create buffer!");
+        }
 
-        VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
-        vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-        vertShaderStageInfo.module = vertShaderModule;
-        vertShaderStageInfo.pName = "main";
+        VkMemoryRequirements memRequirements;
+        vkd.vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
 
-        VkPipelineShaderStageCreateInfo fragShaderStageInfo = {};
-        fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-        fragShaderStageInfo.module = fragShaderModule;
-        fragShaderStageInfo.pName = "main";
+        VkMemoryAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = memRequirements.size;
+        allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
 
-        VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, fragShaderStageInfo };
+        if (vkd.vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate buffer memory!");
+        }
 
-        VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
-        vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-        vertexInputInfo.vertexBindingDescriptionCount = 0;
-        vertexInputInfo.vertexAttributeDescriptionCount = 0;
+        vkd.vkBindBufferMemory(device, buffer, bufferMemory, 0);
+    }
 
-        VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
-        inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-        inputAssembly.primitiveRestartEnable = VK_FALSE;
+    VkCommandBuffer beginSingleTimeCommands() {
+        return beginSingleTimeCommands(commandPool);
+    }
 
-        VkViewport viewport = {};
-        viewport.x = 0.0f;
-        viewport.y = 0.0f;
-        viewport.width = (float)swapChainExtent.width;
-        viewport.height = (float)swapChainExtent.height;
-        viewport.minDepth = 0.0f;
-        viewport.maxDepth = 1.0f;
+    VkCommandBuffer beginSingleTimeCommands(VkCommandPool pool) {
+        VkCommandBufferAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandPool = pool;
+        allocInfo.commandBufferCount = 1;
 
-        VkRect2D scissor = {};
-        scissor.offset = { 0, 0 };
-        scissor.extent = swapChainExtent;
+        VkCommandBuffer commandBuffer;
+        vkd.vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
 
-        VkPipelineViewportStateCreateInfo viewportState = {};
-        viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-        viewportState.viewportCount = 1;
-        viewportState.pViewports = &viewport;
-        viewportState.scissorCount = 1;
-        viewportState.pScissors = &scissor;
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
 
-        VkPipelineRasterizationStateCreateInfo rasterizer = {};
-        rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-        rasterizer.depthClampEnable = VK_FALSE;
-        rasterizer.rasterizerDiscardEnable = VK_FALSE;
-        rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
-        rasterizer.lineWidth = 1.0f;
-        rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
-        rasterizer.frontFace = VK_FRONT_FACE_CLOCKWISE;
-        rasterizer.depthBiasEnable = VK_FALSE;
+        vkd.vkBeginCommandBuffer(commandBuffer, &beginInfo);
 
-        VkPipelineMultisampleStateCreateInfo multisampling = {};
-        multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-        multisampling.sampleShadingEnable = VK_FALSE;
-        multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+        return commandBuffer;
+    }
 
-        VkPipelineColorBlendAttachmentState colorBlendAttachment = {};
-        colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-        colorBlendAttachment.blendEnable = VK_FALSE;
+    void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
+        endSingleTimeCommands(commandBuffer, commandPool, graphicsQueue);
+    }
 
-        VkPipelineColorBlendStateCreateInfo colorBlending = {};
-        colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-        colorBlending.logicOpEnable = VK_FALSE;
-        colorBlending.logicOp = VK_LOGIC_OP_COPY;
-        colorBlending.attachmentCount = 1;
-        colorBlending.pAttachments = &colorBlendAttachment;
-        colorBlending.blendConstants[0] = 0.0f;
-        colorBlending.blendConstants[1] = 0.0f;
-        colorBlending.blendConstants[2] = 0.0f;
-        colorBlending.blendConstants[3] = 0.0f;
+    void endSingleTimeCommands(VkCommandBuffer commandBuffer, VkCommandPool pool, VkQueue queue) {
+        vkd.vkEndCommandBuffer(commandBuffer);
 
-        VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
-        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-        pipelineLayoutInfo.setLayoutCount = 0;
-        pipelineLayoutInfo.pushConstantRangeCount = 0;
+        VkSubmitInfo submitInfo = {};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &commandBuffer;
 
-        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create pipeline layout!");
-        }
+        vkd.vkQueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE);
+        vkd.vkQueueWaitIdle(queue);
 
-        VkGraphicsPipelineCreateInfo pipelineInfo = {};
-        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-        pipelineInfo.stageCount = 2;
-        pipelineInfo.pStages = shaderStages;
-        pipelineInfo.pVertexInputState = &vertexInputInfo;
-        pipelineInfo.pInputAssemblyState = &inputAssembly;
-        pipelineInfo.pViewportState = &viewportState;
-        pipelineInfo.pRasterizationState = &rasterizer;
-        pipelineInfo.pMultisampleState = &multisampling;
-        pipelineInfo.pColorBlendState = &colorBlending;
-        pipelineInfo.layout = pipelineLayout;
-        pipelineInfo.renderPass = renderPass;
-        pipelineInfo.subpass = 0;
-        pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+        vkd.vkFreeCommandBuffers(device, pool, 1, &commandBuffer);
+    }
 
-        if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create graphics pipeline!");
+    void createArenaBuffers(VkBuffer& vertexBuffer, VkDeviceMemory& vertexMemory, VkBuffer& indexBuffer, VkDeviceMemory& indexMemory) {
+        const VkBufferUsageFlags transfer = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        createBuffer(VkDeviceSize(geometryArena.vertexRanges().capacity()) * geometryArena.vertexStride(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | transfer,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexMemory);
+        createBuffer(VkDeviceSize(geometryArena.indexRanges().capacity()) * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT | transfer,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexMemory);
+    }
+
+    void createGeometryArena() {
+        createArenaBuffers(arenaVertexBuffer, arenaVertexBufferMemory, arenaIndexBuffer, arenaIndexBufferMemory);
+    }
+
+    void destroyGeometryArena() {
+        vkd.vkDestroyBuffer(device, arenaVertexBuffer, nullptr);
+        vkd.vkFreeMemory(device, arenaVertexBufferMemory, nullptr);
+        vkd.vkDestroyBuffer(device, arenaIndexBuffer, nullptr);
+        vkd.vkFreeMemory(device, arenaIndexBufferMemory, nullptr);
+    }
+
+    // Sub-allocates a mesh in the arena, growing it if needed, and copies the
+    // data in through one staging buffer. Returns the mesh's arena handle.
+    uint32_t uploadMesh(const void* vertices, uint32_t vertexCount, const uint32_t* indices, uint32_t indexCount) {
+        PROFILE_FUNCTION();
+        uint32_t handle = geometryArena.add(vertexCount, indexCount);
+        if (handle == GeometryArena::INVALID) {
+            const RangeAllocator& vertexRanges = geometryArena.vertexRanges();
+            const RangeAllocator& indexRanges = geometryArena.indexRanges();
+            compactGeometryArena(std::max(vertexRanges.capacity() * 2, vertexRanges.allocated() + vertexCount),
+                std::max(indexRanges.capacity() * 2, indexRanges.allocated() + indexCount));
+            handle = geometryArena.add(vertexCount, indexCount);
+        }
+        const MeshRange& mesh = geometryArena.mesh(handle);
+
+        VkDeviceSize vertexBytes = VkDeviceSize(vertexCount) * geometryArena.vertexStride();
+        VkDeviceSize indexBytes = VkDeviceSize(indexCount) * sizeof(uint32_t);
+        VkBuffer stagingBuffer;
+        VkDeviceMemory stagingBufferMemory;
+        createBuffer(vertexBytes + indexBytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            stagingBuffer, stagingBufferMemory);
+
+        void* data;
+        vkd.vkMapMemory(device, stagingBufferMemory, 0, vertexBytes + indexBytes, 0, &data);
+        memcpy(data, vertices, static_cast<size_t>(vertexBytes));
+        memcpy(static_cast<char*>(data) + vertexBytes, indices, static_cast<size_t>(indexBytes));
+        vkd.vkUnmapMemory(device, stagingBufferMemory);
+        telemetry.add(TelemetryCounter::UploadBytes, static_cast<double>(vertexBytes + indexBytes));
+
+        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+        if (vertexBytes > 0) {
+            VkBufferCopy vertexRegion = { 0, VkDeviceSize(mesh.firstVertex) * geometryArena.vertexStride(), vertexBytes };
+            vkd.vkCmdCopyBuffer(commandBuffer, stagingBuffer, arenaVertexBuffer, 1, &vertexRegion);
         }
+        if (indexBytes > 0) {
+            VkBufferCopy indexRegion = { vertexBytes, VkDeviceSize(mesh.firstIndex) * sizeof(uint32_t), indexBytes };
+            vkd.vkCmdCopyBuffer(commandBuffer, stagingBuffer, arenaIndexBuffer, 1, &indexRegion);
+        }
+        endSingleTimeCommands(commandBuffer);
 
-        vkDestroyShaderModule(device, fragShaderModule, nullptr);
-        vkDestroyShaderModule(device, vertShaderModule, nullptr);
+        vkd.vkDestroyBuffer(device, stagingBuffer, nullptr);
+        vkd.vkFreeMemory(device, stagingBufferMemory, nullptr);
+        return handle;
     }
 
-    void createFramebuffers() {
-        swapChainFramebuffers.resize(swapChainImageViews.size());
-
-        for (size_t i = 0; i < swapChainImageViews.size(); i++) {
-            VkImageView attachments[] = {
-                swapChainImageViews[i]
-            };
+    // Packs every live mesh to the front of freshly allocated buffers (copies
+    // within one buffer may not overlap) and re-records the draws that point
+    // into the arena. endSingleTimeCommands idles the queue, so the old
+    // buffers can go right away.
+    void compactGeometryArena(uint32_t vertexCapacity, uint32_t indexCapacity) {
+        std::vector<VkBufferCopy> vertexCopies, indexCopies;
+        geometryArena.compact(vertexCapacity, indexCapacity, vertexCopies, indexCopies);
+
+        VkBuffer vertexBuffer, indexBuffer;
+        VkDeviceMemory vertexMemory, indexMemory;
+        createArenaBuffers(vertexBuffer, vertexMemory, indexBuffer, indexMemory);
+
+        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+        if (!vertexCopies.empty()) {
+            vkd.vkCmdCopyBuffer(commandBuffer, arenaVertexBuffer, vertexBuffer, static_cast<uint32_t>(vertexCopies.size()), vertexCopies.data());
+        }
+        if (!indexCopies.empty()) {
+            vkd.vkCmdCopyBuffer(commandBuffer, arenaIndexBuffer, indexBuffer, static_cast<uint32_t>(indexCopies.size()), indexCopies.data());
+        }
+        endSingleTimeCommands(commandBuffer);
 
-            VkFramebufferCreateInfo framebufferInfo = {};
-            framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-            framebufferInfo.renderPass = renderPass;
-            framebufferInfo.attachmentCount = 1;
-            framebufferInfo.pAttachments = attachments;
-            framebufferInfo.width = swapChainExtent.width;
-            framebufferInfo.height = swapChainExtent.height;
-            framebufferInfo.layers = 1;
+        destroyGeometryArena();
+        arenaVertexBuffer = vertexBuffer;
+        arenaVertexBufferMemory = vertexMemory;
+        arenaIndexBuffer = indexBuffer;
+        arenaIndexBufferMemory = indexMemory;
 
-            if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &swapChainFramebuffers[i]) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create framebuffer!");
-            }
+        if (skinnedMesh != GeometryArena::INVALID && !drawBuckets.empty()) {
+            fillSkinnedBucket();
+        }
+        if (propMesh != GeometryArena::INVALID && !drawBuckets.empty()) {
+            fillPropBucket();
         }
     }
 
-    VkShaderModule createShaderModule(const std::vector<char>& code) {
-        VkShaderModuleCreateInfo createInfo = {};
-        createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-        createInfo.codeSize = code.size();
-        createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
+    void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
+        copyBuffer(srcBuffer, dstBuffer, size, commandPool, graphicsQueue);
+    }
 
-        VkShaderModule shaderModule;
-        if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create shader module!");
-        }
+    void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkCommandPool pool, VkQueue queue) {
+        VkCommandBuffer commandBuffer = beginSingleTimeCommands(pool);
 
-        return shaderModule;
+        VkBufferCopy copyRegion = {};
+        copyRegion.size = size;
+        vkd.vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+
+        endSingleTimeCommands(commandBuffer, pool, queue);
     }
 /////////////tools///////////////////////////////////////////////////////////////////////////////
     VkSurfaceFormatKHR chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats) {
@@ -839,18 +10115,26 @@ private:
 
         int i = 0;
         for (const auto& queueFamily : queueFamilies) {
-            if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-                indices.graphicsFamily = i;
-            }
+            if (!indices.isComplete()) {
+                if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+                    indices.graphicsFamily = i;
+                }
 
-            VkBool32 presentSupport = false;
-            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+                VkBool32 presentSupport = false;
+                vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+
+                if (queueFamily.queueCount > 0 && presentSupport) {
+                    indices.presentFamily = i;
+                }
+            }
 
-            if (queueFamily.queueCount > 0 && presentSupport) {
-                indices.presentFamily = i;
+            // families without graphics map to the separate compute engines
+            if (!indices.computeFamily.has_value() && queueFamily.queueCount > 0 &&
+                (queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT) && !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+                indices.computeFamily = i;
             }
 
-            if (indices.isComplete()) {
+            if (indices.isComplete() && indices.computeFamily.has_value()) {
                 break;
             }
 
@@ -871,6 +10155,17 @@ private:
             extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
         }
 
+        // lets a 1.0 instance query extension features such as present wait
+        uint32_t availableCount = 0;
+        vkEnumerateInstanceExtensionProperties(nullptr, &availableCount, nullptr);
+        std::vector<VkExtensionProperties> available(availableCount);
+        vkEnumerateInstanceExtensionProperties(nullptr, &availableCount, available.data());
+        for (const auto& extension : available) {
+            if (strcmp(extension.extensionName, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0) {
+                extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+            }
+        }
+
         return extensions;
     }
 
@@ -924,9 +10219,1082 @@ private:
     }
 };
 
-int main() {
+// Measures CPU backend throughput on a million particles, no window needed.
+void benchmarkCpuParticles() {
+    const uint32_t count = 1 << 20;
+    const int steps = 100;
+
+    ParticleSettings settings;
+    CpuParticleSystem particles;
+    particles.init(count, settings);
+    std::vector<ParticleVertex> vertices(count);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int step = 0; step < steps; step++) {
+        particles.update(1.0f / 60.0f, step + 1, settings);
+    }
+    auto simulated = std::chrono::high_resolution_clock::now();
+    particles.writeVertices(vertices.data(), true, glm::vec3(0.0f, 0.0f, -1.0f));
+    auto sorted = std::chrono::high_resolution_clock::now();
+
+    double simulateSeconds = std::chrono::duration<double>(simulated - start).count();
+    double sortMilliseconds = std::chrono::duration<double, std::milli>(sorted - simulated).count();
+    std::cout << "cpu particles: " << count * double(steps) / simulateSeconds / 1e6 << " M particle updates/s, "
+        << "sort + write " << sortMilliseconds << " ms for " << count << " particles" << std::endl;
+}
+
+// Times the hierarchy pass and CPU pre-skinning for a 1k character crowd with
+// both skinning methods, alongside what each path uploads per frame. The
+// vertex shader path's GPU cost has to be read from a GPU profiler.
+void benchmarkSkinning() {
+    const uint32_t characters = 1000;
+    const int frames = 50;
+
+    SkinnedCrowd crowd;
+    crowd.init(characters);
+    std::vector<SkinnedOutputVertex> skinned(crowd.meshVertices().size() * characters);
+    size_t vertexBytes = skinned.size() * sizeof(SkinnedOutputVertex);
+
+    for (SkinningMethod method : { SkinningMethod::Linear, SkinningMethod::DualQuaternion }) {
+        double hierarchyMilliseconds = 0.0;
+        double skinMilliseconds = 0.0;
+        for (int frame = 0; frame < frames; frame++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            crowd.animate(frame / 60.0f);
+            crowd.computePalettes(method);
+            auto palettes = std::chrono::high_resolution_clock::now();
+            crowd.skin(method, skinned.data());
+            auto end = std::chrono::high_resolution_clock::now();
+            hierarchyMilliseconds += std::chrono::duration<double, std::milli>(palettes - start).count();
+            skinMilliseconds += std::chrono::duration<double, std::milli>(end - palettes).count();
+        }
+
+        std::cout << (method == SkinningMethod::Linear ? "linear blend" : "dual quaternion") << ", " << characters << " characters: "
+            << "hierarchy " << hierarchyMilliseconds / frames << " ms, cpu skinning " << skinMilliseconds / frames << " ms, "
+            << "upload " << crowd.paletteSize(method) / 1024 << " KiB (vertex shader) vs " << vertexBytes / 1024 << " KiB (cpu)" << std::endl;
+    }
+}
+
+// A static world of ~1M nodes (1000 roots, 10 children each, 100 leaves
+// under every child): a full propagation against frames where only a few
+// subtrees move.
+void benchmarkSceneGraph() {
+    const uint32_t roots = 1000;
+    const uint32_t children = 10;
+    const uint32_t leaves = 100;
+    const int frames = 100;
+
+    SceneGraph graph;
+    std::vector<uint32_t> movers;
+    glm::quat identity(1.0f, 0.0f, 0.0f, 0.0f);
+    for (uint32_t r = 0; r < roots; r++) {
+        uint32_t root = graph.add(SceneGraph::NO_PARENT, glm::vec3(float(r), 0.0f, 0.0f), identity, glm::vec3(1.0f));
+        for (uint32_t c = 0; c < children; c++) {
+            uint32_t child = graph.add(root, glm::vec3(0.0f, float(c), 0.0f), identity, glm::vec3(0.5f));
+            movers.push_back(child);
+            for (uint32_t l = 0; l < leaves; l++) {
+                graph.add(child, glm::vec3(0.0f, 0.0f, float(l)), identity, glm::vec3(1.0f));
+            }
+        }
+    }
+    graph.update();
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int frame = 0; frame < frames; frame++) {
+        for (uint32_t r = 0; r < roots; r++) {
+            graph.setTranslation(r * (1 + children * (1 + leaves)), glm::vec3(float(r), float(frame), 0.0f));
+        }
+        graph.update();
+    }
+    auto full = std::chrono::high_resolution_clock::now();
+    size_t fullCount = graph.lastUpdateCount();
+
+    for (int frame = 0; frame < frames; frame++) {
+        for (uint32_t m = 0; m < 8; m++) {
+            uint32_t node = movers[(frame * 8 + m) * 7919 % movers.size()];
+            graph.setLocal(node, glm::vec3(0.0f, float(frame), 0.0f), glm::angleAxis(frame * 0.1f, glm::vec3(0.0f, 1.0f, 0.0f)), glm::vec3(0.5f));
+        }
+        graph.update();
+    }
+    auto incremental = std::chrono::high_resolution_clock::now();
+
+    std::cout << "scene graph, " << graph.size() << " nodes: full update " << std::chrono::duration<double, std::milli>(full - start).count() / frames
+        << " ms (" << fullCount << " matrices), 8 moving subtrees " << std::chrono::duration<double, std::micro>(incremental - full).count() / frames
+        << " us (" << graph.lastUpdateCount() << " matrices)" << std::endl;
+}
+
+// Writes a million-node scene archive, maps it back and compares opening it
+// (map + validation) and first touching the transforms with copying it all
+// into a SceneGraph, the deserialization the archive avoids. The file was
+// just written, so these are warm page-cache numbers; drop the cache before
+// a second run of --bench-scene-archive-read for cold ones.
+void benchmarkSceneArchive(bool write) {
+    const std::string path = "scene_archive_bench.bin";
+    const uint32_t roots = 1000;
+    const uint32_t children = 10;
+    const uint32_t leaves = 100;
+
+    double writeMilliseconds = 0.0;
+    if (write) {
+        SceneArchiveWriter writer;
+        for (uint32_t m = 0; m < 64; m++) {
+            writer.addMesh("meshes/mesh" + std::to_string(m) + ".bin", 1000 + m, 3000 + m * 3);
+        }
+        for (uint32_t m = 0; m < 16; m++) {
+            writer.addMaterial("material" + std::to_string(m), { m & 31u, glm::vec4(m / 16.0f, 0.5f, 1.0f - m / 16.0f, 1.0f) });
+        }
+
+        glm::quat identity(1.0f, 0.0f, 0.0f, 0.0f);
+        for (uint32_t r = 0; r < roots; r++) {
+            uint32_t root = writer.addNode(NO_ARCHIVE_REFERENCE, glm::vec3(float(r), 0.0f, 0.0f), identity, glm::vec3(1.0f));
+            for (uint32_t c = 0; c < children; c++) {
+                uint32_t child = writer.addNode(root, glm::vec3(0.0f, float(c), 0.0f), glm::angleAxis(c * 0.1f, glm::vec3(0.0f, 1.0f, 0.0f)), glm::vec3(0.5f));
+                for (uint32_t l = 0; l < leaves; l++) {
+                    writer.addNode(child, glm::vec3(0.0f, 0.0f, float(l)), identity, glm::vec3(1.0f), (r + l) % 64, (c + l) % 16);
+                }
+            }
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        if (!writer.write(path)) {
+            throw std::runtime_error("failed to write " + path + "!");
+        }
+        writeMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        SceneArchive archive;
+        archive.open(path);
+        auto opened = std::chrono::high_resolution_clock::now();
+
+        glm::vec3 sum(0.0f);
+        for (size_t i = 0; i < archive.nodeCount(); i++) {
+            sum += archive.translation(i) * archive.scale(i) + glm::vec3(archive.rotation(i).w);
+        }
+        auto touched = std::chrono::high_resolution_clock::now();
+
+        SceneGraph graph;
+        std::vector<uint32_t> ids(archive.nodeCount());
+        for (size_t i = 0; i < archive.nodeCount(); i++) {
+            uint32_t parent = archive.node(i).parent;
+            ids[i] = graph.add(parent == NO_ARCHIVE_REFERENCE ? SceneGraph::NO_PARENT : ids[parent], archive.translation(i), archive.rotation(i), archive.scale(i));
+        }
+        auto built = std::chrono::high_resolution_clock::now();
+
+        std::cout << "scene archive, " << archive.nodeCount() << " nodes, " << archive.header().fileSize / (1024 * 1024) << " MiB";
+        if (write) {
+            std::cout << ": write " << writeMilliseconds << " ms";
+        }
+        std::cout << ", map + validate " << std::chrono::duration<double, std::milli>(opened - start).count()
+            << " ms, first touch of all transforms " << std::chrono::duration<double, std::milli>(touched - opened).count()
+            << " ms, copying into a SceneGraph " << std::chrono::duration<double, std::milli>(built - touched).count()
+            << " ms (checksum " << sum.x + sum.y + sum.z << ")" << std::endl;
+    }
+}
+
+// Reads 32 generated 4 MiB files one after another on the calling thread, as
+// readFile does, then through AssetLoader while a 1 ms frame loop delivers
+// them. The second half is queued at a higher priority after the first and
+// should still arrive first; the longest deliver() call shows what loading
+// costs the render thread. The files were just written, so this measures
+// the pipeline against a warm page cache rather than the disk.
+void benchmarkAssetIo() {
+    const size_t fileCount = 32;
+    const size_t fileSize = 4 << 20;
+
+    std::vector<std::string> paths;
+    uint32_t state = 1;
+    std::vector<uint32_t> contents(fileSize / 4);
+    for (size_t f = 0; f < fileCount; f++) {
+        for (auto& word : contents) {
+            state = state * 1664525u + 1013904223u;
+            word = state;
+        }
+        paths.push_back("asset_io_bench_" + std::to_string(f) + ".bin");
+        std::ofstream file(paths.back(), std::ios::binary);
+        file.write(reinterpret_cast<const char*>(contents.data()), fileSize);
+        if (!file.good()) {
+            throw std::runtime_error("failed to write " + paths.back() + "!");
+        }
+    }
+
+    // stands in for decompression: one pass over every byte
+    auto checksum = [](const std::vector<uint8_t>& data) {
+        uint32_t a = 1, b = 0;
+        for (uint8_t byte : data) {
+            a = (a + byte) % 65521;
+            b = (b + a) % 65521;
+        }
+        return (b << 16) | a;
+    };
+
+    std::vector<uint32_t> expected(fileCount);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t f = 0; f < fileCount; f++) {
+        std::ifstream file(paths[f], std::ios::ate | std::ios::binary);
+        std::vector<uint8_t> data(static_cast<size_t>(file.tellg()));
+        file.seekg(0);
+        file.read(reinterpret_cast<char*>(data.data()), data.size());
+        expected[f] = checksum(data);
+    }
+    double serialSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+    class ChecksumJob : public AssetJob {
+    public:
+        ChecksumJob(size_t index, uint32_t (*sum)(const std::vector<uint8_t>&), std::vector<uint32_t>* sums, std::vector<size_t>* order)
+            : index(index), sum(sum), sums(sums), order(order) {}
+
+        bool decode(std::vector<uint8_t>& data) override {
+            (*sums)[index] = sum(data);
+            return true;
+        }
+
+        void complete(std::vector<uint8_t>&) override {
+            order->push_back(index);
+        }
+
+    private:
+        size_t index;
+        uint32_t (*sum)(const std::vector<uint8_t>&);
+        std::vector<uint32_t>* sums;
+        std::vector<size_t>* order;
+    };
+
+    std::vector<uint32_t> sums(fileCount);
+    std::vector<size_t> order;
+    order.reserve(fileCount);
+    double maxDeliverMicroseconds = 0.0, totalDeliverMicroseconds = 0.0;
+    size_t frames = 0;
+    AssetLoaderStats stats;
+    {
+        AssetLoader loader;
+        loader.start(ASSET_READER_THREADS, ASSET_DECODER_THREADS);
+        start = std::chrono::high_resolution_clock::now();
+        for (size_t f = 0; f < fileCount; f++) {
+            int priority = f < fileCount / 2 ? 0 : 1;
+            std::unique_ptr<AssetJob> job(new ChecksumJob(f, checksum, &sums, &order));
+            loader.load(paths[f], priority, start + std::chrono::milliseconds(40 * (f + 1)), std::move(job));
+        }
+        while (loader.pending() > 0) {
+            auto deliverStart = std::chrono::high_resolution_clock::now();
+            loader.deliver(ASSET_DELIVERIES_PER_FRAME);
+            auto deliverEnd = std::chrono::high_resolution_clock::now();
+            double deliverMicroseconds = std::chrono::duration<double, std::micro>(deliverEnd - deliverStart).count();
+            maxDeliverMicroseconds = std::max(maxDeliverMicroseconds, deliverMicroseconds);
+            totalDeliverMicroseconds += deliverMicroseconds;
+            frames++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        stats = loader.stats();
+    }
+    double loaderSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+    for (const auto& path : paths) {
+        std::remove(path.c_str());
+    }
+    if (sums != expected || stats.failed != 0) {
+        throw std::runtime_error("asset loader returned different data!");
+    }
+
+    double highRank = 0.0, lowRank = 0.0;
+    for (size_t rank = 0; rank < order.size(); rank++) {
+        (order[rank] < fileCount / 2 ? lowRank : highRank) += double(rank) / (fileCount / 2);
+    }
+
+    double megabytes = double(fileCount * fileSize) / (1 << 20);
+    std::cout << "asset io, " << fileCount << " x " << (fileSize >> 20) << " MiB (" << (FileReader().usingRing() ? "io_uring" : "positional reads")
+        << ", " << ASSET_READER_THREADS << " readers, " << ASSET_DECODER_THREADS << " decoders)" << std::endl;
+    std::cout << "  serial readFile + decode: " << megabytes / serialSeconds << " MiB/s" << std::endl;
+    std::cout << "  asset loader: " << megabytes / loaderSeconds << " MiB/s over " << frames << " frames, reads "
+        << stats.bytesRead / double(1 << 20) / stats.readSeconds << " MiB/s per reader, " << stats.late << " late" << std::endl;
+    std::cout << "  mean delivery rank: high priority " << highRank << ", low priority " << lowRank
+        << ", deliver() mean " << totalDeliverMicroseconds / frames << " us, longest " << maxDeliverMicroseconds << " us" << std::endl;
+}
+
+// Cost of a profiling zone with no capture running and with one, against
+// the same loop without zones. Zones come in bursts the collector can keep
+// up with, as frames would produce them; a nested pair per iteration.
+void benchmarkProfiler() {
+    const std::string path = "profiler_bench.json";
+    const size_t bursts = 100;
+    const size_t iterations = 250;
+    volatile uint64_t sink = 0;
+
+    auto measure = [&](bool zones) {
+        double nanoseconds = 0.0;
+        for (size_t b = 0; b < bursts; b++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            if (zones) {
+                for (size_t i = 0; i < iterations; i++) {
+                    PROFILE_ZONE("outer");
+                    {
+                        PROFILE_ZONE("inner");
+                        sink = sink + i;
+                    }
+                }
+            }
+            else {
+                for (size_t i = 0; i < iterations; i++) {
+                    sink = sink + i;
+                }
+            }
+            nanoseconds += std::chrono::duration<double, std::nano>(std::chrono::high_resolution_clock::now() - start).count();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return nanoseconds / (bursts * iterations);
+    };
+
+    PROFILE_THREAD("benchmark");
+    double baseline = measure(false);
+    double idle = measure(true);
+    profiler().start(path);
+    double capturing = measure(true);
+    profiler().stop();
+
+    std::ifstream trace(path, std::ios::ate | std::ios::binary);
+    double megabytes = trace.is_open() ? double(trace.tellg()) / (1 << 20) : 0.0;
+    trace.close();
+    std::remove(path.c_str());
+
+    std::cout << "profiler, " << bursts * iterations * 2 << " zones: "
+        << (idle - baseline) / 2 << " ns/zone without a capture, "
+        << (capturing - baseline) / 2 << " ns/zone capturing (" << profiler().droppedEvents() << " dropped, "
+        << megabytes << " MiB trace)" << std::endl;
+}
+
+// 100k objects with 1% moving every frame: update cost per move and batched
+// frustum, sphere and ray queries against a linear scan.
+void benchmarkSpatialIndex() {
+    const uint32_t count = 100000;
+    const int frames = 100;
+    const size_t batch = 64;
+
+    uint32_t state = 1;
+    auto random = [&state]() {
+        state = state * 1664525u + 1013904223u;
+        return (state >> 8) * (1.0f / 16777216.0f);
+    };
+    auto randomBox = [&random]() {
+        glm::vec3 center(random() * 1000.0f - 500.0f, random() * 1000.0f - 500.0f, random() * 1000.0f - 500.0f);
+        glm::vec3 extent(0.5f + random() * 4.0f);
+        return AABB{ center - extent, center + extent };
+    };
+
+    LooseOctree octree(glm::vec3(0.0f), 512.0f, 8);
+    std::vector<uint32_t> handles(count);
+    for (uint32_t i = 0; i < count; i++) {
+        handles[i] = octree.insert(randomBox());
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int frame = 0; frame < frames; frame++) {
+        for (uint32_t i = 0; i < count / 100; i++) {
+            uint32_t handle = handles[(frame * 997 + i * 101) % count];
+            AABB box = octree.bounds(handle);
+            glm::vec3 step(random() - 0.5f, random() - 0.5f, random() - 0.5f);
+            octree.move(handle, { box.min + step, box.max + step });
+        }
+    }
+    auto moved = std::chrono::high_resolution_clock::now();
+
+    std::vector<Frustum> frustums(batch);
+    std::vector<Sphere> spheres(batch);
+    std::vector<Ray> rays(batch);
+    for (size_t q = 0; q < batch; q++) {
+        glm::mat4 projection(1.0f / 50.0f);
+        projection[3] = glm::vec4(-(random() * 800.0f - 400.0f) / 50.0f, -(random() * 800.0f - 400.0f) / 50.0f, 0.5f, 1.0f);
+        projection[2][2] = 1.0f / 1000.0f;
+        frustums[q] = Frustum::fromMatrix(projection);
+        spheres[q] = { glm::vec3(random() * 1000.0f - 500.0f, random() * 1000.0f - 500.0f, random() * 1000.0f - 500.0f), 40.0f };
+        rays[q].origin = glm::vec3(random() * 1000.0f - 500.0f, random() * 1000.0f - 500.0f, -600.0f);
+        rays[q].direction = glm::normalize(glm::vec3(random() - 0.5f, random() - 0.5f, 1.0f));
+    }
+
+    std::vector<std::vector<uint32_t>> results(batch);
+    std::vector<std::vector<RayHit>> hits(batch);
+    auto queried = std::chrono::high_resolution_clock::now();
+    octree.queryBatch(frustums.data(), batch, results.data());
+    auto frustumDone = std::chrono::high_resolution_clock::now();
+    octree.queryBatch(spheres.data(), batch, results.data());
+    auto sphereDone = std::chrono::high_resolution_clock::now();
+    octree.queryBatch(rays.data(), batch, hits.data());
+    auto rayDone = std::chrono::high_resolution_clock::now();
+
+    size_t scanned = 0;
+    for (size_t q = 0; q < batch; q++) {
+        for (uint32_t handle : handles) {
+            if (spheres[q].intersects(octree.bounds(handle))) scanned++;
+        }
+    }
+    auto scanDone = std::chrono::high_resolution_clock::now();
+
+    size_t found = 0;
+    for (const auto& result : results) {
+        found += result.size();
+    }
+    if (found != scanned) {
+        std::cout << "loose octree: sphere queries found " << found << " objects, linear scan " << scanned << std::endl;
+    }
+
+    auto micro = [](std::chrono::high_resolution_clock::time_point a, std::chrono::high_resolution_clock::time_point b) {
+        return std::chrono::duration<double, std::micro>(b - a).count();
+    };
+    std::cout << "loose octree, " << count << " objects: move " << micro(start, moved) * 1000.0 / (frames * (count / 100)) << " ns, "
+        << "per query: frustum " << micro(queried, frustumDone) / batch << " us, sphere " << micro(frustumDone, sphereDone) / batch
+        << " us (linear scan " << micro(rayDone, scanDone) / batch << " us), ray " << micro(sphereDone, rayDone) / batch << " us" << std::endl;
+}
+
+// Renders the Vulkan path's default scene on the CPU, for comparison with
+// a Vulkan capture through --golden.
+void renderSoftwareScene(const std::string& path) {
+    std::vector<SoftwareVertex> vertices;
+    std::vector<uint32_t> indices;
+    trianglePassScene(vertices, indices);
+
+    SoftwareRasterizer rasterizer(WIDTH, HEIGHT);
+    rasterizer.clear(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    rasterizer.draw(vertices.data(), indices.data(), indices.size(), glm::mat4(1.0f));
+    rasterizer.finish();
+
+    if (!writePng(path, rasterizer.frame())) {
+        throw std::runtime_error("failed to write software render!");
+    }
+    std::cout << "wrote software render " << path << std::endl;
+}
+
+// Decodes the reference images in textures/png against the CRC-32 of their
+// known RGBA8 pixels. They were written by zlib, not by writePng, so they
+// cover dynamic and fixed Huffman blocks as well as stored ones, every row
+// filter (row y uses filter y % 5), 1/2/4/8/16-bit samples, palettes with a
+// short tRNS, color keys and IDAT split across chunks. Every truncation of
+// each file must also be rejected without reading past the end.
+bool validatePngDecoder(const std::string& directory) {
+    struct Reference {
+        const char* name;
+        uint32_t width;
+        uint32_t height;
+        uint32_t crc;
+    };
+    static const Reference references[] = {
+    { "gray1", 61, 47, 0xEDD7E410u },
+    { "gray2", 61, 47, 0x3B6141CFu },
+    { "gray4", 61, 47, 0x82747AB3u },
+    { "gray8", 61, 47, 0x4D6F1292u },
+    { "gray8_trns", 61, 47, 0x4F354311u },
+    { "gray16", 61, 47, 0x522ED8F5u },
+    { "gray16_trns", 61, 47, 0x16B11C9Du },
+    { "graya8", 61, 47, 0x8AED00ABu },
+    { "graya16", 61, 47, 0xAD14EDA0u },
+    { "rgb8", 61, 47, 0xCF201687u },
+    { "rgb8_trns", 61, 47, 0x9E0E706Du },
+    { "rgb16", 61, 47, 0x7FCF8B07u },
+    { "rgb16_trns", 61, 47, 0x5A1546A2u },
+    { "rgba8", 61, 47, 0x8CA8B047u },
+    { "rgba16", 61, 47, 0x25D80CDFu },
+    { "palette1", 61, 47, 0x156DDAB2u },
+    { "palette2", 61, 47, 0xF7032C87u },
+    { "palette4", 61, 47, 0xAB433B15u },
+    { "palette8", 61, 47, 0xE924D911u },
+    { "palette8_trns", 61, 47, 0x102B11ABu },
+    { "rgba8_fixed", 61, 47, 0x1724991Fu },
+    { "rgba8_stored", 61, 47, 0x259EBC13u },
+    { "rgb8_split_idat", 61, 47, 0xC4D6943Du },
+    { "gray8_1x1", 1, 1, 0x352C3B42u },
+    };
+
+    int failures = 0;
+    for (const auto& reference : references) {
+        std::string path = directory + "/" + reference.name + ".png";
+        std::ifstream file(path, std::ios::binary);
+        std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        std::vector<uint8_t> rgba;
+        uint32_t width = 0, height = 0;
+        if (data.empty() || !decodePng(data, rgba, width, height)) {
+            std::cout << reference.name << ": failed to decode " << path << std::endl;
+            failures++;
+            continue;
+        }
+        uint32_t crc = crc32(rgba.data(), rgba.size());
+        if (width != reference.width || height != reference.height || crc != reference.crc) {
+            std::cout << reference.name << ": got " << width << "x" << height << " crc " << std::hex << crc << ", expected "
+                << std::dec << reference.width << "x" << reference.height << " crc " << std::hex << reference.crc << std::dec << std::endl;
+            failures++;
+            continue;
+        }
+
+        uint32_t accepted = 0;
+        for (size_t length = 0; length < data.size(); length++) {
+            std::vector<uint8_t> truncated(data.begin(), data.begin() + length);
+            // IEND carries no data, so only losing part of it may still decode
+            if (decodePng(truncated, rgba, width, height) && length < data.size() - 12) accepted++;
+        }
+        if (accepted) {
+            std::cout << reference.name << ": " << accepted << " truncated copies decoded" << std::endl;
+            failures++;
+        }
+    }
+
+    std::cout << "png decoder: " << sizeof(references) / sizeof(references[0]) - failures << "/" << sizeof(references) / sizeof(references[0])
+        << " reference images match" << std::endl;
+    return failures == 0;
+}
+
+// Encodes a test image with every block format and quality level and
+// reports throughput and PSNR against the source.
+void benchmarkBlockCompression() {
+    const uint32_t size = 1024;
+    std::vector<uint8_t> translucent;
+    proceduralTexture(size, translucent);
+    // BC1 alpha is a cut-out; its color is measured on opaque content
+    std::vector<uint8_t> opaque = translucent;
+    for (size_t i = 3; i < opaque.size(); i += 4) {
+        opaque[i] = 255;
+    }
+
+    const char* formatNames[] = { "BC1", "BC3", "BC7" };
+    const char* qualityNames[] = { "fast", "normal", "high" };
+    const uint32_t blocksWide = size / 4;
+
+    for (int f = 0; f < 3; f++) {
+        BlockFormat format = static_cast<BlockFormat>(f);
+        const std::vector<uint8_t>& image = format == BlockFormat::BC1 ? opaque : translucent;
+        size_t bytes = BlockEncoder::blockBytes(format);
+        std::vector<uint8_t> blocks(BlockEncoder::encodedSize(format, size, size));
+
+        for (int q = 0; q < 3; q++) {
+            BlockEncoder encoder(format, static_cast<BlockQuality>(q));
+            auto start = std::chrono::high_resolution_clock::now();
+            encoder.encode(image.data(), size, size, blocks.data());
+            auto done = std::chrono::high_resolution_clock::now();
+
+            double colorError = 0.0, alphaError = 0.0;
+            uint8_t decoded[64];
+            for (uint32_t by = 0; by < size / 4; by++) {
+                for (uint32_t bx = 0; bx < blocksWide; bx++) {
+                    BlockEncoder::decodeBlock(format, &blocks[(size_t(by) * blocksWide + bx) * bytes], decoded);
+                    for (uint32_t i = 0; i < 16; i++) {
+                        const uint8_t* source = &image[((size_t(by) * 4 + (i >> 2)) * size + bx * 4 + (i & 3)) * 4];
+                        for (int c = 0; c < 4; c++) {
+                            double d = double(decoded[i * 4 + c]) - source[c];
+                            (c < 3 ? colorError : alphaError) += d * d;
+                        }
+                    }
+                }
+            }
+
+            double pixels = double(size) * size;
+            auto psnr = [](double meanSquaredError) {
+                return meanSquaredError > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / meanSquaredError) : 99.0;
+            };
+            double seconds = std::chrono::duration<double>(done - start).count();
+            std::cout << formatNames[f] << " " << qualityNames[q] << ": " << pixels / seconds / 1e6 << " Mpixels/s on "
+                << workerPool().size() << " threads, color PSNR " << psnr(colorError / (pixels * 3)) << " dB, alpha PSNR "
+                << psnr(alphaError / pixels) << " dB" << std::endl;
+        }
+    }
+}
+
+// Offline path: block-compresses any PNG decodePng reads into a DDS file at
+// the highest quality. Alpha is kept for BC3 and BC7 and dropped by BC1.
+void encodeTextureFile(const std::string& formatName, const std::string& input, const std::string& output) {
+    BlockFormat format;
+    if (formatName == "bc1") format = BlockFormat::BC1;
+    else if (formatName == "bc3") format = BlockFormat::BC3;
+    else if (formatName == "bc7") format = BlockFormat::BC7;
+    else throw std::runtime_error("unknown block format " + formatName + "!");
+
+    std::vector<uint8_t> rgba;
+    uint32_t width, height;
+    if (!readPng(input, rgba, width, height)) {
+        throw std::runtime_error("failed to read " + input + "!");
+    }
+
+    std::vector<uint8_t> blocks(BlockEncoder::encodedSize(format, width, height));
+    BlockEncoder(format, BlockQuality::High).encode(rgba.data(), width, height, blocks.data());
+    if (!writeDds(output, format, width, height, blocks.data())) {
+        throw std::runtime_error("failed to write " + output + "!");
+    }
+    std::cout << "wrote " << output << " (" << blocks.size() << " bytes)" << std::endl;
+}
+
+// Streams meshes of random sizes in and out of a geometry arena and reports
+// how fragmented it gets, and what compaction costs in copies.
+void benchmarkGeometryArena() {
+    uint32_t state = 5;
+    auto random = [&state]() {
+        state = state * 1664525u + 1013904223u;
+        return (state >> 8) * (1.0f / 16777216.0f);
+    };
+
+    const uint32_t vertexCapacity = 1 << 22, indexCapacity = 1 << 23;
+    GeometryArena arena(32, vertexCapacity, indexCapacity);
+    std::vector<uint32_t> handles;
+    uint64_t operations = 0, failures = 0;
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int round = 0; round < 200000; round++) {
+        if (!handles.empty() && (random() < 0.4f || arena.vertexRanges().allocated() > vertexCapacity * 0.9f)) {
+            size_t victim = static_cast<size_t>(random() * handles.size()) % handles.size();
+            arena.remove(handles[victim]);
+            handles[victim] = handles.back();
+            handles.pop_back();
+        }
+        else {
+            uint32_t vertices = 64 + static_cast<uint32_t>(random() * random() * 20000.0f);
+            uint32_t handle = arena.add(vertices, vertices * 3);
+            if (handle == GeometryArena::INVALID) {
+                failures++;
+            }
+            else {
+                handles.push_back(handle);
+            }
+        }
+        operations++;
+    }
+    auto churned = std::chrono::high_resolution_clock::now();
+
+    float fragmentation = arena.fragmentation();
+    uint32_t largestBefore = arena.vertexRanges().largestFreeBlock();
+    std::vector<VkBufferCopy> vertexCopies, indexCopies;
+    arena.compact(vertexCapacity, indexCapacity, vertexCopies, indexCopies);
+    auto compacted = std::chrono::high_resolution_clock::now();
+
+    VkDeviceSize copiedBytes = 0;
+    for (const auto& copy : vertexCopies) copiedBytes += copy.size;
+    for (const auto& copy : indexCopies) copiedBytes += copy.size;
+
+    std::cout << "geometry arena: " << std::chrono::duration<double, std::nano>(churned - start).count() / operations << " ns per add/remove, "
+        << handles.size() << " live meshes, " << failures << " failed adds, fragmentation " << fragmentation
+        << " (largest free vertex block " << largestBefore << ", " << arena.vertexRanges().largestFreeBlock() << " after compaction); "
+        << "compaction " << std::chrono::duration<double, std::micro>(compacted - churned).count() << " us, "
+        << vertexCopies.size() + indexCopies.size() << " copy regions, " << copiedBytes / (1024 * 1024) << " MiB" << std::endl;
+}
+
+void benchmarkLightClustering() {
+    uint32_t state = 11;
+    auto random = [&state]() {
+        state = state * 1664525u + 1013904223u;
+        return (state >> 8) * (1.0f / 16777216.0f);
+    };
+
+    const float aspect = float(WIDTH) / HEIGHT;
+    LightClusterer clusterer;
+    clusterer.setProjection(glm::radians(60.0f), aspect, 0.1f, 150.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 10.0f, 60.0f), glm::vec3(0.0f, 5.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+    for (uint32_t count : { 256u, 4096u, 65536u }) {
+        std::vector<PointLight> lights(count);
+        for (auto& light : lights) {
+            light.positionRadius = glm::vec4(random() * 200.0f - 100.0f, random() * 20.0f, random() * 200.0f - 100.0f, 1.0f + random() * 4.0f);
+            light.color = glm::vec4(1.0f);
+        }
+
+        const int frames = 20;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int frame = 0; frame < frames; frame++) {
+            clusterer.build(lights.data(), lights.size(), view);
+        }
+        auto done = std::chrono::high_resolution_clock::now();
+
+        // what a fragment would loop over, averaged over visible surface points
+        uint64_t samples = 0, lightsVisited = 0;
+        float tanY = std::tan(glm::radians(30.0f));
+        for (int s = 0; s < 100000; s++) {
+            float depth = 1.0f + random() * 100.0f;
+            glm::vec3 p((random() * 2.0f - 1.0f) * tanY * aspect * depth, (random() * 2.0f - 1.0f) * tanY * depth, -depth);
+            int cluster = clusterer.clusterAt(p);
+            if (cluster < 0) continue;
+            samples++;
+            lightsVisited += clusterer.clusterGrid()[cluster].count;
+        }
+
+        std::cout << "clustered lights, " << count << " lights: build " << std::chrono::duration<double, std::milli>(done - start).count() / frames
+            << " ms, " << clusterer.lightIndices().size() << " indices, " << double(lightsVisited) / samples << " lights per fragment (vs "
+            << count << " unclustered)" << std::endl;
+    }
+}
+
+// LOD selection over a large field of icospheres seen from a dollying,
+// slightly shaky camera: selection cost, triangles drawn against full
+// detail, and how often levels switch with and without hysteresis.
+void benchmarkLodSelection() {
+    uint32_t state = 13;
+    auto random = [&state]() {
+        state = state * 1664525u + 1013904223u;
+        return (state >> 8) * (1.0f / 16777216.0f);
+    };
+
+    std::vector<glm::vec3> positions;
+    std::vector<uint32_t> indices;
+    std::vector<LodChain> chains(1);
+    buildIcosphereChain(5, 1.5f, positions, indices, chains[0]);
+    const auto& levels = chains[0].levels;
+    std::cout << "lod chain:";
+    for (const auto& level : levels) {
+        std::cout << " " << level.indexCount / 3 << " tris (error " << level.geometricError << ")";
+    }
+    std::cout << std::endl;
+
+    const uint32_t count = 1 << 16;
+    uint32_t coarsest = static_cast<uint32_t>(levels.size() - 1);
+    std::vector<LodInstance> field(count);
+    for (auto& instance : field) {
+        instance.center = glm::vec3(random() * 400.0f - 200.0f, 1.5f, random() * 400.0f - 200.0f);
+        instance.radius = 1.5f;
+        instance.chain = 0;
+        instance.level = coarsest;
+        instance.previousLevel = coarsest;
+        instance.fade = 1.0f;
+    }
+    glm::mat4 projection = glm::perspective(glm::radians(CAMERA_FOV), float(WIDTH) / HEIGHT, CAMERA_Z_NEAR, CAMERA_Z_FAR);
+
+    for (float hysteresis : { 0.0f, 0.25f }) {
+        std::vector<LodInstance> instances = field;
+        LodSelector selector;
+        selector.hysteresis = hysteresis;
+
+        const int frames = 600;
+        std::vector<uint32_t> lastLevels(count, coarsest);
+        uint64_t switches = 0, triangles = 0;
+        double seconds = 0.0;
+        for (int frame = 0; frame < frames; frame++) {
+            glm::vec3 jitter(random() - 0.5f, random() - 0.5f, random() - 0.5f);
+            glm::vec3 eye = glm::vec3(-150.0f + frame * 0.5f, 8.0f, -20.0f) + jitter * 0.2f;
+            glm::mat4 view = glm::lookAt(eye, eye + glm::vec3(1.0f, -0.1f, 0.4f), glm::vec3(0.0f, 1.0f, 0.0f));
+            selector.setCamera(view, projection, float(HEIGHT));
+
+            auto start = std::chrono::high_resolution_clock::now();
+            selector.select(instances, chains, 1.0f / 60.0f);
+            seconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+            // the first frames settle from the coarsest level
+            for (uint32_t i = 0; i < count; i++) {
+                const LodInstance& instance = instances[i];
+                if (frame >= 30 && instance.level != lastLevels[i]) switches++;
+                lastLevels[i] = instance.level;
+                triangles += levels[instance.level].indexCount / 3;
+                if (instance.previousLevel != instance.level) {
+                    triangles += levels[instance.previousLevel].indexCount / 3;
+                }
+            }
+        }
+
+        std::cout << "lod selection, " << count << " instances, hysteresis " << hysteresis << ": "
+            << seconds * 1e9 / (double(frames) * count) << " ns per instance, " << double(triangles) / frames / 1e6 << " M tris per frame vs "
+            << double(count) * (levels[0].indexCount / 3) / 1e6 << " M at full detail, " << double(switches) / (frames - 30) << " level switches per frame" << std::endl;
+    }
+}
+
+// Occlusion culling at street level in a city grid: the buildings are the
+// occluders, and small objects scattered along the streets are tested
+// against them. False culls are found by casting rays from the eye to
+// points on every culled box; one that reaches a point on screen without
+// hitting a building means the box should have been drawn.
+void benchmarkOcclusionCulling() {
+    uint32_t state = 17;
+    auto random = [&state]() {
+        state = state * 1664525u + 1013904223u;
+        return (state >> 8) * (1.0f / 16777216.0f);
+    };
+
+    const int grid = 12;
+    const float spacing = 24.0f, street = 8.0f;
+    const float half = grid * spacing * 0.5f;
+    std::vector<AABB> buildings;
+    for (int z = 0; z < grid; z++) {
+        for (int x = 0; x < grid; x++) {
+            glm::vec3 min(x * spacing - half + street * 0.5f, 0.0f, z * spacing - half + street * 0.5f);
+            float height = 15.0f + random() * 30.0f;
+            buildings.push_back({ min, min + glm::vec3(spacing - street, height, spacing - street) });
+        }
+    }
+
+    std::vector<glm::vec3> boxPositions, boxNormals;
+    std::vector<uint32_t> boxIndices;
+    buildBox(glm::vec3(0.5f), boxPositions, boxNormals, boxIndices);
+
+    // objects on the streets, i.e. outside every building's footprint
+    const uint32_t count = 1 << 15;
+    std::vector<AABB> objects;
+    while (objects.size() < count) {
+        glm::vec3 p(random() * 2.0f * half - half, 0.0f, random() * 2.0f * half - half);
+        float cellX = std::fmod(p.x + half + street * 0.5f, spacing), cellZ = std::fmod(p.z + half + street * 0.5f, spacing);
+        if (cellX > street + 2.0f && cellZ > street + 2.0f) {
+            continue;
+        }
+        glm::vec3 size(0.5f + random() * 1.5f, 0.5f + random() * 2.5f, 0.5f + random() * 1.5f);
+        objects.push_back({ p - glm::vec3(size.x, 0.0f, size.z) * 0.5f, p + glm::vec3(size.x * 0.5f, size.y, size.z * 0.5f) });
+    }
+
+    // the first building the segment from the eye hits, as a fraction of its length
+    auto blocked = [&buildings](const glm::vec3& from, const glm::vec3& to) {
+        glm::vec3 direction = to - from;
+        for (const auto& building : buildings) {
+            float enter = 0.0f, leave = 1.0f;
+            for (int axis = 0; axis < 3 && enter <= leave; axis++) {
+                if (std::abs(direction[axis]) < 1e-8f) {
+                    if (from[axis] < building.min[axis] || from[axis] > building.max[axis]) leave = -1.0f;
+                    continue;
+                }
+                float t0 = (building.min[axis] - from[axis]) / direction[axis];
+                float t1 = (building.max[axis] - from[axis]) / direction[axis];
+                enter = std::max(enter, std::min(t0, t1));
+                leave = std::min(leave, std::max(t0, t1));
+            }
+            if (enter <= leave) return true;
+        }
+        return false;
+    };
+
+    OcclusionCuller culler;
+    glm::mat4 projection = glm::perspective(glm::radians(CAMERA_FOV), float(WIDTH) / HEIGHT, CAMERA_Z_NEAR, CAMERA_Z_FAR);
+    projection[1][1] *= -1;
+    glm::vec3 eye(-half + spacing * 3.0f + street * 0.25f, 1.7f, street * 0.25f);
+
+    for (float heading : { 0.0f, 90.0f, 180.0f, 270.0f }) {
+        glm::vec3 forward(std::cos(glm::radians(heading)), 0.0f, std::sin(glm::radians(heading)));
+        glm::mat4 viewProjection = projection * glm::lookAt(eye, eye + forward, glm::vec3(0.0f, 1.0f, 0.0f));
+
+        const int frames = 50;
+        double rasterSeconds = 0.0, testSeconds = 0.0;
+        std::vector<char> visible(objects.size());
+        for (int frame = 0; frame < frames; frame++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            culler.clearOccluders();
+            culler.setViewProjection(viewProjection);
+            for (const auto& building : buildings) {
+                glm::mat4 model = glm::translate(glm::mat4(1.0f), (building.min + building.max) * 0.5f);
+                culler.addOccluder(boxPositions, boxIndices, glm::scale(model, building.max - building.min));
+            }
+            culler.rasterize();
+            auto rasterized = std::chrono::high_resolution_clock::now();
+            for (size_t i = 0; i < objects.size(); i++) {
+                visible[i] = culler.isVisible(objects[i]);
+            }
+            auto tested = std::chrono::high_resolution_clock::now();
+            rasterSeconds += std::chrono::duration<double>(rasterized - start).count();
+            testSeconds += std::chrono::duration<double>(tested - rasterized).count();
+        }
+
+        uint32_t culled = 0, falseCulls = 0;
+        for (size_t i = 0; i < objects.size(); i++) {
+            if (visible[i]) continue;
+            culled++;
+
+            // corners pulled slightly inwards and the center, skipping points off screen
+            const AABB& box = objects[i];
+            glm::vec3 center = (box.min + box.max) * 0.5f;
+            for (int corner = 0; corner < 9; corner++) {
+                glm::vec3 p = center;
+                if (corner < 8) {
+                    glm::vec3 c((corner & 1) ? box.max.x : box.min.x, (corner & 2) ? box.max.y : box.min.y, (corner & 4) ? box.max.z : box.min.z);
+                    p = glm::mix(center, c, 0.95f);
+                }
+                glm::vec4 clip = viewProjection * glm::vec4(p, 1.0f);
+                if (clip.w <= 0.0f || std::abs(clip.x) > clip.w || std::abs(clip.y) > clip.w || clip.z > clip.w) continue;
+                if (!blocked(eye, p)) {
+                    falseCulls++;
+                    break;
+                }
+            }
+        }
+
+        std::cout << "occlusion culling, heading " << heading << ", " << buildings.size() << " occluders, " << objects.size() << " boxes: rasterize "
+            << rasterSeconds * 1000.0 / frames << " ms, " << testSeconds * 1e9 / (double(frames) * objects.size()) << " ns per box test, "
+            << 100.0 * culled / objects.size() << "% culled, " << falseCulls << " false culls" << std::endl;
+    }
+}
+
+// Triangle throughput of the software backend: many small triangles, the
+// common case for real meshes, and a few large ones that are fill bound.
+void benchmarkSoftwareRasterizer() {
+    uint32_t state = 7;
+    auto random = [&state]() {
+        state = state * 1664525u + 1013904223u;
+        return (state >> 8) * (1.0f / 16777216.0f);
+    };
+
+    for (float size : { 0.01f, 0.3f }) {
+        const uint32_t triangleCount = size < 0.1f ? 1 << 18 : 1 << 12;
+        std::vector<SoftwareVertex> vertices;
+        std::vector<uint32_t> indices;
+        for (uint32_t i = 0; i < triangleCount; i++) {
+            glm::vec3 center(random() * 2.0f - 1.0f, random() * 2.0f - 1.0f, random() * 0.5f + 0.25f);
+            glm::vec3 tint(random(), random(), random());
+            indices.insert(indices.end(), { uint32_t(vertices.size()), uint32_t(vertices.size() + 1), uint32_t(vertices.size() + 2) });
+            vertices.push_back({ center + glm::vec3(0.0f, -size, 0.0f), tint });
+            vertices.push_back({ center + glm::vec3(size, size, 0.0f), glm::vec3(tint.g, tint.b, tint.r) });
+            vertices.push_back({ center + glm::vec3(-size, size, 0.0f), glm::vec3(tint.b, tint.r, tint.g) });
+        }
+
+        SoftwareRasterizer rasterizer(WIDTH, HEIGHT);
+        const int frames = 10;
+        double setupSeconds = 0.0, rasterSeconds = 0.0;
+        for (int frame = 0; frame < frames; frame++) {
+            auto start = std::chrono::high_resolution_clock::now();
+            rasterizer.clear(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+            rasterizer.draw(vertices.data(), indices.data(), indices.size(), glm::mat4(1.0f), SoftwareRasterizer::Interpolated, true, true);
+            auto binned = std::chrono::high_resolution_clock::now();
+            rasterizer.finish();
+            auto done = std::chrono::high_resolution_clock::now();
+            setupSeconds += std::chrono::duration<double>(binned - start).count();
+            rasterSeconds += std::chrono::duration<double>(done - binned).count();
+        }
+
+        double triangles = double(triangleCount) * frames;
+        std::cout << "software rasterizer, " << triangleCount << " triangles of ~" << size * WIDTH * size * HEIGHT * 0.5f << " px, "
+            << workerPool().size() << " threads: " << triangles / (setupSeconds + rasterSeconds) / 1e6 << " M tris/s "
+            << "(transform+clip+bin " << setupSeconds * 1000.0 / frames << " ms, raster " << rasterSeconds * 1000.0 / frames << " ms per frame)" << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
     HelloTriangleApplication app;
 
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--bench-particles") == 0) {
+            benchmarkCpuParticles();
+            return EXIT_SUCCESS;
+        }
+        if (strcmp(argv[i], "--bench-spatial") == 0) {
+            benchmarkSpatialIndex();
+            return EXIT_SUCCESS;
+        }
+        if (strcmp(argv[i], "--bench-scene-graph") == 0) {
+            benchmarkSceneGraph();
+            return EXIT_SUCCESS;
+        }
+        if (strcmp(argv[i], "--bench-scene-archive") == 0 || strcmp(argv[i], "--bench-scene-archive-read") == 0) {
+            try {
+                benchmarkSceneArchive(strcmp(argv[i], "--bench-scene-archive") == 0);
+            }
+            catch (const std::exception& e) {
+                std::cerr << e.what() << std::endl;
+                return EXIT_FAILURE;
+            }
+            return EXIT_SUCCESS;
+        }
+        if (strcmp(argv[i], "--bench-asset-io") == 0) {
+            try {
+                benchmarkAssetIo();
+            }
+            catch (const std::exception& e) {
+                std::cerr << e.what() << std::endl;
+                return EXIT_FAILURE;
+            }
+            return EXIT_SUCCESS;
+        }
+        if (strcmp(argv[i], "--bench-profiler") == 0) {
+            try {
+                benchmarkProfiler();
+            }
+            catch (const std::exception& e) {
+                std::cerr << e.what() << std::endl;
+                return EXIT_FAILURE;
+            }
+            return EXIT_SUCCESS;
+        }
+        if (strcmp(argv[i], "--bench-geometry-arena") == 0) {
+            benchmarkGeometryArena();
+            return EXIT_SUCCESS;
+        }
+        if (strcmp(argv[i], "--bench-lights") == 0) {
+            benchmarkLightClustering();
+            return EXIT_SUCCESS;
+        }
+        if (strcmp(argv[i], "--bench-lod") == 0) {
+            benchmarkLodSelection();
+            return EXIT_SUCCESS;
+        }
+        if (strcmp(argv[i], "--bench-occlusion") == 0) {
+            benchmarkOcclusionCulling();
+            return EXIT_SUCCESS;
+        }
+        if (strcmp(argv[i], "--bench-software-raster") == 0) {
+            benchmarkSoftwareRasterizer();
+            return EXIT_SUCCESS;
+        }
+        if (strcmp(argv[i], "--validate-png") == 0) {
+            return validatePngDecoder(i + 1 < argc ? argv[i + 1] : "textures/png") ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        if (strcmp(argv[i], "--bench-texture-compression") == 0) {
+            benchmarkBlockCompression();
+            return EXIT_SUCCESS;
+        }
+        if (strcmp(argv[i], "--encode-bc") == 0 && i + 3 < argc) {
+            try {
+                encodeTextureFile(argv[i + 1], argv[i + 2], argv[i + 3]);
+            }
+            catch (const std::exception& e) {
+                std::cerr << e.what() << std::endl;
+                return EXIT_FAILURE;
+            }
+            return EXIT_SUCCESS;
+        }
+        if (strcmp(argv[i], "--software-render") == 0 && i + 1 < argc) {
+            try {
+                renderSoftwareScene(argv[i + 1]);
+            }
+            catch (const std::exception& e) {
+                std::cerr << e.what() << std::endl;
+                return EXIT_FAILURE;
+            }
+            return EXIT_SUCCESS;
+        }
+        if (strcmp(argv[i], "--bench-skinning") == 0) {
+            benchmarkSkinning();
+            return EXIT_SUCCESS;
+        }
+        if (strcmp(argv[i], "--bench-dispatch") == 0) {
+            app.benchmarkDispatch = true;
+        }
+        if (strcmp(argv[i], "--idle") == 0) {
+            app.idleMode = true;
+        }
+        if (strcmp(argv[i], "--stats") == 0) {
+            app.printStats = true;
+        }
+        if ((strcmp(argv[i], "--telemetry") == 0 || strcmp(argv[i], "--telemetry-prometheus") == 0) && i + 1 < argc) {
+            app.telemetryFormat = strcmp(argv[i], "--telemetry") == 0 ? Telemetry::JsonLines : Telemetry::Prometheus;
+            app.telemetryPath = argv[++i];
+        }
+        if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            app.profilePath = argv[++i];
+        }
+        if (strcmp(argv[i], "--texture") == 0 && i + 1 < argc) {
+            app.texturePaths.push_back(argv[++i]);
+        }
+        if (strcmp(argv[i], "--no-async-compute") == 0) {
+            app.asyncComputeAllowed = false;
+        }
+        if (strcmp(argv[i], "--lockstep") == 0) {
+            app.decoupledThreads = false;
+        }
+        if (strcmp(argv[i], "--no-pacing") == 0) {
+            app.framePacing = false;
+        }
+        if (strcmp(argv[i], "--bench-variants") == 0) {
+            app.benchmarkVariants = true;
+        }
+        if (strcmp(argv[i], "--validate-particles") == 0) {
+            app.validateParticlesOnStart = true;
+        }
+        if (strcmp(argv[i], "--capture-png") == 0 && i + 1 < argc) {
+            app.capturePngPrefix = argv[++i];
+        }
+        if (strcmp(argv[i], "--capture-every") == 0 && i + 1 < argc) {
+            app.captureEvery = std::max(1, atoi(argv[++i]));
+        }
+        if (strcmp(argv[i], "--capture-video") == 0 && i + 1 < argc) {
+            app.captureVideoPath = argv[++i];
+        }
+        if ((strcmp(argv[i], "--golden") == 0 || strcmp(argv[i], "--write-golden") == 0) && i + 1 < argc) {
+            app.writeGoldenImage = strcmp(argv[i], "--write-golden") == 0;
+            app.goldenImagePath = argv[++i];
+        }
+    }
+
     try {
         app.run();
     }
@@ -935,6 +11303,10 @@ int main() {
         return EXIT_FAILURE;
     }
 
+    if (app.goldenImageFailed()) {
+        return EXIT_FAILURE;
+    }
+
     return EXIT_SUCCESS;
 }
 
@@ -0,0 +1,57 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Grid layout and depth range, matching LightClusterer in main.cpp.
+layout(constant_id = 0) const uint GRID_X = 16;
+layout(constant_id = 1) const uint GRID_Y = 9;
+layout(constant_id = 2) const uint GRID_Z = 24;
+layout(constant_id = 3) const float VIEWPORT_WIDTH = 800.0;
+layout(constant_id = 4) const float VIEWPORT_HEIGHT = 600.0;
+layout(constant_id = 5) const float Z_NEAR = 0.1;
+layout(constant_id = 6) const float Z_FAR = 150.0;
+
+struct PointLight {
+    vec4 positionRadius; // view space
+    vec4 color;
+};
+
+layout(std430, set = 0, binding = 0) readonly buffer LightBuffer {
+    PointLight lights[];
+};
+
+// offset and count into lightIndices, one per cluster
+layout(std430, set = 0, binding = 1) readonly buffer ClusterBuffer {
+    uvec2 clusters[];
+};
+
+layout(std430, set = 0, binding = 2) readonly buffer IndexBuffer {
+    uint lightIndices[];
+};
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec3 viewPosition;
+layout(location = 2) in vec3 viewNormal;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    float depth = -viewPosition.z;
+    uvec3 cell = uvec3(
+        min(uint(gl_FragCoord.x / VIEWPORT_WIDTH * GRID_X), GRID_X - 1),
+        min(uint(gl_FragCoord.y / VIEWPORT_HEIGHT * GRID_Y), GRID_Y - 1),
+        uint(clamp(log(depth / Z_NEAR) / log(Z_FAR / Z_NEAR) * GRID_Z, 0.0, float(GRID_Z - 1))));
+    uvec2 cluster = clusters[(cell.z * GRID_Y + cell.y) * GRID_X + cell.x];
+
+    // only the lights binned into this fragment's cluster
+    vec3 normal = normalize(viewNormal);
+    vec3 lighting = vec3(0.05);
+    for (uint i = 0; i < cluster.y; i++) {
+        PointLight light = lights[lightIndices[cluster.x + i]];
+        vec3 toLight = light.positionRadius.xyz - viewPosition;
+        float distance = length(toLight);
+        float falloff = clamp(1.0 - distance / light.positionRadius.w, 0.0, 1.0);
+        lighting += light.color.rgb * max(dot(normal, toLight / distance), 0.0) * falloff * falloff;
+    }
+
+    outColor = vec4(fragColor * lighting, 1.0);
+}
\ No newline at end of file
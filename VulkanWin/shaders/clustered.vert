@@ -0,0 +1,35 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// A ground plane under the clustered lights, two triangles from
+// gl_VertexIndex; shaded in view space by clustered.frag.
+layout(set = 0, binding = 3) uniform Camera {
+    mat4 view;
+    mat4 projection;
+} camera;
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec3 viewPosition;
+layout(location = 2) out vec3 viewNormal;
+
+vec2 corners[6] = vec2[](
+    vec2(-1.0, -1.0),
+    vec2(1.0, -1.0),
+    vec2(1.0, 1.0),
+    vec2(-1.0, -1.0),
+    vec2(1.0, 1.0),
+    vec2(-1.0, 1.0)
+);
+
+void main() {
+    vec2 corner = corners[gl_VertexIndex] * 70.0;
+    vec4 position = camera.view * vec4(corner.x, 0.0, corner.y, 1.0);
+    gl_Position = camera.projection * position;
+    fragColor = vec3(0.6);
+    viewPosition = position.xyz;
+    viewNormal = (camera.view * vec4(0.0, 1.0, 0.0, 0.0)).xyz;
+}
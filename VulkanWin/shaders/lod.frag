@@ -0,0 +1,27 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Screen-door cross-fade between two LODs. The incoming level (fade in
+// [0, 1]) keeps the pixels whose 4x4 Bayer threshold is below fade; the
+// outgoing level (fade - 1, in [-1, 0)) keeps exactly the others.
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) flat in float fade;
+
+layout(location = 0) out vec4 outColor;
+
+const float BAYER[16] = float[](
+    0.0, 8.0, 2.0, 10.0,
+    12.0, 4.0, 14.0, 6.0,
+    3.0, 11.0, 1.0, 9.0,
+    15.0, 7.0, 13.0, 5.0
+);
+
+void main() {
+    uint x = uint(gl_FragCoord.x) & 3u;
+    uint y = uint(gl_FragCoord.y) & 3u;
+    float threshold = (BAYER[y * 4u + x] + 0.5) / 16.0;
+    if (fade >= 0.0 ? threshold >= fade : threshold < fade + 1.0) {
+        discard;
+    }
+    outColor = vec4(fragColor, 1.0);
+}
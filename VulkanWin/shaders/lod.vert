@@ -0,0 +1,28 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// One prop per instance: sphere props at their LOD, and the occluder
+// blocks. Instances [0, count) draw each sphere's current LOD and
+// [count, 2 * count) the outgoing LOD while it fades out; the blocks follow.
+layout(std430, binding = 0) readonly buffer Props {
+    mat4 viewProjection;
+    vec4 props[]; // position and scale, then fade and color
+};
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+layout(location = 0) in vec4 inPosition;
+layout(location = 1) in vec4 inNormal;
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) flat out float fade;
+
+void main() {
+    vec4 placement = props[gl_InstanceIndex * 2];
+    vec4 params = props[gl_InstanceIndex * 2 + 1];
+    gl_Position = viewProjection * vec4(placement.xyz + inPosition.xyz * placement.w, 1.0);
+    fragColor = params.yzw * (0.3 + 0.7 * max(dot(inNormal.xyz, normalize(vec3(0.3, 0.8, 0.5))), 0.0));
+    fade = params.x;
+}
@@ -0,0 +1,54 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Feature bits, matching MaterialFeature in main.cpp.
+const uint MATERIAL_TINT = 1;
+const uint MATERIAL_STRIPES = 2;
+const uint MATERIAL_VIGNETTE = 4;
+const uint MATERIAL_NOISE = 8;
+const uint MATERIAL_GRADE = 16;
+
+// Specialized variants bake their feature bits in, so the driver drops the
+// unused branches. The uber variant reads the bits from the material instead.
+layout(constant_id = 0) const uint FEATURES = 0;
+layout(constant_id = 1) const bool UBER = false;
+layout(constant_id = 2) const float VIEWPORT_WIDTH = 800.0;
+layout(constant_id = 3) const float VIEWPORT_HEIGHT = 600.0;
+
+layout(set = 0, binding = 0) uniform MaterialParams {
+    vec4 tint;
+    uint features;
+} material;
+
+layout(location = 0) in vec3 fragColor;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    uint features = UBER ? material.features : FEATURES;
+    vec3 color = fragColor;
+
+    if ((features & MATERIAL_TINT) != 0) {
+        color *= material.tint.rgb;
+    }
+    if ((features & MATERIAL_STRIPES) != 0) {
+        color *= 0.75 + 0.25 * sin(gl_FragCoord.x * 0.5);
+    }
+    if ((features & MATERIAL_VIGNETTE) != 0) {
+        vec2 uv = gl_FragCoord.xy / vec2(VIEWPORT_WIDTH, VIEWPORT_HEIGHT) - 0.5;
+        color *= 1.0 - dot(uv, uv);
+    }
+    if ((features & MATERIAL_NOISE) != 0) {
+        float n = dot(gl_FragCoord.xy, vec2(12.9898, 78.233));
+        for (int i = 0; i < 16; i++) {
+            n = fract(sin(n) * 43758.5453) * 100.0;
+        }
+        color += (n * 0.01 - 0.5) * 0.05;
+    }
+    if ((features & MATERIAL_GRADE) != 0) {
+        color = color / (color + 1.0);
+        color = pow(color, vec3(1.0 / 2.2));
+    }
+
+    outColor = vec4(color, 1.0);
+}
\ No newline at end of file
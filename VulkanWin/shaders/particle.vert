@@ -0,0 +1,17 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+out gl_PerVertex {
+    vec4 gl_Position;
+    float gl_PointSize;
+};
+
+layout(location = 0) in vec4 inPosition;
+
+layout(location = 0) out vec3 fragColor;
+
+void main() {
+    gl_Position = vec4(inPosition.xy, inPosition.z * 0.5 + 0.5, 1.0);
+    gl_PointSize = 2.0;
+    fragColor = mix(vec3(1.0, 0.3, 0.1), vec3(1.0, 0.9, 0.5), clamp(inPosition.w, 0.0, 1.0));
+}
\ No newline at end of file
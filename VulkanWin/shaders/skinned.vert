@@ -0,0 +1,57 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// params.x joint count, params.y method (0 linear blend, 1 dual quaternion).
+// Linear stores 3 rows per joint, dual quaternion stores real and dual parts.
+layout(std430, binding = 0) readonly buffer Palette {
+    uvec4 params;
+    vec4 joints[];
+};
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+layout(location = 0) in vec4 inPosition;
+layout(location = 1) in vec4 inNormal;
+layout(location = 2) in vec4 inWeights;
+layout(location = 3) in uvec4 inJoints;
+
+layout(location = 0) out vec3 fragColor;
+
+void main() {
+    uint base = uint(gl_InstanceIndex) * params.x;
+    vec3 position;
+    vec3 normal;
+
+    if (params.y == 0) {
+        mat3x4 skin = mat3x4(0.0);
+        for (int k = 0; k < 4; k++) {
+            uint j = (base + inJoints[k]) * 3;
+            skin += inWeights[k] * mat3x4(joints[j], joints[j + 1], joints[j + 2]);
+        }
+        position = vec4(inPosition.xyz, 1.0) * skin;
+        normal = normalize(vec4(inNormal.xyz, 0.0) * skin);
+    }
+    else {
+        vec4 pivot = joints[(base + inJoints[0]) * 2];
+        vec4 real = vec4(0.0);
+        vec4 dual = vec4(0.0);
+        for (int k = 0; k < 4; k++) {
+            uint j = (base + inJoints[k]) * 2;
+            float w = dot(pivot, joints[j]) < 0.0 ? -inWeights[k] : inWeights[k];
+            real += w * joints[j];
+            dual += w * joints[j + 1];
+        }
+        float inverseLength = 1.0 / length(real);
+        real *= inverseLength;
+        dual *= inverseLength;
+
+        vec3 translation = 2.0 * (real.w * dual.xyz - dual.w * real.xyz + cross(real.xyz, dual.xyz));
+        position = inPosition.xyz + 2.0 * cross(real.xyz, cross(real.xyz, inPosition.xyz) + real.w * inPosition.xyz) + translation;
+        normal = inNormal.xyz + 2.0 * cross(real.xyz, cross(real.xyz, inNormal.xyz) + real.w * inNormal.xyz);
+    }
+
+    gl_Position = vec4(position, 1.0);
+    fragColor = vec3(0.8, 0.6, 0.4) * (0.3 + 0.7 * max(dot(normal, normalize(vec3(0.3, -0.6, -0.7))), 0.0));
+}
\ No newline at end of file
@@ -0,0 +1,18 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Vertices already skinned on the CPU.
+
+out gl_PerVertex {
+    vec4 gl_Position;
+};
+
+layout(location = 0) in vec4 inPosition;
+layout(location = 1) in vec4 inNormal;
+
+layout(location = 0) out vec3 fragColor;
+
+void main() {
+    gl_Position = vec4(inPosition.xyz, 1.0);
+    fragColor = vec3(0.8, 0.6, 0.4) * (0.3 + 0.7 * max(dot(inNormal.xyz, normalize(vec3(0.3, -0.6, -0.7))), 0.0));
+}
\ No newline at end of file
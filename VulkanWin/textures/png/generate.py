@@ -0,0 +1,151 @@
+# Writes the reference PNGs for --validate-png into the given directory and
+# prints the table of expected sizes and RGBA8 CRC-32s for validatePngDecoder.
+# The expected pixels come from the generated samples, not from decoding.
+#   python3 generate.py textures/png
+import zlib, struct, os, sys
+out_dir = sys.argv[1]
+os.makedirs(out_dir, exist_ok=True)
+
+state = [12345]
+def rnd():
+    state[0] = (state[0] * 1664525 + 1013904223) & 0xFFFFFFFF
+    return state[0] >> 8
+
+def chunk(t, body):
+    return struct.pack('>I', len(body)) + t + body + struct.pack('>I', zlib.crc32(t + body) & 0xFFFFFFFF)
+
+def paeth(a, b, c):
+    p = a + b - c
+    pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+    return a if pa <= pb and pa <= pc else b if pb <= pc else c
+
+def filter_rows(rows, bpp):
+    out = bytearray()
+    prev = bytes(len(rows[0]))
+    for y, row in enumerate(rows):
+        f = y % 5
+        out.append(f)
+        for i in range(len(row)):
+            a = row[i - bpp] if i >= bpp else 0
+            b = prev[i]
+            c = prev[i - bpp] if i >= bpp else 0
+            pred = [0, a, b, (a + b) >> 1, paeth(a, b, c)][f]
+            out.append((row[i] - pred) & 0xFF)
+        prev = row
+    return bytes(out)
+
+CHANNELS = {0: 1, 2: 3, 3: 1, 4: 2, 6: 4}
+
+def make(name, color, depth, w, h, trns=False, level=9, strategy=zlib.Z_DEFAULT_STRATEGY, idat_size=None, expect_block=None):
+    ch = CHANNELS[color]
+    maxv = (1 << depth) - 1
+    # samples: smooth gradient plus noise, with a repeated band so LZ77 finds matches
+    samples = []
+    for y in range(h):
+        row = []
+        for x in range(w):
+            px = []
+            for c in range(ch):
+                yy = y % 9 if y >= h // 2 else y
+                v = ((x * (3 + c) + yy * 5) * maxv // max(1, (w * (3 + c) + h * 5))) if maxv > 255 else (x * (3 + c) + yy * 5 + c * 11) % (maxv + 1)
+                if (x + yy) % 7 == 0:
+                    v = rnd() % (maxv + 1)
+                px.append(v)
+            row.append(px)
+        samples.append(row)
+
+    palette = None
+    trns_body = b''
+    if color == 3:
+        n = 1 << depth
+        palette = [((i * 37) & 255, (i * 91 + 17) & 255, (255 - i * 13) & 255) for i in range(n)]
+        if trns:
+            alphas = [(i * 53) & 255 for i in range(n // 2 + 1)]  # shorter than the palette
+            trns_body = bytes(alphas)
+    elif trns:
+        key = samples[3][4][:3] if color == 2 else samples[3][4][:1]
+        trns_body = b''.join(struct.pack('>H', k) for k in key)
+
+    # pack rows
+    rows = []
+    for y in range(h):
+        if depth < 8:
+            bits = []
+            for x in range(w):
+                bits.append(samples[y][x][0])
+            row = bytearray((w * depth + 7) // 8)
+            for x, v in enumerate(bits):
+                bit = x * depth
+                row[bit // 8] |= v << (8 - depth - bit % 8)
+            rows.append(bytes(row))
+        else:
+            row = bytearray()
+            for x in range(w):
+                for v in samples[y][x]:
+                    row += struct.pack('>H', v) if depth == 16 else bytes([v])
+            rows.append(bytes(row))
+    bpp = max(1, ch * depth // 8)
+    raw = filter_rows(rows, bpp)
+    co = zlib.compressobj(level, zlib.DEFLATED, 15, 9, strategy)
+    z = co.compress(raw) + co.flush()
+    block = (z[2] >> 1) & 3
+    if expect_block is not None:
+        assert block == expect_block, (name, block)
+
+    png = b'\x89PNG\r\n\x1a\n' + chunk(b'IHDR', struct.pack('>IIBBBBB', w, h, depth, color, 0, 0, 0))
+    if palette:
+        png += chunk(b'PLTE', b''.join(bytes(p) for p in palette))
+    if trns_body:
+        png += chunk(b'tRNS', trns_body)
+    step = idat_size or len(z)
+    for i in range(0, len(z), step):
+        png += chunk(b'IDAT', z[i:i + step])
+    png += chunk(b'IEND', b'')
+    open(os.path.join(out_dir, name + '.png'), 'wb').write(png)
+
+    # expected RGBA8, computed from the samples rather than by decoding
+    to8 = lambda v: v >> 8 if depth == 16 else v if depth == 8 else v * 255 // maxv
+    rgba = bytearray()
+    for y in range(h):
+        for x in range(w):
+            s = samples[y][x]
+            if color == 3:
+                r, g, b = palette[s[0]]
+                a = trns_body[s[0]] if s[0] < len(trns_body) else 255
+                rgba += bytes([r, g, b, a])
+            elif color in (0, 4):
+                a = to8(s[1]) if color == 4 else (0 if trns and s[0] == key[0] else 255)
+                rgba += bytes([to8(s[0])] * 3 + [a])
+            else:
+                a = to8(s[3]) if color == 6 else (0 if trns and s[:3] == key else 255)
+                rgba += bytes([to8(s[0]), to8(s[1]), to8(s[2]), a])
+    return name, w, h, zlib.crc32(bytes(rgba)) & 0xFFFFFFFF, block
+
+cases = [
+    make('gray1', 0, 1, 61, 47, expect_block=2),
+    make('gray2', 0, 2, 61, 47, expect_block=2),
+    make('gray4', 0, 4, 61, 47, expect_block=2),
+    make('gray8', 0, 8, 61, 47, expect_block=2),
+    make('gray8_trns', 0, 8, 61, 47, trns=True, expect_block=2),
+    make('gray16', 0, 16, 61, 47, expect_block=2),
+    make('gray16_trns', 0, 16, 61, 47, trns=True, expect_block=2),
+    make('graya8', 4, 8, 61, 47, expect_block=2),
+    make('graya16', 4, 16, 61, 47, expect_block=2),
+    make('rgb8', 2, 8, 61, 47, expect_block=2),
+    make('rgb8_trns', 2, 8, 61, 47, trns=True, expect_block=2),
+    make('rgb16', 2, 16, 61, 47, expect_block=2),
+    make('rgb16_trns', 2, 16, 61, 47, trns=True, expect_block=2),
+    make('rgba8', 6, 8, 61, 47, expect_block=2),
+    make('rgba16', 6, 16, 61, 47, expect_block=2),
+    make('palette1', 3, 1, 61, 47, trns=True, expect_block=2),
+    make('palette2', 3, 2, 61, 47, trns=True, expect_block=2),
+    make('palette4', 3, 4, 61, 47, trns=True, expect_block=2),
+    make('palette8', 3, 8, 61, 47, expect_block=2),
+    make('palette8_trns', 3, 8, 61, 47, trns=True, expect_block=2),
+    make('rgba8_fixed', 6, 8, 61, 47, strategy=zlib.Z_FIXED, expect_block=1),
+    make('rgba8_stored', 6, 8, 61, 47, level=0, expect_block=0),
+    make('rgb8_split_idat', 2, 8, 61, 47, idat_size=97, expect_block=2),
+    make('gray8_1x1', 0, 8, 1, 1),
+]
+for name, w, h, crc, block in cases:
+    print('    { "%s", %d, %d, 0x%08Xu },' % (name, w, h, crc))